@@ -0,0 +1,81 @@
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "../src/batch.hpp"
+
+namespace
+{
+    // g2 = (g0 * 3 + g1 > 100) ? g0 - g1 : g0 + g1
+    ByteCode scoring_program()
+    {
+        std::vector<std::vector<unsigned char>> parts {
+            make(OpReadGlobal, 0),
+            make(OpConstant, 0),
+            make(OpMul),
+            make(OpReadGlobal, 1),
+            make(OpAdd),
+            make(OpConstant, 1),
+            make(OpGreaterThan),
+            make(OpJumpFalse, 16),
+            make(OpReadGlobal, 0),
+            make(OpReadGlobal, 1),
+            make(OpSub),
+            make(OpWriteGlobal, 2),
+            make(OpJump, 13),
+            make(OpReadGlobal, 0),
+            make(OpReadGlobal, 1),
+            make(OpAdd),
+            make(OpWriteGlobal, 2),
+        };
+        std::vector<unsigned char> instructions;
+        for (auto& part: parts)
+        {
+            instructions.insert(instructions.end(), part.begin(), part.end());
+        }
+        return ByteCode{instructions, std::vector<Value>{3, 100}};
+    }
+
+    std::vector<std::vector<Value>> records(int64_t n)
+    {
+        std::vector<std::vector<Value>> inputs;
+        inputs.reserve(n);
+        for (int64_t i = 0; i < n; ++i)
+        {
+            inputs.push_back({(i * 37) % 61, (i * 11) % 17});
+        }
+        return inputs;
+    }
+}
+
+static void BM_ScoringScalar(benchmark::State& state)
+{
+    const auto code = scoring_program();
+    const auto inputs = records(state.range(0));
+    for (auto _ : state)
+    {
+        for (const auto& input: inputs)
+        {
+            VM vm {code};
+            vm.auto_gc = false;
+            vm.globals = input;
+            vm.run();
+            benchmark::DoNotOptimize(vm.globals[2]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * inputs.size());
+}
+BENCHMARK(BM_ScoringScalar)->Arg(1 << 10)->Arg(1 << 14);
+
+static void BM_ScoringBatch(benchmark::State& state)
+{
+    const auto code = scoring_program();
+    const auto inputs = records(state.range(0));
+    B_BatchVM batch {code};
+    for (auto _ : state)
+    {
+        batch.run(inputs);
+        benchmark::DoNotOptimize(batch.global(0, 2));
+    }
+    state.SetItemsProcessed(state.iterations() * inputs.size());
+}
+BENCHMARK(BM_ScoringBatch)->Arg(1 << 10)->Arg(1 << 14);
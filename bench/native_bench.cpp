@@ -0,0 +1,67 @@
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "../src/vm.hpp"
+
+namespace
+{
+    constexpr int calls = 256;
+
+    int64_t add(int64_t a, int64_t b) {return a + b;}
+
+    // `calls` times: push 2 and 3, call, drop the result
+    std::vector<unsigned char> call_sequence(std::vector<unsigned char> call)
+    {
+        std::vector<unsigned char> instructions;
+        for (auto i = 0; i < calls; ++i)
+        {
+            for (const auto& part: {make(OpConstant, 0), make(OpConstant, 1), call, make(OpPop)})
+            {
+                instructions.insert(instructions.end(), part.begin(), part.end());
+            }
+        }
+        return instructions;
+    }
+
+    void run_calls(benchmark::State& state, VM& vm)
+    {
+        vm.auto_gc = false;
+        vm.constants = std::vector<Value>{2, 3};
+        for (auto _ : state)
+        {
+            vm.ip = 0;
+            vm.sp = 0;
+            vm.run();
+            benchmark::DoNotOptimize(vm.stack[0]);
+        }
+        state.SetItemsProcessed(state.iterations() * calls);
+    }
+}
+
+// Baseline: the same sequence with the built-in instruction
+static void BM_CallOverheadBuiltin(benchmark::State& state)
+{
+    VM vm {};
+    vm.instructions = call_sequence(make(OpAdd));
+    run_calls(state, vm);
+}
+BENCHMARK(BM_CallOverheadBuiltin);
+
+static void BM_CallOverheadNative(benchmark::State& state)
+{
+    VM vm {};
+    vm.instructions = call_sequence(make(OpCallNative, vm.register_native<add>("add")));
+    run_calls(state, vm);
+}
+BENCHMARK(BM_CallOverheadNative);
+
+static void BM_CallOverheadHost(benchmark::State& state)
+{
+    VM vm {};
+    const auto idx = vm.register_host_function("add", 2, [](std::span<const Value> args){
+        return B_HostResult{std::get<int64_t>(args[0]) + std::get<int64_t>(args[1])};
+    });
+    vm.instructions = call_sequence(make(OpCallHost, idx));
+    run_calls(state, vm);
+}
+BENCHMARK(BM_CallOverheadHost);
@@ -0,0 +1,66 @@
+#include <memory>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "../src/scheduler.hpp"
+
+namespace
+{
+    ByteCode counting_loop(int64_t iterations)
+    {
+        // g0 = 0; while (iterations > g0) { g0 = g0 + 1; }
+        std::vector<std::vector<unsigned char>> parts {
+            make(OpConstant, 0),
+            make(OpWriteGlobal, 0),
+            make(OpConstant, 1),
+            make(OpReadGlobal, 0),
+            make(OpGreaterThan),
+            make(OpJumpFalse, 16),
+            make(OpReadGlobal, 0),
+            make(OpConstant, 2),
+            make(OpAdd),
+            make(OpWriteGlobal, 0),
+            make(OpJump, -20),
+        };
+        std::vector<unsigned char> instructions;
+        for (auto& part: parts)
+        {
+            instructions.insert(instructions.end(), part.begin(), part.end());
+        }
+        return ByteCode{instructions, std::vector<Value>{0, iterations, 1}};
+    }
+}
+
+// Throughput of a fleet of small scripts as the worker pool grows from 1 to N cores
+static void BM_SchedulerThroughput(benchmark::State& state)
+{
+    const auto workers = static_cast<size_t>(state.range(0));
+    const auto scripts = 1000;
+    const auto code = counting_loop(200);
+    int64_t instructions = 0;
+    for (auto _ : state)
+    {
+        B_Scheduler scheduler{workers, 500};
+        std::vector<std::shared_ptr<VM>> vms;
+        vms.reserve(scripts);
+        for (auto i = 0; i < scripts; ++i)
+        {
+            vms.push_back(std::make_shared<VM>(code));
+            scheduler.submit(vms.back());
+        }
+        scheduler.wait();
+        for (auto& vm: vms)
+        {
+            instructions += vm->instructions_executed;
+        }
+        state.counters["steals"] = scheduler.steals();
+    }
+    state.counters["instructions/s"] = benchmark::Counter(instructions, benchmark::Counter::kIsRate);
+    state.SetItemsProcessed(state.iterations() * scripts);
+}
+BENCHMARK(BM_SchedulerThroughput)
+    ->RangeMultiplier(2)
+    ->Range(1, std::max(1u, std::thread::hardware_concurrency()))
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
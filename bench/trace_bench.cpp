@@ -0,0 +1,70 @@
+#include <filesystem>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "../src/trace.hpp"
+#include "../src/vm.hpp"
+
+namespace
+{
+    constexpr int64_t iterations = 1000;
+
+    ByteCode counting_loop()
+    {
+        // g0 = 0; while (iterations > g0) { g0 = g0 + 1; }
+        std::vector<std::vector<unsigned char>> parts {
+            make(OpConstant, 0),
+            make(OpWriteGlobal, 0),
+            make(OpConstant, 1),
+            make(OpReadGlobal, 0),
+            make(OpGreaterThan),
+            make(OpJumpFalse, 16),
+            make(OpReadGlobal, 0),
+            make(OpConstant, 2),
+            make(OpAdd),
+            make(OpWriteGlobal, 0),
+            make(OpJump, -20),
+        };
+        std::vector<unsigned char> instructions;
+        for (auto& part: parts)
+        {
+            instructions.insert(instructions.end(), part.begin(), part.end());
+        }
+        return ByteCode{instructions, std::vector<Value>{0, iterations, 1}};
+    }
+
+    void run_loop(benchmark::State& state, VM& vm)
+    {
+        for (auto _ : state)
+        {
+            vm.ip = 0;
+            vm.sp = 0;
+            vm.run();
+            benchmark::DoNotOptimize(vm.globals[0]);
+        }
+        state.SetItemsProcessed(state.iterations() * iterations);
+    }
+}
+
+// Overhead of recording: the same loop with and without a recorder attached
+static void BM_TraceOff(benchmark::State& state)
+{
+    VM vm(counting_loop());
+    vm.auto_gc = false;
+    run_loop(state, vm);
+}
+BENCHMARK(BM_TraceOff);
+
+static void BM_TraceOn(benchmark::State& state)
+{
+    VM vm(counting_loop());
+    vm.auto_gc = false;
+    const auto path = (std::filesystem::temp_directory_path() / "bonsai_trace_bench.trace").string();
+    B_TraceRecorder recorder(path, 1 << 20, std::chrono::milliseconds(1));
+    recorder.start(vm);
+    run_loop(state, vm);
+    recorder.stop();
+    state.counters["dropped"] = recorder.dropped();
+    std::filesystem::remove(path);
+}
+BENCHMARK(BM_TraceOn);
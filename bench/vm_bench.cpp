@@ -0,0 +1,325 @@
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "../src/escape.hpp"
+#include "../src/vm.hpp"
+
+namespace
+{
+    std::vector<unsigned char> assemble(const std::vector<std::vector<unsigned char>>& parts)
+    {
+        std::vector<unsigned char> instructions;
+        for (auto& part: parts)
+        {
+            instructions.insert(instructions.end(), part.begin(), part.end());
+        }
+        return instructions;
+    }
+
+    // `count` copies of `body`
+    std::vector<unsigned char> repeat(const std::vector<std::vector<unsigned char>>& body, int count)
+    {
+        const auto once = assemble(body);
+        std::vector<unsigned char> instructions;
+        for (auto i = 0; i < count; ++i)
+        {
+            instructions.insert(instructions.end(), once.begin(), once.end());
+        }
+        return instructions;
+    }
+
+    // Run the program from the start on every iteration
+    void run_program(benchmark::State& state, VM& vm)
+    {
+        for (auto _ : state)
+        {
+            vm.ip = 0;
+            vm.sp = 0;
+            vm.run();
+            benchmark::DoNotOptimize(vm.stack[0]);
+        }
+    }
+
+    constexpr int repetitions = 64;
+}
+
+// Dispatch throughput: g0 = 0; while (n > g0) { g0 = g0 + 1; }
+static void BM_DispatchLoop(benchmark::State& state)
+{
+    VM vm {ByteCode{
+        assemble({
+            make(OpConstant, 0),
+            make(OpWriteGlobal, 0),
+            make(OpConstant, 1),
+            make(OpReadGlobal, 0),
+            make(OpGreaterThan),
+            make(OpJumpFalse, 16),
+            make(OpReadGlobal, 0),
+            make(OpConstant, 2),
+            make(OpAdd),
+            make(OpWriteGlobal, 0),
+            make(OpJump, -20),
+        }),
+        std::vector<Value>{0, state.range(0), 1}
+    }};
+    vm.auto_gc = state.range(1);
+    vm.cache_top = state.range(2);
+    vm.register_tier = state.range(3);
+    int64_t executed = 0;
+    for (auto _ : state)
+    {
+        vm.ip = 0;
+        const auto before = vm.instructions_executed;
+        vm.run();
+        executed += vm.instructions_executed - before;
+    }
+    state.SetItemsProcessed(executed);
+}
+BENCHMARK(BM_DispatchLoop)->ArgNames({"n", "gc", "cache", "registers"})
+    ->ArgsProduct({{1000, 100000}, {0}, {0, 1}, {0}})
+    ->Args({1000, 0, 0, 1})->Args({100000, 0, 0, 1})
+    ->Args({1000, 1, 0, 0})->Args({1000, 1, 1, 0});
+
+// Straight-line arithmetic with no jumps: 1 + 2 pushed and added, then dropped
+static void BM_DispatchStraightLine(benchmark::State& state)
+{
+    VM vm {ByteCode{repeat({make(OpConstant, 0), make(OpConstant, 1), make(OpAdd), make(OpPop)}, repetitions), std::vector<Value>{1, 2}}};
+    vm.auto_gc = false;
+    vm.cache_top = state.range(0);
+    vm.register_tier = state.range(1);
+    run_program(state, vm);
+    state.SetItemsProcessed(state.iterations() * repetitions * 4);
+}
+BENCHMARK(BM_DispatchStraightLine)->ArgNames({"cache", "registers"})->Args({0, 0})->Args({1, 0})->Args({0, 1});
+
+// The straight-line program with 16-bit operands or with every operand behind OpWide: code size and decode cost
+static void BM_WideOperands(benchmark::State& state)
+{
+    const auto wide = state.range(0) != 0;
+    const auto constant = [&](int32_t idx){return wide ? make_wide(OpConstant, idx) : make(OpConstant, static_cast<int16_t>(idx));};
+    VM vm {ByteCode{repeat({constant(0), constant(1), make(OpAdd), make(OpPop)}, repetitions), std::vector<Value>{1, 2}}};
+    vm.auto_gc = false;
+    vm.register_tier = false;
+    run_program(state, vm);
+    state.SetItemsProcessed(state.iterations() * repetitions * 4);
+    state.counters["code_bytes"] = static_cast<double>(vm.instructions.size());
+}
+BENCHMARK(BM_WideOperands)->ArgName("wide")->Arg(0)->Arg(1);
+
+static void BM_StringConcat(benchmark::State& state)
+{
+    B_Allocator constants {};
+    const auto piece = std::string(state.range(0), 'x');
+    VM vm {ByteCode{
+        repeat({make(OpConstant, 0), make(OpConstant, 1), make(OpAdd), make(OpPop)}, repetitions),
+        std::vector<Value>{constants.alloc(piece), constants.alloc(piece)}
+    }};
+    vm.auto_gc = false;
+    for (auto _ : state)
+    {
+        vm.ip = 0;
+        vm.sp = 0;
+        vm.run();
+        state.PauseTiming();
+        vm.run_gc();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * repetitions);
+    state.SetBytesProcessed(state.iterations() * repetitions * piece.size() * 2);
+}
+BENCHMARK(BM_StringConcat)->Arg(8)->Arg(256)->Arg(4096);
+
+// OpArray of n integer constants, collected between iterations
+static void BM_ArrayBuild(benchmark::State& state)
+{
+    const auto n = static_cast<int>(state.range(0));
+    std::vector<std::vector<unsigned char>> parts(n, make(OpConstant, 0));
+    parts.push_back(make(OpArray, n));
+    VM vm {ByteCode{assemble(parts), std::vector<Value>{7}}};
+    vm.auto_gc = false;
+    for (auto _ : state)
+    {
+        vm.ip = 0;
+        vm.sp = 0;
+        vm.run();
+        state.PauseTiming();
+        vm.sp = 0;
+        vm.run_gc();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_ArrayBuild)->Arg(4)->Arg(32)->Arg(200);
+
+// OpHash of n pairs with distinct string keys (records up to VM::max_record_keys) or integer keys
+static void BM_HashBuild(benchmark::State& state)
+{
+    B_Allocator constants {};
+    const auto n = static_cast<int>(state.range(0));
+    const bool string_keys = state.range(1);
+    std::vector<Value> values;
+    std::vector<std::vector<unsigned char>> parts;
+    for (auto i = 0; i < n; ++i)
+    {
+        values.push_back(string_keys ? Value{constants.alloc("key" + std::to_string(i))} : Value{int64_t{i}});
+        parts.push_back(make(OpConstant, i));
+        parts.push_back(make(OpConstant, n));
+    }
+    values.push_back(1);
+    parts.push_back(make(OpHash, 2 * n));
+    VM vm {ByteCode{assemble(parts), values}};
+    vm.auto_gc = false;
+    for (auto _ : state)
+    {
+        vm.ip = 0;
+        vm.sp = 0;
+        vm.run();
+        state.PauseTiming();
+        vm.sp = 0;
+        vm.run_gc();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_HashBuild)->ArgNames({"n", "string_keys"})->ArgsProduct({{4, 32, 120}, {0, 1}});
+
+// OpIndex on a collection of n elements held in g0, `repetitions` lookups per run
+static void index_benchmark(benchmark::State& state, bool hash)
+{
+    B_Allocator constants {};
+    const auto n = static_cast<int>(state.range(0));
+    std::vector<Value> values;
+    std::vector<std::vector<unsigned char>> parts;
+    for (auto i = 0; i < n; ++i)
+    {
+        values.push_back(hash ? Value{constants.alloc("key" + std::to_string(i))} : Value{int64_t{i}});
+        parts.push_back(make(OpConstant, i));
+        if (hash)
+        {
+            parts.push_back(make(OpConstant, i));
+        }
+    }
+    parts.push_back(make(hash ? OpHash : OpArray, hash ? 2 * n : n));
+    parts.push_back(make(OpWriteGlobal, 0));
+    VM vm {ByteCode{assemble(parts), values}};
+    vm.run();
+
+    // Look up the last key, the same constant every time as an inline cache would see it
+    vm.instructions = repeat({make(OpReadGlobal, 0), make(OpConstant, n - 1), make(OpIndex), make(OpPop)}, repetitions);
+    vm.auto_gc = false;
+    run_program(state, vm);
+    state.SetItemsProcessed(state.iterations() * repetitions);
+}
+
+static void BM_IndexArray(benchmark::State& state)
+{
+    index_benchmark(state, false);
+}
+BENCHMARK(BM_IndexArray)->Arg(4)->Arg(32)->Arg(120);
+
+static void BM_IndexHash(benchmark::State& state)
+{
+    index_benchmark(state, true);
+}
+BENCHMARK(BM_IndexHash)->Arg(4)->Arg(32)->Arg(120);
+
+// `[c0, ..., cn-1][n-1]` and `{c0: c0, ...}[cn-1]`, with and without elide_temporaries.
+// With n = 32 the hash has too many stack values to be elided.
+static void BM_TemporaryIndex(benchmark::State& state)
+{
+    B_Allocator constants {};
+    const auto n = static_cast<int>(state.range(0));
+    std::vector<Value> values;
+    std::vector<std::vector<unsigned char>> array;
+    std::vector<std::vector<unsigned char>> hash;
+    for (auto i = 0; i < n; ++i)
+    {
+        values.push_back(constants.alloc("key" + std::to_string(i)));
+        array.push_back(make(OpConstant, i));
+        hash.push_back(make(OpConstant, i));
+        hash.push_back(make(OpConstant, i));
+    }
+    values.push_back(int64_t{n - 1});
+    array.insert(array.end(), {make(OpArray, n), make(OpConstant, n), make(OpIndex), make(OpPop)});
+    hash.insert(hash.end(), {make(OpHash, 2 * n), make(OpConstant, n - 1), make(OpIndex), make(OpPop)});
+    auto instructions = repeat(array, repetitions);
+    const auto hashes = repeat(hash, repetitions);
+    instructions.insert(instructions.end(), hashes.begin(), hashes.end());
+    ByteCode code {instructions, values};
+    if (state.range(1))
+    {
+        elide_temporaries(code);
+    }
+    VM vm {code};
+    vm.auto_gc = false;
+    for (auto _ : state)
+    {
+        vm.ip = 0;
+        vm.sp = 0;
+        vm.run();
+        state.PauseTiming();
+        vm.run_gc();
+        state.ResumeTiming();
+    }
+    state.counters["allocations_per_run"] = benchmark::Counter(
+        static_cast<double>(vm.bgc.allocator->allocated.objects) / static_cast<double>(state.iterations()));
+    state.SetItemsProcessed(state.iterations() * repetitions * 2);
+}
+BENCHMARK(BM_TemporaryIndex)->ArgNames({"n", "elide"})->ArgsProduct({{4, 32}, {0, 1}});
+
+// One collection with n live strings, reachable from an array in g0
+static void BM_GcLiveHeap(benchmark::State& state)
+{
+    VM vm {};
+    auto& allocator = *vm.bgc.allocator;
+    std::vector<Value> strings;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        strings.push_back(allocator.alloc(std::to_string(i)));
+    }
+    vm.globals.push_back(allocator.alloc(strings.data(), strings.data() + strings.size()));
+    for (auto _ : state)
+    {
+        vm.run_gc();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_GcLiveHeap)->RangeMultiplier(8)->Range(64, 1 << 15);
+
+// One collection freeing n unreachable strings, next to n live ones
+static void BM_GcGarbage(benchmark::State& state)
+{
+    VM vm {};
+    auto& allocator = *vm.bgc.allocator;
+    std::vector<Value> strings;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        strings.push_back(allocator.alloc(std::to_string(i)));
+    }
+    vm.globals.push_back(allocator.alloc(strings.data(), strings.data() + strings.size()));
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (int64_t i = 0; i < state.range(0); ++i)
+        {
+            allocator.alloc(std::to_string(i));
+        }
+        state.ResumeTiming();
+        vm.run_gc();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_GcGarbage)->RangeMultiplier(8)->Range(64, 1 << 12);
+
+// Building a VM around a program with n constants
+static void BM_VmConstruction(benchmark::State& state)
+{
+    const ByteCode code {repeat({make(OpConstant, 0), make(OpPop)}, repetitions), std::vector<Value>(state.range(0), Value{1})};
+    for (auto _ : state)
+    {
+        VM vm {code};
+        benchmark::DoNotOptimize(vm.constants.data());
+    }
+}
+BENCHMARK(BM_VmConstruction)->Arg(0)->Arg(64)->Arg(4096);
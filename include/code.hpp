@@ -2,76 +2,145 @@
 #define CODE_HPP
 
 #include <array>
-#include <memory>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+/**
+ * The instruction set, in opcode order, as X(operation, printed name, operands, values popped, values pushed).
+ *
+ * Everything describing instructions is generated from this list: the Operation enum, opDefinitions,
+ * the instruction widths and operand accessors below, and through them the encoder, the decoders,
+ * the verifiers of the passes and the disassembler. Operands are 16 bits, or 32 after the OpWide
+ * prefix. V marks a stack effect that depends on the operand or on the VM, as the arguments of a call.
+*/
+#define BONSAI_INSTRUCTIONS(X, V) \
+    X(OpConstant,          "OpConstantInt",       1, 0, 1) \
+    X(OpTrue,              "OpTrue",              0, 0, 1) \
+    X(OpFalse,             "OpFalse",             0, 0, 1) \
+    X(OpPop,               "OpPop",               0, 1, 0) \
+    X(OpAdd,               "OpAddInt",            0, 2, 1) \
+    X(OpSub,               "OpSubInt",            0, 2, 1) \
+    X(OpMul,               "OpMulInt",            0, 2, 1) \
+    X(OpDiv,               "OpDivInt",            0, 2, 1) \
+    X(OpEqual,             "OpEqual",             0, 2, 1) \
+    X(OpGreaterThan,       "OpGreaterThan",       0, 2, 1) \
+    X(OpGreaterEqual,      "OpGreaterEqual",      0, 2, 1) \
+    X(OpUnaryMinus,        "OpUnaryMinus",        0, 1, 1) \
+    X(OpBang,              "OpBang",              0, 1, 1) \
+    X(OpJumpFalse,         "OpJumpFalse",         1, 1, 0) \
+    X(OpJump,              "OpJump",              1, 0, 0) \
+    X(OpWriteGlobal,       "OpWriteGlobal",       1, 1, 0) \
+    X(OpReadGlobal,        "OpReadGlobal",        1, 0, 1) \
+    X(OpArray,             "OpArray",             1, V, 1) \
+    X(OpHash,              "OpHash",              1, V, 1) \
+    X(OpIndex,             "OpIndex",             0, 2, 1) \
+    X(OpCallHost,          "OpCallHost",          1, V, V) \
+    X(OpArraySum,          "OpArraySum",          0, 1, 1) \
+    X(OpArrayMin,          "OpArrayMin",          0, 1, 1) \
+    X(OpArrayMax,          "OpArrayMax",          0, 1, 1) \
+    X(OpArrayAdd,          "OpArrayAdd",          0, 2, 1) \
+    X(OpArrayMul,          "OpArrayMul",          0, 2, 1) \
+    X(OpArrayDot,          "OpArrayDot",          0, 2, 1) \
+    X(OpArrayMap,          "OpArrayMap",          1, 2, 1) \
+    X(OpArrayFilter,       "OpArrayFilter",       1, 2, 1) \
+    X(OpArrayReduce,       "OpArrayReduce",       1, 2, 1) \
+    X(OpArraySort,         "OpArraySort",         0, 1, 1) \
+    X(OpArrayBinarySearch, "OpArrayBinarySearch", 0, 2, 1) \
+    X(OpCall,              "OpCall",              1, V, 1) \
+    X(OpTailCall,          "OpTailCall",          1, V, V) \
+    X(OpReturn,            "OpReturn",            0, V, V) \
+    X(OpGetLocal,          "OpGetLocal",          1, 0, 1) \
+    X(OpSetLocal,          "OpSetLocal",          1, 1, 0) \
+    X(OpSetIndex,          "OpSetIndex",          0, 3, 1) \
+    X(OpSlice,             "OpSlice",             0, 3, 1) \
+    X(OpCallNative,        "OpCallNative",        1, V, V) \
+    X(OpSelect,            "OpSelect",            1, V, 1) \
+    X(OpSelectKey,         "OpSelectKey",         1, V, 1) \
+    X(OpWide,              "OpWide",              0, V, V)
+
+// Marks a stack effect that depends on the operand or on the VM
+constexpr int variable_effect = -1;
+
+// Width of each operand, and of each operand of an instruction prefixed by OpWide
+constexpr int short_operand_width = 2;
+constexpr int wide_operand_width = 4;
+
+#define BONSAI_OPERATION(op, name, operands, pops, pushes) op,
 typedef enum : unsigned char{
-    OpConstant,
-    OpTrue,
-    OpFalse,
-    OpPop,
-    OpAdd,
-    OpSub,
-    OpMul,
-    OpDiv,
-    OpEqual,
-    OpGreaterThan,
-    OpGreaterEqual,
-    OpUnaryMinus,
-    OpBang,
-    OpJumpFalse,
-    OpJump,
-    OpWriteGlobal,
-    OpReadGlobal,
-    OpArray,
-    OpHash,
-    OpIndex,
+    BONSAI_INSTRUCTIONS(BONSAI_OPERATION, variable_effect)
 } Operation;
-
-struct Instruction
-{
-    unsigned char op;
-    std::unique_ptr<unsigned char*> operands;
-    ~Instruction() = default;
-};
+#undef BONSAI_OPERATION
 
 struct Definition
 {
-    std::string opName;
+    std::string_view opName;
     int numOperands;
     std::array<unsigned char, 5> operandsWidth;
+    int pops;
+    int pushes;
 };
 
-static std::array<Definition, 256> opDefinitions {
-    Definition{"OpConstantInt", 1, {2}},
-    Definition{"OpTrue", 0, {}},
-    Definition{"OpFalse", 0, {}},
-    Definition{"OpPop", 0, {}},
-    Definition{"OpAddInt", 0, {}},
-    Definition{"OpSubInt", 0, {}},
-    Definition{"OpMulInt", 0, {}},
-    Definition{"OpDivInt", 0, {}},
-    Definition{"OpEqual", 0, {}},
-    Definition{"OpGreaterThan", 0, {}},
-    Definition{"OpGreaterEqual", 0, {}},
-    Definition{"OpUnaryMinus", 0, {}},
-    Definition{"OpBang", 0, {}},
-    Definition{"OpJumpFalse", 1, {2}},
-    Definition{"OpJump", 1, {2}},
-    Definition{"OpWriteGlobal", 1, {2}},
-    Definition{"OpReadGlobal", 1, {2}},
-    Definition{"OpArray", 1, {2}},
-    Definition{"OpHash", 1, {2}},
-    Definition{"OpIndex", 0, {}},
+#define BONSAI_DEFINITION(op, name, operands, pops, pushes) Definition{name, operands, {operands > 0 ? short_operand_width : 0}, pops, pushes},
+// Definitions by opcode, with an empty name for the opcodes no instruction uses
+inline constexpr std::array<Definition, 256> opDefinitions {
+    BONSAI_INSTRUCTIONS(BONSAI_DEFINITION, variable_effect)
 };
+#undef BONSAI_DEFINITION
 
-std::vector<unsigned char> make(Operation op);
+#define BONSAI_COUNT(op, name, operands, pops, pushes) + 1
+constexpr int instruction_count = 0 BONSAI_INSTRUCTIONS(BONSAI_COUNT, variable_effect);
+#undef BONSAI_COUNT
+static_assert(instruction_count <= 256, "Opcodes are one byte");
 
-std::vector<unsigned char> make(Operation op, int16_t arg);
+// Bytes of the instruction `op`, with the OpWide prefix when `wide`
+constexpr int64_t instruction_width(unsigned char op, bool wide = false)
+{
+    const auto operands = opDefinitions[op].numOperands;
+    return wide ? 2 + operands * wide_operand_width : 1 + operands * short_operand_width;
+}
 
 int16_t ReadInt16(std::array<unsigned char, 2>);
 constexpr bool is_system_little_endian();
 std::array<unsigned char, 2> WriteInt16(int16_t value);
+int32_t ReadInt32(std::array<unsigned char, 4>);
+std::array<unsigned char, 4> WriteInt32(int32_t value);
+
+/**
+ * Operand of `Op` at `offset`, prefixed by OpWide when `Wide`, for decoders that know the instruction
+ * they read, as the handlers of the interpreter. The width comes from the instruction list.
+*/
+template <Operation Op, bool Wide = false>
+int32_t read_operand(const std::vector<unsigned char>& instructions, size_t offset)
+{
+    static_assert(opDefinitions[Op].numOperands == 1, "Only instructions with an operand have one to read");
+    if constexpr (Wide)
+    {
+        static_assert(wide_operand_width == sizeof(int32_t));
+        return ReadInt32({instructions[offset + 2], instructions[offset + 3], instructions[offset + 4], instructions[offset + 5]});
+    } else
+    {
+        static_assert(opDefinitions[Op].operandsWidth[0] == sizeof(int16_t));
+        return ReadInt16({instructions[offset + 1], instructions[offset + 2]});
+    }
+}
+
+std::vector<unsigned char> make(Operation op);
+
+std::vector<unsigned char> make(Operation op, int16_t arg);
+// `op` prefixed by OpWide, with a 32-bit operand
+std::vector<unsigned char> make_wide(Operation op, int32_t arg);
+// The short form of `op` when `arg` fits 16 bits, the wide one otherwise
+std::vector<unsigned char> make_sized(Operation op, int32_t arg);
+
+// Bytes of the instruction at `offset`, with its OpWide prefix if any
+int64_t instruction_width(const std::vector<unsigned char>& instructions, size_t offset);
+// First operand of the instruction at `offset`, short or wide
+int32_t read_operand(const std::vector<unsigned char>& instructions, size_t offset);
+// Overwrite the first operand of the instruction at `offset`, short or wide; `value` must fit it
+void write_operand(std::vector<unsigned char>& instructions, size_t offset, int32_t value);
+// One line per instruction: its offset, its name and its operand, if any
+std::string disassemble(const std::vector<unsigned char>& instructions);
 
 #endif
\ No newline at end of file
@@ -6,26 +6,67 @@
 #ifndef OBJECT_HPP
 #define OBJECT_HPP
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <initializer_list>
+#include <map>
 #include <memory>
+#include <new>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <variant>
+#include <vector>
+
+#include "persistent.hpp"
+
+// Concrete type of a heap object, used by the heap statistics
+enum class B_Kind : unsigned char
+{
+    String,
+    Array,
+    IntArray,
+    FloatArray,
+    Function,
+    HashMap,
+    Slice,
+    PVector,
+    PMap,
+    Record,
+    Count,
+};
+
+const char* kind_name(B_Kind kind);
 
 class B_Object
 {
 public:
     virtual ~B_Object() {};
+    virtual B_Kind kind() const = 0;
+    // Approximate memory held by the object, its own storage included
+    virtual size_t bytes() const = 0;
     bool used() {return _used;}
     void set_used() {_used = true;}
     void set_not_used() {_used = false;}
+    // Whether the only reference to the object is the one on the VM stack, so it can be updated in place
+    bool unique() {return _unique;}
+    void set_unique(bool unique) {_unique = unique;}
  
 private:
     bool _used;
+    bool _unique {false};
 };
 
 using Value = std::variant<int64_t, _Float64, bool, B_Object*>;
 
+class B_Allocator;
+
 struct VHash {
     size_t operator()(const Value& v) const;
 };
@@ -34,22 +75,152 @@ struct VEqual {
     bool operator()(const Value& l, const Value &r) const;
 };
 
+/**
+ * Elements of a heap object. The allocator stores them right after the object, in room sized for the
+ * elements it is created with, so a small object is a single allocation. They move to a buffer of their
+ * own when the object grows past that room, or when they are handed over as a vector.
+*/
+template <typename T>
+class B_Elements
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    public:
+    // Elements in the buffer of `values`
+    B_Elements(std::vector<T> values) : heap(std::move(values)), first(heap.data()), count(heap.size()) {};
+    // Copies of [begin, end) stored in `trailing`, which has room for them
+    B_Elements(const T* begin, const T* end, std::byte* trailing)
+    : first(reinterpret_cast<T*>(trailing)), count(end - begin), reserved(count)
+    {
+        std::copy(begin, end, first);
+    };
+    // Move `other` to a new place, with room in `trailing` for other.inline_bytes()
+    B_Elements(B_Elements&& other, std::byte* trailing) : first(reinterpret_cast<T*>(trailing)), count(other.count)
+    {
+        if (other.on_heap())
+        {
+            heap = std::move(other.heap);
+            first = heap.data();
+        } else
+        {
+            reserved = count;
+            std::copy(other.begin(), other.end(), first);
+        }
+    };
+    B_Elements(const B_Elements&) = delete;
+
+    size_t size() const {return count;}
+    bool empty() const {return count == 0;}
+    T* data() {return first;}
+    const T* data() const {return first;}
+    T* begin() {return first;}
+    T* end() {return first + count;}
+    const T* begin() const {return first;}
+    const T* end() const {return first + count;}
+    T& operator[](size_t i) {return first[i];}
+    const T& operator[](size_t i) const {return first[i];}
+    size_t capacity() const {return on_heap() ? heap.capacity() : reserved;}
+    bool operator==(const std::vector<T>& other) const {return std::equal(begin(), end(), other.begin(), other.end());}
+
+    void push_back(const T& value)
+    {
+        if (!on_heap())
+        {
+            heap.reserve(2 * count + 1);
+            heap.assign(begin(), end());
+        }
+        heap.push_back(value);
+        first = heap.data();
+        ++count;
+    }
+
+    // Bytes reserved after the object when it was allocated, used or not
+    size_t trailing_bytes() const {return reserved * sizeof(T);}
+    // Bytes of the elements stored after the object
+    size_t inline_bytes() const {return on_heap() ? 0 : count * sizeof(T);}
+
+    private:
+    bool on_heap() const {return first == heap.data();}
+
+    std::vector<T> heap;
+    T* first;
+    size_t count;
+    size_t reserved {0};
+};
+
 class B_String: public B_Object
 {
 public:
-    B_String(std::string s): value(s) {set_not_used();};
+    // String with its own copy of s, for strings that do not live in an allocator
+    B_String(std::string_view s);
+    // Concatenation of `parts`, whose characters are stored in `trailing`, which has room for all of them
+    B_String(std::initializer_list<std::string_view> parts, std::byte* trailing);
+    // Move `other` to a new place, with room in `trailing` for other.inline_bytes()
+    B_String(B_String&& other, std::byte* trailing);
     virtual ~B_String() override {};
+    B_Kind kind() const override {return B_Kind::String;}
+    size_t bytes() const override {return sizeof(*this) + value.size();}
+    size_t trailing_bytes() const {return owned ? 0 : value.size();}
+    size_t inline_bytes() const {return trailing_bytes();}
 
-    std::string value;
+    std::string_view value;
+
+private:
+    std::unique_ptr<char[]> owned;
 };
 
 class B_Array: public B_Object
 {
     public:
-    B_Array(Value* first, Value* last) : values(first, last) {set_not_used();};
+    B_Array(const Value* first, const Value* last, std::byte* trailing) : values(first, last, trailing) {set_not_used();};
+    B_Array(B_Array&& other, std::byte* trailing) : B_Object(other), values(std::move(other.values), trailing) {};
     virtual ~B_Array() override {};
+    B_Kind kind() const override {return B_Kind::Array;}
+    size_t bytes() const override {return sizeof(*this) + values.capacity() * sizeof(Value);}
+    size_t trailing_bytes() const {return values.trailing_bytes();}
+    size_t inline_bytes() const {return values.inline_bytes();}
+
+    B_Elements<Value> values;
+};
 
-    std::vector<Value> values;
+/**
+ * Homogeneous array of a primitive type, stored packed.
+ * It holds no B_Object*, so the collector never scans its elements.
+*/
+template <typename T>
+class B_PackedArray: public B_Object
+{
+    public:
+    B_PackedArray(std::vector<T> v) : values(std::move(v)) {set_not_used();};
+    B_PackedArray(const T* first, const T* last, std::byte* trailing) : values(first, last, trailing) {set_not_used();};
+    B_PackedArray(B_PackedArray&& other, std::byte* trailing) : B_Object(other), values(std::move(other.values), trailing) {};
+    virtual ~B_PackedArray() override {};
+    B_Kind kind() const override {return std::is_same_v<T, int64_t> ? B_Kind::IntArray : B_Kind::FloatArray;}
+    size_t bytes() const override {return sizeof(*this) + values.capacity() * sizeof(T);}
+    size_t trailing_bytes() const {return values.trailing_bytes();}
+    size_t inline_bytes() const {return values.inline_bytes();}
+
+    B_Elements<T> values;
+};
+
+using B_IntArray = B_PackedArray<int64_t>;
+using B_FloatArray = B_PackedArray<_Float64>;
+
+/**
+ * Compiled function. Its code lives in the program instructions starting at `entry`
+ * and ends with OpReturn. The first `arity` of its `num_locals` slots hold the arguments.
+*/
+class B_Function: public B_Object
+{
+    public:
+    B_Function(int64_t entry, int arity, int num_locals) : entry(entry), arity(arity), num_locals(num_locals) {set_not_used();};
+    virtual ~B_Function() override {};
+    B_Kind kind() const override {return B_Kind::Function;}
+    size_t bytes() const override {return sizeof(*this);}
+
+    int64_t entry;
+    int arity;
+    int num_locals;
 };
 
 class B_HashPair
@@ -66,11 +237,178 @@ class B_HashMap: public B_Object
 {
     public:
     B_HashMap(B_HashPair* first, B_HashPair* end);
+    B_HashMap(B_HashMap&&) = default;
     virtual ~B_HashMap() override {};
+    B_Kind kind() const override {return B_Kind::HashMap;}
+    size_t bytes() const override {return sizeof(*this) + values.size() * (sizeof(B_HashPair) + sizeof(Value) + 2 * sizeof(void*)) + values.bucket_count() * sizeof(void*);}
 
     std::unordered_map<Value, B_HashPair, VHash, VEqual> values;
 };
 
+/**
+ * Range of a string or of an array that shares the storage of its parent.
+ * The collector keeps the parent alive; when the slices pin only a small part of an otherwise
+ * unreachable parent, they get their own copy of the range instead (see B_GC::compact_slices).
+*/
+class B_Slice: public B_Object
+{
+    public:
+    B_Slice(B_Object* parent, size_t offset, size_t length) : parent(parent), offset(offset), length(length) {set_not_used();};
+    virtual ~B_Slice() override {};
+    B_Kind kind() const override {return B_Kind::Slice;}
+    size_t bytes() const override {return sizeof(*this);}
+
+    // Characters of a string slice
+    std::string_view chars() const;
+    // Element i of an array slice
+    Value at(size_t i) const;
+    // Length of the whole parent
+    size_t parent_length() const;
+    // Copy the range into a new parent allocated by `allocator` and return it
+    B_Object* detach(B_Allocator& allocator);
+
+    B_Object* parent;
+    size_t offset;
+    size_t length;
+};
+
+/**
+ * Array updated by OpSetIndex. Versions share the unchanged parts of the trie,
+ * which bytes() counts once for each version.
+*/
+class B_PVector: public B_Object
+{
+    public:
+    B_PVector(PersistentVector<Value> v) : values(std::move(v)) {set_not_used();};
+    B_PVector(B_PVector&&) = default;
+    virtual ~B_PVector() override {};
+    B_Kind kind() const override {return B_Kind::PVector;}
+    size_t bytes() const override {return sizeof(*this) + values.size() * sizeof(Value);}
+
+    PersistentVector<Value> values;
+};
+
+/**
+ * Hash updated by OpSetIndex. Versions share the unchanged parts of the trie.
+*/
+class B_PMap: public B_Object
+{
+    public:
+    B_PMap(PersistentMap<Value, Value, VHash, VEqual> v) : values(std::move(v)) {set_not_used();};
+    B_PMap(B_PMap&&) = default;
+    virtual ~B_PMap() override {};
+    B_Kind kind() const override {return B_Kind::PMap;}
+    size_t bytes() const override {return sizeof(*this) + values.size() * 2 * sizeof(Value);}
+
+    PersistentMap<Value, Value, VHash, VEqual> values;
+};
+
+// Hash of std::string keys that can be looked up by std::string_view
+struct B_StringHash
+{
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {return std::hash<std::string_view>{}(s);}
+};
+
+/**
+ * Layout shared by the records built with the same keys in the same order.
+ * Shapes are interned by the allocator and live as long as it does, together with their key strings.
+*/
+class B_Shape
+{
+    public:
+    B_Shape(const std::vector<std::string>& keys);
+
+    // Slot of `key`, or -1 when the shape does not have it
+    int slot(std::string_view key) const;
+
+    std::vector<std::unique_ptr<B_String>> keys;
+    std::unordered_map<std::string, int, B_StringHash, std::equal_to<>> slots;
+};
+
+/**
+ * Hash with string keys known when it is built: the values sit in a flat array laid out by the shape.
+*/
+class B_Record: public B_Object
+{
+    public:
+    B_Record(const B_Shape* shape, const Value* first, const Value* last, std::byte* trailing) : shape(shape), values(first, last, trailing) {set_not_used();};
+    B_Record(B_Record&& other, std::byte* trailing) : B_Object(other), shape(other.shape), values(std::move(other.values), trailing) {};
+    virtual ~B_Record() override {};
+    B_Kind kind() const override {return B_Kind::Record;}
+    size_t bytes() const override {return sizeof(*this) + values.capacity() * sizeof(Value);}
+    size_t trailing_bytes() const {return values.trailing_bytes();}
+    size_t inline_bytes() const {return values.inline_bytes();}
+
+    const B_Shape* shape;
+    B_Elements<Value> values;
+};
+
+// Objects and bytes of one kind
+struct B_KindStats
+{
+    uint64_t objects {0};
+    uint64_t bytes {0};
+};
+
+struct B_HeapStats
+{
+    std::array<B_KindStats, static_cast<size_t>(B_Kind::Count)> live {};
+    B_KindStats live_total;
+    // Everything allocated so far, collected or not
+    B_KindStats allocated_total;
+
+    const B_KindStats& operator[](B_Kind kind) const {return live[static_cast<size_t>(kind)];}
+};
+
+/**
+ * Bump allocator over chunks, where the allocator places its objects.
+ * Chunks are only given back with the whole region, so the space of collected objects is lost
+ * until the collector moves the live ones into a new region (see B_GC::compact).
+*/
+class B_Region
+{
+    public:
+    static constexpr size_t chunk_size = 64 * 1024;
+
+    B_Region() = default;
+    B_Region(B_Region&& other) noexcept;
+    B_Region& operator=(B_Region&& other) noexcept;
+
+    void* allocate(size_t size, size_t align);
+    // Take over the chunks of `other`, which is left empty
+    void adopt(B_Region& other);
+    // Bytes handed out since the region was created
+    size_t used() const {return used_bytes;}
+    // Bytes held by the chunks
+    size_t reserved() const {return reserved_bytes;}
+
+    private:
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+    // Free space of the chunk being filled
+    std::byte* top {nullptr};
+    std::byte* end {nullptr};
+    size_t used_bytes {0};
+    size_t reserved_bytes {0};
+};
+
+/**
+ * Where B_Allocator::compact moved each object. The old region stays reserved as long as the relocation
+ * lives, so no new address can be taken for an old one while the references are updated.
+*/
+struct B_Relocation
+{
+    std::unordered_map<B_Object*, B_Object*> forward;
+    B_Region old_region;
+
+    // New address of obj, or obj itself when it did not move
+    B_Object* operator()(B_Object* obj) const
+    {
+        auto it = forward.find(obj);
+        return it != forward.end() ? it->second : obj;
+    }
+};
+
 class B_Allocator {
     public:
     B_Allocator() : memory() {}
@@ -79,14 +417,97 @@ class B_Allocator {
     B_Allocator(const B_Allocator&) = delete;
     B_Allocator(B_Allocator&&);
 
-    B_Object* alloc(std::string data);
+    // Take ownership of the objects allocated by `other`
+    void adopt(B_Allocator& other);
+
+    B_Object* alloc(std::string_view data);
+    // The string left + right, built in place
+    B_Object* concat(std::string_view left, std::string_view right);
     B_Object* alloc(Value* first, Value* last);
     B_Object* alloc(B_HashPair* first, B_HashPair* last);
+    // Packed arrays up to max_inline_bytes are stored after the object, longer ones keep the buffer of `values`
+    B_Object* alloc(std::vector<int64_t> values);
+    B_Object* alloc(std::vector<_Float64> values);
+    B_Object* alloc(int64_t entry, int arity, int num_locals);
+    B_Object* alloc(B_Object* parent, size_t offset, size_t length);
+    B_Object* alloc(const B_Shape* shape, const std::vector<Value>& values);
+    B_Object* alloc(PersistentVector<Value> values);
+    B_Object* alloc(PersistentMap<Value, Value, VHash, VEqual> values);
+
+    // The shape with these keys, created on first use
+    const B_Shape* shape(const std::vector<std::string>& keys);
+
+    // Live objects and bytes by kind, walking `memory`
+    B_HeapStats heap_stats() const;
+
+    // Destroy an object of `memory`; the caller removes it from there
+    void release(B_Object* obj);
+    // Fraction of the region held by objects released since it was created
+    double fragmentation() const;
+    size_t region_bytes() const {return region.used();}
+    /**
+     * Move the objects of `memory` into a new region, keeping their order, and return where they went.
+     * The references to them, in other objects included, are left for the caller to update.
+    */
+    B_Relocation compact();
 
     std::vector<B_Object*> memory;
+    // Objects and bytes allocated over the life of the allocator, adopted ones included
+    B_KindStats allocated;
+    static constexpr size_t max_inline_bytes = 512;
+
+    private:
+    B_Object* track(B_Object* obj);
+
+    template <typename T, typename... Args>
+    B_Object* make(Args&&... args)
+    {
+        live_bytes += sizeof(T);
+        return track(new (region.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...));
+    }
+
+    template <typename T>
+    B_Object* make_packed(std::vector<T> values)
+    {
+        if (values.size() * sizeof(T) > max_inline_bytes)
+        {
+            return make<B_PackedArray<T>>(std::move(values));
+        }
+        return make_trailing<B_PackedArray<T>>(values.size() * sizeof(T), values.data(), values.data() + values.size());
+    }
+
+    // Make a T followed by `trailing` bytes, which its constructor gets as last argument
+    template <typename T, typename... Args>
+    B_Object* make_trailing(size_t trailing, Args&&... args)
+    {
+        live_bytes += sizeof(T) + trailing;
+        auto* storage = static_cast<std::byte*>(region.allocate(sizeof(T) + trailing, alignof(T)));
+        return track(new (storage) T(std::forward<Args>(args)..., storage + sizeof(T)));
+    }
+
+    B_Region region;
+    // Bytes of the region taken by the objects of `memory`
+    size_t live_bytes {0};
+
+    std::vector<std::unique_ptr<B_Shape>> shape_storage;
+    std::map<std::vector<std::string>, const B_Shape*> shapes;
 };
 
+// Characters of a string or of a string slice
+std::optional<std::string_view> as_string_view(const Value& v);
+
 std::string get_string(Value obj);
+/**
+ * Views over the storage of VM objects, without copies. They stay valid until the object is updated
+ * or the next collection: compaction moves objects, with the elements stored inline after them, even
+ * when a B_Handle roots them. Take the view again from the handle after VM::run_gc or a run of the VM.
+*/
+std::string_view get_string_view(Value obj);
+std::span<const Value> get_array_view(Value obj);
+template <typename T>
+std::span<const T> get_packed_view(Value obj);
+// Call fn(key, value) on each entry of a hash, record or persistent map
+void for_each_entry(Value obj, const std::function<void(const Value&, const Value&)>& fn);
 std::vector<Value> get_array(Value obj);
 std::unordered_map<Value, B_HashPair, VHash, VEqual> get_hash(Value obj);
 
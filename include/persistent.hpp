@@ -0,0 +1,327 @@
+/**
+ * Persistent vector and hash map with structural sharing.
+ *
+ * Both are 32-way tries of reference counted nodes: an update copies the O(log n) nodes on the path
+ * to the changed element and shares all the others with the previous version.
+ * The transient updates mutate in place the nodes no other version holds (use_count() == 1),
+ * and are safe only when the caller owns the only reference to the whole structure.
+*/
+#ifndef PERSISTENT_HPP
+#define PERSISTENT_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+template <typename T>
+class PersistentVector
+{
+    static constexpr int bits = 5;
+    static constexpr size_t width = 1 << bits;
+    static constexpr size_t mask = width - 1;
+
+    struct Node
+    {
+        std::vector<std::shared_ptr<Node>> children;
+        std::vector<T> values;
+    };
+
+    public:
+    PersistentVector() : root(nullptr), count(0), shift(0) {};
+
+    template <typename It>
+    PersistentVector(It first, It last) : PersistentVector()
+    {
+        for (auto it = first; it != last; ++it)
+        {
+            set_in_place(count, *it);
+        }
+    }
+
+    size_t size() const {return count;}
+
+    const T& operator[](size_t i) const
+    {
+        if (i >= count)
+        {
+            throw std::out_of_range("Index out of the vector bounds");
+        }
+        const Node* node = root.get();
+        for (auto level = shift; level > 0; level -= bits)
+        {
+            node = node->children[(i >> level) & mask].get();
+        }
+        return node->values[i & mask];
+    }
+
+    // New version with element i set to value. i == size() appends.
+    PersistentVector set(size_t i, T value) const
+    {
+        auto copy = *this;
+        copy.update(i, std::move(value), false);
+        return copy;
+    }
+
+    void set_in_place(size_t i, T value)
+    {
+        update(i, std::move(value), true);
+    }
+
+    template <typename F>
+    void for_each(F fn) const
+    {
+        for_each_node<const Node>(root.get(), shift, fn);
+    }
+
+    // Call fn on each element by reference, nodes shared with other versions included:
+    // only for changes all the versions must see, like the collector moving the objects they point to
+    template <typename F>
+    void update_each(F fn)
+    {
+        for_each_node<Node>(root.get(), shift, fn);
+    }
+
+    private:
+    void update(size_t i, T value, bool transient)
+    {
+        if (i > count)
+        {
+            throw std::out_of_range("Index out of the vector bounds");
+        }
+        if (i == count && count == capacity())
+        {
+            // The trie is full: grow one level on top of the current root
+            auto new_root = std::make_shared<Node>();
+            if (root)
+            {
+                new_root->children.push_back(root);
+                shift += bits;
+            }
+            root = new_root;
+        }
+        root = update_node(root, shift, i, std::move(value), transient);
+        count = std::max(count, i + 1);
+    }
+
+    size_t capacity() const
+    {
+        return root ? width << shift : 0;
+    }
+
+    static std::shared_ptr<Node> update_node(const std::shared_ptr<Node>& node, int level, size_t i, T value, bool transient)
+    {
+        auto result = !node ? std::make_shared<Node>()
+            : transient && node.use_count() == 1 ? node
+            : std::make_shared<Node>(*node);
+        const auto idx = (i >> level) & mask;
+        if (level == 0)
+        {
+            if (idx == result->values.size())
+            {
+                result->values.push_back(std::move(value));
+            } else
+            {
+                result->values[idx] = std::move(value);
+            }
+            return result;
+        }
+        if (idx == result->children.size())
+        {
+            result->children.push_back(nullptr);
+        }
+        auto& child = result->children[idx];
+        child = update_node(child, level - bits, i, std::move(value), transient);
+        return result;
+    }
+
+    template <typename N, typename F>
+    static void for_each_node(N* node, int level, F& fn)
+    {
+        if (node == nullptr)
+        {
+            return;
+        }
+        if (level == 0)
+        {
+            for (auto& v: node->values)
+            {
+                fn(v);
+            }
+            return;
+        }
+        for (const auto& child: node->children)
+        {
+            for_each_node<N>(child.get(), level - bits, fn);
+        }
+    }
+
+    std::shared_ptr<Node> root;
+    size_t count;
+    int shift;
+};
+
+/**
+ * Hash array mapped trie. Each level consumes 5 bits of the hash; keys whose whole hash collides
+ * end up in a node past the last level that is searched linearly.
+*/
+template <typename K, typename V, typename Hash, typename Equal>
+class PersistentMap
+{
+    static constexpr int bits = 5;
+    static constexpr size_t mask = (1 << bits) - 1;
+    static constexpr int hash_bits = 64;
+
+    struct Node;
+
+    struct Entry
+    {
+        std::shared_ptr<Node> child;
+        size_t hash;
+        K key;
+        V value;
+    };
+
+    struct Node
+    {
+        uint32_t bitmap {0};
+        std::vector<Entry> entries;
+    };
+
+    public:
+    PersistentMap() : root(std::make_shared<Node>()), count(0) {};
+
+    size_t size() const {return count;}
+
+    // Value of `key`, or nullptr
+    const V* find(const K& key) const
+    {
+        const auto hash = Hash{}(key);
+        const Node* node = root.get();
+        for (int shift = 0;; shift += bits)
+        {
+            if (shift >= hash_bits)
+            {
+                for (const auto& e: node->entries)
+                {
+                    if (Equal{}(e.key, key))
+                    {
+                        return &e.value;
+                    }
+                }
+                return nullptr;
+            }
+            const uint32_t bit = 1u << ((hash >> shift) & mask);
+            if ((node->bitmap & bit) == 0)
+            {
+                return nullptr;
+            }
+            const auto& e = node->entries[std::popcount(node->bitmap & (bit - 1))];
+            if (!e.child)
+            {
+                return Equal{}(e.key, key) ? &e.value : nullptr;
+            }
+            node = e.child.get();
+        }
+    }
+
+    PersistentMap set(K key, V value) const
+    {
+        auto copy = *this;
+        copy.update(std::move(key), std::move(value), false);
+        return copy;
+    }
+
+    void set_in_place(K key, V value)
+    {
+        update(std::move(key), std::move(value), true);
+    }
+
+    template <typename F>
+    void for_each(F fn) const
+    {
+        for_each_node<const Node>(root.get(), fn);
+    }
+
+    // Call fn(key, value) on each entry by reference, nodes shared with other versions included.
+    // Changing a key must not change its hash.
+    template <typename F>
+    void update_each(F fn)
+    {
+        for_each_node<Node>(root.get(), fn);
+    }
+
+    private:
+    void update(K key, V value, bool transient)
+    {
+        bool added = false;
+        const auto hash = Hash{}(key);
+        root = update_node(root, 0, Entry{nullptr, hash, std::move(key), std::move(value)}, transient, added);
+        count += added ? 1 : 0;
+    }
+
+    static std::shared_ptr<Node> update_node(const std::shared_ptr<Node>& node, int shift, Entry entry, bool transient, bool& added)
+    {
+        auto result = transient && node.use_count() == 1 ? node : std::make_shared<Node>(*node);
+        if (shift >= hash_bits)
+        {
+            for (auto& e: result->entries)
+            {
+                if (Equal{}(e.key, entry.key))
+                {
+                    e.value = std::move(entry.value);
+                    return result;
+                }
+            }
+            result->entries.push_back(std::move(entry));
+            added = true;
+            return result;
+        }
+        const uint32_t bit = 1u << ((entry.hash >> shift) & mask);
+        const auto pos = std::popcount(result->bitmap & (bit - 1));
+        if ((result->bitmap & bit) == 0)
+        {
+            result->bitmap |= bit;
+            result->entries.insert(result->entries.begin() + pos, std::move(entry));
+            added = true;
+            return result;
+        }
+        auto& e = result->entries[pos];
+        if (e.child)
+        {
+            e.child = update_node(e.child, shift + bits, std::move(entry), transient, added);
+        } else if (Equal{}(e.key, entry.key))
+        {
+            e.value = std::move(entry.value);
+        } else
+        {
+            // Two keys in the same slot: push both one level down
+            bool moved = false;
+            auto child = update_node(std::make_shared<Node>(), shift + bits, Entry{nullptr, e.hash, std::move(e.key), std::move(e.value)}, true, moved);
+            e = Entry{update_node(child, shift + bits, std::move(entry), true, added), 0, K{}, V{}};
+        }
+        return result;
+    }
+
+    template <typename N, typename F>
+    static void for_each_node(N* node, F& fn)
+    {
+        for (auto& e: node->entries)
+        {
+            if (e.child)
+            {
+                for_each_node<N>(e.child.get(), fn);
+            } else
+            {
+                fn(e.key, e.value);
+            }
+        }
+    }
+
+    std::shared_ptr<Node> root;
+    size_t count;
+};
+
+#endif
@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <limits>
+
+#include "batch.hpp"
+
+namespace
+{
+    // The loops below are written to be auto-vectorized: no branches on the data, masks applied by selection
+
+    void require_ints(const uint8_t* l, const uint8_t* r, const uint8_t* mask, size_t n)
+    {
+        uint8_t bad = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            bad |= (l[i] | r[i]) & mask[i];
+        }
+        if (bad)
+        {
+            throw invalid_value("Batch arithmetic needs integer operands");
+        }
+    }
+
+    template <typename F>
+    void binary_kernel(int64_t* l, uint8_t* l_kind, const int64_t* r, uint8_t result_kind, const uint8_t* mask, size_t n, bool full, F f)
+    {
+        if (full)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                l[i] = f(l[i], r[i]);
+                l_kind[i] = result_kind;
+            }
+        } else
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                l[i] = mask[i] ? f(l[i], r[i]) : l[i];
+                l_kind[i] = mask[i] ? result_kind : l_kind[i];
+            }
+        }
+    }
+
+    void copy_kernel(int64_t* dst, uint8_t* dst_kind, const int64_t* src, const uint8_t* src_kind, const uint8_t* mask, size_t n, bool full)
+    {
+        if (full)
+        {
+            std::copy(src, src + n, dst);
+            std::copy(src_kind, src_kind + n, dst_kind);
+        } else
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                dst[i] = mask[i] ? src[i] : dst[i];
+                dst_kind[i] = mask[i] ? src_kind[i] : dst_kind[i];
+            }
+        }
+    }
+
+    void fill_kernel(int64_t* dst, uint8_t* dst_kind, int64_t value, uint8_t kind, const uint8_t* mask, size_t n, bool full)
+    {
+        if (full)
+        {
+            std::fill(dst, dst + n, value);
+            std::fill(dst_kind, dst_kind + n, kind);
+        } else
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                dst[i] = mask[i] ? value : dst[i];
+                dst_kind[i] = mask[i] ? kind : dst_kind[i];
+            }
+        }
+    }
+}
+
+B_BatchVM::B_BatchVM(const ByteCode& bc)
+: instructions(bc.instructions), constants(bc.constants), max_depth(0), num_globals(0), num_lanes(0), final_sp(0)
+{
+    verify();
+}
+
+bool B_BatchVM::supports(const ByteCode& bc)
+{
+    try
+    {
+        B_BatchVM{bc};
+        return true;
+    } catch (not_implemented&)
+    {
+        return false;
+    } catch (invalid_value&)
+    {
+        return false;
+    }
+}
+
+/**
+ * Check that every instruction is supported and compute the stack depth at each offset.
+ * Lockstep execution relies on the depth being a function of the offset alone.
+ * Which globals exist depends on the inputs of each lane, so step() checks their bounds per lane.
+*/
+void B_BatchVM::verify()
+{
+    const auto size = static_cast<int64_t>(instructions.size());
+    depth_at.assign(size + 1, -1);
+    depth_at[0] = 0;
+    std::vector<int64_t> work {0};
+
+    auto reach = [&](int64_t target, int64_t depth)
+    {
+        if (target < 0 || target > size)
+        {
+            throw invalid_value("Jump outside of the program at offset " + std::to_string(target));
+        }
+        if (depth_at[target] == -1)
+        {
+            depth_at[target] = depth;
+            work.push_back(target);
+        } else if (depth_at[target] != depth)
+        {
+            throw invalid_value("Inconsistent stack depth at offset " + std::to_string(target));
+        }
+    };
+
+    while (!work.empty())
+    {
+        const auto pc = work.back();
+        work.pop_back();
+        if (pc == size)
+        {
+            continue;
+        }
+        const auto op = instructions[pc];
+        const auto width = instruction_width(op);
+        if (pc + width > size)
+        {
+            throw invalid_value("Truncated instruction at offset " + std::to_string(pc));
+        }
+        const auto depth = depth_at[pc];
+        switch (op)
+        {
+            case OpConstant:
+            {
+                const auto idx = read_operand<OpConstant>(instructions, pc);
+                if (idx < 0 || idx >= static_cast<int64_t>(constants.size()))
+                {
+                    throw invalid_value("Constant index out of range at offset " + std::to_string(pc));
+                }
+                if (!std::holds_alternative<int64_t>(constants[idx]) && !std::holds_alternative<bool>(constants[idx]))
+                {
+                    throw not_implemented("Batch execution supports only integer and boolean constants");
+                }
+                break;
+            }
+            case OpReadGlobal:
+            case OpWriteGlobal:
+            {
+                const auto idx = read_operand(instructions, pc);
+                if (idx < 0)
+                {
+                    throw global_index_too_large_exception();
+                }
+                num_globals = std::max<int64_t>(num_globals, idx + 1);
+                break;
+            }
+            case OpTrue:
+            case OpFalse:
+            case OpPop:
+            case OpAdd:
+            case OpSub:
+            case OpMul:
+            case OpDiv:
+            case OpEqual:
+            case OpGreaterThan:
+            case OpGreaterEqual:
+            case OpUnaryMinus:
+            case OpBang:
+            case OpJumpFalse:
+            case OpJump:
+                break;
+            default:
+                throw not_implemented("Batch execution does not support " + std::string(opDefinitions[op].opName));
+        }
+        const int64_t pops = opDefinitions[op].pops;
+        const int64_t pushes = opDefinitions[op].pushes;
+        if (depth < pops)
+        {
+            throw empty_stack_exception();
+        }
+        const auto next_depth = depth - pops + pushes;
+        if (next_depth >= 255)
+        {
+            throw full_stack_exception();
+        }
+        max_depth = std::max(max_depth, next_depth);
+
+        if (op == OpJump || op == OpJumpFalse)
+        {
+            reach(pc + read_operand(instructions, pc), next_depth);
+        }
+        if (op != OpJump)
+        {
+            reach(pc + width, next_depth);
+        }
+    }
+    final_sp = std::max(depth_at[size], 0);
+}
+
+B_BatchVM::Column B_BatchVM::slot(int64_t idx)
+{
+    return Column{stack_data.data() + idx * num_lanes, stack_kind.data() + idx * num_lanes};
+}
+
+B_BatchVM::Column B_BatchVM::global_column(int64_t idx)
+{
+    return Column{global_data.data() + idx * num_lanes, global_kind.data() + idx * num_lanes};
+}
+
+void B_BatchVM::run(const std::vector<std::vector<Value>>& inputs)
+{
+    num_lanes = inputs.size();
+    auto globals_count = num_globals;
+    for (const auto& input: inputs)
+    {
+        globals_count = std::max(globals_count, static_cast<int64_t>(input.size()));
+    }
+    num_globals = globals_count;
+    stack_data.assign(std::max<int64_t>(max_depth, 1) * num_lanes, 0);
+    stack_kind.assign(stack_data.size(), Int);
+    global_data.assign(num_globals * num_lanes, 0);
+    global_kind.assign(global_data.size(), Int);
+    global_defined.assign(global_data.size(), 0);
+
+    for (size_t lane = 0; lane < num_lanes; ++lane)
+    {
+        for (size_t g = 0; g < inputs[lane].size(); ++g)
+        {
+            const auto& value = inputs[lane][g];
+            auto cell = g * num_lanes + lane;
+            if (auto i64 = std::get_if<int64_t>(&value))
+            {
+                global_data[cell] = *i64;
+                global_kind[cell] = Int;
+            } else if (auto b = std::get_if<bool>(&value))
+            {
+                global_data[cell] = *b;
+                global_kind[cell] = Bool;
+            } else
+            {
+                throw not_implemented("Batch execution supports only integer and boolean globals");
+            }
+            global_defined[cell] = 1;
+        }
+    }
+    if (num_lanes == 0)
+    {
+        return;
+    }
+
+    const auto size = static_cast<int64_t>(instructions.size());
+    mask.assign(num_lanes, 1);
+    lane_pc.assign(num_lanes, 0);
+    auto converged = true;
+    auto full = true;
+    int64_t pc = 0;
+    while (true)
+    {
+        if (converged)
+        {
+            if (pc >= size)
+            {
+                break;
+            }
+            auto next = step(pc, full);
+            if (next >= 0)
+            {
+                pc = next;
+            } else
+            {
+                converged = false;
+            }
+            continue;
+        }
+
+        // Diverged: the lanes with the lowest pc go first, so forward branches reconverge
+        int64_t lo = std::numeric_limits<int64_t>::max();
+        int64_t hi = -1;
+        size_t running = 0;
+        for (size_t lane = 0; lane < num_lanes; ++lane)
+        {
+            if (lane_pc[lane] < size)
+            {
+                lo = std::min(lo, lane_pc[lane]);
+                hi = std::max(hi, lane_pc[lane]);
+                ++running;
+            }
+        }
+        if (hi < 0)
+        {
+            break;
+        }
+        for (size_t lane = 0; lane < num_lanes; ++lane)
+        {
+            mask[lane] = lane_pc[lane] == lo;
+        }
+        if (lo == hi)
+        {
+            converged = true;
+            full = running == num_lanes;
+            pc = lo;
+            continue;
+        }
+        auto next = step(lo, false);
+        if (next >= 0)
+        {
+            for (size_t lane = 0; lane < num_lanes; ++lane)
+            {
+                lane_pc[lane] = mask[lane] ? next : lane_pc[lane];
+            }
+        }
+    }
+}
+
+int64_t B_BatchVM::step(int64_t pc, bool full)
+{
+    const auto op = instructions[pc];
+    const auto next = pc + instruction_width(op);
+    const auto sp = depth_at[pc];
+    const auto n = num_lanes;
+    const auto* m = mask.data();
+
+    switch (op)
+    {
+        case OpConstant:
+        {
+            const auto& value = constants[read_operand<OpConstant>(instructions, pc)];
+            auto dst = slot(sp);
+            if (auto i64 = std::get_if<int64_t>(&value))
+            {
+                fill_kernel(dst.data, dst.kind, *i64, Int, m, n, full);
+            } else
+            {
+                fill_kernel(dst.data, dst.kind, std::get<bool>(value), Bool, m, n, full);
+            }
+            return next;
+        }
+        case OpTrue:
+        case OpFalse:
+        {
+            auto dst = slot(sp);
+            fill_kernel(dst.data, dst.kind, op == OpTrue, Bool, m, n, full);
+            return next;
+        }
+        case OpPop:
+            return next;
+        case OpAdd:
+        case OpSub:
+        case OpMul:
+        case OpDiv:
+        case OpEqual:
+        case OpGreaterThan:
+        case OpGreaterEqual:
+        {
+            auto l = slot(sp - 2);
+            auto r = slot(sp - 1);
+            require_ints(l.kind, r.kind, m, n);
+            switch (op)
+            {
+                case OpAdd:
+                    binary_kernel(l.data, l.kind, r.data, Int, m, n, full, [](int64_t a, int64_t b){return a + b;});
+                    break;
+                case OpSub:
+                    binary_kernel(l.data, l.kind, r.data, Int, m, n, full, [](int64_t a, int64_t b){return a - b;});
+                    break;
+                case OpMul:
+                    binary_kernel(l.data, l.kind, r.data, Int, m, n, full, [](int64_t a, int64_t b){return a * b;});
+                    break;
+                case OpEqual:
+                    binary_kernel(l.data, l.kind, r.data, Bool, m, n, full, [](int64_t a, int64_t b) -> int64_t {return a == b;});
+                    break;
+                case OpGreaterThan:
+                    binary_kernel(l.data, l.kind, r.data, Bool, m, n, full, [](int64_t a, int64_t b) -> int64_t {return a > b;});
+                    break;
+                case OpGreaterEqual:
+                    binary_kernel(l.data, l.kind, r.data, Bool, m, n, full, [](int64_t a, int64_t b) -> int64_t {return a >= b;});
+                    break;
+                default:
+                    // No SIMD integer division: stay scalar and leave masked lanes alone
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        if (m[i])
+                        {
+                            if (r.data[i] == 0)
+                            {
+                                throw invalid_value("Division by zero in lane " + std::to_string(i));
+                            }
+                            l.data[i] /= r.data[i];
+                        }
+                    }
+            }
+            return next;
+        }
+        case OpUnaryMinus:
+        {
+            auto v = slot(sp - 1);
+            require_ints(v.kind, v.kind, m, n);
+            binary_kernel(v.data, v.kind, v.data, Int, m, n, full, [](int64_t a, int64_t){return -a;});
+            return next;
+        }
+        case OpBang:
+        {
+            auto v = slot(sp - 1);
+            for (size_t i = 0; i < n; ++i)
+            {
+                auto negated = static_cast<int64_t>(!(v.kind[i] == Bool && v.data[i] == 1));
+                v.data[i] = m[i] ? negated : v.data[i];
+                v.kind[i] = m[i] ? static_cast<uint8_t>(Bool) : v.kind[i];
+            }
+            return next;
+        }
+        case OpJump:
+            return pc + read_operand<OpJump>(instructions, pc);
+        case OpJumpFalse:
+        {
+            auto cond = slot(sp - 1);
+            const auto target = pc + read_operand<OpJumpFalse>(instructions, pc);
+            size_t active = 0;
+            size_t jumping = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                active += m[i];
+                jumping += m[i] & (cond.kind[i] == Bool) & (cond.data[i] == 0);
+            }
+            if (jumping == 0)
+            {
+                return next;
+            } else if (jumping == active)
+            {
+                return target;
+            }
+            for (size_t i = 0; i < n; ++i)
+            {
+                auto jumps = cond.kind[i] == Bool && cond.data[i] == 0;
+                lane_pc[i] = m[i] ? (jumps ? target : next) : lane_pc[i];
+            }
+            return -1;
+        }
+        case OpReadGlobal:
+        {
+            const auto idx = read_operand<OpReadGlobal>(instructions, pc);
+            const auto* defined = global_defined.data() + idx * n;
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (m[i] && !defined[i])
+                {
+                    throw global_index_too_large_exception();
+                }
+            }
+            auto src = global_column(idx);
+            auto dst = slot(sp);
+            copy_kernel(dst.data, dst.kind, src.data, src.kind, m, n, full);
+            return next;
+        }
+        case OpWriteGlobal:
+        {
+            const auto idx = read_operand<OpWriteGlobal>(instructions, pc);
+            // As in the scalar VM, a write appends at most one global: the one before it must exist
+            if (idx > 0)
+            {
+                const auto* previous = global_defined.data() + (idx - 1) * n;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    if (m[i] && !previous[i])
+                    {
+                        throw global_index_too_large_exception();
+                    }
+                }
+            }
+            auto src = slot(sp - 1);
+            auto dst = global_column(idx);
+            copy_kernel(dst.data, dst.kind, src.data, src.kind, m, n, full);
+            auto* defined = global_defined.data() + idx * n;
+            for (size_t i = 0; i < n; ++i)
+            {
+                defined[i] |= m[i];
+            }
+            return next;
+        }
+        default:
+            throw not_implemented("Batch execution does not support " + std::string(opDefinitions[op].opName));
+    }
+}
+
+Value B_BatchVM::global(size_t lane, size_t idx) const
+{
+    const auto cell = idx * num_lanes + lane;
+    if (idx >= static_cast<size_t>(num_globals) || !global_defined[cell])
+    {
+        throw global_index_too_large_exception();
+    }
+    if (global_kind[cell] == Bool)
+    {
+        return Value{global_data[cell] != 0};
+    }
+    return Value{global_data[cell]};
+}
+
+std::vector<Value> B_BatchVM::globals(size_t lane) const
+{
+    std::vector<Value> values;
+    for (int64_t g = 0; g < num_globals && global_defined[g * num_lanes + lane]; ++g)
+    {
+        values.push_back(global(lane, g));
+    }
+    return values;
+}
+
+Value B_BatchVM::top(size_t lane) const
+{
+    if (final_sp < 1)
+    {
+        throw empty_stack_exception();
+    }
+    const auto cell = (final_sp - 1) * num_lanes + lane;
+    if (stack_kind[cell] == Bool)
+    {
+        return Value{stack_data[cell] != 0};
+    }
+    return Value{stack_data[cell]};
+}
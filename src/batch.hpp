@@ -0,0 +1,77 @@
+/**
+ * Lockstep execution of one ByteCode over a batch of inputs.
+ *
+ * Every lane runs the same program against its own globals. Stack slots and globals are stored
+ * as structure-of-arrays columns, one element per lane, so arithmetic and comparisons run as
+ * vectorizable loops across lanes. Lanes that take different branches are handled with masks:
+ * the lanes sitting at the lowest pc execute together while the others wait to reconverge.
+ *
+ * Only programs over integers and booleans are supported; the constructor throws not_implemented
+ * for anything else so callers can fall back to the scalar VM.
+*/
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "vm.hpp"
+
+class B_BatchVM
+{
+    public:
+    B_BatchVM(const ByteCode& bc);
+
+    // True when `bc` only uses instructions and values the batch interpreter supports
+    static bool supports(const ByteCode& bc);
+
+    // Run the program once per lane, lane i starting with `inputs[i]` as its globals
+    void run(const std::vector<std::vector<Value>>& inputs);
+
+    size_t lanes() const {return num_lanes;}
+    Value global(size_t lane, size_t idx) const;
+    std::vector<Value> globals(size_t lane) const;
+    // Value on top of the stack of `lane` once the program ended
+    Value top(size_t lane) const;
+    int64_t sp() const {return final_sp;}
+
+    private:
+    enum Kind : uint8_t
+    {
+        Int = 0,
+        Bool = 1,
+    };
+
+    struct Column
+    {
+        int64_t* data;
+        uint8_t* kind;
+    };
+
+    void verify();
+    Column slot(int64_t idx);
+    Column global_column(int64_t idx);
+    // Execute the instruction at `pc` for the lanes in `mask`. Returns the next pc when every
+    // lane agrees on it, -1 when a branch diverged and the next pcs were written to `lane_pc`.
+    int64_t step(int64_t pc, bool full);
+
+    std::vector<unsigned char> instructions;
+    std::vector<Value> constants;
+    // Stack depth before the instruction at each offset, the same for every lane
+    std::vector<int32_t> depth_at;
+    int64_t max_depth;
+    int64_t num_globals;
+
+    size_t num_lanes;
+    std::vector<int64_t> stack_data;
+    std::vector<uint8_t> stack_kind;
+    std::vector<int64_t> global_data;
+    std::vector<uint8_t> global_kind;
+    std::vector<uint8_t> global_defined;
+
+    std::vector<uint8_t> mask;
+    std::vector<int64_t> lane_pc;
+    int64_t final_sp;
+};
+
+#endif
@@ -1,6 +1,6 @@
 #include <algorithm>
 #include <bit>
-#include <iostream>
+#include <limits>
 
 #include "../include/code.hpp"
 
@@ -11,22 +11,91 @@ std::vector<unsigned char> make(Operation op)
 
 std::vector<unsigned char> make(Operation op, int16_t arg)
 {
-    auto bytes = std::vector<unsigned char>{static_cast<unsigned char>(op)};
-    std::cout << "arg: " << arg << "\n";
+    static_assert(short_operand_width == sizeof(int16_t));
+    if (opDefinitions[op].numOperands == 0)
+    {
+        return make(op);
+    }
+    const auto op_bytes = WriteInt16(arg);
+    return std::vector<unsigned char>{static_cast<unsigned char>(op), op_bytes[0], op_bytes[1]};
+}
+
+std::vector<unsigned char> make_wide(Operation op, int32_t arg)
+{
+    static_assert(wide_operand_width == sizeof(int32_t));
+    const auto op_bytes = WriteInt32(arg);
+    return {static_cast<unsigned char>(OpWide), static_cast<unsigned char>(op), op_bytes[0], op_bytes[1], op_bytes[2], op_bytes[3]};
+}
 
-    auto def = opDefinitions[op];
-    auto offset = 1;
-    auto bytes_it = bytes.begin();
-    switch(def.operandsWidth[0])
+std::vector<unsigned char> make_sized(Operation op, int32_t arg)
+{
+    if (arg >= std::numeric_limits<int16_t>::min() && arg <= std::numeric_limits<int16_t>::max())
     {
-        case 2:
-        auto op_bytes = WriteInt16(arg);
-        std::cout << "while writing, bytes: " << (int) op_bytes[0] << ", " << (int) op_bytes[1] << "\n";
-        bytes.insert(bytes_it + offset, op_bytes.begin(), op_bytes.end());
-        offset = 2;
+        return make(op, static_cast<int16_t>(arg));
     }
+    return make_wide(op, arg);
+}
 
-    return bytes;
+int64_t instruction_width(const std::vector<unsigned char>& instructions, size_t offset)
+{
+    const auto wide = instructions[offset] == OpWide && offset + 1 < instructions.size();
+    return instruction_width(instructions[offset + (wide ? 1 : 0)], wide);
+}
+
+int32_t read_operand(const std::vector<unsigned char>& instructions, size_t offset)
+{
+    if (instructions[offset] == OpWide)
+    {
+        return ReadInt32({instructions[offset+2], instructions[offset+3], instructions[offset+4], instructions[offset+5]});
+    }
+    return ReadInt16({instructions[offset+1], instructions[offset+2]});
+}
+
+void write_operand(std::vector<unsigned char>& instructions, size_t offset, int32_t value)
+{
+    if (instructions[offset] == OpWide)
+    {
+        const auto bytes = WriteInt32(value);
+        std::copy(bytes.begin(), bytes.end(), instructions.begin() + offset + 2);
+    } else
+    {
+        const auto bytes = WriteInt16(static_cast<int16_t>(value));
+        std::copy(bytes.begin(), bytes.end(), instructions.begin() + offset + 1);
+    }
+}
+
+std::string disassemble(const std::vector<unsigned char>& instructions)
+{
+    std::string out;
+    for (size_t offset = 0; offset < instructions.size();)
+    {
+        const auto wide = instructions[offset] == OpWide && offset + 1 < instructions.size();
+        const auto op = instructions[offset + (wide ? 1 : 0)];
+        const auto& def = opDefinitions[op];
+        const auto width = static_cast<size_t>(instruction_width(instructions, offset));
+        auto position = std::to_string(offset);
+        out += std::string(std::max<int>(4 - static_cast<int>(position.size()), 0), '0') + position + " ";
+        out += wide ? "OpWide " : "";
+        if (def.opName.empty())
+        {
+            out.append("<unknown ").append(std::to_string(op)).append(">");
+        } else
+        {
+            out += def.opName;
+        }
+        if (offset + width > instructions.size())
+        {
+            out += " <truncated>\n";
+            break;
+        }
+        if (def.numOperands > 0)
+        {
+            out.append(" ").append(std::to_string(read_operand(instructions, offset)));
+        }
+        out += "\n";
+        offset += width;
+    }
+    return out;
 }
 
 std::array<unsigned char, 2> WriteInt16(int16_t value){
@@ -55,6 +124,24 @@ int16_t ReadInt16(std::array<unsigned char, 2> bytes)
     return value;
 }
 
+std::array<unsigned char, 4> WriteInt32(int32_t value)
+{
+    const auto bits = static_cast<uint32_t>(value);
+    return {
+        static_cast<unsigned char>(bits >> 24),
+        static_cast<unsigned char>(bits >> 16),
+        static_cast<unsigned char>(bits >> 8),
+        static_cast<unsigned char>(bits),
+    };
+}
+
+int32_t ReadInt32(std::array<unsigned char, 4> bytes)
+{
+    const auto bits = static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16
+        | static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]);
+    return static_cast<int32_t>(bits);
+}
+
 constexpr inline bool is_system_little_endian()
 {
     const int value { 0x01 };
@@ -0,0 +1,320 @@
+/**
+ * Bulk collection operations over arrays: map, filter, reduce, sort and binary search.
+ *
+ * Arrays at least VM::parallel_threshold long are split in chunks run on the VM thread pool.
+ * Objects created by a chunk go into a chunk-local B_Allocator that the VM allocator adopts
+ * once every chunk joined, so the collector, which only runs between instructions, sees them all.
+*/
+#include <algorithm>
+#include <cmath>
+#include <optional>
+
+#include "vm.hpp"
+
+namespace
+{
+    // Elements of any kind of array, read as Values
+    struct Elements
+    {
+        const Value* values = nullptr;
+        const int64_t* ints = nullptr;
+        const _Float64* floats = nullptr;
+        size_t size = 0;
+
+        Value operator[](size_t i) const
+        {
+            if (values)
+            {
+                return values[i];
+            }
+            return ints ? Value{ints[i]} : Value{floats[i]};
+        }
+    };
+
+    Elements elements_of(const Value& v, Operation op)
+    {
+        auto* const* obj = std::get_if<B_Object*>(&v);
+        if (auto* slice = obj != nullptr ? dynamic_cast<B_Slice*>(*obj) : nullptr; slice != nullptr && as_string_view(v) == std::nullopt)
+        {
+            auto elements = elements_of(Value{slice->parent}, op);
+            return Elements{
+                elements.values ? elements.values + slice->offset : nullptr,
+                elements.ints ? elements.ints + slice->offset : nullptr,
+                elements.floats ? elements.floats + slice->offset : nullptr,
+                slice->length,
+            };
+        } else if (obj != nullptr)
+        {
+            if (auto* array = dynamic_cast<B_Array*>(*obj))
+            {
+                return Elements{array->values.data(), nullptr, nullptr, array->values.size()};
+            } else if (auto* ints = dynamic_cast<B_IntArray*>(*obj))
+            {
+                return Elements{nullptr, ints->values.data(), nullptr, ints->values.size()};
+            } else if (auto* floats = dynamic_cast<B_FloatArray*>(*obj))
+            {
+                return Elements{nullptr, nullptr, floats->values.data(), floats->values.size()};
+            }
+        }
+        throw invalid_value("Found a value that is not an array in " + std::string(opDefinitions[op].opName));
+    }
+
+    Value apply(Operation op, const Value& left, const Value& right, B_Allocator& allocator)
+    {
+        switch (op)
+        {
+            case OpAdd:
+            case OpSub:
+            case OpMul:
+            case OpDiv:
+                return binaryOp(op, left, right, allocator);
+            case OpEqual:
+            case OpGreaterThan:
+            case OpGreaterEqual:
+                return binaryComparison(op, left, right);
+            default:
+                throw invalid_instruction("Found instruction " + std::string(opDefinitions[op].opName) + " as a built-in operator");
+        }
+    }
+
+    bool is_number(const Value& v)
+    {
+        return std::holds_alternative<int64_t>(v) || std::holds_alternative<_Float64>(v);
+    }
+
+    // Order of floats with every NaN after the numbers, so that sorts see a strict weak ordering
+    bool float_less(_Float64 l, _Float64 r)
+    {
+        return std::isnan(r) ? !std::isnan(l) : l < r;
+    }
+
+    // Order of numbers, integers and floats mixed, and of strings, slices included. check_sortable rules out the rest.
+    bool value_less(const Value& l, const Value& r)
+    {
+        if (auto *li = std::get_if<int64_t>(&l), *ri = std::get_if<int64_t>(&r); li && ri)
+        {
+            return *li < *ri;
+        } else if (is_number(l) && is_number(r))
+        {
+            auto as_float = [](const Value& v){
+                return std::holds_alternative<int64_t>(v) ? static_cast<_Float64>(std::get<int64_t>(v)) : std::get<_Float64>(v);
+            };
+            return float_less(as_float(l), as_float(r));
+        }
+        return *as_string_view(l) < *as_string_view(r);
+    }
+
+    void check_sortable(const Elements& elements, Operation op)
+    {
+        if (elements.values == nullptr)
+        {
+            return;
+        }
+        const auto numbers = std::all_of(elements.values, elements.values + elements.size, is_number);
+        const auto strings = std::all_of(elements.values, elements.values + elements.size, [](const Value& v){
+            return as_string_view(v).has_value();
+        });
+        if (!numbers && !strings)
+        {
+            throw invalid_value(std::string(opDefinitions[op].opName) + " needs an array of numbers or an array of strings");
+        }
+    }
+
+    /**
+     * Sort the chunks in parallel, then merge adjacent runs pairwise, each round in parallel.
+    */
+    template <typename T, typename Less>
+    void parallel_sort(std::vector<T>& values, size_t chunks, B_ThreadPool& pool, Less less)
+    {
+        const auto n = values.size();
+        chunks = std::clamp<size_t>(chunks, 1, std::max<size_t>(n, 1));
+        if (chunks == 1)
+        {
+            std::sort(values.begin(), values.end(), less);
+            return;
+        }
+        const auto chunk_size = (n + chunks - 1) / chunks;
+        std::vector<size_t> bounds;
+        for (size_t c = 0; c <= chunks; ++c)
+        {
+            bounds.push_back(std::min(n, c * chunk_size));
+        }
+        pool.parallel_for(chunks, chunks, [&](size_t begin, size_t end, size_t){
+            for (auto c = begin; c < end; ++c)
+            {
+                std::sort(values.begin() + bounds[c], values.begin() + bounds[c + 1], less);
+            }
+        });
+        for (size_t width = 1; width < chunks; width *= 2)
+        {
+            const auto pairs = (chunks + 2 * width - 1) / (2 * width);
+            pool.parallel_for(pairs, pairs, [&](size_t begin, size_t end, size_t){
+                for (auto p = begin; p < end; ++p)
+                {
+                    const auto first = bounds[2 * p * width];
+                    const auto middle = bounds[std::min((2 * p + 1) * width, chunks)];
+                    const auto last = bounds[std::min((2 * p + 2) * width, chunks)];
+                    std::inplace_merge(values.begin() + first, values.begin() + middle, values.begin() + last, less);
+                }
+            });
+        }
+    }
+}
+
+size_t VM::chunkCount(size_t n) const
+{
+    // The calling thread runs a chunk too
+    return n < parallel_threshold ? 1 : pool->num_threads() + 1;
+}
+
+void VM::forEachChunk(size_t n, const std::function<void(size_t, size_t, size_t, B_Allocator&)>& fn)
+{
+    const auto chunks = chunkCount(n);
+    if (chunks == 1)
+    {
+        fn(0, n, 0, *bgc.allocator);
+        return;
+    }
+    std::vector<B_Allocator> locals(chunks);
+    pool->parallel_for(n, chunks, [&](size_t begin, size_t end, size_t chunk){
+        fn(begin, end, chunk, locals[chunk]);
+    });
+    for (auto& local: locals)
+    {
+        bgc.allocator->adopt(local);
+    }
+}
+
+void VM::executeCollectionOp(Operation op, int32_t operand)
+{
+    const auto builtin = static_cast<Operation>(operand);
+    switch (op)
+    {
+        case OpArrayMap:
+        {
+            const auto scalar = pop();
+            const auto elements = elements_of(pop(), op);
+            std::vector<Value> result(elements.size);
+            forEachChunk(elements.size, [&](size_t begin, size_t end, size_t, B_Allocator& allocator){
+                for (auto i = begin; i < end; ++i)
+                {
+                    result[i] = apply(builtin, elements[i], scalar, allocator);
+                }
+            });
+            push(makeArray(result.data(), result.data() + result.size()));
+            break;
+        }
+        case OpArrayFilter:
+        {
+            const auto scalar = pop();
+            const auto elements = elements_of(pop(), op);
+            std::vector<std::vector<Value>> kept(chunkCount(elements.size));
+            forEachChunk(elements.size, [&](size_t begin, size_t end, size_t chunk, B_Allocator& allocator){
+                for (auto i = begin; i < end; ++i)
+                {
+                    if (apply(builtin, elements[i], scalar, allocator) == Value{true})
+                    {
+                        kept[chunk].push_back(elements[i]);
+                    }
+                }
+            });
+            std::vector<Value> result;
+            for (auto& part: kept)
+            {
+                result.insert(result.end(), part.begin(), part.end());
+            }
+            push(makeArray(result.data(), result.data() + result.size()));
+            break;
+        }
+        case OpArrayReduce:
+        {
+            if (builtin != OpAdd && builtin != OpMul)
+            {
+                throw invalid_value(std::string(opDefinitions[op].opName) + " needs an associative operator, found " + std::string(opDefinitions[builtin].opName));
+            }
+            const auto initial = pop();
+            const auto elements = elements_of(pop(), op);
+            // Each chunk folds its own range, then the partial results are folded in order
+            std::vector<std::optional<Value>> partials(chunkCount(elements.size));
+            forEachChunk(elements.size, [&](size_t begin, size_t end, size_t chunk, B_Allocator& allocator){
+                if (begin == end)
+                {
+                    return;
+                }
+                auto acc = elements[begin];
+                for (auto i = begin + 1; i < end; ++i)
+                {
+                    acc = apply(builtin, acc, elements[i], allocator);
+                }
+                partials[chunk] = acc;
+            });
+            auto acc = initial;
+            for (auto& partial: partials)
+            {
+                if (partial)
+                {
+                    acc = apply(builtin, acc, *partial, *bgc.allocator);
+                }
+            }
+            push(acc);
+            break;
+        }
+        case OpArraySort:
+        {
+            auto array = pop();
+            const auto elements = elements_of(array, op);
+            check_sortable(elements, op);
+            const auto chunks = chunkCount(elements.size);
+            if (elements.ints)
+            {
+                std::vector<int64_t> values(elements.ints, elements.ints + elements.size);
+                parallel_sort(values, chunks, *pool, std::less<int64_t>{});
+                push(bgc.allocator->alloc(std::move(values)));
+            } else if (elements.floats)
+            {
+                std::vector<_Float64> values(elements.floats, elements.floats + elements.size);
+                parallel_sort(values, chunks, *pool, float_less);
+                push(bgc.allocator->alloc(std::move(values)));
+            } else
+            {
+                std::vector<Value> values(elements.values, elements.values + elements.size);
+                parallel_sort(values, chunks, *pool, value_less);
+                push(bgc.allocator->alloc(values.data(), values.data() + values.size()));
+            }
+            break;
+        }
+        case OpArrayBinarySearch:
+        {
+            const auto needle = pop();
+            const auto elements = elements_of(pop(), op);
+            check_sortable(elements, op);
+            if (!is_number(needle) && !as_string_view(needle))
+            {
+                throw invalid_value(std::string(opDefinitions[op].opName) + " needs a number or a string to look for");
+            }
+            if (elements.size == 0 || is_number(elements[0]) != is_number(needle))
+            {
+                push(Value{int64_t{-1}});
+                break;
+            }
+            size_t low = 0;
+            size_t high = elements.size;
+            while (low < high)
+            {
+                const auto middle = low + (high - low) / 2;
+                if (value_less(elements[middle], needle))
+                {
+                    low = middle + 1;
+                } else
+                {
+                    high = middle;
+                }
+            }
+            const auto found = low < elements.size && !value_less(needle, elements[low]);
+            push(Value{found ? static_cast<int64_t>(low) : int64_t{-1}});
+            break;
+        }
+        default:
+            throw invalid_instruction("Found instruction " + std::string(opDefinitions[op].opName));
+    }
+}
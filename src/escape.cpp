@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <set>
+
+#include "escape.hpp"
+
+namespace
+{
+    // Collections with more stack values are left alone, since their elements would stay on the stack
+    constexpr int16_t max_elided_values = 32;
+
+    struct B_Decoded
+    {
+        size_t offset;
+        // The instruction after the OpWide prefix, if any
+        unsigned char op;
+        int32_t operand;
+        size_t width;
+    };
+
+    std::vector<B_Decoded> decode(const std::vector<unsigned char>& instructions)
+    {
+        std::vector<B_Decoded> decoded;
+        for (size_t offset = 0; offset < instructions.size();)
+        {
+            const auto wide = instructions[offset] == OpWide && offset + 1 < instructions.size();
+            const auto op = instructions[offset + (wide ? 1 : 0)];
+            const auto width = static_cast<size_t>(instruction_width(instructions, offset));
+            int32_t operand = 0;
+            if (opDefinitions[op].numOperands > 0 && offset + width <= instructions.size())
+            {
+                operand = read_operand(instructions, offset);
+            }
+            decoded.push_back(B_Decoded{offset, op, operand, width});
+            offset += width;
+        }
+        return decoded;
+    }
+
+    // Offsets where a block starts: jump targets, the instructions after control transfers, function entries
+    std::set<size_t> block_starts(const std::vector<B_Decoded>& decoded, const std::vector<Value>& constants)
+    {
+        std::set<size_t> starts {0};
+        for (const auto& ins: decoded)
+        {
+            if (ins.op == OpJump || ins.op == OpJumpFalse)
+            {
+                starts.insert(ins.offset + ins.operand);
+            }
+            if (ins.op == OpJump || ins.op == OpJumpFalse || ins.op == OpReturn || ins.op == OpTailCall)
+            {
+                starts.insert(ins.offset + ins.width);
+            }
+        }
+        for (const auto& constant: constants)
+        {
+            auto* const* obj = std::get_if<B_Object*>(&constant);
+            if (auto* function = obj != nullptr ? dynamic_cast<B_Function*>(*obj) : nullptr)
+            {
+                starts.insert(function->entry);
+            }
+        }
+        return starts;
+    }
+
+    // Values popped and pushed by instructions whose effect does not depend on the VM, or nullopt
+    std::optional<std::pair<int, int>> stack_effect(const B_Decoded& ins)
+    {
+        switch (ins.op)
+        {
+            case OpArray:
+            case OpHash:
+                return std::pair{static_cast<int>(ins.operand), 1};
+            case OpCall:
+                // The callee and its arguments make way for the result
+                return std::pair{ins.operand + 1, 1};
+            default:
+            {
+                const auto& def = opDefinitions[ins.op];
+                if (def.opName.empty() || def.pops == variable_effect || def.pushes == variable_effect)
+                {
+                    return std::nullopt;
+                }
+                return std::pair{def.pops, def.pushes};
+            }
+        }
+    }
+
+    /**
+     * Simulate the stack of each block, tracking which slots hold the result of a collection instruction.
+     * Return the collection instructions whose result is consumed by an OpIndex alone, with that OpIndex,
+     * as positions in `decoded`.
+    */
+    std::map<size_t, size_t> find_temporaries(const std::vector<B_Decoded>& decoded, const std::set<size_t>& starts)
+    {
+        // Producer of each simulated slot: an index into `decoded`, or -1 for any other value
+        std::vector<int64_t> stack;
+        std::map<size_t, size_t> temporaries;
+        auto escape_all = [&]{stack.clear();};
+        for (size_t i = 0; i < decoded.size(); ++i)
+        {
+            const auto& ins = decoded[i];
+            if (starts.contains(ins.offset))
+            {
+                // Collections still on the stack live across blocks
+                escape_all();
+            }
+            const auto effect = stack_effect(ins);
+            if (!effect)
+            {
+                escape_all();
+                continue;
+            }
+            int64_t indexed = -1;
+            for (auto k = 0; k < effect->first; ++k)
+            {
+                const auto producer = stack.empty() ? -1 : stack.back();
+                if (!stack.empty())
+                {
+                    stack.pop_back();
+                }
+                // The collection operand of OpIndex sits right below the index
+                if (ins.op == OpIndex && k == 1)
+                {
+                    indexed = producer;
+                }
+            }
+            if (indexed >= 0)
+            {
+                temporaries.emplace(indexed, i);
+            }
+            for (auto k = 0; k < effect->second; ++k)
+            {
+                const auto candidate = (ins.op == OpArray || (ins.op == OpHash && ins.operand % 2 == 0))
+                    && ins.operand >= 0 && ins.operand <= max_elided_values;
+                stack.push_back(candidate ? static_cast<int64_t>(i) : -1);
+            }
+            if (ins.op == OpJump || ins.op == OpJumpFalse)
+            {
+                escape_all();
+            }
+        }
+        return temporaries;
+    }
+}
+
+B_EscapeStats elide_temporaries(ByteCode& code)
+{
+    const auto decoded = decode(code.instructions);
+    const auto temporaries = find_temporaries(decoded, block_starts(decoded, code.constants));
+    // The OpIndex of each temporary, with the instruction replacing it
+    std::map<size_t, std::vector<unsigned char>> selects;
+    B_EscapeStats stats;
+    for (const auto& [collection, index]: temporaries)
+    {
+        const auto& ins = decoded[collection];
+        if (ins.op == OpArray)
+        {
+            selects.emplace(index, make(OpSelect, ins.operand));
+            ++stats.arrays;
+        } else
+        {
+            selects.emplace(index, make(OpSelectKey, ins.operand));
+            ++stats.hashes;
+        }
+    }
+    if (temporaries.empty())
+    {
+        return stats;
+    }
+
+    // New offset of each old instruction, and of the end of the code
+    std::vector<int64_t> relocated(code.instructions.size() + 1, 0);
+    std::vector<unsigned char> instructions;
+    for (size_t i = 0; i < decoded.size(); ++i)
+    {
+        const auto& ins = decoded[i];
+        relocated[ins.offset] = static_cast<int64_t>(instructions.size());
+        if (temporaries.contains(i))
+        {
+            continue;
+        }
+        if (auto select = selects.find(i); select != selects.end())
+        {
+            instructions.insert(instructions.end(), select->second.begin(), select->second.end());
+        } else
+        {
+            const auto end = std::min(ins.offset + ins.width, code.instructions.size());
+            instructions.insert(instructions.end(), code.instructions.begin() + ins.offset, code.instructions.begin() + end);
+        }
+    }
+    relocated[code.instructions.size()] = static_cast<int64_t>(instructions.size());
+
+    for (const auto& ins: decoded)
+    {
+        if (ins.op != OpJump && ins.op != OpJumpFalse)
+        {
+            continue;
+        }
+        const auto from = relocated[ins.offset];
+        const auto distance = relocated[ins.offset + ins.operand] - from;
+        write_operand(instructions, from, static_cast<int32_t>(distance));
+    }
+    for (const auto& constant: code.constants)
+    {
+        auto* const* obj = std::get_if<B_Object*>(&constant);
+        auto* function = obj != nullptr ? dynamic_cast<B_Function*>(*obj) : nullptr;
+        if (function != nullptr && function->entry >= 0 && function->entry < static_cast<int64_t>(relocated.size()))
+        {
+            function->entry = relocated[function->entry];
+        }
+    }
+    code.instructions = std::move(instructions);
+    return stats;
+}
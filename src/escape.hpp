@@ -0,0 +1,37 @@
+/**
+ * Escape analysis of temporary collections.
+ *
+ * An OpArray or OpHash whose result is only ever the collection operand of one OpIndex, as in
+ * `[a, b, c][i]` or `{"k": v}["k"]`, allocates an object that is garbage right after the lookup.
+ * The pass finds them by simulating the stack of each basic block, and rewrites them:
+ * the collection instruction goes away, so its elements stay in their stack slots, and the OpIndex
+ * becomes OpSelect (arrays) or OpSelectKey (hashes), which read the element straight from there.
+ *
+ * A collection escapes, and is left alone, when anything else consumes it: a global or a local,
+ * another collection, a call, a comparison, the end of its block or of the program. Instructions
+ * whose stack effect depends on the VM, as host and native calls, end the simulation conservatively.
+ *
+ * Lookups in elided hashes check the keys when they run, after the index is computed, rather than
+ * when the hash is built: a program that fails on an unhashable key fails one expression later.
+*/
+#ifndef ESCAPE_HPP
+#define ESCAPE_HPP
+
+#include <cstddef>
+
+#include "vm.hpp"
+
+struct B_EscapeStats
+{
+    // Collection sites rewritten, each one an allocation less every time it runs
+    size_t arrays {0};
+    size_t hashes {0};
+};
+
+/**
+ * Rewrite the temporary collections of `code` and relocate the jumps and the entries of the functions
+ * among its constants, which are updated in place. Run it before the VM executes the code.
+*/
+B_EscapeStats elide_temporaries(ByteCode& code);
+
+#endif
@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+#include "heapdump.hpp"
+
+namespace
+{
+    constexpr char magic[] = {'B', 'H', 'D', '1'};
+    constexpr uint32_t none = UINT32_MAX;
+
+    void write_varint(std::ostream& out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.put(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        out.put(static_cast<char>(v));
+    }
+
+    uint64_t read_varint(std::istream& in)
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            const auto c = in.get();
+            if (c == std::istream::traits_type::eof())
+            {
+                throw heap_dump_exception("Truncated heap dump");
+            }
+            v |= static_cast<uint64_t>(c & 0x7f) << shift;
+            if ((c & 0x80) == 0)
+            {
+                return v;
+            }
+        }
+        throw heap_dump_exception("Malformed varint in heap dump");
+    }
+
+    // Call fn on each object referenced by obj
+    template <typename F>
+    void for_each_reference(const B_Object* obj, F&& fn)
+    {
+        const auto visit = [&](const Value& v){
+            if (auto* ptr = std::get_if<B_Object*>(&v); ptr != nullptr && *ptr != nullptr)
+            {
+                fn(*ptr);
+            }
+        };
+        if (auto* slice = dynamic_cast<const B_Slice*>(obj))
+        {
+            fn(slice->parent);
+        } else if (auto* array = dynamic_cast<const B_Array*>(obj))
+        {
+            std::for_each(array->values.begin(), array->values.end(), visit);
+        } else if (auto* record = dynamic_cast<const B_Record*>(obj))
+        {
+            std::for_each(record->values.begin(), record->values.end(), visit);
+        } else if (auto* vector = dynamic_cast<const B_PVector*>(obj))
+        {
+            vector->values.for_each(visit);
+        } else if (auto* map = dynamic_cast<const B_PMap*>(obj))
+        {
+            map->values.for_each([&](const Value& key, const Value& value){
+                visit(key);
+                visit(value);
+            });
+        } else if (auto* hash = dynamic_cast<const B_HashMap*>(obj))
+        {
+            for (const auto& [_, pair]: hash->values)
+            {
+                visit(pair.key);
+                visit(pair.value);
+            }
+        }
+    }
+}
+
+void write_heap_dump(std::ostream& out, const B_Allocator& allocator, const std::vector<std::span<const Value>>& roots)
+{
+    std::vector<const B_Object*> objects(allocator.memory.begin(), allocator.memory.end());
+    std::unordered_map<const B_Object*, uint32_t> ids;
+    ids.reserve(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        ids.emplace(objects[i], static_cast<uint32_t>(i));
+    }
+    const auto id_of = [&](const B_Object* obj){
+        auto [it, inserted] = ids.try_emplace(obj, static_cast<uint32_t>(objects.size()));
+        if (inserted)
+        {
+            objects.push_back(obj);
+        }
+        return it->second;
+    };
+
+    std::vector<uint32_t> root_ids;
+    for (const auto& values: roots)
+    {
+        for (const auto& v: values)
+        {
+            if (auto* ptr = std::get_if<B_Object*>(&v); ptr != nullptr && *ptr != nullptr)
+            {
+                root_ids.push_back(id_of(*ptr));
+            }
+        }
+    }
+
+    // Objects of other allocators are appended as they are found, so the loop reaches them too
+    B_HeapGraph graph;
+    std::vector<uint32_t> targets;
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        targets.clear();
+        for_each_reference(objects[i], [&](const B_Object* target){targets.push_back(id_of(target));});
+        graph.add_object(objects[i]->kind(), objects[i]->bytes(), targets);
+    }
+
+    out.write(magic, sizeof(magic));
+    write_varint(out, graph.size());
+    write_varint(out, root_ids.size());
+    for (auto id: root_ids)
+    {
+        write_varint(out, id);
+    }
+    for (size_t i = 0; i < graph.size(); ++i)
+    {
+        out.put(static_cast<char>(graph.kinds[i]));
+        write_varint(out, graph.sizes[i]);
+        write_varint(out, graph.edge_offsets[i + 1] - graph.edge_offsets[i]);
+        for (auto e = graph.edge_offsets[i]; e < graph.edge_offsets[i + 1]; ++e)
+        {
+            write_varint(out, graph.edges[e]);
+        }
+    }
+}
+
+void B_HeapGraph::add_object(B_Kind kind, uint64_t size, const std::vector<uint32_t>& targets)
+{
+    kinds.push_back(kind);
+    sizes.push_back(size);
+    edges.insert(edges.end(), targets.begin(), targets.end());
+    edge_offsets.push_back(edges.size());
+}
+
+B_HeapGraph B_HeapGraph::read(std::istream& in)
+{
+    char header[sizeof(magic)];
+    if (!in.read(header, sizeof(header)) || std::memcmp(header, magic, sizeof(magic)) != 0)
+    {
+        throw heap_dump_exception("Not a heap dump");
+    }
+    B_HeapGraph graph;
+    const auto object_count = read_varint(in);
+    if (object_count >= none)
+    {
+        throw heap_dump_exception("Too many objects in heap dump");
+    }
+    const auto check_id = [&](uint64_t id){
+        if (id >= object_count)
+        {
+            throw heap_dump_exception("Object id out of range in heap dump");
+        }
+        return static_cast<uint32_t>(id);
+    };
+    graph.roots.resize(read_varint(in));
+    for (auto& root: graph.roots)
+    {
+        root = check_id(read_varint(in));
+    }
+    graph.kinds.reserve(object_count);
+    graph.sizes.reserve(object_count);
+    graph.edge_offsets.reserve(object_count + 1);
+    for (uint64_t i = 0; i < object_count; ++i)
+    {
+        const auto kind = in.get();
+        if (kind == std::istream::traits_type::eof() || kind >= static_cast<int>(B_Kind::Count))
+        {
+            throw heap_dump_exception("Bad object kind in heap dump");
+        }
+        graph.kinds.push_back(static_cast<B_Kind>(kind));
+        graph.sizes.push_back(read_varint(in));
+        const auto edge_count = read_varint(in);
+        for (uint64_t e = 0; e < edge_count; ++e)
+        {
+            graph.edges.push_back(check_id(read_varint(in)));
+        }
+        graph.edge_offsets.push_back(graph.edges.size());
+    }
+    return graph;
+}
+
+/**
+ * Lengauer-Tarjan with path compression, over the graph plus a virtual root pointing to all the roots.
+ * Vertices are renumbered in DFS preorder, the virtual root being 0; recursion is replaced by explicit stacks.
+*/
+B_Dominators dominators(const B_HeapGraph& graph)
+{
+    const auto n = static_cast<uint32_t>(graph.size());
+    const auto root = n;
+    const auto successors = [&](uint32_t v){
+        return v == root
+            ? std::span<const uint32_t>(graph.roots)
+            : std::span<const uint32_t>(graph.edges.data() + graph.edge_offsets[v], graph.edges.data() + graph.edge_offsets[v + 1]);
+    };
+
+    // Preorder numbering and DFS tree parents
+    std::vector<uint32_t> number(n + 1, none);
+    std::vector<uint32_t> vertex;
+    std::vector<uint32_t> parent;
+    vertex.reserve(n + 1);
+    parent.reserve(n + 1);
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> stack {{root, none}};
+        while (!stack.empty())
+        {
+            const auto [v, from] = stack.back();
+            stack.pop_back();
+            if (number[v] != none)
+            {
+                continue;
+            }
+            number[v] = static_cast<uint32_t>(vertex.size());
+            vertex.push_back(v);
+            parent.push_back(from);
+            const auto next = successors(v);
+            // Pushed in reverse so the children are visited in edge order
+            for (auto it = next.rbegin(); it != next.rend(); ++it)
+            {
+                if (number[*it] == none)
+                {
+                    stack.emplace_back(*it, number[v]);
+                }
+            }
+        }
+    }
+    const auto reached = static_cast<uint32_t>(vertex.size());
+
+    // Predecessors among the reached vertices, in preorder numbers
+    std::vector<uint64_t> pred_offsets(reached + 1, 0);
+    for (uint32_t w = 0; w < reached; ++w)
+    {
+        for (auto s: successors(vertex[w]))
+        {
+            ++pred_offsets[number[s] + 1];
+        }
+    }
+    std::partial_sum(pred_offsets.begin(), pred_offsets.end(), pred_offsets.begin());
+    std::vector<uint32_t> preds(pred_offsets.back());
+    {
+        auto fill = pred_offsets;
+        for (uint32_t w = 0; w < reached; ++w)
+        {
+            for (auto s: successors(vertex[w]))
+            {
+                preds[fill[number[s]]++] = w;
+            }
+        }
+    }
+
+    std::vector<uint32_t> semi(reached);
+    std::vector<uint32_t> label(reached);
+    std::vector<uint32_t> ancestor(reached, none);
+    std::vector<uint32_t> idom(reached, none);
+    // Buckets as linked lists: the vertices whose semidominator is v
+    std::vector<uint32_t> bucket_head(reached, none);
+    std::vector<uint32_t> bucket_next(reached, none);
+    for (uint32_t v = 0; v < reached; ++v)
+    {
+        semi[v] = v;
+        label[v] = v;
+    }
+
+    std::vector<uint32_t> path;
+    const auto eval = [&](uint32_t v){
+        if (ancestor[v] == none)
+        {
+            return v;
+        }
+        // Compress the path to the forest root, from its top down
+        path.clear();
+        for (auto x = v; ancestor[ancestor[x]] != none; x = ancestor[x])
+        {
+            path.push_back(x);
+        }
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+        {
+            const auto a = ancestor[*it];
+            if (semi[label[a]] < semi[label[*it]])
+            {
+                label[*it] = label[a];
+            }
+            ancestor[*it] = ancestor[a];
+        }
+        return label[v];
+    };
+
+    for (auto w = reached - 1; w > 0; --w)
+    {
+        for (auto e = pred_offsets[w]; e < pred_offsets[w + 1]; ++e)
+        {
+            const auto u = eval(preds[e]);
+            semi[w] = std::min(semi[w], semi[u]);
+        }
+        bucket_next[w] = bucket_head[semi[w]];
+        bucket_head[semi[w]] = w;
+        const auto p = parent[w];
+        ancestor[w] = p;
+        for (auto v = bucket_head[p]; v != none; v = bucket_next[v])
+        {
+            const auto u = eval(v);
+            idom[v] = semi[u] < semi[v] ? u : p;
+        }
+        bucket_head[p] = none;
+    }
+    for (uint32_t w = 1; w < reached; ++w)
+    {
+        if (idom[w] != semi[w])
+        {
+            idom[w] = idom[idom[w]];
+        }
+    }
+
+    B_Dominators result {std::vector<int64_t>(n, -2), std::vector<uint64_t>(n, 0)};
+    std::vector<uint64_t> retained(reached, 0);
+    // Children come after their dominator in preorder, so one backward pass sums the subtrees
+    for (auto w = reached - 1; w > 0; --w)
+    {
+        const auto v = vertex[w];
+        retained[w] += graph.sizes[v];
+        retained[idom[w]] += retained[w];
+        result.retained[v] = retained[w];
+        result.idom[v] = idom[w] == 0 ? -1 : static_cast<int64_t>(vertex[idom[w]]);
+    }
+    return result;
+}
+
+std::vector<B_Retainer> top_retainers(const B_HeapGraph& graph, const B_Dominators& dom, size_t count)
+{
+    std::vector<uint32_t> ids(graph.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    count = std::min(count, ids.size());
+    std::partial_sort(ids.begin(), ids.begin() + count, ids.end(), [&](uint32_t a, uint32_t b){
+        return dom.retained[a] != dom.retained[b] ? dom.retained[a] > dom.retained[b] : a < b;
+    });
+    std::vector<B_Retainer> result;
+    for (size_t i = 0; i < count; ++i)
+    {
+        result.push_back(B_Retainer{ids[i], graph.kinds[ids[i]], graph.sizes[ids[i]], dom.retained[ids[i]]});
+    }
+    return result;
+}
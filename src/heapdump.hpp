@@ -0,0 +1,80 @@
+/**
+ * Heap dumps and retainer analysis.
+ *
+ * A dump is the object graph seen by the collector: its roots and, for each object, its kind,
+ * shallow size (B_Object::bytes) and outgoing references. The file is compact and binary,
+ * every number after the magic is an unsigned LEB128 varint:
+ *
+ *     "BHD1" object_count root_count root_id... (kind shallow_size edge_count target_id...)...
+ *
+ * Ids are positions in the allocator memory; objects reachable but owned by another allocator,
+ * as the constants often are, are numbered after them.
+ *
+ * The analyzer reads a dump back into a compressed adjacency graph and computes the retained size
+ * of each object, the memory that would be freed with it, from the dominator tree of the graph.
+ * It is iterative and linear in memory, for heaps of tens of millions of objects.
+*/
+#ifndef HEAPDUMP_HPP
+#define HEAPDUMP_HPP
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "../include/object.hpp"
+
+// Write the objects of `allocator`, and those reachable from the roots, as a heap dump
+void write_heap_dump(std::ostream& out, const B_Allocator& allocator, const std::vector<std::span<const Value>>& roots);
+
+struct B_HeapGraph
+{
+    std::vector<B_Kind> kinds;
+    std::vector<uint64_t> sizes;
+    // Outgoing references of object i: edges[edge_offsets[i]] to edges[edge_offsets[i + 1]]
+    std::vector<uint64_t> edge_offsets {0};
+    std::vector<uint32_t> edges;
+    std::vector<uint32_t> roots;
+
+    size_t size() const {return kinds.size();}
+    void add_object(B_Kind kind, uint64_t size, const std::vector<uint32_t>& targets);
+
+    static B_HeapGraph read(std::istream& in);
+};
+
+/**
+ * Immediate dominator of each object: -1 when no single object dominates it, only the roots together,
+ * as for the roots themselves; -2 when it is unreachable. Unreachable objects retain nothing.
+*/
+struct B_Dominators
+{
+    std::vector<int64_t> idom;
+    std::vector<uint64_t> retained;
+};
+
+B_Dominators dominators(const B_HeapGraph& graph);
+
+struct B_Retainer
+{
+    uint32_t id;
+    B_Kind kind;
+    uint64_t shallow;
+    uint64_t retained;
+};
+
+// The `count` objects retaining the most memory, largest first
+std::vector<B_Retainer> top_retainers(const B_HeapGraph& graph, const B_Dominators& dom, size_t count);
+
+class heap_dump_exception
+{
+  std::string message;
+
+  public:
+  heap_dump_exception(std::string msg) : message(msg) {};
+  std::string what() {return message;}
+};
+
+#endif
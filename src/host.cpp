@@ -0,0 +1,89 @@
+#include "host.hpp"
+
+B_HostResult::B_HostResult()
+: state(std::make_shared<State>())
+{
+}
+
+B_HostResult::B_HostResult(Value v)
+: state(std::make_shared<State>())
+{
+    state->value = v;
+}
+
+bool B_HostResult::ready() const
+{
+    std::lock_guard guard(state->lock);
+    return state->value.has_value();
+}
+
+Value B_HostResult::value() const
+{
+    std::lock_guard guard(state->lock);
+    return state->value.value();
+}
+
+void B_HostResult::resolve(Value v) const
+{
+    std::function<void()> continuation;
+    {
+        std::lock_guard guard(state->lock);
+        state->value = v;
+        std::swap(continuation, state->continuation);
+    }
+    if (continuation)
+    {
+        continuation();
+    }
+}
+
+void B_HostResult::on_ready(std::function<void()> continuation) const
+{
+    {
+        std::lock_guard guard(state->lock);
+        if (!state->value.has_value())
+        {
+            state->continuation = std::move(continuation);
+            return;
+        }
+    }
+    continuation();
+}
+
+void B_HostResult::cancel() const
+{
+    std::lock_guard guard(state->lock);
+    state->continuation = nullptr;
+}
+
+bool B_HostResult::await_suspend(std::coroutine_handle<> handle) const
+{
+    std::lock_guard guard(state->lock);
+    if (state->value.has_value())
+    {
+        return false;
+    }
+    state->continuation = [handle]{handle.resume();};
+    return true;
+}
+
+RunStatus B_Task::result() const
+{
+    if (handle.promise().exception)
+    {
+        std::rethrow_exception(handle.promise().exception);
+    }
+    return handle.promise().result;
+}
+
+B_Task::~B_Task()
+{
+    if (handle)
+    {
+        if (handle.promise().awaited)
+        {
+            handle.promise().awaited->cancel();
+        }
+        handle.destroy();
+    }
+}
@@ -0,0 +1,114 @@
+/**
+ * Calls from scripts into the host.
+ *
+ * A host function receives its arguments as a view over the VM stack and returns a B_HostResult.
+ * The arguments, and views taken over their objects, are valid for the call only: keep the values
+ * that must outlive it in a B_Handle, since later collections may move them.
+ * The result is either ready, or pending until the host resolves it, possibly from another thread.
+ * A pending result makes the VM stop with RunStatus::Waiting; B_Task coroutines and B_Scheduler
+ * resume it once the value arrives.
+*/
+#ifndef HOST_HPP
+#define HOST_HPP
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+
+#include "../include/object.hpp"
+
+class B_HostResult
+{
+    public:
+    // A pending result, to be resolved later by the host
+    B_HostResult();
+    // A result that is ready right away
+    B_HostResult(Value v);
+
+    bool ready() const;
+    Value value() const;
+    // Make the value available and run the continuation waiting for it, if any
+    void resolve(Value v) const;
+    // Run `continuation` once the value is available, immediately if it already is
+    void on_ready(std::function<void()> continuation) const;
+    // Drop the continuation waiting for the value, if any: a later resolve() only stores it
+    void cancel() const;
+
+    bool await_ready() const {return ready();}
+    bool await_suspend(std::coroutine_handle<> handle) const;
+    Value await_resume() const {return value();}
+
+    private:
+    struct State
+    {
+        mutable std::mutex lock;
+        std::optional<Value> value;
+        std::function<void()> continuation;
+    };
+
+    // Copies share the state, so the host can keep one to resolve the result
+    std::shared_ptr<State> state;
+};
+
+using B_HostFunction = std::function<B_HostResult(std::span<const Value>)>;
+
+struct B_HostBinding
+{
+    std::string name;
+    int arity;
+    B_HostFunction function;
+};
+
+enum class RunStatus
+{
+    Finished,
+    Yielded,
+    Waiting,
+    Error,
+};
+
+/**
+ * Coroutine returned by VM::run_async().
+ * It starts eagerly and suspends every time the script waits on a pending host result.
+ * An exception escaping the VM is kept in the task, not thrown at the thread resolving the result,
+ * and result() rethrows it to the owner of the task.
+ * Destroying a task that waits cancels the result it waits on, so resolving that result later does
+ * not resume the destroyed coroutine. The destruction must not race with that resolve() itself.
+*/
+class B_Task
+{
+    public:
+    struct promise_type
+    {
+        RunStatus result {RunStatus::Yielded};
+        std::exception_ptr exception;
+        // The host result the coroutine last waited on, cancelled if the task goes away first
+        std::optional<B_HostResult> awaited;
+
+        B_Task get_return_object() {return B_Task{std::coroutine_handle<promise_type>::from_promise(*this)};}
+        std::suspend_never initial_suspend() noexcept {return {};}
+        std::suspend_always final_suspend() noexcept {return {};}
+        void return_value(RunStatus status) {result = status;}
+        void unhandled_exception() {exception = std::current_exception();}
+        B_HostResult await_transform(const B_HostResult& host_result) {awaited = host_result; return host_result;}
+    };
+
+    B_Task(B_Task&& other) : handle(other.handle) {other.handle = nullptr;}
+    B_Task(const B_Task&) = delete;
+    ~B_Task();
+
+    bool done() const {return handle.done();}
+    RunStatus result() const;
+
+    private:
+    explicit B_Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+#endif
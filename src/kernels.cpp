@@ -0,0 +1,300 @@
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "kernels.hpp"
+
+static_assert(sizeof(_Float64) == sizeof(double));
+
+namespace
+{
+    const double* as_double(const _Float64* v) {return reinterpret_cast<const double*>(v);}
+    double* as_double(_Float64* v) {return reinterpret_cast<double*>(v);}
+}
+
+namespace kernels
+{
+    int64_t sum(const int64_t* v, size_t n)
+    {
+        size_t i = 0;
+        int64_t total = 0;
+#if defined(__AVX2__)
+        auto acc = _mm256_setzero_si256();
+        for (; i + 4 <= n; i += 4)
+        {
+            acc = _mm256_add_epi64(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i)));
+        }
+        alignas(32) int64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+        auto acc = _mm_setzero_si128();
+        for (; i + 2 <= n; i += 2)
+        {
+            acc = _mm_add_epi64(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i)));
+        }
+        alignas(16) int64_t lanes[2];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        total = lanes[0] + lanes[1];
+#endif
+        for (; i < n; ++i)
+        {
+            total += v[i];
+        }
+        return total;
+    }
+
+    _Float64 sum(const _Float64* v_, size_t n)
+    {
+        const auto* v = as_double(v_);
+        size_t i = 0;
+        double total = 0;
+#if defined(__AVX2__)
+        auto acc = _mm256_setzero_pd();
+        for (; i + 4 <= n; i += 4)
+        {
+            acc = _mm256_add_pd(acc, _mm256_loadu_pd(v + i));
+        }
+        alignas(32) double lanes[4];
+        _mm256_store_pd(lanes, acc);
+        total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+        auto acc = _mm_setzero_pd();
+        for (; i + 2 <= n; i += 2)
+        {
+            acc = _mm_add_pd(acc, _mm_loadu_pd(v + i));
+        }
+        alignas(16) double lanes[2];
+        _mm_store_pd(lanes, acc);
+        total = lanes[0] + lanes[1];
+#endif
+        for (; i < n; ++i)
+        {
+            total += v[i];
+        }
+        return total;
+    }
+
+    int64_t min(const int64_t* v, size_t n)
+    {
+        size_t i = 0;
+        int64_t result = v[0];
+#if defined(__AVX2__)
+        if (n >= 4)
+        {
+            auto acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v));
+            for (i = 4; i + 4 <= n; i += 4)
+            {
+                auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+                acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+            }
+            alignas(32) int64_t lanes[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+            result = *std::min_element(lanes, lanes + 4);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            result = std::min(result, v[i]);
+        }
+        return result;
+    }
+
+    int64_t max(const int64_t* v, size_t n)
+    {
+        size_t i = 0;
+        int64_t result = v[0];
+#if defined(__AVX2__)
+        if (n >= 4)
+        {
+            auto acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v));
+            for (i = 4; i + 4 <= n; i += 4)
+            {
+                auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+                acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+            }
+            alignas(32) int64_t lanes[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+            result = *std::max_element(lanes, lanes + 4);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            result = std::max(result, v[i]);
+        }
+        return result;
+    }
+
+    _Float64 min(const _Float64* v_, size_t n)
+    {
+        const auto* v = as_double(v_);
+        size_t i = 0;
+        double result = v[0];
+#if defined(__SSE2__)
+        if (n >= 2)
+        {
+            auto acc = _mm_loadu_pd(v);
+            for (i = 2; i + 2 <= n; i += 2)
+            {
+                acc = _mm_min_pd(acc, _mm_loadu_pd(v + i));
+            }
+            alignas(16) double lanes[2];
+            _mm_store_pd(lanes, acc);
+            result = std::min(lanes[0], lanes[1]);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            result = std::min(result, v[i]);
+        }
+        return result;
+    }
+
+    _Float64 max(const _Float64* v_, size_t n)
+    {
+        const auto* v = as_double(v_);
+        size_t i = 0;
+        double result = v[0];
+#if defined(__SSE2__)
+        if (n >= 2)
+        {
+            auto acc = _mm_loadu_pd(v);
+            for (i = 2; i + 2 <= n; i += 2)
+            {
+                acc = _mm_max_pd(acc, _mm_loadu_pd(v + i));
+            }
+            alignas(16) double lanes[2];
+            _mm_store_pd(lanes, acc);
+            result = std::max(lanes[0], lanes[1]);
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            result = std::max(result, v[i]);
+        }
+        return result;
+    }
+
+    void add(const int64_t* l, const int64_t* r, int64_t* out, size_t n)
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        for (; i + 4 <= n; i += 4)
+        {
+            auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(l + i));
+            auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi64(x, y));
+        }
+#elif defined(__SSE2__)
+        for (; i + 2 <= n; i += 2)
+        {
+            auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + i));
+            auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi64(x, y));
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            out[i] = l[i] + r[i];
+        }
+    }
+
+    void add(const _Float64* l_, const _Float64* r_, _Float64* out_, size_t n)
+    {
+        const auto* l = as_double(l_);
+        const auto* r = as_double(r_);
+        auto* out = as_double(out_);
+        size_t i = 0;
+#if defined(__AVX2__)
+        for (; i + 4 <= n; i += 4)
+        {
+            _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(l + i), _mm256_loadu_pd(r + i)));
+        }
+#elif defined(__SSE2__)
+        for (; i + 2 <= n; i += 2)
+        {
+            _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(l + i), _mm_loadu_pd(r + i)));
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            out[i] = l[i] + r[i];
+        }
+    }
+
+    // There is no packed 64-bit integer multiply below AVX-512: plain loop, left to the auto-vectorizer
+    void mul(const int64_t* l, const int64_t* r, int64_t* out, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            out[i] = l[i] * r[i];
+        }
+    }
+
+    void mul(const _Float64* l_, const _Float64* r_, _Float64* out_, size_t n)
+    {
+        const auto* l = as_double(l_);
+        const auto* r = as_double(r_);
+        auto* out = as_double(out_);
+        size_t i = 0;
+#if defined(__AVX2__)
+        for (; i + 4 <= n; i += 4)
+        {
+            _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(l + i), _mm256_loadu_pd(r + i)));
+        }
+#elif defined(__SSE2__)
+        for (; i + 2 <= n; i += 2)
+        {
+            _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(l + i), _mm_loadu_pd(r + i)));
+        }
+#endif
+        for (; i < n; ++i)
+        {
+            out[i] = l[i] * r[i];
+        }
+    }
+
+    int64_t dot(const int64_t* l, const int64_t* r, size_t n)
+    {
+        int64_t total = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            total += l[i] * r[i];
+        }
+        return total;
+    }
+
+    _Float64 dot(const _Float64* l_, const _Float64* r_, size_t n)
+    {
+        const auto* l = as_double(l_);
+        const auto* r = as_double(r_);
+        size_t i = 0;
+        double total = 0;
+#if defined(__AVX2__)
+        auto acc = _mm256_setzero_pd();
+        for (; i + 4 <= n; i += 4)
+        {
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(l + i), _mm256_loadu_pd(r + i)));
+        }
+        alignas(32) double lanes[4];
+        _mm256_store_pd(lanes, acc);
+        total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+        auto acc = _mm_setzero_pd();
+        for (; i + 2 <= n; i += 2)
+        {
+            acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(l + i), _mm_loadu_pd(r + i)));
+        }
+        alignas(16) double lanes[2];
+        _mm_store_pd(lanes, acc);
+        total = lanes[0] + lanes[1];
+#endif
+        for (; i < n; ++i)
+        {
+            total += l[i] * r[i];
+        }
+        return total;
+    }
+}
@@ -0,0 +1,32 @@
+/**
+ * Bulk kernels over packed arrays.
+ *
+ * Each kernel has a SIMD implementation (SSE2, or AVX2 when the compiler targets it)
+ * and a scalar fallback used for the tail and on other architectures.
+*/
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kernels
+{
+    int64_t sum(const int64_t* v, size_t n);
+    _Float64 sum(const _Float64* v, size_t n);
+
+    int64_t min(const int64_t* v, size_t n);
+    _Float64 min(const _Float64* v, size_t n);
+    int64_t max(const int64_t* v, size_t n);
+    _Float64 max(const _Float64* v, size_t n);
+
+    void add(const int64_t* l, const int64_t* r, int64_t* out, size_t n);
+    void add(const _Float64* l, const _Float64* r, _Float64* out, size_t n);
+    void mul(const int64_t* l, const int64_t* r, int64_t* out, size_t n);
+    void mul(const _Float64* l, const _Float64* r, _Float64* out, size_t n);
+
+    int64_t dot(const int64_t* l, const int64_t* r, size_t n);
+    _Float64 dot(const _Float64* l, const _Float64* r, size_t n);
+}
+
+#endif
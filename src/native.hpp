@@ -0,0 +1,95 @@
+/**
+ * Native functions: synchronous calls from scripts into C++.
+ *
+ * A native receives a span over its argument slots in VM::stack and writes its result into the first one,
+ * so a call builds no container and the result needs no extra push. Unlike host functions (see host.hpp)
+ * natives can not suspend the VM.
+ *
+ * B_Native<F> wraps a plain C++ function at compile time: it unpacks typed arguments from the slots
+ * and stores the returned value back. std::string_view arguments point into the VM heap: allocating
+ * does not collect, so they stay valid during the call, but not after it returns.
+*/
+#ifndef NATIVE_HPP
+#define NATIVE_HPP
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "../include/object.hpp"
+
+using B_NativeFunction = void (*)(std::span<Value> args, B_Allocator& allocator);
+
+struct B_NativeBinding
+{
+    std::string name;
+    int arity;
+    B_NativeFunction function;
+};
+
+namespace native
+{
+    template <typename T>
+    T from_value(const Value& v)
+    {
+        if constexpr (std::is_same_v<T, Value>)
+        {
+            return v;
+        } else if constexpr (std::is_same_v<T, std::string_view>)
+        {
+            return get_string_view(v);
+        } else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+        {
+            return static_cast<T>(std::get<int64_t>(v));
+        } else if constexpr (std::is_same_v<T, _Float64>)
+        {
+            // Integer arguments are accepted where a float is expected
+            return std::holds_alternative<int64_t>(v) ? static_cast<_Float64>(std::get<int64_t>(v)) : std::get<_Float64>(v);
+        } else
+        {
+            return std::get<T>(v);
+        }
+    }
+
+    template <typename T>
+    Value to_value(T&& v, B_Allocator& allocator)
+    {
+        using U = std::decay_t<T>;
+        if constexpr (std::is_same_v<U, std::string> || std::is_same_v<U, std::string_view>)
+        {
+            return allocator.alloc(std::string(v));
+        } else if constexpr (std::is_integral_v<U> && !std::is_same_v<U, bool>)
+        {
+            return static_cast<int64_t>(v);
+        } else
+        {
+            return Value{std::forward<T>(v)};
+        }
+    }
+}
+
+template <auto F, typename = decltype(F)>
+struct B_Native;
+
+template <auto F, typename R, typename... Args>
+struct B_Native<F, R (*)(Args...)>
+{
+    static_assert(!std::is_void_v<R>, "Native functions return the value of the call");
+    static constexpr int arity = sizeof...(Args);
+
+    static void call(std::span<Value> args, B_Allocator& allocator)
+    {
+        call(args, allocator, std::index_sequence_for<Args...>{});
+    }
+
+    private:
+    template <size_t... I>
+    static void call(std::span<Value> args, B_Allocator& allocator, std::index_sequence<I...>)
+    {
+        args[0] = native::to_value(F(native::from_value<std::decay_t<Args>>(args[I])...), allocator);
+    }
+};
+
+#endif
@@ -3,6 +3,12 @@
 #include "vm.hpp"
 #include "../include/object.hpp"
 
+const char* kind_name(B_Kind kind)
+{
+    static const char* names[] = {"string", "array", "int_array", "float_array", "function", "hash_map", "slice", "pvector", "pmap", "record"};
+    return names[static_cast<size_t>(kind)];
+}
+
 B_HashPair::B_HashPair(Value k, Value v) : key(k), value(v) 
 {
     if (std::holds_alternative<int64_t>(k))
@@ -26,16 +32,59 @@ B_HashPair::B_HashPair(Value k, Value v) : key(k), value(v)
     }
 }
 
+B_String::B_String(std::string_view s) : owned(std::make_unique_for_overwrite<char[]>(s.size()))
+{
+    std::copy(s.begin(), s.end(), owned.get());
+    value = std::string_view(owned.get(), s.size());
+    set_not_used();
+}
+
+B_String::B_String(std::initializer_list<std::string_view> parts, std::byte* trailing)
+{
+    auto* chars = reinterpret_cast<char*>(trailing);
+    auto* end = chars;
+    for (const auto& part: parts)
+    {
+        end = std::copy(part.begin(), part.end(), end);
+    }
+    value = std::string_view(chars, end - chars);
+    set_not_used();
+}
+
+B_String::B_String(B_String&& other, std::byte* trailing) : B_Object(other), value(other.value), owned(std::move(other.owned))
+{
+    if (!owned)
+    {
+        auto* chars = reinterpret_cast<char*>(trailing);
+        std::copy(other.value.begin(), other.value.end(), chars);
+        value = std::string_view(chars, other.value.size());
+    }
+}
+
 B_HashMap::B_HashMap(B_HashPair *first, B_HashPair *end)
 {
     for (auto* it = first; it < end; ++it)
     {
-        std::cout << "key: " << it->key << ", value: " << *it << "\n";
         values.insert_or_assign(it->key, *it);
     }
     set_not_used();
 }
 
+B_Shape::B_Shape(const std::vector<std::string>& keys)
+{
+    for (const auto& key: keys)
+    {
+        slots.emplace(key, static_cast<int>(this->keys.size()));
+        this->keys.push_back(std::make_unique<B_String>(key));
+    }
+}
+
+int B_Shape::slot(std::string_view key) const
+{
+    auto it = slots.find(key);
+    return it != slots.end() ? it->second : -1;
+}
+
 size_t VHash::operator()(const Value& v) const
 {
     if (auto i64 = std::get_if<int64_t>(&v))
@@ -46,7 +95,7 @@ size_t VHash::operator()(const Value& v) const
         return std::hash<_Float64>{}(*f64);
     } else if (auto* o_str = dynamic_cast<B_String*>(std::get<B_Object*>(v)))
     {
-        return std::hash<std::string>{}(o_str->value);
+        return std::hash<std::string_view>{}(o_str->value);
     } 
     else
     {
@@ -72,19 +121,282 @@ bool VEqual::operator()(const Value &l, const Value &r) const
     return &l == &r;
 }
 
+std::string_view B_Slice::chars() const
+{
+    return dynamic_cast<B_String*>(parent)->value.substr(offset, length);
+}
+
+Value B_Slice::at(size_t i) const
+{
+    if (i >= length)
+    {
+        throw invalid_value("Index out of the slice bounds");
+    }
+    if (auto* ints = dynamic_cast<B_IntArray*>(parent))
+    {
+        return ints->values[offset + i];
+    } else if (auto* floats = dynamic_cast<B_FloatArray*>(parent))
+    {
+        return floats->values[offset + i];
+    } else if (auto* array = dynamic_cast<B_Array*>(parent))
+    {
+        return array->values[offset + i];
+    }
+    throw invalid_value("Found a string slice where an array was expected");
+}
+
+size_t B_Slice::parent_length() const
+{
+    if (auto* str = dynamic_cast<B_String*>(parent))
+    {
+        return str->value.size();
+    } else if (auto* ints = dynamic_cast<B_IntArray*>(parent))
+    {
+        return ints->values.size();
+    } else if (auto* floats = dynamic_cast<B_FloatArray*>(parent))
+    {
+        return floats->values.size();
+    }
+    return dynamic_cast<B_Array*>(parent)->values.size();
+}
+
+B_Object* B_Slice::detach(B_Allocator& allocator)
+{
+    if (auto* str = dynamic_cast<B_String*>(parent))
+    {
+        parent = allocator.alloc(str->value.substr(offset, length));
+    } else if (auto* ints = dynamic_cast<B_IntArray*>(parent))
+    {
+        parent = allocator.alloc(std::vector<int64_t>(ints->values.begin() + offset, ints->values.begin() + offset + length));
+    } else if (auto* floats = dynamic_cast<B_FloatArray*>(parent))
+    {
+        parent = allocator.alloc(std::vector<_Float64>(floats->values.begin() + offset, floats->values.begin() + offset + length));
+    } else if (auto* array = dynamic_cast<B_Array*>(parent))
+    {
+        parent = allocator.alloc(array->values.data() + offset, array->values.data() + offset + length);
+    }
+    offset = 0;
+    return parent;
+}
+
+std::optional<std::string_view> as_string_view(const Value& v)
+{
+    auto* const* obj = std::get_if<B_Object*>(&v);
+    if (obj == nullptr)
+    {
+        return std::nullopt;
+    } else if (auto* str = dynamic_cast<B_String*>(*obj))
+    {
+        return str->value;
+    } else if (auto* slice = dynamic_cast<B_Slice*>(*obj); slice != nullptr && dynamic_cast<B_String*>(slice->parent) != nullptr)
+    {
+        return slice->chars();
+    }
+    return std::nullopt;
+}
+
 std::string get_string(Value obj) 
 {
-    return dynamic_cast<B_String*>(std::get<B_Object*>(obj))->value;
+    return std::string(as_string_view(obj).value());
+}
+
+std::string_view get_string_view(Value obj)
+{
+    auto view = as_string_view(obj);
+    if (!view)
+    {
+        throw invalid_value("Found a value that is not a string");
+    }
+    return *view;
+}
+
+std::span<const Value> get_array_view(Value obj)
+{
+    auto* o = std::get<B_Object*>(obj);
+    if (auto* array = dynamic_cast<B_Array*>(o))
+    {
+        return {array->values.data(), array->values.size()};
+    } else if (auto* slice = dynamic_cast<B_Slice*>(o); slice != nullptr && dynamic_cast<B_Array*>(slice->parent) != nullptr)
+    {
+        return get_array_view(slice->parent).subspan(slice->offset, slice->length);
+    }
+    throw invalid_value("Found a value that is not an array of values, packed arrays are read with get_packed_view");
+}
+
+template <typename T>
+std::span<const T> get_packed_view(Value obj)
+{
+    auto* o = std::get<B_Object*>(obj);
+    if (auto* array = dynamic_cast<B_PackedArray<T>*>(o))
+    {
+        return {array->values.data(), array->values.size()};
+    } else if (auto* slice = dynamic_cast<B_Slice*>(o); slice != nullptr && dynamic_cast<B_PackedArray<T>*>(slice->parent) != nullptr)
+    {
+        return get_packed_view<T>(slice->parent).subspan(slice->offset, slice->length);
+    }
+    throw invalid_value("Found a value that is not a packed array of the requested type");
+}
+
+template std::span<const int64_t> get_packed_view<int64_t>(Value obj);
+template std::span<const _Float64> get_packed_view<_Float64>(Value obj);
+
+void for_each_entry(Value obj, const std::function<void(const Value&, const Value&)>& fn)
+{
+    auto* o = std::get<B_Object*>(obj);
+    if (auto* record = dynamic_cast<B_Record*>(o))
+    {
+        for (size_t i = 0; i < record->values.size(); ++i)
+        {
+            fn(record->shape->keys[i].get(), record->values[i]);
+        }
+    } else if (auto* map = dynamic_cast<B_PMap*>(o))
+    {
+        map->values.for_each(fn);
+    } else if (auto* hash = dynamic_cast<B_HashMap*>(o))
+    {
+        for (const auto& [key, pair]: hash->values)
+        {
+            fn(pair.key, pair.value);
+        }
+    } else
+    {
+        throw invalid_value("Found a value that is not a hash");
+    }
 }
 
 std::vector<Value> get_array(Value obj) 
 {
-    return dynamic_cast<B_Array*>(std::get<B_Object*>(obj))->values;
+    auto* o = std::get<B_Object*>(obj);
+    if (auto* ints = dynamic_cast<B_IntArray*>(o))
+    {
+        return std::vector<Value>(ints->values.begin(), ints->values.end());
+    } else if (auto* floats = dynamic_cast<B_FloatArray*>(o))
+    {
+        return std::vector<Value>(floats->values.begin(), floats->values.end());
+    } else if (auto* slice = dynamic_cast<B_Slice*>(o))
+    {
+        std::vector<Value> values;
+        for (size_t i = 0; i < slice->length; ++i)
+        {
+            values.push_back(slice->at(i));
+        }
+        return values;
+    } else if (auto* vector = dynamic_cast<B_PVector*>(o))
+    {
+        std::vector<Value> values;
+        values.reserve(vector->values.size());
+        vector->values.for_each([&](const Value& v){values.push_back(v);});
+        return values;
+    }
+    const auto& values = dynamic_cast<B_Array*>(o)->values;
+    return std::vector<Value>(values.begin(), values.end());
 }
 
 std::unordered_map<Value, B_HashPair, VHash, VEqual> get_hash(Value obj) 
 {
-    return dynamic_cast<B_HashMap*>(std::get<B_Object*>(obj))->values;
+    if (auto* hash = dynamic_cast<B_HashMap*>(std::get<B_Object*>(obj)))
+    {
+        return hash->values;
+    }
+    std::unordered_map<Value, B_HashPair, VHash, VEqual> values;
+    for_each_entry(obj, [&](const Value& key, const Value& value){values.emplace(key, B_HashPair{key, value});});
+    return values;
+}
+
+namespace
+{
+    // Bytes an object takes in its region, the elements stored after it included
+    template <typename T>
+    size_t footprint(const T* obj)
+    {
+        if constexpr (requires {obj->trailing_bytes();})
+        {
+            return sizeof(T) + obj->trailing_bytes();
+        } else
+        {
+            return sizeof(T);
+        }
+    }
+
+    // Call fn with obj cast to its concrete type
+    template <typename F>
+    decltype(auto) visit_object(B_Object* obj, F fn)
+    {
+        switch (obj->kind())
+        {
+            case B_Kind::String:
+                return fn(static_cast<B_String*>(obj));
+            case B_Kind::Array:
+                return fn(static_cast<B_Array*>(obj));
+            case B_Kind::IntArray:
+                return fn(static_cast<B_IntArray*>(obj));
+            case B_Kind::FloatArray:
+                return fn(static_cast<B_FloatArray*>(obj));
+            case B_Kind::Function:
+                return fn(static_cast<B_Function*>(obj));
+            case B_Kind::HashMap:
+                return fn(static_cast<B_HashMap*>(obj));
+            case B_Kind::Slice:
+                return fn(static_cast<B_Slice*>(obj));
+            case B_Kind::PVector:
+                return fn(static_cast<B_PVector*>(obj));
+            case B_Kind::PMap:
+                return fn(static_cast<B_PMap*>(obj));
+            case B_Kind::Record:
+                return fn(static_cast<B_Record*>(obj));
+            default:
+                throw invalid_value("Found an object of unknown kind");
+        }
+    }
+}
+
+B_Region::B_Region(B_Region&& other) noexcept
+: chunks{std::move(other.chunks)}, top{std::exchange(other.top, nullptr)}, end{std::exchange(other.end, nullptr)},
+  used_bytes{std::exchange(other.used_bytes, 0)}, reserved_bytes{std::exchange(other.reserved_bytes, 0)}
+{
+    other.chunks.clear();
+}
+
+B_Region& B_Region::operator=(B_Region&& other) noexcept
+{
+    chunks = std::move(other.chunks);
+    other.chunks.clear();
+    top = std::exchange(other.top, nullptr);
+    end = std::exchange(other.end, nullptr);
+    used_bytes = std::exchange(other.used_bytes, 0);
+    reserved_bytes = std::exchange(other.reserved_bytes, 0);
+    return *this;
+}
+
+void* B_Region::allocate(size_t size, size_t align)
+{
+    void* ptr = top;
+    auto space = static_cast<size_t>(end - top);
+    if (top == nullptr || std::align(align, size, ptr, space) == nullptr)
+    {
+        // Objects larger than a chunk get one of their own
+        const auto capacity = std::max(chunk_size, size);
+        chunks.push_back(std::make_unique_for_overwrite<std::byte[]>(capacity));
+        reserved_bytes += capacity;
+        ptr = chunks.back().get();
+        end = chunks.back().get() + capacity;
+    }
+    top = static_cast<std::byte*>(ptr) + size;
+    used_bytes += size;
+    return ptr;
+}
+
+void B_Region::adopt(B_Region& other)
+{
+    std::move(other.chunks.begin(), other.chunks.end(), std::back_inserter(chunks));
+    if (top == nullptr)
+    {
+        top = other.top;
+        end = other.end;
+    }
+    used_bytes += other.used_bytes;
+    reserved_bytes += other.reserved_bytes;
+    other = B_Region{};
 }
 
 B_Allocator::~B_Allocator()
@@ -93,36 +405,173 @@ B_Allocator::~B_Allocator()
     {
         if (obj != nullptr)
         {
-            delete obj;
+            std::destroy_at(obj);
         }
     }
 }
 
 B_Allocator::B_Allocator(B_Allocator && other)
-: memory{other.memory}
+: memory{other.memory}, allocated{other.allocated}, region{std::move(other.region)}, live_bytes{std::exchange(other.live_bytes, 0)},
+  shape_storage{std::move(other.shape_storage)}, shapes{std::move(other.shapes)}
 {
     other.memory.clear();
 }
 
-B_Object *B_Allocator::alloc(std::string data)
+void B_Allocator::adopt(B_Allocator& other)
 {
-    auto* new_obj = new B_String{data};
-    memory.push_back(new_obj);
-    return new_obj;
+    memory.insert(memory.end(), other.memory.begin(), other.memory.end());
+    other.memory.clear();
+    allocated.objects += other.allocated.objects;
+    allocated.bytes += other.allocated.bytes;
+    other.allocated = B_KindStats{};
+    region.adopt(other.region);
+    live_bytes += std::exchange(other.live_bytes, 0);
+    // Adopted records may point to shapes of `other`: keep them alive, even when this allocator has an equal one
+    for (auto& [keys, shape]: other.shapes)
+    {
+        shapes.try_emplace(keys, shape);
+    }
+    std::move(other.shape_storage.begin(), other.shape_storage.end(), std::back_inserter(shape_storage));
+    other.shape_storage.clear();
+    other.shapes.clear();
+}
+
+const B_Shape* B_Allocator::shape(const std::vector<std::string>& keys)
+{
+    auto it = shapes.find(keys);
+    if (it != shapes.end())
+    {
+        return it->second;
+    }
+    shape_storage.push_back(std::make_unique<B_Shape>(keys));
+    return shapes.emplace(keys, shape_storage.back().get()).first->second;
+}
+
+B_HeapStats B_Allocator::heap_stats() const
+{
+    B_HeapStats stats;
+    for (const auto* obj: memory)
+    {
+        if (obj == nullptr)
+        {
+            continue;
+        }
+        auto& kind = stats.live[static_cast<size_t>(obj->kind())];
+        const auto bytes = obj->bytes();
+        ++kind.objects;
+        kind.bytes += bytes;
+        ++stats.live_total.objects;
+        stats.live_total.bytes += bytes;
+    }
+    stats.allocated_total = allocated;
+    return stats;
+}
+
+void B_Allocator::release(B_Object* obj)
+{
+    live_bytes -= visit_object(obj, [](auto* o){return footprint(o);});
+    std::destroy_at(obj);
+}
+
+double B_Allocator::fragmentation() const
+{
+    return region.used() == 0 ? 0.0 : 1.0 - static_cast<double>(live_bytes) / region.used();
+}
+
+B_Relocation B_Allocator::compact()
+{
+    B_Relocation relocation;
+    relocation.forward.reserve(memory.size());
+    relocation.old_region = std::move(region);
+    for (auto*& obj: memory)
+    {
+        if (obj == nullptr)
+        {
+            continue;
+        }
+        auto* moved = visit_object(obj, [&](auto* o) -> B_Object* {
+            using T = std::remove_pointer_t<decltype(o)>;
+            B_Object* copy;
+            if constexpr (requires {o->inline_bytes();})
+            {
+                // Elements that outgrew their room are not stored after the copy
+                auto* storage = static_cast<std::byte*>(region.allocate(sizeof(T) + o->inline_bytes(), alignof(T)));
+                copy = new (storage) T(std::move(*o), storage + sizeof(T));
+            } else
+            {
+                copy = new (region.allocate(sizeof(T), alignof(T))) T(std::move(*o));
+            }
+            std::destroy_at(o);
+            return copy;
+        });
+        relocation.forward.emplace(obj, moved);
+        obj = moved;
+    }
+    live_bytes = region.used();
+    return relocation;
+}
+
+B_Object* B_Allocator::track(B_Object* obj)
+{
+    memory.push_back(obj);
+    ++allocated.objects;
+    allocated.bytes += obj->bytes();
+    return obj;
+}
+
+B_Object *B_Allocator::alloc(std::string_view data)
+{
+    return make_trailing<B_String>(data.size(), std::initializer_list<std::string_view>{data});
+}
+
+B_Object *B_Allocator::concat(std::string_view left, std::string_view right)
+{
+    return make_trailing<B_String>(left.size() + right.size(), std::initializer_list<std::string_view>{left, right});
 }
 
 B_Object *B_Allocator::alloc(Value* first, Value* last)
 {
-    auto* new_obj = new B_Array{first, last};
-    memory.push_back(new_obj);
-    return new_obj;
+    return make_trailing<B_Array>((last - first) * sizeof(Value), first, last);
 }
 
 B_Object *B_Allocator::alloc(B_HashPair* first, B_HashPair* last)
 {
-    auto* new_obj = new B_HashMap{first, last};
-    memory.push_back(new_obj);
-    return new_obj;
+    return make<B_HashMap>(first, last);
+}
+
+B_Object *B_Allocator::alloc(std::vector<int64_t> values)
+{
+    return make_packed(std::move(values));
+}
+
+B_Object *B_Allocator::alloc(std::vector<_Float64> values)
+{
+    return make_packed(std::move(values));
+}
+
+B_Object *B_Allocator::alloc(const B_Shape* shape, const std::vector<Value>& values)
+{
+    return make_trailing<B_Record>(values.size() * sizeof(Value), shape, values.data(), values.data() + values.size());
+}
+
+B_Object *B_Allocator::alloc(PersistentVector<Value> values)
+{
+    return make<B_PVector>(std::move(values));
+}
+
+B_Object *B_Allocator::alloc(PersistentMap<Value, Value, VHash, VEqual> values)
+{
+    return make<B_PMap>(std::move(values));
+}
+
+B_Object *B_Allocator::alloc(int64_t entry, int arity, int num_locals)
+{
+    return make<B_Function>(entry, arity, num_locals);
+}
+
+B_Object *B_Allocator::alloc(B_Object* parent, size_t offset, size_t length)
+{
+    return make<B_Slice>(parent, offset, length);
 }
 
 std::ostream& operator<<(std::ostream& lhs, Value rhs)
@@ -0,0 +1,116 @@
+#ifdef BONSAI_PROFILE
+
+#include <algorithm>
+#include <tuple>
+
+#include "profile.hpp"
+
+B_OpClass op_class(unsigned char op)
+{
+    switch (op)
+    {
+        case OpConstant:
+        case OpTrue:
+        case OpFalse:
+        case OpPop:
+            return B_OpClass::Stack;
+        case OpAdd:
+        case OpSub:
+        case OpMul:
+        case OpDiv:
+        case OpUnaryMinus:
+        case OpBang:
+            return B_OpClass::Arithmetic;
+        case OpEqual:
+        case OpGreaterThan:
+        case OpGreaterEqual:
+            return B_OpClass::Comparison;
+        case OpJumpFalse:
+        case OpJump:
+            return B_OpClass::Control;
+        case OpWriteGlobal:
+        case OpReadGlobal:
+        case OpGetLocal:
+        case OpSetLocal:
+            return B_OpClass::Variables;
+        case OpCall:
+        case OpTailCall:
+        case OpReturn:
+        case OpCallHost:
+        case OpCallNative:
+            return B_OpClass::Calls;
+        default:
+            return B_OpClass::Collections;
+    }
+}
+
+const char* op_class_name(B_OpClass op_class)
+{
+    static const char* names[] = {"stack", "arithmetic", "comparison", "control", "variables", "collections", "calls"};
+    return names[static_cast<size_t>(op_class)];
+}
+
+B_Stats::B_Stats()
+{
+    reset();
+}
+
+void B_Stats::record(unsigned char op, std::chrono::nanoseconds elapsed)
+{
+    ++op_counts[op];
+    if (previous_op >= 0)
+    {
+        ++pair_counts[previous_op * 256 + op];
+    }
+    previous_op = op;
+    class_time[static_cast<size_t>(op_class(op))] += elapsed;
+}
+
+void B_Stats::reset()
+{
+    op_counts.fill(0);
+    pair_counts.assign(256 * 256, 0);
+    class_time.fill(std::chrono::nanoseconds::zero());
+    gc_runs = 0;
+    gc_time = std::chrono::nanoseconds::zero();
+    in_instruction = false;
+    instruction_gc_time = std::chrono::nanoseconds::zero();
+    previous_op = -1;
+}
+
+void B_Stats::report(std::ostream& out, size_t top_pairs) const
+{
+    out << "opcode counts\n";
+    for (size_t op = 0; op < op_counts.size(); ++op)
+    {
+        if (op_counts[op] > 0)
+        {
+            out << "  " << opDefinitions[op].opName << " " << op_counts[op] << "\n";
+        }
+    }
+
+    std::vector<std::tuple<uint64_t, size_t>> pairs;
+    for (size_t i = 0; i < pair_counts.size(); ++i)
+    {
+        if (pair_counts[i] > 0)
+        {
+            pairs.emplace_back(pair_counts[i], i);
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), std::greater<>{});
+    out << "opcode pairs\n";
+    for (size_t i = 0; i < std::min(top_pairs, pairs.size()); ++i)
+    {
+        const auto [count, pair] = pairs[i];
+        out << "  " << opDefinitions[pair / 256].opName << " " << opDefinitions[pair % 256].opName << " " << count << "\n";
+    }
+
+    out << "time by class (ns)\n";
+    for (size_t c = 0; c < class_time.size(); ++c)
+    {
+        out << "  " << op_class_name(static_cast<B_OpClass>(c)) << " " << class_time[c].count() << "\n";
+    }
+    out << "gc " << gc_runs << " runs, " << gc_time.count() << " ns\n";
+}
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * Execution statistics of a VM, compiled in only with the BONSAI_PROFILE CMake option.
+ *
+ * Without it the BONSAI_PROFILE_* macros expand to nothing, VM has no stats member
+ * and the interpreter loop is the same as if this file did not exist.
+*/
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#ifdef BONSAI_PROFILE
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "../include/code.hpp"
+
+enum class B_OpClass : unsigned char
+{
+    Stack,
+    Arithmetic,
+    Comparison,
+    Control,
+    Variables,
+    Collections,
+    Calls,
+    Count,
+};
+
+B_OpClass op_class(unsigned char op);
+const char* op_class_name(B_OpClass op_class);
+
+struct B_Stats
+{
+    B_Stats();
+
+    // Executions of each opcode
+    std::array<uint64_t, 256> op_counts;
+    // Executions of each opcode right after another one, see pair()
+    std::vector<uint64_t> pair_counts;
+    // Time spent in the instructions of each class
+    std::array<std::chrono::nanoseconds, static_cast<size_t>(B_OpClass::Count)> class_time;
+    uint64_t gc_runs;
+    std::chrono::nanoseconds gc_time;
+
+    uint64_t pair(Operation first, Operation second) const {return pair_counts[first * 256 + second];}
+    void record(unsigned char op, std::chrono::nanoseconds elapsed);
+    void reset();
+    // Human readable summary: opcode counts, the most frequent pairs, time by class and GC time
+    void report(std::ostream& out, size_t top_pairs = 10) const;
+
+    // Collections run while an instruction is timed, not charged to its class
+    bool in_instruction;
+    std::chrono::nanoseconds instruction_gc_time;
+
+    private:
+    int previous_op;
+};
+
+/**
+ * Time and count one instruction, from its construction to the end of the enclosing scope.
+*/
+class B_OpTimer
+{
+    public:
+    B_OpTimer(B_Stats& stats, unsigned char op) : stats(stats), op(op), start(std::chrono::steady_clock::now())
+    {
+        stats.in_instruction = true;
+    }
+    ~B_OpTimer()
+    {
+        stats.in_instruction = false;
+        stats.record(op, std::chrono::steady_clock::now() - start - stats.instruction_gc_time);
+        stats.instruction_gc_time = std::chrono::nanoseconds::zero();
+    }
+
+    private:
+    B_Stats& stats;
+    unsigned char op;
+    std::chrono::steady_clock::time_point start;
+};
+
+class B_GcTimer
+{
+    public:
+    B_GcTimer(B_Stats& stats) : stats(stats), start(std::chrono::steady_clock::now()) {};
+    ~B_GcTimer()
+    {
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        ++stats.gc_runs;
+        stats.gc_time += elapsed;
+        if (stats.in_instruction)
+        {
+            stats.instruction_gc_time += elapsed;
+        }
+    }
+
+    private:
+    B_Stats& stats;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define BONSAI_PROFILE_INSTRUCTION(stats, op) B_OpTimer bonsai_op_timer_ {stats, op}
+#define BONSAI_PROFILE_GC(stats) B_GcTimer bonsai_gc_timer_ {stats}
+
+#else
+
+#define BONSAI_PROFILE_INSTRUCTION(stats, op)
+#define BONSAI_PROFILE_GC(stats)
+
+#endif
+
+#endif
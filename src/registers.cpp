@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <optional>
+#include <set>
+
+#include "sampler.hpp"
+#include "vm.hpp"
+
+namespace
+{
+    // Deepest stack VM::push allows
+    constexpr int32_t max_depth = 255;
+
+    struct B_StackInstruction
+    {
+        int32_t offset;
+        unsigned char op;
+        int16_t operand;
+        // Offset of the instruction after it
+        int32_t next;
+    };
+
+    // Values popped and pushed by the instructions the tier runs, nullopt for the others
+    std::optional<std::pair<int32_t, int32_t>> stack_effect(unsigned char op)
+    {
+        switch (op)
+        {
+            case OpConstant:
+            case OpTrue:
+            case OpFalse:
+            case OpReadGlobal:
+            case OpPop:
+            case OpWriteGlobal:
+            case OpJumpFalse:
+            case OpAdd:
+            case OpSub:
+            case OpMul:
+            case OpDiv:
+            case OpGreaterThan:
+            case OpEqual:
+            case OpGreaterEqual:
+            case OpBang:
+            case OpUnaryMinus:
+            case OpJump:
+                return std::pair{opDefinitions[op].pops, opDefinitions[op].pushes};
+            default:
+                return std::nullopt;
+        }
+    }
+
+    B_RegOp register_op(unsigned char op)
+    {
+        switch (op)
+        {
+            case OpAdd:
+                return B_RegOp::Add;
+            case OpSub:
+                return B_RegOp::Sub;
+            case OpMul:
+                return B_RegOp::Mul;
+            case OpDiv:
+                return B_RegOp::Div;
+            case OpGreaterThan:
+                return B_RegOp::GreaterThan;
+            case OpEqual:
+                return B_RegOp::Equal;
+            case OpGreaterEqual:
+                return B_RegOp::GreaterEqual;
+            case OpBang:
+                return B_RegOp::Not;
+            default:
+                return B_RegOp::Negate;
+        }
+    }
+
+    B_Operand reg(int32_t index)
+    {
+        return B_Operand{B_Operand::Register, static_cast<int16_t>(index)};
+    }
+
+    /**
+     * Operands of the stack slots of a block. Loads stay operands until an instruction consumes them,
+     * and every slot is in its register by the end of the block, where the stack is as the stack
+     * interpreter leaves it.
+    */
+    class B_Emitter
+    {
+        public:
+        B_Emitter(std::vector<B_RegInstruction>& code, int32_t depth) : code(code), block_begin(code.size())
+        {
+            for (auto i = 0; i < depth; ++i)
+            {
+                slots.push_back(reg(i));
+            }
+        }
+
+        int32_t depth() const {return static_cast<int32_t>(slots.size());}
+
+        void push(B_Operand operand) {slots.push_back(operand);}
+
+        B_Operand pop()
+        {
+            const auto operand = slots.back();
+            slots.pop_back();
+            return operand;
+        }
+
+        void emit(B_RegOp op, B_Operand dst, B_Operand a, B_Operand b, int32_t source)
+        {
+            code.push_back(B_RegInstruction{op, dst, a, b, source, depth()});
+        }
+
+        // Move the load in `slot`, if any, into its register
+        void materialize(int32_t slot, int32_t source)
+        {
+            if (slots[slot].kind != B_Operand::Register)
+            {
+                const auto operand = slots[slot];
+                slots[slot] = reg(slot);
+                emit(B_RegOp::Move, reg(slot), operand, {}, source);
+            }
+        }
+
+        void materialize_all(int32_t source)
+        {
+            for (auto i = 0; i < depth(); ++i)
+            {
+                materialize(i, source);
+            }
+        }
+
+        // Compute `op` into the register of the slot its result takes
+        void compute(B_RegOp op, B_Operand a, B_Operand b, int32_t source)
+        {
+            slots.push_back(reg(depth()));
+            emit(op, slots.back(), a, b, source);
+        }
+
+        void write_global(int16_t global, int32_t source)
+        {
+            const auto value = pop();
+            // Loads of the global still pending read it before it changes
+            for (auto i = 0; i < depth(); ++i)
+            {
+                if (slots[i].kind == B_Operand::Global && slots[i].index == global)
+                {
+                    materialize(i, source);
+                }
+            }
+            if (value.kind == B_Operand::Register && code.size() > block_begin
+                && code.back().dst.kind == B_Operand::Register && code.back().dst.index == value.index)
+            {
+                // The instruction computing the value stores it in the global itself
+                code.back().dst = B_Operand{B_Operand::Global, global};
+                code.back().sp = depth();
+            } else
+            {
+                emit(B_RegOp::Move, B_Operand{B_Operand::Global, global}, value, {}, source);
+            }
+        }
+
+        private:
+        std::vector<B_RegInstruction>& code;
+        size_t block_begin;
+        std::vector<B_Operand> slots;
+    };
+
+    std::optional<std::vector<B_StackInstruction>> decode(const std::vector<unsigned char>& instructions)
+    {
+        std::vector<B_StackInstruction> decoded;
+        for (size_t offset = 0; offset < instructions.size();)
+        {
+            const auto op = instructions[offset];
+            if (!stack_effect(op))
+            {
+                return std::nullopt;
+            }
+            // OpWide has no stack effect here, so every instruction is in its short form
+            int16_t operand = 0;
+            const auto width = static_cast<size_t>(instruction_width(op));
+            if (offset + width > instructions.size())
+            {
+                return std::nullopt;
+            }
+            if (opDefinitions[op].numOperands > 0)
+            {
+                operand = static_cast<int16_t>(read_operand(instructions, offset));
+            }
+            decoded.push_back(B_StackInstruction{static_cast<int32_t>(offset), op, operand, static_cast<int32_t>(offset + width)});
+            offset += width;
+        }
+        return decoded;
+    }
+}
+
+B_RegisterCode translate_registers(const std::vector<unsigned char>& instructions)
+{
+    B_RegisterCode result;
+    const auto decoded = decode(instructions);
+    if (!decoded || instructions.size() > static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+    {
+        return result;
+    }
+    const auto size = static_cast<int32_t>(instructions.size());
+    // Position in `decoded` of the instruction at each offset, the end included
+    std::vector<int32_t> positions(size + 1, -1);
+    for (size_t i = 0; i < decoded->size(); ++i)
+    {
+        positions[(*decoded)[i].offset] = static_cast<int32_t>(i);
+    }
+    positions[size] = static_cast<int32_t>(decoded->size());
+
+    std::set<int32_t> starts {0, size};
+    for (const auto& ins: *decoded)
+    {
+        if (ins.op == OpJump || ins.op == OpJumpFalse)
+        {
+            const auto target = ins.offset + ins.operand;
+            if (target < 0 || target > size || positions[target] < 0)
+            {
+                return result;
+            }
+            starts.insert(target);
+            starts.insert(ins.next);
+        }
+    }
+
+    // Stack depth at the start of each block reachable from the first one
+    std::map<int32_t, int32_t> depths {{0, 0}};
+    std::vector<int32_t> pending {0};
+    auto reach = [&](int32_t start, int32_t depth){
+        auto [it, inserted] = depths.emplace(start, depth);
+        if (inserted)
+        {
+            pending.push_back(start);
+        }
+        return it->second == depth;
+    };
+    while (!pending.empty())
+    {
+        const auto start = pending.back();
+        pending.pop_back();
+        if (start == size)
+        {
+            continue;
+        }
+        const auto end = *starts.upper_bound(start);
+        auto depth = depths[start];
+        auto falls_through = true;
+        for (auto i = positions[start]; i < positions[end]; ++i)
+        {
+            const auto& ins = (*decoded)[i];
+            const auto [popped, pushed] = *stack_effect(ins.op);
+            depth -= popped;
+            if (depth < 0)
+            {
+                return result;
+            }
+            depth += pushed;
+            if (depth > max_depth)
+            {
+                return result;
+            }
+            if ((ins.op == OpJump || ins.op == OpJumpFalse) && !reach(ins.offset + ins.operand, depth))
+            {
+                return result;
+            }
+            falls_through = ins.op != OpJump;
+        }
+        if (falls_through && !reach(end, depth))
+        {
+            return result;
+        }
+    }
+
+    result.entries.assign(size + 1, -1);
+    result.depths.assign(size + 1, 0);
+    for (const auto& [start, depth]: depths)
+    {
+        if (start == size)
+        {
+            continue;
+        }
+        result.entries[start] = static_cast<int32_t>(result.code.size());
+        result.depths[start] = depth;
+        B_Emitter block {result.code, depth};
+        const auto end = *starts.upper_bound(start);
+        auto falls_through = true;
+        for (auto i = positions[start]; i < positions[end]; ++i)
+        {
+            const auto& ins = (*decoded)[i];
+            switch (ins.op)
+            {
+                case OpConstant:
+                    block.push(B_Operand{B_Operand::Constant, ins.operand});
+                    break;
+                case OpTrue:
+                    block.push(B_Operand{B_Operand::True});
+                    break;
+                case OpFalse:
+                    block.push(B_Operand{B_Operand::False});
+                    break;
+                case OpReadGlobal:
+                    block.push(B_Operand{B_Operand::Global, ins.operand});
+                    break;
+                case OpPop:
+                {
+                    // A global is still read, so that a missing one fails as in the stack interpreter
+                    const auto operand = block.pop();
+                    if (operand.kind == B_Operand::Global)
+                    {
+                        block.emit(B_RegOp::Move, reg(block.depth()), operand, {}, ins.offset);
+                    }
+                    break;
+                }
+                case OpWriteGlobal:
+                    block.write_global(ins.operand, ins.offset);
+                    break;
+                case OpBang:
+                case OpUnaryMinus:
+                {
+                    const auto operand = block.pop();
+                    block.compute(register_op(ins.op), operand, {}, ins.offset);
+                    break;
+                }
+                case OpJump:
+                case OpJumpFalse:
+                {
+                    const auto condition = ins.op == OpJumpFalse ? block.pop() : B_Operand{};
+                    block.materialize_all(ins.offset);
+                    block.emit(ins.op == OpJump ? B_RegOp::Jump : B_RegOp::JumpFalse, {}, condition, {}, ins.offset);
+                    result.code.back().target_ip = ins.offset + ins.operand;
+                    result.code.back().next_ip = ins.next;
+                    falls_through = ins.op != OpJump;
+                    break;
+                }
+                default:
+                {
+                    const auto right = block.pop();
+                    const auto left = block.pop();
+                    block.compute(register_op(ins.op), left, right, ins.offset);
+                    break;
+                }
+            }
+        }
+        if (falls_through)
+        {
+            block.materialize_all(end);
+        }
+    }
+    result.entries[size] = static_cast<int32_t>(result.code.size());
+    result.depths[size] = depths.contains(size) ? depths[size] : 0;
+    for (auto& ins: result.code)
+    {
+        if (ins.op == B_RegOp::Jump || ins.op == B_RegOp::JumpFalse)
+        {
+            ins.target = result.entries[ins.target_ip];
+        }
+    }
+    result.translated = true;
+    return result;
+}
+
+bool VM::use_register_tier()
+{
+#ifdef BONSAI_PROFILE
+    // The statistics count the instructions of the stack bytecode
+    return false;
+#else
+    if (!register_tier || ip < 0 || ip >= static_cast<int64_t>(instructions.size()))
+    {
+        return false;
+    }
+    if (register_generation != instructions_generation)
+    {
+        register_code = translate_registers(instructions);
+        register_generation = instructions_generation;
+    }
+    return register_code.translated && register_code.entries[ip] >= 0 && register_code.depths[ip] == sp;
+#endif
+}
+
+Value VM::readOperand(const B_Operand& operand)
+{
+    switch (operand.kind)
+    {
+        case B_Operand::Register:
+            return stack[operand.index];
+        case B_Operand::Constant:
+            return constants[operand.index];
+        case B_Operand::Global:
+            if (operand.index >= static_cast<int64_t>(globals.size()))
+            {
+                throw global_index_too_large_exception();
+            }
+            share(globals[operand.index]);
+            return globals[operand.index];
+        case B_Operand::True:
+            return trueValue;
+        default:
+            return falseValue;
+    }
+}
+
+void VM::writeOperand(const B_Operand& operand, const Value& value)
+{
+    if (operand.kind == B_Operand::Register)
+    {
+        stack[operand.index] = value;
+        return;
+    }
+    auto cmp = operand.index <=> static_cast<int64_t>(globals.size());
+    if (cmp < 0)
+    {
+        globals[operand.index] = value;
+    } else if (cmp == 0)
+    {
+        globals.push_back(value);
+    } else
+    {
+        throw global_index_too_large_exception();
+    }
+}
+
+bool VM::execute_registers(int64_t& block_start)
+{
+    const auto& code = register_code.code;
+    auto pc = static_cast<size_t>(register_code.entries[ip]);
+    while (pc < code.size())
+    {
+        const auto& ins = code[pc];
+        if (sample_point != nullptr)
+        {
+            sample_point->publish(ins.source, fp);
+        }
+        switch (ins.op)
+        {
+            case B_RegOp::Move:
+                writeOperand(ins.dst, readOperand(ins.a));
+                break;
+            case B_RegOp::Add:
+            case B_RegOp::Sub:
+            case B_RegOp::Mul:
+            {
+                const auto left = readOperand(ins.a);
+                const auto right = readOperand(ins.b);
+                const auto* l = std::get_if<int64_t>(&left);
+                const auto* r = std::get_if<int64_t>(&right);
+                if (l != nullptr && r != nullptr)
+                {
+                    writeOperand(ins.dst, ins.op == B_RegOp::Add ? *l + *r : ins.op == B_RegOp::Sub ? *l - *r : *l * *r);
+                } else
+                {
+                    const auto op = ins.op == B_RegOp::Add ? OpAdd : ins.op == B_RegOp::Sub ? OpSub : OpMul;
+                    writeOperand(ins.dst, binaryOp(op, left, right, *bgc.allocator));
+                }
+                break;
+            }
+            case B_RegOp::Div:
+                writeOperand(ins.dst, binaryOp(OpDiv, readOperand(ins.a), readOperand(ins.b), *bgc.allocator));
+                break;
+            case B_RegOp::GreaterThan:
+            case B_RegOp::Equal:
+            case B_RegOp::GreaterEqual:
+            {
+                const auto op = ins.op == B_RegOp::GreaterThan ? OpGreaterThan : ins.op == B_RegOp::Equal ? OpEqual : OpGreaterEqual;
+                writeOperand(ins.dst, binaryComparison(op, readOperand(ins.a), readOperand(ins.b)));
+                break;
+            }
+            case B_RegOp::Not:
+                writeOperand(ins.dst, readOperand(ins.a) == trueValue ? falseValue : trueValue);
+                break;
+            case B_RegOp::Negate:
+                writeOperand(ins.dst, Value{-std::get<int64_t>(readOperand(ins.a))});
+                break;
+            case B_RegOp::Jump:
+            case B_RegOp::JumpFalse:
+            {
+                const auto taken = ins.op == B_RegOp::Jump || readOperand(ins.a) == falseValue;
+                ip = taken ? ins.target_ip : ins.next_ip;
+                sp = ins.sp;
+                // Every value live across the jump sits in a slot below `sp`, where the collection sees it
+                if (auto_gc)
+                {
+                    run_gc();
+                }
+                if (end_block(block_start, ins.source, ip < ins.source))
+                {
+                    return true;
+                }
+                block_start = ip;
+                pc = taken ? ins.target : pc + 1;
+                continue;
+            }
+        }
+        ++pc;
+    }
+    ip = static_cast<int64_t>(instructions.size());
+    sp = register_code.depths[ip];
+    if (auto_gc)
+    {
+        run_gc();
+    }
+    return false;
+}
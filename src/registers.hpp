@@ -0,0 +1,83 @@
+/**
+ * Register tier: a three-address form of the stack bytecode and its translator.
+ *
+ * Each stack slot is a virtual register, held in the slot itself, so the VM stack doubles as the
+ * register file and a program leaves `stack` and `sp` as the stack interpreter would. Constants,
+ * globals and booleans are operands of their own: loads are folded into the instruction using them,
+ * and a store into a global becomes the destination of the instruction computing the value,
+ * so `g0 = g0 + 1` is one instruction instead of four.
+ *
+ * Only straight arithmetic programs are translated: constants, globals, arithmetic, comparisons,
+ * negations, pops and jumps. Anything else, and stack depths that differ between the paths
+ * reaching a block, leave the program to the stack interpreter.
+ *
+ * Register instructions have no stack of their own in between them, so with VM::auto_gc the tier
+ * collects at the end of each block, where every live value sits below `sp`, rather than after
+ * each instruction as the stack interpreter does.
+*/
+#ifndef REGISTERS_HPP
+#define REGISTERS_HPP
+
+#include <cstdint>
+#include <vector>
+
+enum class B_RegOp : uint8_t
+{
+    Move,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    GreaterThan,
+    Equal,
+    GreaterEqual,
+    Not,
+    Negate,
+    Jump,
+    JumpFalse,
+};
+
+struct B_Operand
+{
+    enum Kind : uint8_t
+    {
+        Register,
+        Constant,
+        Global,
+        True,
+        False,
+    };
+
+    Kind kind {Register};
+    int16_t index {0};
+};
+
+struct B_RegInstruction
+{
+    B_RegOp op;
+    B_Operand dst;
+    B_Operand a;
+    B_Operand b;
+    // Offset of the stack instruction it comes from
+    int32_t source;
+    // Stack depth once it ran, the `sp` jumps leave to a VM that yields there
+    int32_t sp;
+    // Jumps: the instruction they go to, its offset in the stack bytecode, and the offset they fall through to
+    int32_t target {-1};
+    int32_t target_ip {-1};
+    int32_t next_ip {-1};
+};
+
+struct B_RegisterCode
+{
+    // False when the bytecode has instructions the tier does not run
+    bool translated {false};
+    std::vector<B_RegInstruction> code;
+    // Instruction of each block start by offset in the stack bytecode, -1 elsewhere, and the stack depth there
+    std::vector<int32_t> entries;
+    std::vector<int32_t> depths;
+};
+
+B_RegisterCode translate_registers(const std::vector<unsigned char>& instructions);
+
+#endif
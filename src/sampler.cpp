@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
+
+#include "sampler.hpp"
+#include "vm.hpp"
+
+// Older glibc headers do not name the thread of SIGEV_THREAD_ID
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace
+{
+    std::atomic<B_Sampler*> active_sampler {nullptr};
+
+    void on_sigprof(int)
+    {
+        const auto saved_errno = errno;
+        if (auto* sampler = active_sampler.load(std::memory_order_acquire))
+        {
+            sampler->sample();
+        }
+        errno = saved_errno;
+    }
+
+    // The handler stays installed after a sampler stops, so a tick still pending then is dropped
+    // instead of reaching the default action of SIGPROF, which terminates the process
+    void install_handler()
+    {
+        static std::once_flag installed;
+        std::call_once(installed, []{
+            struct sigaction action {};
+            action.sa_handler = on_sigprof;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            if (sigaction(SIGPROF, &action, nullptr) != 0)
+            {
+                throw sampler_exception(std::string("sigaction: ") + std::strerror(errno));
+            }
+        });
+    }
+}
+
+B_Sampler::B_Sampler(std::chrono::nanoseconds interval, size_t capacity)
+: interval(interval), samples(capacity)
+{
+}
+
+B_Sampler::~B_Sampler()
+{
+    stop();
+}
+
+void B_Sampler::start(VM& vm)
+{
+    B_Sampler* expected = nullptr;
+    if (!active_sampler.compare_exchange_strong(expected, this))
+    {
+        throw sampler_exception("Another sampler is running");
+    }
+    install_handler();
+    this->vm = &vm;
+    point.frames = vm.frames.data();
+    point.fp.store(vm.fp, std::memory_order_relaxed);
+    vm.sample_point = &point;
+
+    struct sigevent event {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = gettid();
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0)
+    {
+        vm.sample_point = nullptr;
+        active_sampler.store(nullptr, std::memory_order_release);
+        throw sampler_exception(std::string("timer_create: ") + std::strerror(errno));
+    }
+    struct itimerspec spec {};
+    spec.it_interval.tv_sec = interval.count() / 1'000'000'000;
+    spec.it_interval.tv_nsec = interval.count() % 1'000'000'000;
+    spec.it_value = spec.it_interval;
+    timer_settime(timer, 0, &spec, nullptr);
+    running = true;
+}
+
+void B_Sampler::stop()
+{
+    if (!running)
+    {
+        return;
+    }
+    timer_delete(timer);
+    active_sampler.store(nullptr, std::memory_order_release);
+    vm->sample_point = nullptr;
+    running = false;
+}
+
+void B_Sampler::sample()
+{
+    const auto ip = point.ip.load(std::memory_order_relaxed);
+    const auto in_gc = point.in_gc.load(std::memory_order_relaxed);
+    if (ip < 0 && !in_gc)
+    {
+        // The host is running, not the VM
+        return;
+    }
+    const auto i = next.load(std::memory_order_relaxed);
+    if (i >= samples.size())
+    {
+        dropped_samples.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto& s = samples[i];
+    s.ip = ip;
+    s.in_gc = in_gc;
+    s.depth = point.fp.load(std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    const auto first = std::max<int64_t>(s.depth - B_Sample::max_depth, 0);
+    for (auto f = first; f < s.depth; ++f)
+    {
+        s.call_sites[f - first] = point.frames[f].call_ip;
+    }
+    next.store(i + 1, std::memory_order_release);
+}
+
+uint64_t B_Sampler::gc_samples() const
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < sample_count(); ++i)
+    {
+        count += samples[i].in_gc;
+    }
+    return count;
+}
+
+std::map<int64_t, uint64_t> B_Sampler::histogram() const
+{
+    std::map<int64_t, uint64_t> result;
+    for (size_t i = 0; i < sample_count(); ++i)
+    {
+        ++result[samples[i].ip];
+    }
+    return result;
+}
+
+std::string B_Sampler::frame_name(int64_t offset) const
+{
+    const auto op = vm->instructions[offset];
+    if (op == OpWide)
+    {
+        return "OpWide " + std::string(opDefinitions[vm->instructions[offset + 1]].opName) + "@" + std::to_string(offset);
+    }
+    return std::string(opDefinitions[op].opName) + "@" + std::to_string(offset);
+}
+
+void B_Sampler::write_folded(std::ostream& out) const
+{
+    std::map<std::string, uint64_t> stacks;
+    for (size_t i = 0; i < sample_count(); ++i)
+    {
+        const auto& s = samples[i];
+        std::string stack = "main";
+        if (s.depth > B_Sample::max_depth)
+        {
+            stack += ";...";
+        }
+        for (int64_t f = 0; f < std::min<int64_t>(s.depth, B_Sample::max_depth); ++f)
+        {
+            stack.append(";").append(frame_name(s.call_sites[f]));
+        }
+        if (s.ip >= 0)
+        {
+            stack.append(";").append(frame_name(s.ip));
+        }
+        if (s.in_gc)
+        {
+            stack += ";[gc]";
+        }
+        ++stacks[stack];
+    }
+    for (const auto& [stack, count]: stacks)
+    {
+        out << stack << " " << count << "\n";
+    }
+}
@@ -0,0 +1,119 @@
+/**
+ * Sampling profiler: a CPU-time timer interrupts the thread running a VM with SIGPROF
+ * and the handler records the instruction it was executing, its callers and whether it was collecting.
+ *
+ * The VM publishes its position through a B_SamplePoint only while a sampler is attached,
+ * so an unsampled VM pays one null check per instruction. Samples are aggregated after the run,
+ * as a histogram by bytecode offset or as folded stacks for flame-graph tools.
+ * Linux only: the timer is delivered to one thread with SIGEV_THREAD_ID.
+*/
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct VM;
+struct B_Frame;
+
+/**
+ * Where a running VM is, readable from a signal handler interrupting it.
+ * `ip` is the offset of the running instruction, -1 outside the interpreter loop.
+*/
+struct B_SamplePoint
+{
+    std::atomic<int64_t> ip {-1};
+    std::atomic<int64_t> fp {0};
+    std::atomic<bool> in_gc {false};
+    const B_Frame* frames {nullptr};
+
+    void publish(int64_t op_start, int64_t frame_count)
+    {
+        // The frames below frame_count are written before they are published
+        std::atomic_signal_fence(std::memory_order_release);
+        fp.store(frame_count, std::memory_order_relaxed);
+        ip.store(op_start, std::memory_order_relaxed);
+    }
+};
+
+// Publishes that the VM left the interpreter loop when the scope ends
+struct B_SampleExit
+{
+    B_SamplePoint* const& point;
+    ~B_SampleExit()
+    {
+        if (point != nullptr)
+        {
+            point->ip.store(-1, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct B_Sample
+{
+    static constexpr int max_depth = 16;
+
+    int64_t ip;
+    bool in_gc;
+    // Active frames, of which the innermost max_depth are in `call_sites`, outermost first
+    int64_t depth;
+    std::array<int64_t, max_depth> call_sites;
+};
+
+class B_Sampler
+{
+    public:
+    // Sample every `interval` of CPU time of the sampled thread, keeping at most `capacity` samples
+    B_Sampler(std::chrono::nanoseconds interval = std::chrono::milliseconds(1), size_t capacity = 1 << 15);
+    ~B_Sampler();
+
+    B_Sampler(const B_Sampler&) = delete;
+    B_Sampler& operator=(const B_Sampler&) = delete;
+
+    /**
+     * Attach to `vm` and arm the timer on the calling thread, which must be the one running `vm`.
+     * Only one sampler in the process can run at a time.
+    */
+    void start(VM& vm);
+    void stop();
+    // Record where the attached VM is. This is what the SIGPROF handler does at each tick.
+    void sample();
+
+    size_t sample_count() const {return next.load(std::memory_order_acquire);}
+    uint64_t dropped() const {return dropped_samples.load(std::memory_order_relaxed);}
+    uint64_t gc_samples() const;
+    // Samples by offset of the running instruction, -1 for collections run outside the interpreter loop
+    std::map<int64_t, uint64_t> histogram() const;
+    // One line per distinct stack, e.g. "main;OpCall@12;OpAdd@40 7", for flamegraph.pl and compatible tools
+    void write_folded(std::ostream& out) const;
+
+    private:
+    std::string frame_name(int64_t offset) const;
+
+    std::chrono::nanoseconds interval;
+    VM* vm {nullptr};
+    B_SamplePoint point;
+    std::vector<B_Sample> samples;
+    std::atomic<size_t> next {0};
+    std::atomic<uint64_t> dropped_samples {0};
+    timer_t timer;
+    bool running {false};
+};
+
+class sampler_exception
+{
+  std::string message;
+
+  public:
+  sampler_exception(std::string msg) : message(msg) {};
+  std::string what() {return message;}
+};
+
+#endif
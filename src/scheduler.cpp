@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include "scheduler.hpp"
+
+namespace
+{
+    // Heap order: the VM with the fewest executed instructions sits on top
+    bool ran_more(const std::shared_ptr<VM>& l, const std::shared_ptr<VM>& r)
+    {
+        return l->instructions_executed > r->instructions_executed;
+    }
+}
+
+B_Scheduler::B_Scheduler(size_t num_workers, int64_t slice, size_t gc_min_objects)
+: workers(), slice(slice), gc_min_objects(gc_min_objects), next_worker(0), queued(0), slice_count(0), steal_count(0),
+active(0), parked(0), stopping(false), parking(std::make_shared<Parking>())
+{
+    parking->scheduler = this;
+    num_workers = std::max<size_t>(num_workers, 1);
+    for (size_t i = 0; i < num_workers; ++i)
+    {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < num_workers; ++i)
+    {
+        workers[i]->thread = std::thread(&B_Scheduler::work, this, i);
+    }
+}
+
+B_Scheduler::~B_Scheduler()
+{
+    // Wait for every VM to finish or to park, then cancel the parked ones with no continuation resuming them in between
+    while (true)
+    {
+        {
+            std::unique_lock guard(idle_lock);
+            done.wait(guard, [this]{return active == parked;});
+        }
+        std::lock_guard parking_guard(parking->lock);
+        std::lock_guard guard(idle_lock);
+        if (active == parked)
+        {
+            parking->scheduler = nullptr;
+            stopping = true;
+            break;
+        }
+    }
+    idle.notify_all();
+    for (auto& worker: workers)
+    {
+        worker->thread.join();
+    }
+}
+
+void B_Scheduler::submit(std::shared_ptr<VM> vm, std::function<void(VM&)> on_done)
+{
+    vm->auto_gc = false;
+    {
+        std::lock_guard guard(idle_lock);
+        ++active;
+    }
+    auto live = vm->bgc.allocator->memory.size();
+    enqueue(next_worker++ % workers.size(), Task{std::move(vm), std::move(on_done), live});
+}
+
+void B_Scheduler::wait()
+{
+    std::unique_lock guard(idle_lock);
+    done.wait(guard, [this]{return active == 0;});
+}
+
+void B_Scheduler::enqueue(size_t id, Task task)
+{
+    {
+        auto& worker = *workers[id];
+        std::lock_guard guard(worker.lock);
+        worker.queue.push_back(std::move(task));
+        std::push_heap(worker.queue.begin(), worker.queue.end(), [](const Task& l, const Task& r){
+            return ran_more(l.vm, r.vm);
+        });
+    }
+    ++queued;
+    // Taking the lock orders this wake-up after a worker that is about to sleep has checked `queued`
+    {
+        std::lock_guard guard(idle_lock);
+    }
+    idle.notify_one();
+}
+
+bool B_Scheduler::take_from(Worker& worker, Task& task)
+{
+    std::lock_guard guard(worker.lock);
+    if (worker.queue.empty())
+    {
+        return false;
+    }
+    std::pop_heap(worker.queue.begin(), worker.queue.end(), [](const Task& l, const Task& r){
+        return ran_more(l.vm, r.vm);
+    });
+    task = std::move(worker.queue.back());
+    worker.queue.pop_back();
+    --queued;
+    return true;
+}
+
+bool B_Scheduler::take(size_t id, Task& task)
+{
+    if (take_from(*workers[id], task))
+    {
+        return true;
+    }
+    for (size_t i = 1; i < workers.size(); ++i)
+    {
+        if (take_from(*workers[(id + i) % workers.size()], task))
+        {
+            ++steal_count;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Collect when the heap doubled since the last collection.
+ * Runs on the worker thread, so heaps of VMs living on different workers are collected in parallel.
+*/
+void B_Scheduler::collect_if_needed(Task& task)
+{
+    auto size = task.vm->bgc.allocator->memory.size();
+    if (size >= std::max(gc_min_objects, 2 * task.live_after_gc))
+    {
+        task.vm->run_gc();
+        task.live_after_gc = task.vm->bgc.allocator->memory.size();
+    }
+}
+
+void B_Scheduler::unpark(size_t id, Task task)
+{
+    {
+        std::lock_guard guard(idle_lock);
+        --parked;
+    }
+    task.vm->complete_host_call();
+    enqueue(id, std::move(task));
+}
+
+void B_Scheduler::work(size_t id)
+{
+    while (true)
+    {
+        Task task;
+        if (!take(id, task))
+        {
+            std::unique_lock guard(idle_lock);
+            idle.wait(guard, [this]{return stopping || queued.load() > 0;});
+            if (stopping)
+            {
+                return;
+            }
+            continue;
+        }
+
+        auto status = task.vm->run_for(slice);
+        ++slice_count;
+        if (status == RunStatus::Yielded)
+        {
+            collect_if_needed(task);
+            enqueue(id, std::move(task));
+            continue;
+        }
+        if (status == RunStatus::Waiting)
+        {
+            // Parked until the host resolves the call; the resolving thread puts it back in a queue
+            {
+                std::lock_guard guard(idle_lock);
+                ++parked;
+            }
+            done.notify_all();
+            auto pending = *task.vm->pending_host;
+            pending.on_ready([parking = parking, id, task]() mutable {
+                std::lock_guard guard(parking->lock);
+                if (parking->scheduler != nullptr)
+                {
+                    parking->scheduler->unpark(id, std::move(task));
+                }
+            });
+            continue;
+        }
+
+        task.vm->run_gc();
+        if (task.on_done)
+        {
+            task.on_done(*task.vm);
+        }
+        std::lock_guard guard(idle_lock);
+        // Both wait() and the destructor, which also waits for the parked VMs, may be done
+        if (--active == parked)
+        {
+            done.notify_all();
+        }
+    }
+}
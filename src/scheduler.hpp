@@ -0,0 +1,89 @@
+/**
+ * Multiplex many resumable VMs onto a fixed pool of worker threads.
+ *
+ * Every worker owns a run queue ordered by executed instructions, so the VM that ran the least goes next.
+ * Idle workers steal from the others. Garbage collection is driven by the worker between slices,
+ * hence the VMs submitted to a scheduler must not share their B_Allocator.
+ * A VM waiting on a host call leaves the queues and is put back by the thread resolving the call.
+ * Destroying the scheduler runs the other VMs to the end and cancels the waiting ones: their results
+ * may still be resolved later, but the VMs stay in RunStatus::Waiting and their `on_done` never runs.
+*/
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "vm.hpp"
+
+class B_Scheduler
+{
+    public:
+    B_Scheduler(size_t num_workers = std::thread::hardware_concurrency(), int64_t slice = 10000, size_t gc_min_objects = 1024);
+    ~B_Scheduler();
+
+    B_Scheduler(const B_Scheduler&) = delete;
+
+    // `on_done` runs on the worker thread once the VM finished or failed
+    void submit(std::shared_ptr<VM> vm, std::function<void(VM&)> on_done = {});
+    // Block until every submitted VM finished or failed
+    void wait();
+
+    size_t num_workers() const {return workers.size();}
+    int64_t slices() const {return slice_count.load();}
+    int64_t steals() const {return steal_count.load();}
+
+    private:
+    struct Task
+    {
+        std::shared_ptr<VM> vm;
+        std::function<void(VM&)> on_done;
+        size_t live_after_gc;
+    };
+
+    // Shared with the continuations of parked VMs, which may run after the scheduler is gone
+    struct Parking
+    {
+        std::mutex lock;
+        B_Scheduler* scheduler;
+    };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::vector<Task> queue;
+        std::thread thread;
+    };
+
+    void work(size_t id);
+    void enqueue(size_t id, Task task);
+    bool take(size_t id, Task& task);
+    bool take_from(Worker& worker, Task& task);
+    void collect_if_needed(Task& task);
+    void unpark(size_t id, Task task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    const int64_t slice;
+    const size_t gc_min_objects;
+
+    std::atomic<size_t> next_worker;
+    std::atomic<size_t> queued;
+    std::atomic<int64_t> slice_count;
+    std::atomic<int64_t> steal_count;
+
+    std::mutex idle_lock;
+    std::condition_variable idle;
+    std::condition_variable done;
+    size_t active;
+    // Active VMs waiting on a host result
+    size_t parked;
+    bool stopping;
+    std::shared_ptr<Parking> parking;
+};
+
+#endif
@@ -0,0 +1,317 @@
+/**
+ * Top-of-stack caching: the interpreter variant VM::execute switches to when VM::cache_top is set.
+ *
+ * The top two values of the stack live in two locals instead of `stack`, so a sequence as
+ * `OpConstant; OpConstant; OpAdd; OpWriteGlobal` touches memory only to read its constants.
+ * The cache is in one of three states, with 0, 1 or 2 values cached. The interpreter has a copy
+ * of its handlers for each state, VM::step_cached<Depth>, so every push and pop in them knows where
+ * the values are at compile time and the only dispatch on the state is the one choosing the handler. Values move to `stack` only when a third one is pushed,
+ * before an instruction the variant does not run, and at the collections after each instruction
+ * when the cache holds an object, so mark_and_sweep and compact still see every root.
+*/
+#include <algorithm>
+#include <utility>
+
+#include "sampler.hpp"
+#include "vm.hpp"
+
+class B_StackCache
+{
+    public:
+    B_StackCache(std::array<Value, 256>& stack, int64_t& sp) : stack(stack), sp(sp) {};
+    // The cached values go back to `stack` however the variant returns, errors included
+    ~B_StackCache() {spill();}
+
+    B_StackCache(const B_StackCache&) = delete;
+    B_StackCache& operator=(const B_StackCache&) = delete;
+
+    // Handlers for a cache holding `Depth` values
+
+    template <int Depth>
+    void push(const Value& v)
+    {
+        if (sp + Depth >= static_cast<int64_t>(stack.size()) - 1)
+        {
+            throw full_stack_exception();
+        }
+        if constexpr (Depth == 2)
+        {
+            stack[sp++] = next;
+        }
+        if constexpr (Depth >= 1)
+        {
+            next = top;
+        }
+        top = v;
+        depth = std::min(Depth + 1, 2);
+    }
+
+    template <int Depth>
+    Value pop()
+    {
+        if constexpr (Depth == 0)
+        {
+            if (sp < 1)
+            {
+                throw empty_stack_exception();
+            }
+            return stack[--sp];
+        } else if constexpr (Depth == 1)
+        {
+            depth = 0;
+            return top;
+        } else
+        {
+            depth = 1;
+            return std::exchange(top, next);
+        }
+    }
+
+    // The top of the stack, cached so an instruction can replace it in place
+    template <int Depth>
+    Value& peek()
+    {
+        if constexpr (Depth == 0)
+        {
+            top = pop<0>();
+            depth = 1;
+        }
+        return top;
+    }
+
+    void spill()
+    {
+        if (depth == 2)
+        {
+            stack[sp++] = next;
+        }
+        if (depth >= 1)
+        {
+            stack[sp++] = top;
+        }
+        depth = 0;
+    }
+
+    // Whether a collection needs the cached values among its roots
+    bool holds_objects() const
+    {
+        return (depth >= 1 && std::holds_alternative<B_Object*>(top))
+            || (depth == 2 && std::holds_alternative<B_Object*>(next));
+    }
+
+    private:
+    std::array<Value, 256>& stack;
+    int64_t& sp;
+    Value top;
+    Value next;
+
+    public:
+    // Values cached, the state choosing the handlers
+    int depth {0};
+};
+
+namespace
+{
+    // Depth of a cache holding `depth` values once one is popped
+    constexpr int popped(int depth)
+    {
+        return depth > 0 ? depth - 1 : 0;
+    }
+
+    bool cached(unsigned char op)
+    {
+        switch (op)
+        {
+            case OpConstant:
+            case OpTrue:
+            case OpFalse:
+            case OpAdd:
+            case OpSub:
+            case OpMul:
+            case OpDiv:
+            case OpGreaterThan:
+            case OpEqual:
+            case OpGreaterEqual:
+            case OpPop:
+            case OpBang:
+            case OpUnaryMinus:
+            case OpJumpFalse:
+            case OpJump:
+            case OpWriteGlobal:
+            case OpReadGlobal:
+            case OpGetLocal:
+            case OpSetLocal:
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+// Inlined into execute_cached, so the cached values can live in registers across the handlers
+template <int Depth>
+[[gnu::always_inline]] inline bool VM::step_cached(B_StackCache& cache, int64_t& block_start)
+{
+    const auto op_start = ip;
+    const auto op = instructions[ip];
+    BONSAI_PROFILE_INSTRUCTION(stats, op);
+    if (sample_point != nullptr)
+    {
+        sample_point->publish(op_start, fp);
+    }
+    // The cached loop only runs short instructions
+    const auto operand = opDefinitions[op].numOperands > 0 ? read_operand(instructions, op_start) : 0;
+    ip += instruction_width(op);
+
+    switch (op)
+    {
+        case OpConstant:
+            cache.push<Depth>(constants[operand]);
+            break;
+        case OpTrue:
+            cache.push<Depth>(trueValue);
+            break;
+        case OpFalse:
+            cache.push<Depth>(falseValue);
+            break;
+        case OpAdd:
+        case OpSub:
+        case OpMul:
+        case OpDiv:
+        {
+            const auto right = cache.pop<Depth>();
+            auto& left = cache.peek<popped(Depth)>();
+            const auto* l = std::get_if<int64_t>(&left);
+            const auto* r = std::get_if<int64_t>(&right);
+            if (l != nullptr && r != nullptr && op != OpDiv)
+            {
+                left = op == OpAdd ? *l + *r : op == OpSub ? *l - *r : *l * *r;
+            } else
+            {
+                left = binaryOp(static_cast<Operation>(op), left, right, *bgc.allocator);
+            }
+            break;
+        }
+        case OpGreaterThan:
+        case OpEqual:
+        case OpGreaterEqual:
+        {
+            const auto right = cache.pop<Depth>();
+            auto& left = cache.peek<popped(Depth)>();
+            left = binaryComparison(static_cast<Operation>(op), left, right);
+            break;
+        }
+        case OpPop:
+            cache.pop<Depth>();
+            break;
+        case OpBang:
+        {
+            auto& value = cache.peek<Depth>();
+            value = value == trueValue ? falseValue : trueValue;
+            break;
+        }
+        case OpUnaryMinus:
+        {
+            auto& value = cache.peek<Depth>();
+            value = Value{-std::get<int64_t>(value)};
+            break;
+        }
+        case OpJumpFalse:
+        case OpJump:
+        {
+            int64_t jmp_offset = ip - op_start;
+            if (op == OpJump || cache.pop<Depth>() == falseValue)
+            {
+                jmp_offset = operand;
+            }
+            ip = op_start + jmp_offset;
+            if (auto_gc)
+            {
+                if (cache.holds_objects())
+                {
+                    cache.spill();
+                }
+                run_gc();
+            }
+            if (end_block(block_start, op_start, jmp_offset < 0))
+            {
+                return true;
+            }
+            block_start = ip;
+            return false;
+        }
+        case OpWriteGlobal:
+        {
+            auto top = cache.pop<Depth>();
+            auto cmp = operand <=> static_cast<int64_t>(globals.size());
+            if (cmp < 0)
+            {
+                globals[operand] = top;
+            } else if (cmp == 0)
+            {
+                globals.push_back(top);
+            } else
+            {
+                throw global_index_too_large_exception();
+            }
+            break;
+        }
+        case OpReadGlobal:
+            if (operand >= static_cast<int64_t>(globals.size()))
+            {
+                throw global_index_too_large_exception();
+            }
+            share(globals[operand]);
+            cache.push<Depth>(globals[operand]);
+            break;
+        case OpGetLocal:
+        {
+            // Locals sit below the values pushed since the call, so they are never cached
+            const auto slot = localSlot(operand);
+            share(stack[slot]);
+            cache.push<Depth>(stack[slot]);
+            break;
+        }
+        case OpSetLocal:
+        {
+            auto top = cache.pop<Depth>();
+            stack[localSlot(operand)] = top;
+            break;
+        }
+    }
+    if (auto_gc)
+    {
+        if (cache.holds_objects())
+        {
+            cache.spill();
+        }
+        run_gc();
+    }
+    return false;
+}
+
+bool VM::execute_cached(int64_t& block_start)
+{
+    B_StackCache cache {stack, sp};
+    while (ip < static_cast<int64_t>(instructions.size()) && cached(instructions[ip]))
+    {
+        bool yield;
+        switch (cache.depth)
+        {
+            case 0:
+                yield = step_cached<0>(cache, block_start);
+                break;
+            case 1:
+                yield = step_cached<1>(cache, block_start);
+                break;
+            default:
+                yield = step_cached<2>(cache, block_start);
+                break;
+        }
+        if (yield)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "telemetry.hpp"
+
+void B_PauseHistogram::record(std::chrono::nanoseconds pause)
+{
+    const auto ns = static_cast<uint64_t>(std::max<int64_t>(pause.count(), 1));
+    ++counts[std::bit_width(ns) - 1];
+    ++pauses;
+    total_time += pause;
+    max_time = std::max(max_time, pause);
+    last_time = pause;
+}
+
+std::chrono::nanoseconds B_PauseHistogram::percentile(double p) const
+{
+    if (pauses == 0)
+    {
+        return std::chrono::nanoseconds::zero();
+    }
+    const auto rank = static_cast<uint64_t>(std::ceil(p / 100 * pauses));
+    uint64_t seen = 0;
+    for (size_t k = 0; k < bucket_count; ++k)
+    {
+        seen += counts[k];
+        if (seen >= rank)
+        {
+            const auto upper = k + 1 < bucket_count ? int64_t{1} << (k + 1) : max_time.count();
+            return std::min(std::chrono::nanoseconds(upper), max_time);
+        }
+    }
+    return max_time;
+}
+
+namespace
+{
+    void write_kind(std::ostream& out, const char* name, const B_KindStats& stats)
+    {
+        out << "\"" << name << "\":{\"objects\":" << stats.objects << ",\"bytes\":" << stats.bytes << "}";
+    }
+}
+
+void write_telemetry_json(std::ostream& out, const B_HeapStats& heap, const B_GcTelemetry& gc)
+{
+    const auto uptime = std::chrono::steady_clock::now() - gc.started;
+    const auto seconds = std::chrono::duration<double>(uptime).count();
+    const auto allocated = heap.allocated_total.bytes - std::min(heap.allocated_total.bytes, gc.allocated_bytes_at_start);
+
+    out << "{\"uptime_ns\":" << std::chrono::nanoseconds(uptime).count();
+    out << ",\"gc\":{\"collections\":" << gc.collections
+        << ",\"objects_freed\":" << gc.objects_freed
+        << ",\"bytes_freed\":" << gc.bytes_freed
+        << ",\"pause_ns\":{\"count\":" << gc.pauses.count()
+        << ",\"total\":" << gc.pauses.total().count()
+        << ",\"max\":" << gc.pauses.max().count()
+        << ",\"p50\":" << gc.pauses.percentile(50).count()
+        << ",\"p90\":" << gc.pauses.percentile(90).count()
+        << ",\"p99\":" << gc.pauses.percentile(99).count() << "}"
+        << ",\"compactions\":" << gc.compactions
+        << ",\"compacted_bytes\":" << gc.compacted_bytes << "}";
+    out << ",\"heap\":{";
+    write_kind(out, "allocated", heap.allocated_total);
+    out << ",\"allocation_rate\":" << (seconds > 0 ? allocated / seconds : 0.0) << ",";
+    write_kind(out, "live", heap.live_total);
+    for (size_t kind = 0; kind < heap.live.size(); ++kind)
+    {
+        out << ",";
+        write_kind(out, kind_name(static_cast<B_Kind>(kind)), heap.live[kind]);
+    }
+    out << "}}";
+}
@@ -0,0 +1,69 @@
+/**
+ * Heap and collector statistics, always on.
+ *
+ * The collector counts its runs, what they free and how long they pause the VM;
+ * the live heap is measured on demand by B_Allocator::heap_stats. Both can be written as JSON,
+ * on request or periodically into a file, one object per line.
+*/
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+
+#include "../include/object.hpp"
+
+/**
+ * Pause times in power of two buckets: bucket k counts the pauses of [2^k, 2^(k+1)) nanoseconds.
+*/
+class B_PauseHistogram
+{
+    public:
+    static constexpr size_t bucket_count = 64;
+
+    void record(std::chrono::nanoseconds pause);
+    // Upper bound of the bucket holding the p-th percentile, 0 < p <= 100, never above the longest pause
+    std::chrono::nanoseconds percentile(double p) const;
+
+    uint64_t count() const {return pauses;}
+    std::chrono::nanoseconds total() const {return total_time;}
+    std::chrono::nanoseconds max() const {return max_time;}
+    std::chrono::nanoseconds last() const {return last_time;}
+    const std::array<uint64_t, bucket_count>& buckets() const {return counts;}
+
+    private:
+    std::array<uint64_t, bucket_count> counts {};
+    uint64_t pauses {0};
+    std::chrono::nanoseconds total_time {0};
+    std::chrono::nanoseconds max_time {0};
+    std::chrono::nanoseconds last_time {0};
+};
+
+struct B_GcTelemetry
+{
+    uint64_t collections {0};
+    uint64_t objects_freed {0};
+    uint64_t bytes_freed {0};
+    B_PauseHistogram pauses;
+    // Heap compactions, and the region bytes they gave back
+    uint64_t compactions {0};
+    uint64_t compacted_bytes {0};
+
+    std::chrono::steady_clock::time_point started {std::chrono::steady_clock::now()};
+    uint64_t allocated_bytes_at_start {0};
+
+    // When set, append the telemetry to this file after a collection, at most once per dump_interval
+    std::string dump_path;
+    std::chrono::milliseconds dump_interval {1000};
+    std::optional<std::chrono::steady_clock::time_point> last_dump;
+};
+
+// One JSON object with the collector counters, the pause percentiles, the allocation rate in bytes per second
+// since the collector started and the live heap by kind
+void write_telemetry_json(std::ostream& out, const B_HeapStats& heap, const B_GcTelemetry& gc);
+
+#endif
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <exception>
+
+#include "thread_pool.hpp"
+
+B_ThreadPool::B_ThreadPool(size_t num_threads)
+: stopping(false)
+{
+    for (size_t i = 0; i < std::max<size_t>(num_threads, 1); ++i)
+    {
+        threads.emplace_back(&B_ThreadPool::work, this);
+    }
+}
+
+B_ThreadPool::~B_ThreadPool()
+{
+    {
+        std::lock_guard guard(lock);
+        stopping = true;
+    }
+    available.notify_all();
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+}
+
+B_ThreadPool& B_ThreadPool::shared()
+{
+    static B_ThreadPool pool {};
+    return pool;
+}
+
+void B_ThreadPool::work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock guard(lock);
+            available.wait(guard, [this]{return stopping || !tasks.empty();});
+            if (tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void B_ThreadPool::parallel_for(size_t n, size_t num_chunks, const std::function<void(size_t, size_t, size_t)>& fn)
+{
+    num_chunks = std::clamp<size_t>(num_chunks, 1, std::max<size_t>(n, 1));
+    const auto chunk_size = (n + num_chunks - 1) / num_chunks;
+
+    std::mutex done_lock;
+    std::condition_variable done;
+    size_t remaining = num_chunks - 1;
+    std::exception_ptr error;
+
+    auto run_chunk = [&](size_t chunk)
+    {
+        try
+        {
+            const auto begin = std::min(n, chunk * chunk_size);
+            fn(begin, std::min(n, begin + chunk_size), chunk);
+        } catch (...)
+        {
+            std::lock_guard guard(done_lock);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    if (num_chunks > 1)
+    {
+        std::lock_guard guard(lock);
+        for (size_t chunk = 1; chunk < num_chunks; ++chunk)
+        {
+            tasks.push_back([&, chunk]{
+                run_chunk(chunk);
+                std::lock_guard guard(done_lock);
+                if (--remaining == 0)
+                {
+                    done.notify_one();
+                }
+            });
+        }
+    }
+    available.notify_all();
+
+    run_chunk(0);
+    {
+        std::unique_lock guard(done_lock);
+        done.wait(guard, [&]{return remaining == 0;});
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,47 @@
+/**
+ * Fixed pool of threads running the chunks of data-parallel operations.
+ *
+ * Chunks are leaf tasks: they never wait on the pool, so a caller blocked in parallel_for
+ * always makes progress, even when called from many threads at once.
+*/
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class B_ThreadPool
+{
+    public:
+    B_ThreadPool(size_t num_threads = std::thread::hardware_concurrency());
+    ~B_ThreadPool();
+
+    B_ThreadPool(const B_ThreadPool&) = delete;
+
+    // Pool shared by all the VMs of the process
+    static B_ThreadPool& shared();
+
+    size_t num_threads() const {return threads.size();}
+
+    /**
+     * Split [0, n) in at most num_chunks ranges and call fn(begin, end, chunk) on each.
+     * The calling thread runs the first chunk. The first exception thrown by a chunk is rethrown here
+     * once all the chunks completed.
+    */
+    void parallel_for(size_t n, size_t num_chunks, const std::function<void(size_t, size_t, size_t)>& fn);
+
+    private:
+    void work();
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable available;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,409 @@
+#include <bit>
+#include <cstring>
+
+#include "trace.hpp"
+#include "vm.hpp"
+
+namespace
+{
+    constexpr char magic[] = {'B', 'T', 'R', '2'};
+    constexpr size_t chunk_size = 2 * sizeof(int64_t);
+
+    /**
+     * Events are written field by field, integers as LEB128 varints, zigzag encoded when signed,
+     * and chunks as the string bytes they hold, so a trace does not depend on the layout or
+     * the byte order of the build that recorded it.
+    */
+    void write_varint(std::ostream& out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.put(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        out.put(static_cast<char>(v));
+    }
+
+    uint64_t read_varint(std::istream& in)
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            const auto c = in.get();
+            if (c == std::istream::traits_type::eof())
+            {
+                throw trace_exception("Truncated trace");
+            }
+            v |= static_cast<uint64_t>(c & 0x7f) << shift;
+            if ((c & 0x80) == 0)
+            {
+                return v;
+            }
+        }
+        throw trace_exception("Malformed varint in trace");
+    }
+
+    uint64_t zigzag(int64_t v)
+    {
+        return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+    }
+
+    int64_t unzigzag(uint64_t v)
+    {
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    void write_event(std::ostream& out, const B_TraceEvent& event)
+    {
+        out.put(static_cast<char>(event.kind));
+        if (event.kind == B_TraceKind::Chunk)
+        {
+            char bytes[chunk_size];
+            std::memcpy(bytes, &event.a, sizeof(event.a));
+            std::memcpy(bytes + sizeof(event.a), &event.b, sizeof(event.b));
+            out.write(bytes, chunk_size);
+            return;
+        }
+        out.put(static_cast<char>(event.tag));
+        write_varint(out, event.aux);
+        write_varint(out, zigzag(event.a));
+        write_varint(out, zigzag(event.b));
+    }
+
+    // Read the next event into `event`, false at the end of the trace
+    bool read_event(std::istream& in, B_TraceEvent& event)
+    {
+        const auto kind = in.get();
+        if (kind == std::istream::traits_type::eof())
+        {
+            return false;
+        }
+        if (kind > static_cast<int>(B_TraceKind::Dropped))
+        {
+            throw trace_exception("Unknown event in trace");
+        }
+        event = B_TraceEvent{static_cast<B_TraceKind>(kind), B_TraceTag::Int, 0, 0, 0};
+        if (event.kind == B_TraceKind::Chunk)
+        {
+            char bytes[chunk_size];
+            if (!in.read(bytes, chunk_size))
+            {
+                throw trace_exception("Truncated trace");
+            }
+            std::memcpy(&event.a, bytes, sizeof(event.a));
+            std::memcpy(&event.b, bytes + sizeof(event.a), sizeof(event.b));
+            return true;
+        }
+        const auto tag = in.get();
+        if (tag == std::istream::traits_type::eof())
+        {
+            throw trace_exception("Truncated trace");
+        }
+        if (tag > static_cast<int>(B_TraceTag::Unsupported))
+        {
+            throw trace_exception("Unknown value in trace");
+        }
+        event.tag = static_cast<B_TraceTag>(tag);
+        event.aux = static_cast<uint32_t>(read_varint(in));
+        event.a = unzigzag(read_varint(in));
+        event.b = unzigzag(read_varint(in));
+        return true;
+    }
+
+    // Rebuild the value held by events[i] and its chunks, leaving i on the last event read
+    Value decode_value(const std::vector<B_TraceEvent>& events, size_t& i, B_Allocator& allocator)
+    {
+        const auto& event = events[i];
+        switch (event.tag)
+        {
+            case B_TraceTag::Int:
+                return event.a;
+            case B_TraceTag::Float:
+                return std::bit_cast<_Float64>(event.a);
+            case B_TraceTag::Bool:
+                return event.a != 0;
+            case B_TraceTag::Null:
+                return static_cast<B_Object*>(nullptr);
+            case B_TraceTag::String:
+            {
+                std::string s(event.a, '\0');
+                for (size_t offset = 0; offset < s.size(); offset += chunk_size)
+                {
+                    if (++i >= events.size() || events[i].kind != B_TraceKind::Chunk)
+                    {
+                        throw trace_exception("Truncated string in trace");
+                    }
+                    std::memcpy(s.data() + offset, &events[i].a, std::min(chunk_size, s.size() - offset));
+                }
+                return allocator.alloc(s);
+            }
+            default:
+                throw trace_exception("The trace does not hold the value of this input");
+        }
+    }
+
+    // Recorded host call results, handed out in order by the replay stubs
+    struct B_ReplayInputs
+    {
+        // Owns the recorded strings, which the VM does not collect, as if the host had allocated them
+        B_Allocator allocator;
+        std::vector<std::pair<int16_t, Value>> results;
+        size_t next {0};
+    };
+}
+
+B_TraceRecorder::B_TraceRecorder(const std::string& path, size_t capacity, std::chrono::milliseconds flush_interval)
+: ring(capacity), out(path, std::ios::binary | std::ios::trunc), flush_interval(flush_interval)
+{
+    if (!out)
+    {
+        throw trace_exception("Can not open trace file " + path);
+    }
+    out.write(magic, sizeof(magic));
+}
+
+B_TraceRecorder::~B_TraceRecorder()
+{
+    stop();
+}
+
+void B_TraceRecorder::start(VM& vm)
+{
+    this->vm = &vm;
+    // The flusher runs first, since recording the globals may wait for it
+    running = true;
+    flusher = std::thread([this]{flush_loop();});
+    for (size_t idx = 0; idx < vm.globals.size(); ++idx)
+    {
+        append_value(B_TraceKind::Global, idx, 0, vm.globals[idx]);
+    }
+    if (vm.ip < static_cast<int64_t>(vm.instructions.size()))
+    {
+        block(vm.ip);
+    }
+    vm.trace = this;
+}
+
+void B_TraceRecorder::stop()
+{
+    if (!running)
+    {
+        return;
+    }
+    vm->trace = nullptr;
+    {
+        std::lock_guard guard(wake_lock);
+        running = false;
+    }
+    wake.notify_one();
+    flusher.join();
+    drain();
+    // The ring is empty now: the last marker fits
+    mark_dropped();
+    drain();
+    out.flush();
+}
+
+void B_TraceRecorder::append(const B_TraceEvent& event)
+{
+    if (!mark_dropped() || !ring.push(event))
+    {
+        ++(event.kind == B_TraceKind::Block ? dropped_blocks : dropped_collections);
+        dropped_events.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool B_TraceRecorder::mark_dropped()
+{
+    if (dropped_blocks == 0 && dropped_collections == 0)
+    {
+        return true;
+    }
+    if (!ring.push(B_TraceEvent{B_TraceKind::Dropped, B_TraceTag::Int, 0, dropped_blocks, dropped_collections}))
+    {
+        return false;
+    }
+    dropped_blocks = 0;
+    dropped_collections = 0;
+    return true;
+}
+
+void B_TraceRecorder::wait_for_room()
+{
+    // The VM thread never takes wake_lock: a wake-up missed here costs one flush interval at most
+    room_wanted.store(true, std::memory_order_release);
+    wake.notify_one();
+    std::this_thread::yield();
+}
+
+void B_TraceRecorder::append_value(B_TraceKind kind, uint32_t aux, int64_t b, const Value& v)
+{
+    scratch.clear();
+    scratch.push_back(B_TraceEvent{kind, B_TraceTag::Unsupported, aux, 0, b});
+    auto& event = scratch.back();
+    if (auto* i = std::get_if<int64_t>(&v))
+    {
+        event.tag = B_TraceTag::Int;
+        event.a = *i;
+    } else if (auto* f = std::get_if<_Float64>(&v))
+    {
+        event.tag = B_TraceTag::Float;
+        event.a = std::bit_cast<int64_t>(*f);
+    } else if (auto* flag = std::get_if<bool>(&v))
+    {
+        event.tag = B_TraceTag::Bool;
+        event.a = *flag;
+    } else if (std::get<B_Object*>(v) == nullptr)
+    {
+        event.tag = B_TraceTag::Null;
+    } else if (auto chars = as_string_view(v))
+    {
+        event.tag = B_TraceTag::String;
+        event.a = static_cast<int64_t>(chars->size());
+        for (size_t offset = 0; offset < chars->size(); offset += chunk_size)
+        {
+            B_TraceEvent chunk {B_TraceKind::Chunk, B_TraceTag::Int, 0, 0, 0};
+            std::memcpy(&chunk.a, chars->data() + offset, std::min(chunk_size, chars->size() - offset));
+            scratch.push_back(chunk);
+        }
+    }
+    // Inputs are never dropped: a value longer than the ring goes in pieces, in order since only this thread pushes
+    while (!mark_dropped())
+    {
+        wait_for_room();
+    }
+    for (size_t done = 0; done < scratch.size();)
+    {
+        const auto count = std::min(scratch.size() - done, ring.capacity());
+        if (ring.push(std::span<const B_TraceEvent>(scratch.data() + done, count)))
+        {
+            done += count;
+        } else
+        {
+            wait_for_room();
+        }
+    }
+}
+
+void B_TraceRecorder::flush_loop()
+{
+    std::unique_lock lock(wake_lock);
+    while (running)
+    {
+        lock.unlock();
+        room_wanted.store(false, std::memory_order_relaxed);
+        drain();
+        lock.lock();
+        wake.wait_for(lock, flush_interval, [this]{return !running || room_wanted.load(std::memory_order_acquire);});
+    }
+}
+
+void B_TraceRecorder::drain()
+{
+    B_TraceEvent event;
+    while (ring.pop(event))
+    {
+        write_event(out, event);
+    }
+}
+
+B_Trace B_Trace::read(std::istream& in)
+{
+    char header[sizeof(magic)];
+    if (!in.read(header, sizeof(header)) || std::memcmp(header, magic, sizeof(magic)) != 0)
+    {
+        throw trace_exception("Not a trace");
+    }
+    B_Trace trace;
+    B_TraceEvent event;
+    while (read_event(in, event))
+    {
+        trace.events.push_back(event);
+    }
+    return trace;
+}
+
+std::vector<int64_t> B_Trace::blocks() const
+{
+    std::vector<int64_t> result;
+    for (const auto& event: events)
+    {
+        if (event.kind == B_TraceKind::Block)
+        {
+            result.push_back(event.a);
+        }
+    }
+    return result;
+}
+
+std::vector<uint64_t> B_Trace::collections() const
+{
+    std::vector<uint64_t> result;
+    for (const auto& event: events)
+    {
+        if (event.kind == B_TraceKind::Gc)
+        {
+            result.push_back(static_cast<uint64_t>(event.a));
+        }
+    }
+    return result;
+}
+
+uint64_t B_Trace::dropped() const
+{
+    uint64_t result = 0;
+    for (const auto& event: events)
+    {
+        if (event.kind == B_TraceKind::Dropped)
+        {
+            result += static_cast<uint64_t>(event.a + event.b) + event.aux;
+        }
+    }
+    return result;
+}
+
+std::unique_ptr<VM> B_Trace::replay(const ByteCode& code) const
+{
+    for (const auto& event: events)
+    {
+        if (event.kind == B_TraceKind::Dropped && event.aux > 0)
+        {
+            // Later results would be handed to earlier calls
+            throw trace_exception("The trace lost inputs and can not be replayed");
+        }
+    }
+    auto vm = std::make_unique<VM>(code);
+    auto inputs = std::make_shared<B_ReplayInputs>();
+    std::vector<int> arities;
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const auto& event = events[i];
+        if (event.kind == B_TraceKind::Global)
+        {
+            if (vm->globals.size() <= event.aux)
+            {
+                vm->globals.resize(event.aux + 1, Value{int64_t{0}});
+            }
+            vm->globals[event.aux] = decode_value(events, i, *vm->bgc.allocator);
+        } else if (event.kind == B_TraceKind::HostResult)
+        {
+            if (arities.size() <= event.aux)
+            {
+                arities.resize(event.aux + 1, 0);
+            }
+            arities[event.aux] = static_cast<int>(event.b);
+            inputs->results.emplace_back(event.aux, decode_value(events, i, inputs->allocator));
+        }
+    }
+    for (size_t idx = 0; idx < arities.size(); ++idx)
+    {
+        vm->register_host_function("replay", arities[idx], [inputs, idx](std::span<const Value>){
+            if (inputs->next >= inputs->results.size() || inputs->results[inputs->next].first != static_cast<int16_t>(idx))
+            {
+                throw trace_exception("Replay diverged from the trace at host function " + std::to_string(idx));
+            }
+            return B_HostResult(inputs->results[inputs->next++].second);
+        });
+    }
+    return vm;
+}
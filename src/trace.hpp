@@ -0,0 +1,214 @@
+/**
+ * Execution traces, to reproduce offline what a script did in production.
+ *
+ * While a B_TraceRecorder is attached the VM appends an event for each basic block it enters,
+ * each value the host hands it (the globals when recording starts, host call results)
+ * and each collection that frees objects. Events go into a lock-free single producer, single consumer ring
+ * that a background thread flushes to a file. When the ring is full, block and collection events are
+ * dropped rather than stalling the VM, and a Dropped event records how many before the next one gets in;
+ * inputs are never dropped, the VM waits for the flusher to make room for them.
+ *
+ * B_Trace reads a trace file back and builds a VM that runs the same ByteCode against
+ * the recorded inputs: the globals start as recorded and host calls return the recorded results.
+*/
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/object.hpp"
+
+struct VM;
+struct ByteCode;
+
+/**
+ * Bounded lock-free queue between one producer and one consumer thread.
+ * The capacity is rounded up to a power of two.
+*/
+template <typename T>
+class B_SpscRing
+{
+    public:
+    explicit B_SpscRing(size_t capacity) : slots(std::bit_ceil(std::max<size_t>(capacity, 2))), mask(slots.size() - 1) {};
+
+    // Append all of `items` or, when they do not fit, none of them. Producer only.
+    bool push(std::span<const T> items)
+    {
+        const auto t = tail.load(std::memory_order_relaxed);
+        if (t + items.size() - cached_head > slots.size())
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t + items.size() - cached_head > slots.size())
+            {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            slots[(t + i) & mask] = items[i];
+        }
+        tail.store(t + items.size(), std::memory_order_release);
+        return true;
+    }
+    bool push(const T& item) {return push(std::span<const T>(&item, 1));}
+
+    // Take the oldest item, if any. Consumer only.
+    bool pop(T& item)
+    {
+        const auto h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+            {
+                return false;
+            }
+        }
+        item = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const {return slots.size();}
+
+    private:
+    std::vector<T> slots;
+    size_t mask;
+    // Each index is written by one side; the cached copy of the other side's index saves a shared load
+    alignas(64) std::atomic<size_t> head {0};
+    size_t cached_tail {0};
+    alignas(64) std::atomic<size_t> tail {0};
+    size_t cached_head {0};
+};
+
+/**
+ * Events carrying a value hold it in `tag` and `a`; strings have their length in `a`
+ * and their bytes in the Chunk events that follow, 16 per event.
+*/
+enum class B_TraceKind : uint8_t
+{
+    // a: offset of the first instruction of the block
+    Block,
+    // aux: global index, with its value when recording started
+    Global,
+    // aux: host function index, b: its arity, with the value it returned
+    HostResult,
+    // A collection that freed something. a: objects freed, b: pause in nanoseconds
+    Gc,
+    Chunk,
+    // Events lost to a full ring before the next one. a: blocks, b: collections, aux: inputs
+    Dropped,
+};
+
+enum class B_TraceTag : uint8_t
+{
+    Int,
+    Float,
+    Bool,
+    Null,
+    String,
+    // Objects the trace can not hold; replaying them fails
+    Unsupported,
+};
+
+struct B_TraceEvent
+{
+    B_TraceKind kind;
+    B_TraceTag tag;
+    uint32_t aux;
+    int64_t a;
+    int64_t b;
+};
+
+class B_TraceRecorder
+{
+    public:
+    // Record into the file at `path`, flushing every `flush_interval`
+    B_TraceRecorder(const std::string& path, size_t capacity = 1 << 16, std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10));
+    ~B_TraceRecorder();
+
+    B_TraceRecorder(const B_TraceRecorder&) = delete;
+    B_TraceRecorder& operator=(const B_TraceRecorder&) = delete;
+
+    // Attach to `vm`, record its globals and the block it is about to run, and start the flushing thread
+    void start(VM& vm);
+    // Detach, flush what is left and close the file
+    void stop();
+
+    // Hooks called by the VM thread
+    void block(int64_t ip) {append({B_TraceKind::Block, B_TraceTag::Int, 0, ip, 0});}
+    void host_result(int16_t function, int arity, const Value& v) {append_value(B_TraceKind::HostResult, function, arity, v);}
+    void gc(uint64_t freed, std::chrono::nanoseconds pause) {append({B_TraceKind::Gc, B_TraceTag::Int, 0, static_cast<int64_t>(freed), pause.count()});}
+    uint64_t dropped() const {return dropped_events.load(std::memory_order_relaxed);}
+
+    private:
+    void append(const B_TraceEvent& event);
+    void append_value(B_TraceKind kind, uint32_t aux, int64_t b, const Value& v);
+    // Record the events dropped since the last marker, if any; false when the ring has no room for it
+    bool mark_dropped();
+    void wait_for_room();
+    void flush_loop();
+    void drain();
+
+    VM* vm {nullptr};
+    B_SpscRing<B_TraceEvent> ring;
+    std::ofstream out;
+    std::chrono::milliseconds flush_interval;
+    std::thread flusher;
+    // Only the flusher sleeps on it; the VM thread never takes the lock
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    bool running {false};
+    // Set by the VM thread waiting to record an input, so the flusher does not sleep its whole interval
+    std::atomic<bool> room_wanted {false};
+    std::atomic<uint64_t> dropped_events {0};
+    // Dropped since the last marker, VM thread only
+    int64_t dropped_blocks {0};
+    int64_t dropped_collections {0};
+    std::vector<B_TraceEvent> scratch;
+};
+
+class B_Trace
+{
+    public:
+    static B_Trace read(std::istream& in);
+
+    // Block entries in execution order
+    std::vector<int64_t> blocks() const;
+    // Objects freed by each collection
+    std::vector<uint64_t> collections() const;
+    // Events the recorder dropped, missing from blocks() and collections()
+    uint64_t dropped() const;
+    /**
+     * A VM running `code` against the recorded inputs. Host functions are replaced by stubs
+     * returning the recorded results in order; natives are not recorded and must be registered again.
+     * A trace that lost inputs can not be replayed.
+    */
+    std::unique_ptr<VM> replay(const ByteCode& code) const;
+
+    std::vector<B_TraceEvent> events;
+};
+
+class trace_exception
+{
+  std::string message;
+
+  public:
+  trace_exception(std::string msg) : message(msg) {};
+  std::string what() {return message;}
+};
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ * OpSetIndex: update an element of an array or a hash.
+ *
+ * A collection only referenced from the stack (B_Object::unique) is updated in place.
+ * Any other gets a new version: flat arrays and hashes switch to a persistent trie on their first update,
+ * so the following ones copy O(log n) nodes instead of the whole collection.
+*/
+#include <algorithm>
+
+#include "vm.hpp"
+
+namespace
+{
+    size_t checked_index(const Value& idx, size_t size)
+    {
+        auto* i = std::get_if<int64_t>(&idx);
+        if (i == nullptr || *i < 0 || static_cast<size_t>(*i) > size)
+        {
+            throw invalid_value("Index out of bounds in OpSetIndex");
+        }
+        return static_cast<size_t>(*i);
+    }
+
+    template <typename T>
+    B_Object* set_packed(B_PackedArray<T>* array, const Value& idx, const Value& value, B_Allocator& allocator)
+    {
+        const auto i = checked_index(idx, array->values.size());
+        if (array->unique() && std::holds_alternative<T>(value))
+        {
+            if (i == array->values.size())
+            {
+                array->values.push_back(std::get<T>(value));
+            } else
+            {
+                array->values[i] = std::get<T>(value);
+            }
+            return array;
+        }
+        PersistentVector<Value> vector(array->values.begin(), array->values.end());
+        vector.set_in_place(i, value);
+        return allocator.alloc(std::move(vector));
+    }
+
+    PersistentMap<Value, Value, VHash, VEqual> to_persistent(const std::unordered_map<Value, B_HashPair, VHash, VEqual>& values)
+    {
+        PersistentMap<Value, Value, VHash, VEqual> map;
+        for (const auto& [key, pair]: values)
+        {
+            map.set_in_place(pair.key, pair.value);
+        }
+        return map;
+    }
+}
+
+void share(const Value& v)
+{
+    if (auto* obj = std::get_if<B_Object*>(&v); obj != nullptr && *obj != nullptr)
+    {
+        (*obj)->set_unique(false);
+    }
+}
+
+void VM::executeSetIndex()
+{
+    const auto value = pop();
+    const auto idx = pop();
+    auto* target = std::get<B_Object*>(pop());
+    share(value);
+    auto* result = setIndex(target, idx, value);
+    result->set_unique(true);
+    push(result);
+}
+
+B_Object* VM::setIndex(B_Object* target, const Value& idx, const Value& value)
+{
+    auto& allocator = *bgc.allocator;
+    const auto in_place = target->unique();
+    if (auto* array = dynamic_cast<B_Array*>(target))
+    {
+        const auto i = checked_index(idx, array->values.size());
+        if (in_place)
+        {
+            if (i == array->values.size())
+            {
+                array->values.push_back(value);
+            } else
+            {
+                array->values[i] = value;
+            }
+            return array;
+        }
+        PersistentVector<Value> vector(array->values.begin(), array->values.end());
+        vector.set_in_place(i, value);
+        return allocator.alloc(std::move(vector));
+    } else if (auto* ints = dynamic_cast<B_IntArray*>(target))
+    {
+        return set_packed(ints, idx, value, allocator);
+    } else if (auto* floats = dynamic_cast<B_FloatArray*>(target))
+    {
+        return set_packed(floats, idx, value, allocator);
+    } else if (auto* vector = dynamic_cast<B_PVector*>(target))
+    {
+        const auto i = checked_index(idx, vector->values.size());
+        if (in_place)
+        {
+            vector->values.set_in_place(i, value);
+            return vector;
+        }
+        return allocator.alloc(vector->values.set(i, value));
+    }
+
+    // Hashes: reject the keys B_HashMap rejects
+    B_HashPair{idx, value};
+    if (auto* record = dynamic_cast<B_Record*>(target))
+    {
+        const auto* key = std::holds_alternative<B_Object*>(idx) ? dynamic_cast<B_String*>(std::get<B_Object*>(idx)) : nullptr;
+        const auto slot = key != nullptr ? record->shape->slot(key->value) : -1;
+        if (slot >= 0)
+        {
+            if (in_place)
+            {
+                record->values[slot] = value;
+                return record;
+            }
+            std::vector<Value> values(record->values.begin(), record->values.end());
+            values[slot] = value;
+            return allocator.alloc(record->shape, std::move(values));
+        } else if (key != nullptr && record->values.size() < max_record_keys)
+        {
+            // Shape transition: the same keys plus the new one
+            std::vector<std::string> keys;
+            for (const auto& k: record->shape->keys)
+            {
+                keys.emplace_back(k->value);
+            }
+            keys.emplace_back(key->value);
+            const auto* shape = allocator.shape(keys);
+            if (in_place)
+            {
+                record->shape = shape;
+                record->values.push_back(value);
+                return record;
+            }
+            std::vector<Value> values(record->values.begin(), record->values.end());
+            values.push_back(value);
+            return allocator.alloc(shape, std::move(values));
+        }
+        PersistentMap<Value, Value, VHash, VEqual> map;
+        for (size_t i = 0; i < record->values.size(); ++i)
+        {
+            map.set_in_place(record->shape->keys[i].get(), record->values[i]);
+        }
+        map.set_in_place(idx, value);
+        return allocator.alloc(std::move(map));
+    } else if (auto* hash = dynamic_cast<B_HashMap*>(target))
+    {
+        if (in_place)
+        {
+            hash->values.insert_or_assign(idx, B_HashPair{idx, value});
+            return hash;
+        }
+        auto map = to_persistent(hash->values);
+        map.set_in_place(idx, value);
+        return allocator.alloc(std::move(map));
+    } else if (auto* map = dynamic_cast<B_PMap*>(target))
+    {
+        if (in_place)
+        {
+            map->values.set_in_place(idx, value);
+            return map;
+        }
+        return allocator.alloc(map->values.set(idx, value));
+    }
+    throw invalid_value("Found a value that is not an array or a hash in OpSetIndex");
+}
@@ -1,15 +1,22 @@
-#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <limits>
 
+#include "heapdump.hpp"
+#include "kernels.hpp"
+#include "sampler.hpp"
+#include "trace.hpp"
 #include "vm.hpp"
 
 VM::VM(std::shared_ptr<B_Allocator> alloc) 
 : stack(std::array<Value, 256>()), constants(std::vector<Value>()), 
-instructions(std::vector<unsigned char>()), ip(0), sp(0), bgc(alloc)
+instructions(std::vector<unsigned char>()), ip(0), sp(0), bp(0), fp(0), instructions_executed(0), status(RunStatus::Yielded), bgc(alloc)
 {
 }
 
 VM::VM(const ByteCode& bc, std::shared_ptr<B_Allocator> alloc)
-: stack(std::array<Value, 256>()), constants(bc.constants), instructions(bc.instructions), ip(0), sp(0), bgc(alloc)
+: stack(std::array<Value, 256>()), constants(bc.constants), instructions(bc.instructions), ip(0), sp(0), bp(0), fp(0),
+instructions_executed(0), status(RunStatus::Yielded), bgc(alloc)
 {
 
 }
@@ -35,188 +42,698 @@ Value VM::pop()
 
 void VM::run()
 {
-    auto offset = 0;
-    while(ip < static_cast<int64_t>(instructions.size()))
+    if (execute(std::numeric_limits<int64_t>::max(), std::chrono::steady_clock::time_point::max()) == RunStatus::Waiting)
     {
-        ip += offset;
-        std::cout << "ip: " << ip << "\n";
-        auto op = instructions[ip];
-        auto byte_count = 0;
-        auto def = opDefinitions[op];
+        throw invalid_instruction("Host call " + host_functions[pending_host_function].name
+            + " is pending, use run_async() or run_for()");
+    }
+}
 
-        ++ip;
-        for (auto i = 0; i < def.numOperands; ++i)
+RunStatus VM::run_for(int64_t budget, std::chrono::steady_clock::time_point deadline)
+{
+    if (status != RunStatus::Yielded)
+    {
+        return status;
+    }
+    try
+    {
+        return execute(budget, deadline);
+    } catch (std::exception& e)
+    {
+        error = e.what();
+    } catch (invalid_instruction& e)
+    {
+        error = e.what();
+    } catch (invalid_value& e)
+    {
+        error = e.what();
+    } catch (not_implemented& e)
+    {
+        error = e.what();
+    }
+    status = RunStatus::Error;
+    return status;
+}
+
+B_Task VM::run_async()
+{
+    while (true)
+    {
+        auto result = run_for(std::numeric_limits<int64_t>::max());
+        if (result != RunStatus::Waiting)
         {
-            byte_count += def.operandsWidth[i];
+            co_return result;
         }
+        co_await *pending_host;
+        complete_host_call();
+    }
+}
 
-        switch (op)
+int16_t VM::register_host_function(std::string name, int arity, B_HostFunction function)
+{
+    host_functions.push_back(B_HostBinding{name, arity, function});
+    return static_cast<int16_t>(host_functions.size() - 1);
+}
+
+int16_t VM::register_native_function(std::string name, int arity, B_NativeFunction function)
+{
+    native_functions.push_back(B_NativeBinding{name, arity, function});
+    return static_cast<int16_t>(native_functions.size() - 1);
+}
+
+void VM::complete_host_call()
+{
+    if (trace != nullptr)
+    {
+        trace->host_result(pending_host_function, host_functions[pending_host_function].arity, pending_host->value());
+    }
+    push(pending_host->value());
+    pending_host.reset();
+    status = RunStatus::Yielded;
+}
+
+RunStatus VM::execute(int64_t budget, std::chrono::steady_clock::time_point deadline)
+{
+    if (indexed_generation != instructions_generation || instruction_ordinals.size() != instructions.size() + 1)
+    {
+        index_instructions();
+    }
+    budget_limit = instructions_executed > std::numeric_limits<int64_t>::max() - budget 
+        ? std::numeric_limits<int64_t>::max() 
+        : instructions_executed + budget;
+    budget_deadline = deadline;
+    B_SampleExit sample_exit {sample_point};
+
+    auto block_start = ip;
+    if (use_register_tier() && execute_registers(block_start))
+    {
+        return RunStatus::Yielded;
+    }
+    while(ip < static_cast<int64_t>(instructions.size()))
+    {
+        if (cache_top)
         {
-            case OpConstant:
+            if (execute_cached(block_start))
             {
-                auto operand_ref = ReadInt16({instructions[ip], instructions[ip+1]});
-                push(constants[operand_ref]);
-                break;
+                return RunStatus::Yielded;
             }
-            case OpTrue:
+            if (ip >= static_cast<int64_t>(instructions.size()))
             {
-                push(trueValue);
                 break;
             }
-            case OpFalse:
+        }
+        const auto op_start = ip;
+        const auto wide = instructions[ip] == OpWide;
+        if (wide && ++ip >= static_cast<int64_t>(instructions.size()))
+        {
+            throw invalid_instruction("Found OpWide at the end of the instructions");
+        }
+        auto op = instructions[ip];
+        BONSAI_PROFILE_INSTRUCTION(stats, op);
+        if (sample_point != nullptr)
+        {
+            sample_point->publish(op_start, fp);
+        }
+        ++ip;
+        B_Step next;
+        switch (op)
+        {
+#define BONSAI_DISPATCH(o, name, operands, pops, pushes) \
+            case o: \
+                next = wide ? step<o, true>(op_start, block_start) : step<o, false>(op_start, block_start); \
+                break;
+            BONSAI_INSTRUCTIONS(BONSAI_DISPATCH, variable_effect)
+#undef BONSAI_DISPATCH
+            default:
+                if (wide)
+                {
+                    throw invalid_instruction("Found OpWide before an unknown opcode");
+                }
+                next = B_Step::Next;
+                break;
+        }
+        switch (next)
+        {
+            case B_Step::Yield:
+                return RunStatus::Yielded;
+            case B_Step::Wait:
+                return status;
+            case B_Step::Jumped:
+                continue;
+            case B_Step::Next:
+                break;
+        }
+        if (auto_gc)
+        {
+            run_gc();
+        }
+    }
+    const auto end = std::min(ip, static_cast<int64_t>(instructions.size()));
+    instructions_executed += instruction_ordinals[end] - instruction_ordinals[std::min(block_start, end)];
+    status = RunStatus::Finished;
+    return status;
+}
+
+/**
+ * The instruction `Op`, prefixed by OpWide when `Wide`, with `ip` right after its opcode.
+ * Its width and operand decoding are constants of the instantiation, and so is the switch:
+ * each instantiation keeps only the case of `Op`.
+*/
+template <Operation Op, bool Wide>
+B_Step VM::step(int64_t op_start, int64_t& block_start)
+{
+    if constexpr (Wide && (opDefinitions[Op].numOperands == 0 || Op == OpWide))
+    {
+        throw invalid_instruction("Found OpWide before " + std::string(opDefinitions[Op].opName));
+    }
+    // Operand bytes after the opcode
+    constexpr auto byte_count = instruction_width(Op, Wide) - (Wide ? 2 : 1);
+    int32_t operand = 0;
+    if constexpr (opDefinitions[Op].numOperands > 0)
+    {
+        operand = read_operand<Op, Wide>(instructions, op_start);
+    }
+
+    switch (Op)
+    {
+        case OpConstant:
+        {
+            push(constants[operand]);
+            break;
+        }
+        case OpTrue:
+        {
+            push(trueValue);
+            break;
+        }
+        case OpFalse:
+        {
+            push(falseValue);
+            break;
+        }
+        case OpAdd:
+        case OpSub:
+        case OpMul:
+        case OpDiv:
+        {
+            executeBinaryOp(Op);
+            break;
+        }
+        case OpGreaterThan:
+        case OpEqual:
+        case OpGreaterEqual:
+        {
+            executeBinaryComparison(Op);
+            break;
+        }
+        case OpPop:
+            pop();
+            break;
+        case OpBang:
+        {
+            auto value = pop();
+            if(value == trueValue)
             {
                 push(falseValue);
-                break;
+            } else 
+            {
+                push(trueValue);
             }
-            case OpAdd:
-            case OpSub:
-            case OpMul:
-            case OpDiv:
+            break;
+        }
+        case OpUnaryMinus:
+        {
+            auto value = std::get<int64_t>(pop());
+            push(Value{-value});
+            break;
+        }
+        case OpJumpFalse:
+        {
+            auto top = pop();
+            int64_t jmp_offset = ip + byte_count - op_start;
+            if (top == falseValue) 
             {
-                executeBinaryOp(static_cast<Operation>(op));
-                break;
+                jmp_offset = operand;
             }
-            case OpGreaterThan:
-            case OpEqual:
-            case OpGreaterEqual:
+            ip = op_start + jmp_offset;
+            if (auto_gc)
             {
-                executeBinaryComparison(static_cast<Operation>(op));
-                break;
+                run_gc();
             }
-            case OpPop:
-                pop();
-                break;
-            case OpBang:
+            if (end_block(block_start, op_start, jmp_offset < 0))
             {
-                auto value = pop();
-                if(value == trueValue)
-                {
-                    push(falseValue);
-                } else 
-                {
-                    push(trueValue);
-                }
-                break;
+                return B_Step::Yield;
             }
-            case OpUnaryMinus:
+            block_start = ip;
+            return B_Step::Jumped;
+        }
+        case OpJump:
+        {
+            int64_t jmp_offset = operand;
+            ip = op_start + jmp_offset;
+            if (auto_gc)
             {
-                auto value = std::get<int64_t>(pop());
-                push(Value{-value});
-                break;
+                run_gc();
             }
-            case OpJumpFalse:
+            if (end_block(block_start, op_start, jmp_offset < 0))
             {
-                auto top = pop();
-                if (top == falseValue) 
-                {
-                    int64_t jmp_offset = static_cast<int64_t>(ReadInt16({instructions[ip], instructions[ip+1]}));
-                    ip += jmp_offset - 1 - byte_count;
-                }
-                break;
+                return B_Step::Yield;
             }
-            case OpJump:
+            block_start = ip;
+            return B_Step::Jumped;
+        }
+        case OpWriteGlobal:
+        {
+            auto top = pop();
+            int64_t idx = operand;
+            auto cmp = idx <=> static_cast<int64_t>(globals.size());
+            if(cmp < 0)
             {
-                int64_t jmp_offset = static_cast<int64_t>(ReadInt16({instructions[ip], instructions[ip+1]}));
-                ip += jmp_offset - 1 - byte_count;
-                break;
+                globals[idx] = top;
+            } else if (cmp == 0)
+            {
+                globals.push_back(top);
+            } else
+            {
+                throw global_index_too_large_exception();
             }
-            case OpWriteGlobal:
+            break;
+        }
+        case OpReadGlobal:
+        {
+            int64_t idx = operand;
+            if(idx < static_cast<int64_t>(globals.size()))
             {
-                auto top = pop();
-                int64_t idx = static_cast<int64_t>(ReadInt16({instructions[ip], instructions[ip+1]}));
-                auto cmp = idx <=> static_cast<int64_t>(globals.size());
-                if(cmp < 0)
-                {
-                    globals[idx] = top;
-                } else if (cmp == 0)
-                {
-                    globals.push_back(top);
-                } else
-                {
-                    throw global_index_too_large_exception();
-                }
-                break;
+                share(globals[idx]);
+                push(globals[idx]);
+            } else
+            {
+                throw global_index_too_large_exception();
             }
-            case OpReadGlobal:
+            break;
+        }
+        case OpArray:
+        {
+            const auto num_values = operand;
+            if (num_values > sp + 1)
             {
-                int64_t idx = static_cast<int64_t>(ReadInt16({instructions[ip], instructions[ip+1]}));
-                if(idx < static_cast<int64_t>(globals.size()))
-                {
-                    push(globals[idx]);
-                } else
+                throw empty_stack_exception();
+            } else 
+            {
+                const auto start_elem = sp - num_values;
+                B_Object* arr = makeArray(stack.begin()+start_elem, stack.begin() + sp);
+                for (int i = 0, d = num_values; i < d; ++i)
                 {
-                    throw global_index_too_large_exception();
+                    pop();
                 }
-                break;
+                push(arr);
             }
-            case OpArray:
+            break;
+        }
+        case OpHash:
+        {
+            const auto num_values = operand;
+            if (num_values > sp + 1)
             {
-                const auto num_values = ReadInt16({instructions[ip], instructions[ip+1]});
-                if (num_values > sp + 1)
-                {
-                    throw empty_stack_exception();
-                } else 
-                {
-                    const auto start_elem = sp - num_values;
-                    B_Object* arr = bgc.allocator->alloc(stack.begin()+start_elem, stack.begin() + sp);
-                    for (int i = 0, d = num_values; i < d; ++i)
-                    {
-                        pop();
-                    }
-                    push(arr);
-                }
-                break;
+                throw empty_stack_exception();
+            } else if (num_values % 2 == 1)
+            {
+                throw invalid_value(std::string("num_values must be an even value, found " + num_values));
             }
-            case OpHash:
             {
-                const auto num_values = ReadInt16({instructions[ip], instructions[ip+1]});
-                if (num_values > sp + 1)
+                const auto start_elem = sp - num_values;
+                B_Object* hm = makeHash(stack.begin() + start_elem, stack.begin() + sp);
+                for (int i = 0, d = num_values; i < d; ++i)
                 {
-                    throw empty_stack_exception();
-                } else if (num_values % 2 == 1)
-                {
-                    throw invalid_value(std::string("num_values must be an even value, found " + num_values));
+                    pop();
                 }
-                {
-                    const auto start_elem = sp - num_values;
-                    std::vector<B_HashPair> pairs{};
-                    for (auto i = start_elem; i - start_elem < num_values; i += 2)
-                    {
-                        pairs.emplace_back(stack[i], stack[i+1]);
-                    }
-                    B_Object* hm = bgc.allocator->alloc(&(*pairs.begin()), &(*pairs.end()));
-                    for (int i = 0, d = num_values; i < d; ++i)
-                    {
-                        pop();
-                    }
-                    push(hm);
-                }
-                break;
+                push(hm);
             }
-            case OpIndex:
+            break;
+        }
+        case OpIndex:
+        {
+            const auto idx = pop();
+            const auto top = std::get<B_Object*>(pop());
+            if (auto* obj = dynamic_cast<B_Record*>(top))
             {
-                const auto idx = pop();
-                const auto top = std::get<B_Object*>(pop());
-                if (auto* obj = dynamic_cast<B_Array*>(top))
-                {
-                    push(obj->values[std::get<int64_t>(idx)]);
-                } else if (auto* obj = dynamic_cast<B_HashMap*>(top))
+                push(indexRecord(obj, idx, op_start));
+            } else if (auto* obj = dynamic_cast<B_Array*>(top))
+            {
+                push(obj->values[std::get<int64_t>(idx)]);
+            } else if (auto* obj = dynamic_cast<B_HashMap*>(top))
+            {
+                push(obj->values[idx].value);
+            } else if (auto* obj = dynamic_cast<B_Slice*>(top))
+            {
+                push(obj->at(std::get<int64_t>(idx)));
+            } else if (auto* obj = dynamic_cast<B_PVector*>(top))
+            {
+                push(obj->values[std::get<int64_t>(idx)]);
+            } else if (auto* obj = dynamic_cast<B_PMap*>(top))
+            {
+                const auto* value = obj->values.find(idx);
+                push(value != nullptr ? *value : Value{static_cast<B_Object*>(nullptr)});
+            } else if (auto* obj = dynamic_cast<B_IntArray*>(top))
+            {
+                push(obj->values[std::get<int64_t>(idx)]);
+            } else if (auto* obj = dynamic_cast<B_FloatArray*>(top))
+            {
+                push(obj->values[std::get<int64_t>(idx)]);
+            }
+            break;
+        }
+        case OpSetIndex:
+        {
+            executeSetIndex();
+            break;
+        }
+        case OpSelect:
+        case OpSelectKey:
+        {
+            executeSelect(Op, operand);
+            break;
+        }
+        case OpSlice:
+        {
+            executeSlice();
+            break;
+        }
+        case OpArraySum:
+        case OpArrayMin:
+        case OpArrayMax:
+        case OpArrayAdd:
+        case OpArrayMul:
+        case OpArrayDot:
+        {
+            executeBulkOp(Op);
+            break;
+        }
+        case OpArrayMap:
+        case OpArrayFilter:
+        case OpArrayReduce:
+        case OpArraySort:
+        case OpArrayBinarySearch:
+        {
+            executeCollectionOp(Op, operand);
+            break;
+        }
+        case OpCallHost:
+        {
+            const auto idx = operand;
+            if (idx < 0 || idx >= static_cast<int32_t>(host_functions.size()))
+            {
+                throw invalid_value("Unknown host function " + std::to_string(idx));
+            }
+            const auto& binding = host_functions[idx];
+            if (binding.arity > sp)
+            {
+                throw empty_stack_exception();
+            }
+            std::for_each(stack.begin() + sp - binding.arity, stack.begin() + sp, share);
+            auto result = binding.function(std::span<const Value>(stack.begin() + sp - binding.arity, binding.arity));
+            sp -= binding.arity;
+            if (!result.ready())
+            {
+                ip += byte_count;
+                instructions_executed += instruction_ordinals[op_start] - instruction_ordinals[block_start] + 1;
+                pending_host = result;
+                pending_host_function = idx;
+                status = RunStatus::Waiting;
+                return B_Step::Wait;
+            }
+            if (trace != nullptr)
+            {
+                trace->host_result(idx, binding.arity, result.value());
+            }
+            push(result.value());
+            break;
+        }
+        case OpCall:
+        case OpTailCall:
+        {
+            const auto argc = operand;
+            auto* function = callee(argc);
+            if (Op == OpTailCall && fp > 0)
+            {
+                // Slide the callee and its arguments over the current frame and reuse it
+                std::copy(stack.begin() + sp - argc - 1, stack.begin() + sp, stack.begin() + bp - 1);
+                sp = bp + argc;
+            } else
+            {
+                if (fp >= static_cast<int64_t>(frames.size()))
                 {
-                    push(obj->values[idx].value);
+                    throw call_depth_exception();
                 }
+                frames[fp++] = B_Frame{ip + byte_count, bp, op_start};
+                bp = sp - argc;
             }
-            default:
-                break;
+            if (bp + function->num_locals >= static_cast<int64_t>(stack.size()))
+            {
+                throw full_stack_exception();
+            }
+            std::fill(stack.begin() + sp, stack.begin() + bp + function->num_locals, Value{int64_t{0}});
+            sp = bp + function->num_locals;
+            ip = function->entry;
+            if (auto_gc)
+            {
+                run_gc();
+            }
+            if (end_block(block_start, op_start, ip <= op_start))
+            {
+                return B_Step::Yield;
+            }
+            block_start = ip;
+            return B_Step::Jumped;
+        }
+        case OpReturn:
+        {
+            if (fp == 0)
+            {
+                throw invalid_instruction("Found OpReturn outside of a function");
+            }
+            const auto result = pop();
+            const auto frame = frames[--fp];
+            // Drop the locals and the callee itself
+            sp = bp - 1;
+            bp = frame.bp;
+            ip = frame.return_ip;
+            push(result);
+            if (auto_gc)
+            {
+                run_gc();
+            }
+            if (end_block(block_start, op_start, ip <= op_start))
+            {
+                return B_Step::Yield;
+            }
+            block_start = ip;
+            return B_Step::Jumped;
+        }
+        case OpGetLocal:
+        {
+            const auto slot = localSlot(operand);
+            share(stack[slot]);
+            push(stack[slot]);
+            break;
+        }
+        case OpSetLocal:
+        {
+            auto top = pop();
+            stack[localSlot(operand)] = top;
+            break;
+        }
+        case OpCallNative:
+        {
+            const auto idx = operand;
+            if (idx < 0 || idx >= static_cast<int32_t>(native_functions.size()))
+            {
+                throw invalid_value("Unknown native function " + std::to_string(idx));
+            }
+            const auto& binding = native_functions[idx];
+            if (binding.arity > sp)
+            {
+                throw empty_stack_exception();
+            } else if (binding.arity == 0)
+            {
+                // Slot for the result
+                push(falseValue);
             }
-        ip += byte_count;
-        run_gc();
+            const auto base = sp - std::max(binding.arity, 1);
+            binding.function(std::span<Value>(stack.begin() + base, sp - base), *bgc.allocator);
+            sp = base + 1;
+            break;
+        }
+        default:
+            break;
+    }
+    ip += byte_count;
+    return B_Step::Next;
+}
+
+/**
+ * Charge the instructions of the block [block_start, block_end] and tell whether the budget is spent.
+ * The clock is read only on back-edges, which is where a script can spin forever.
+*/
+bool VM::end_block(int64_t block_start, int64_t block_end, bool back_edge)
+{
+    instructions_executed += instruction_ordinals[block_end] - instruction_ordinals[block_start] + 1;
+    // The next block is recorded even when the VM yields before running it, so resuming records nothing
+    if (trace != nullptr && ip < static_cast<int64_t>(instructions.size()))
+    {
+        trace->block(ip);
+    }
+    if (instructions_executed >= budget_limit)
+    {
+        return true;
+    }
+    return back_edge 
+        && budget_deadline != std::chrono::steady_clock::time_point::max() 
+        && std::chrono::steady_clock::now() >= budget_deadline;
+}
+
+/**
+ * The function called with `argc` arguments, which sits in the stack right below them.
+*/
+B_Function* VM::callee(int64_t argc)
+{
+    if (argc < 0 || argc + 1 > sp)
+    {
+        throw empty_stack_exception();
+    }
+    auto* const* obj = std::get_if<B_Object*>(&stack[sp - argc - 1]);
+    auto* function = obj != nullptr ? dynamic_cast<B_Function*>(*obj) : nullptr;
+    if (function == nullptr)
+    {
+        throw invalid_value("Found a value that is not a function in OpCall");
     }
+    if (function->num_locals < function->arity)
+    {
+        throw invalid_value("Function has fewer locals than arguments");
+    }
+    if (function->arity != argc)
+    {
+        throw invalid_value("Function expects " + std::to_string(function->arity) + " arguments, found " + std::to_string(argc));
+    }
+    return function;
+}
+
+int64_t VM::localSlot(int32_t idx) const
+{
+    if (idx < 0 || bp + idx >= sp)
+    {
+        throw invalid_value("Local slot " + std::to_string(idx) + " is outside of the current frame");
+    }
+    return bp + idx;
+}
+
+/**
+ * Load `key` from a record. A cache hit is a direct slot load, a miss looks the key up in the shape
+ * and refills the cache of the site. Missing keys read as null, like in B_HashMap.
+*/
+Value VM::indexRecord(const B_Record* record, const Value& key, int64_t op_start)
+{
+    auto& cache = index_caches[op_start];
+    auto* const* key_obj = std::get_if<B_Object*>(&key);
+    if (key_obj != nullptr && cache.shape == record->shape && cache.key == *key_obj)
+    {
+        return record->values[cache.slot];
+    }
+    auto* key_str = key_obj != nullptr ? dynamic_cast<B_String*>(*key_obj) : nullptr;
+    const auto slot = key_str != nullptr ? record->shape->slot(key_str->value) : -1;
+    if (slot < 0)
+    {
+        return Value{static_cast<B_Object*>(nullptr)};
+    }
+    const auto site_key = index_keys[op_start];
+    if (site_key >= 0 && site_key < static_cast<int64_t>(constants.size()) && constants[site_key] == key)
+    {
+        cache = B_InlineCache{record->shape, key_str, slot};
+    }
+    return record->values[slot];
 }
 
+/**
+ * OpIndex on an array, or a hash, that escape analysis elided (see escape.hpp): its `count` elements,
+ * or keys and values, are still on the stack below the index. Hash keys are checked as OpHash would,
+ * and the last pair with the key wins.
+*/
+void VM::executeSelect(Operation op, int32_t count)
+{
+    const auto idx = pop();
+    if (count < 0 || count > sp)
+    {
+        throw empty_stack_exception();
+    }
+    const auto first = stack.begin() + sp - count;
+    Value result {static_cast<B_Object*>(nullptr)};
+    if (op == OpSelect)
+    {
+        const auto i = std::get<int64_t>(idx);
+        if (i < 0 || i >= count)
+        {
+            throw invalid_value("Index out of the array bounds");
+        }
+        result = first[i];
+    } else
+    {
+        auto* const* idx_obj = std::get_if<B_Object*>(&idx);
+        auto* idx_str = idx_obj != nullptr && *idx_obj != nullptr ? dynamic_cast<B_String*>(*idx_obj) : nullptr;
+        for (auto it = first; it < stack.begin() + sp; it += 2)
+        {
+            const B_HashPair pair {*it, *(it + 1)};
+            auto* const* key_obj = std::get_if<B_Object*>(&pair.key);
+            const auto match = key_obj != nullptr
+                ? idx_str != nullptr && dynamic_cast<B_String*>(*key_obj)->value == idx_str->value
+                : pair.key == idx;
+            if (match)
+            {
+                result = pair.value;
+            }
+        }
+    }
+    sp -= count;
+    push(result);
+}
+
+void VM::index_instructions()
+{
+    indexed_generation = instructions_generation;
+    instruction_ordinals.assign(instructions.size() + 1, 0);
+    index_caches.assign(instructions.size(), B_InlineCache{});
+    index_keys.assign(instructions.size(), -1);
+    int32_t ordinal = 0;
+    size_t previous = instructions.size();
+    for (size_t i = 0; i < instructions.size();)
+    {
+        const auto width = static_cast<size_t>(instruction_width(instructions, i));
+        for (size_t k = i; k < i + width && k < instructions.size(); ++k)
+        {
+            instruction_ordinals[k] = ordinal;
+        }
+        // A jump may still reach the site with another key: indexRecord compares it with the constant
+        const auto constant_before = previous < i && instructions[previous + (instructions[previous] == OpWide ? 1 : 0)] == OpConstant;
+        if (instructions[i] == OpIndex && constant_before)
+        {
+            index_keys[i] = read_operand(instructions, previous);
+        }
+        ++ordinal;
+        previous = i;
+        i += width;
+    }
+    instruction_ordinals[instructions.size()] = ordinal;
+}
+
+
 void VM::executeBinaryOp(Operation op)
 {
-    Value operand_right_ = pop();
-    Value operand_left_ = pop();
+    Value operand_right = pop();
+    Value operand_left = pop();
+    push(binaryOp(op, operand_left, operand_right, *bgc.allocator));
+}
+
+Value binaryOp(Operation op, const Value& operand_left_, const Value& operand_right_, B_Allocator& allocator)
+{
     Value value;
     switch(op)
     {
@@ -229,9 +746,14 @@ void VM::executeBinaryOp(Operation op)
                 value = operand_left + operand_right;
             } else if (std::holds_alternative<B_Object*>(operand_left_) && std::holds_alternative<B_Object*>(operand_right_))
             {
-                auto operand_left = std::get<B_Object*>(operand_left_);
-                auto operand_right = std::get<B_Object*>(operand_right_);
-                value = Value(bgc.allocator->alloc(dynamic_cast<B_String*>(operand_left)->value + dynamic_cast<B_String*>(operand_right)->value));
+                // Strings and string slices
+                auto operand_left = as_string_view(operand_left_);
+                auto operand_right = as_string_view(operand_right_);
+                if (!operand_left || !operand_right)
+                {
+                    throw invalid_value("OpAdd can only concatenate strings");
+                }
+                value = Value(allocator.concat(*operand_left, *operand_right));
             }
             break;
         }
@@ -257,16 +779,208 @@ void VM::executeBinaryOp(Operation op)
             break;
         }
         default:
-            auto def = opDefinitions[op];
-            throw invalid_instruction("Found instruction " + def.opName);
+            const auto& def = opDefinitions[op];
+            throw invalid_instruction("Found instruction " + std::string(def.opName));
+    }
+    return value;
+}
+
+namespace
+{
+    template <typename T>
+    Value reduce_packed(Operation op, std::span<const T> values)
+    {
+        if (op == OpArraySum)
+        {
+            return Value{kernels::sum(values.data(), values.size())};
+        } else if (values.empty())
+        {
+            throw invalid_value("Found empty packed array in " + std::string(opDefinitions[op].opName));
+        }
+        return op == OpArrayMin 
+            ? Value{kernels::min(values.data(), values.size())} 
+            : Value{kernels::max(values.data(), values.size())};
+    }
+
+    template <typename T>
+    Value combine_packed(Operation op, std::span<const T> left, std::span<const T> right, B_Allocator& allocator)
+    {
+        if (left.size() != right.size())
+        {
+            throw invalid_value("Found packed arrays of different lengths in " + std::string(opDefinitions[op].opName));
+        }
+        if (op == OpArrayDot)
+        {
+            return Value{kernels::dot(left.data(), right.data(), left.size())};
+        }
+        std::vector<T> result(left.size());
+        if (op == OpArrayAdd)
+        {
+            kernels::add(left.data(), right.data(), result.data(), left.size());
+        } else
+        {
+            kernels::mul(left.data(), right.data(), result.data(), left.size());
+        }
+        return Value{allocator.alloc(std::move(result))};
+    }
+}
+
+/**
+ * Build an array from [first, last), packed when all the elements are integers or all are floats.
+*/
+B_Object* VM::makeArray(Value* first, Value* last)
+{
+    auto* array = packArray(first, last);
+    array->set_unique(true);
+    return array;
+}
+
+B_Object* VM::packArray(Value* first, Value* last)
+{
+    if (first != last && std::all_of(first, last, [](const Value& v){return std::holds_alternative<int64_t>(v);}))
+    {
+        std::vector<int64_t> values;
+        values.reserve(last - first);
+        std::transform(first, last, std::back_inserter(values), [](const Value& v){return std::get<int64_t>(v);});
+        return bgc.allocator->alloc(std::move(values));
+    } else if (first != last && std::all_of(first, last, [](const Value& v){return std::holds_alternative<_Float64>(v);}))
+    {
+        std::vector<_Float64> values;
+        values.reserve(last - first);
+        std::transform(first, last, std::back_inserter(values), [](const Value& v){return std::get<_Float64>(v);});
+        return bgc.allocator->alloc(std::move(values));
+    }
+    std::for_each(first, last, share);
+    return bgc.allocator->alloc(first, last);
+}
+
+B_Object* VM::makeHash(Value* first, Value* last)
+{
+    const auto num_pairs = static_cast<size_t>(last - first) / 2;
+    std::vector<std::string> keys;
+    std::vector<Value> values;
+    for (auto* it = first; num_pairs > 0 && num_pairs <= max_record_keys && it < last; it += 2)
+    {
+        auto* const* obj = std::get_if<B_Object*>(it);
+        auto* key = obj != nullptr ? dynamic_cast<B_String*>(*obj) : nullptr;
+        if (key == nullptr || std::find(keys.begin(), keys.end(), key->value) != keys.end())
+        {
+            break;
+        }
+        keys.emplace_back(key->value);
+        values.push_back(*(it + 1));
+    }
+    std::for_each(first, last, share);
+    B_Object* hash = nullptr;
+    if (num_pairs > 0 && keys.size() == num_pairs)
+    {
+        hash = bgc.allocator->alloc(bgc.allocator->shape(keys), std::move(values));
+    } else
+    {
+        std::vector<B_HashPair> pairs{};
+        for (auto* it = first; it < last; it += 2)
+        {
+            pairs.emplace_back(*it, *(it + 1));
+        }
+        hash = bgc.allocator->alloc(pairs.data(), pairs.data() + pairs.size());
+    }
+    hash->set_unique(true);
+    return hash;
+}
+
+/**
+ * OpSlice: [string or array, start, end] -> slice of [start, end) sharing the storage of the target.
+ * A slice of a slice refers to the original parent. Persistent vectors have no contiguous storage and are copied.
+*/
+void VM::executeSlice()
+{
+    const auto end = pop();
+    const auto start = pop();
+    const auto target = pop();
+    auto* obj = std::get<B_Object*>(target);
+    B_Object* parent = obj;
+    size_t offset = 0;
+    size_t length = 0;
+    if (auto* slice = dynamic_cast<B_Slice*>(obj))
+    {
+        parent = slice->parent;
+        offset = slice->offset;
+        length = slice->length;
+    } else if (auto* str = dynamic_cast<B_String*>(obj))
+    {
+        length = str->value.size();
+    } else if (auto* array = dynamic_cast<B_Array*>(obj))
+    {
+        length = array->values.size();
+    } else if (auto* ints = dynamic_cast<B_IntArray*>(obj))
+    {
+        length = ints->values.size();
+    } else if (auto* floats = dynamic_cast<B_FloatArray*>(obj))
+    {
+        length = floats->values.size();
+    } else if (dynamic_cast<B_PVector*>(obj))
+    {
+        auto values = get_array(target);
+        parent = makeArray(values.data(), values.data() + values.size());
+        length = values.size();
+    } else
+    {
+        throw invalid_value("Found a value that is not a string or an array in OpSlice");
+    }
+    auto* first = std::get_if<int64_t>(&start);
+    auto* last = std::get_if<int64_t>(&end);
+    if (first == nullptr || last == nullptr || *first < 0 || *first > *last || static_cast<size_t>(*last) > length)
+    {
+        throw invalid_value("Slice bounds out of range");
+    }
+    push(bgc.allocator->alloc(parent, offset + *first, *last - *first));
+}
+
+void VM::executeBulkOp(Operation op)
+{
+    if (op == OpArraySum || op == OpArrayMin || op == OpArrayMax)
+    {
+        auto* operand = std::get<B_Object*>(pop());
+        if (auto* ints = dynamic_cast<B_IntArray*>(operand))
+        {
+            push(reduce_packed<int64_t>(op, ints->values));
+        } else if (auto* floats = dynamic_cast<B_FloatArray*>(operand))
+        {
+            push(reduce_packed<_Float64>(op, floats->values));
+        } else
+        {
+            throw invalid_value("Found a value that is not a packed array in " + std::string(opDefinitions[op].opName));
+        }
+        return;
+    }
+
+    auto* operand_right = std::get<B_Object*>(pop());
+    auto* operand_left = std::get<B_Object*>(pop());
+    if (auto* ints_left = dynamic_cast<B_IntArray*>(operand_left), *ints_right = dynamic_cast<B_IntArray*>(operand_right);
+        ints_left && ints_right)
+    {
+        push(combine_packed<int64_t>(op, ints_left->values, ints_right->values, *bgc.allocator));
+    } else if (auto* floats_left = dynamic_cast<B_FloatArray*>(operand_left), *floats_right = dynamic_cast<B_FloatArray*>(operand_right);
+        floats_left && floats_right)
+    {
+        push(combine_packed<_Float64>(op, floats_left->values, floats_right->values, *bgc.allocator));
+    } else
+    {
+        throw invalid_value("Found values that are not packed arrays of the same type in " + std::string(opDefinitions[op].opName));
     }
-    push(value);
 }
 
 void VM::executeBinaryComparison(Operation op)
 {
-    auto operand_right = std::get<int64_t>(pop());
-    auto operand_left = std::get<int64_t>(pop());
+    Value operand_right = pop();
+    Value operand_left = pop();
+    push(binaryComparison(op, operand_left, operand_right));
+}
+
+Value binaryComparison(Operation op, const Value& operand_left_, const Value& operand_right_)
+{
+    auto operand_right = std::get<int64_t>(operand_right_);
+    auto operand_left = std::get<int64_t>(operand_left_);
     Value value;
     switch(op)
     {
@@ -283,74 +997,273 @@ void VM::executeBinaryComparison(Operation op)
             value = operand_left / operand_right;
             break;
         default:
-            auto def = opDefinitions[op];
-            throw invalid_instruction("Found instruction " + def.opName);
+            const auto& def = opDefinitions[op];
+            throw invalid_instruction("Found instruction " + std::string(def.opName));
     }
-    push(value);
+    return value;
 }
 
 void VM::run_gc()
 {
+    BONSAI_PROFILE_GC(stats);
+    if (sample_point != nullptr)
+    {
+        sample_point->in_gc.store(true, std::memory_order_relaxed);
+    }
+    const auto freed = bgc.telemetry.objects_freed;
     bgc.mark_and_sweep(stack, sp, constants, globals);
+    if (bgc.compaction_due())
+    {
+        bgc.compact(stack, sp, constants, globals);
+        // The caches identify constant keys by address
+        std::fill(index_caches.begin(), index_caches.end(), B_InlineCache{});
+    }
+    if (sample_point != nullptr)
+    {
+        sample_point->in_gc.store(false, std::memory_order_relaxed);
+    }
+    if (trace != nullptr && bgc.telemetry.objects_freed > freed)
+    {
+        trace->gc(bgc.telemetry.objects_freed - freed, bgc.telemetry.pauses.last());
+    }
+}
+
+void VM::dump_heap(std::ostream& out) const
+{
+    write_heap_dump(out, *bgc.allocator, {std::span<const Value>(stack.data(), sp), constants, globals, bgc.handles});
 }
 
 B_GC::B_GC(std::shared_ptr<B_Allocator> alloc)
 : allocator(alloc)
 {
+    telemetry.allocated_bytes_at_start = allocator->allocated.bytes;
 }
 
-void B_GC::mark_and_sweep(std::array<Value, 256> stack, int64_t sp, std::vector<Value> constants, std::vector<Value> globals)
+void B_GC::mark_and_sweep(const std::array<Value, 256>& stack, int64_t sp, const std::vector<Value>& constants, const std::vector<Value>& globals)
 {
+    const auto pause_start = std::chrono::steady_clock::now();
     std::vector<B_Object*> mark_stack = {};
 
     mark_container(stack.begin(), stack.begin() + sp, mark_stack);
     mark_container(constants.begin(), constants.end(), mark_stack);
     mark_container(globals.begin(), globals.end(), mark_stack);
-    // cycle inside the objects
-    for (uint i = 0; i < mark_stack.size(); ++i)
+    mark_container(handles.begin(), handles.end(), mark_stack);
+    std::vector<B_Slice*> slices;
+    size_t i = 0;
+    do
     {
-        auto* obj = mark_stack[i];
-        obj->set_used();
-        if (auto* array = dynamic_cast<B_Array*>(obj))
+        // cycle inside the objects
+        for (; i < mark_stack.size(); ++i)
         {
-            for (auto val: array->values)
+            auto* obj = mark_stack[i];
+            obj->set_used();
+            if (auto* slice = dynamic_cast<B_Slice*>(obj))
+            {
+                // The parent is marked, or copied out, once everything else is
+                slices.push_back(slice);
+            } else if (auto* array = dynamic_cast<B_Array*>(obj))
+            {
+                for (auto val: array->values)
+                {
+                    if (auto* obj_ptr = std::get_if<B_Object*>(&val); obj_ptr != nullptr && *obj_ptr != nullptr && !(*obj_ptr)->used())
+                    {
+                        mark_stack.push_back(*obj_ptr);
+                    }
+                }
+            } else if (auto* vector = dynamic_cast<B_PVector*>(obj))
+            {
+                vector->values.for_each([&](const Value& val){
+                    if (auto* obj_ptr = std::get_if<B_Object*>(&val); obj_ptr != nullptr && *obj_ptr != nullptr && !(*obj_ptr)->used())
+                    {
+                        mark_stack.push_back(*obj_ptr);
+                    }
+                });
+            } else if (auto* map = dynamic_cast<B_PMap*>(obj))
             {
-                if (auto* obj_ptr = std::get_if<B_Object*>(&val); obj_ptr != nullptr && !(*obj_ptr)->used())
+                map->values.for_each([&](const Value& key, const Value& val){
+                    for (const auto* v: {&key, &val})
+                    {
+                        if (auto* obj_ptr = std::get_if<B_Object*>(v); obj_ptr != nullptr && *obj_ptr != nullptr && !(*obj_ptr)->used())
+                        {
+                            mark_stack.push_back(*obj_ptr);
+                        }
+                    }
+                });
+            } else if (auto* record = dynamic_cast<B_Record*>(obj))
+            {
+                for (auto val: record->values)
+                {
+                    if (auto* obj_ptr = std::get_if<B_Object*>(&val); obj_ptr != nullptr && *obj_ptr != nullptr && !(*obj_ptr)->used())
+                    {
+                        mark_stack.push_back(*obj_ptr);
+                    }
+                }
+            } else if (auto* h_map = dynamic_cast<B_HashMap*>(obj))
+            {
+                for (auto n : h_map->values)
                 {
-                    mark_stack.push_back(*obj_ptr);
+                    auto key = n.second.key;
+                    auto value = n.second.value;
+                    if (auto* obj_ptr = std::get_if<B_Object*>(&key); obj_ptr != nullptr && *obj_ptr != nullptr && !(*obj_ptr)->used())
+                    {
+                        mark_stack.push_back(*obj_ptr);
+                    }
+                    if (auto* obj_ptr = std::get_if<B_Object*>(&value); obj_ptr != nullptr && *obj_ptr != nullptr && !(*obj_ptr)->used())
+                    {
+                        mark_stack.push_back(*obj_ptr);
+                    }
                 }
             }
+        }
+    } while (resolve_slices(slices, mark_stack));
+
+    // sweep the others, keeping the order of the survivors
+    auto& memory = allocator->memory;
+    auto live = memory.begin();
+    for (auto* obj: memory)
+    {
+        if (!obj->used())
+        {
+            ++telemetry.objects_freed;
+            telemetry.bytes_freed += obj->bytes();
+            allocator->release(obj);
+        } else 
+        {
+            obj->set_not_used();
+            *live++ = obj;
+        }
+    }
+    memory.erase(live, memory.end());
+
+    ++telemetry.collections;
+    telemetry.pauses.record(std::chrono::steady_clock::now() - pause_start);
+    if (!telemetry.dump_path.empty())
+    {
+        dump_telemetry();
+    }
+}
+
+bool B_GC::compaction_due() const
+{
+    return compact_heap && allocator->region_bytes() >= compaction_min_bytes && allocator->fragmentation() > compaction_threshold;
+}
+
+/**
+ * Move the live objects into a new region and point every reference to them at their new address:
+ * the roots, and the fields of the objects, keys of hashes and shared persistent nodes included.
+ * Run right after a sweep, when everything left in the allocator is live.
+*/
+void B_GC::compact(std::array<Value, 256>& stack, int64_t sp, std::vector<Value>& constants, std::vector<Value>& globals)
+{
+    const auto reclaimed = allocator->region_bytes();
+    const auto relocation = allocator->compact();
+    auto update = [&](Value& v){
+        if (auto* obj = std::get_if<B_Object*>(&v); obj != nullptr && *obj != nullptr)
+        {
+            *obj = relocation(*obj);
+        }
+    };
+    std::for_each(stack.begin(), stack.begin() + sp, update);
+    std::for_each(constants.begin(), constants.end(), update);
+    std::for_each(globals.begin(), globals.end(), update);
+    std::for_each(handles.begin(), handles.end(), update);
+    for (auto* obj: allocator->memory)
+    {
+        if (auto* slice = dynamic_cast<B_Slice*>(obj))
+        {
+            slice->parent = relocation(slice->parent);
+        } else if (auto* array = dynamic_cast<B_Array*>(obj))
+        {
+            std::for_each(array->values.begin(), array->values.end(), update);
+        } else if (auto* record = dynamic_cast<B_Record*>(obj))
+        {
+            std::for_each(record->values.begin(), record->values.end(), update);
+        } else if (auto* vector = dynamic_cast<B_PVector*>(obj))
+        {
+            // New addresses never match old ones, so nodes reached from several versions are updated once
+            vector->values.update_each(update);
+        } else if (auto* map = dynamic_cast<B_PMap*>(obj))
+        {
+            // Keys hash by content, so they keep their place in the trie
+            map->values.update_each([&](Value& key, Value& value){
+                update(key);
+                update(value);
+            });
         } else if (auto* h_map = dynamic_cast<B_HashMap*>(obj))
         {
-            for (auto n : h_map->values)
+            // Keys are const in the map: take out the nodes of object keys, which can not be hashed
+            // until they are updated, and put them back once they are
+            std::vector<decltype(h_map->values)::node_type> moved_keys;
+            for (auto it = h_map->values.begin(); it != h_map->values.end();)
             {
-                auto key = n.second.key;
-                auto value = n.second.value;
-                if (auto* obj_ptr = std::get_if<B_Object*>(&key); obj_ptr != nullptr && !(*obj_ptr)->used())
+                update(it->second.key);
+                update(it->second.value);
+                if (std::holds_alternative<B_Object*>(it->first))
                 {
-                    mark_stack.push_back(*obj_ptr);
-                }
-                if (auto* obj_ptr = std::get_if<B_Object*>(&value); obj_ptr != nullptr && !(*obj_ptr)->used())
+                    moved_keys.push_back(h_map->values.extract(it++));
+                } else
                 {
-                    mark_stack.push_back(*obj_ptr);
+                    ++it;
                 }
             }
+            for (auto& node: moved_keys)
+            {
+                update(node.key());
+                h_map->values.insert(std::move(node));
+            }
         }
     }
+    ++telemetry.compactions;
+    telemetry.compacted_bytes += reclaimed - allocator->region_bytes();
+}
 
-    // sweep the others
-    for (std::vector<B_Object*>::iterator obj = allocator->memory.begin(); obj != allocator->memory.end();)
+void B_GC::dump_telemetry()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (telemetry.last_dump && now - *telemetry.last_dump < telemetry.dump_interval)
     {
-        if (!(*obj)->used())
+        return;
+    }
+    telemetry.last_dump = now;
+    std::ofstream out(telemetry.dump_path, std::ios::app);
+    write_telemetry(out);
+    out << "\n";
+}
+
+/**
+ * Decide the fate of the parents of the live slices once marking is over: a parent already marked stays,
+ * one that only slices reach is marked too, unless they pin a small part of it and get their own copies.
+ * Tell whether objects were added to the mark stack.
+*/
+bool B_GC::resolve_slices(std::vector<B_Slice*>& slices, std::vector<B_Object*>& mark_stack)
+{
+    std::sort(slices.begin(), slices.end());
+    slices.erase(std::unique(slices.begin(), slices.end()), slices.end());
+    std::unordered_map<B_Object*, size_t> pinned;
+    for (auto* slice: slices)
+    {
+        if (!slice->parent->used())
         {
-            delete *obj;
-            obj = allocator->memory.erase(obj);
-        } else 
+            pinned[slice->parent] += slice->length;
+        }
+    }
+    const auto size = mark_stack.size();
+    for (auto* slice: slices)
+    {
+        if (slice->parent->used())
+        {
+            continue;
+        }
+        if (compact_slices && pinned[slice->parent] * slice_compaction_ratio < slice->parent_length())
+        {
+            mark_stack.push_back(slice->detach(*allocator));
+        } else
         {
-            (*obj)->set_not_used();
-            ++obj;
+            mark_stack.push_back(slice->parent);
         }
     }
+    slices.clear();
+    return mark_stack.size() > size;
 }
 
 template <typename InputIt>
@@ -359,7 +1272,7 @@ void mark_container(const InputIt it_b, const InputIt it_e, std::vector<B_Object
 {
     for (auto it = it_b; it < it_e; ++it)
     {
-        if (auto* obj = std::get_if<B_Object*>(&(*it)); obj != nullptr)
+        if (auto* obj = std::get_if<B_Object*>(&(*it)); obj != nullptr && *obj != nullptr)
         {
             mark_stack.push_back(*obj);
         }
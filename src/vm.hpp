@@ -2,13 +2,25 @@
 #define VM_HPP
 
 #include <array>
+#include <chrono>
 #include <exception>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <vector>
 
 #include "../include/code.hpp"
 #include "../include/object.hpp"
+#include "host.hpp"
+#include "native.hpp"
+#include "profile.hpp"
+#include "registers.hpp"
+#include "telemetry.hpp"
+#include "thread_pool.hpp"
+
+struct B_SamplePoint;
+class B_TraceRecorder;
+class B_StackCache;
 
 
 struct ByteCode 
@@ -21,22 +33,135 @@ class B_GC
 {
   public:
   B_GC(std::shared_ptr<B_Allocator> alloc);
-  void mark_and_sweep(std::array<Value, 256> stack, int64_t sp, std::vector<Value> constants, std::vector<Value> globals);
+  void mark_and_sweep(const std::array<Value, 256>& stack, int64_t sp, const std::vector<Value>& constants, const std::vector<Value>& globals);
+  // Whether enough of the allocator region holds dead objects for compact() to run
+  bool compaction_due() const;
+  /**
+   * Move the objects of the allocator next to each other in a new region and update the references to them.
+   * Pointers the host keeps outside of the roots are left dangling: hold objects through B_Handles instead.
+  */
+  void compact(std::array<Value, 256>& stack, int64_t sp, std::vector<Value>& constants, std::vector<Value>& globals);
+
+  // Live objects and bytes by kind of the allocator
+  B_HeapStats heap_stats() const {return allocator->heap_stats();}
+  void write_telemetry(std::ostream& out) const {write_telemetry_json(out, heap_stats(), telemetry);}
 
   std::shared_ptr<B_Allocator> allocator;
+  // Collections run, what they freed and their pauses
+  B_GcTelemetry telemetry;
+  // Values held by the host through B_Handles, roots like the stack
+  std::vector<Value> handles;
+  // Copy out slices that pin less than 1/slice_compaction_ratio of a parent nothing else references
+  bool compact_slices {true};
+  size_t slice_compaction_ratio {4};
+  // Compact the heap after a collection that leaves more than compaction_threshold of a region
+  // of at least compaction_min_bytes to dead objects
+  bool compact_heap {true};
+  double compaction_threshold {0.5};
+  size_t compaction_min_bytes {1 << 20};
+
+  private:
+  void dump_telemetry();
+  bool resolve_slices(std::vector<B_Slice*>& slices, std::vector<B_Object*>& mark_stack);
+};
+
+/**
+ * Activation record of a function call. The locals live in the stack from `bp` on,
+ * so a frame only keeps what is needed to return to the caller.
+ * `call_ip` is the offset of the OpCall, OpWide prefix included, for the sampler.
+*/
+struct B_Frame
+{
+    int64_t return_ip;
+    int64_t bp;
+    int64_t call_ip;
+};
+
+/**
+ * Inline cache of an OpIndex site: the slot `key` has in records of `shape`.
+ * Only constant keys are cached, since constants outlive the program and their address identifies them.
+*/
+struct B_InlineCache
+{
+    const B_Shape* shape {nullptr};
+    const B_Object* key {nullptr};
+    int slot {-1};
+};
+
+/**
+ * Value held by the host. It stays valid, and keeps its object alive, until its scope ends.
+*/
+class B_Handle
+{
+    public:
+    Value get() const {return (*slots)[index];}
+    B_Object* object() const {return std::get<B_Object*>(get());}
+
+    private:
+    friend class B_HandleScope;
+    B_Handle(const std::vector<Value>* slots, size_t index) : slots(slots), index(index) {};
+
+    const std::vector<Value>* slots;
+    size_t index;
+};
+
+/**
+ * Scope of the handles created through it. Registering a handle appends a root to the collector,
+ * and the scope releases all of them at once when it ends. Scopes of a collector must nest.
+*/
+class B_HandleScope
+{
+    public:
+    B_HandleScope(B_GC& gc) : gc(gc), base(gc.handles.size()) {};
+    ~B_HandleScope() {gc.handles.resize(base);}
+
+    B_HandleScope(const B_HandleScope&) = delete;
+    B_HandleScope& operator=(const B_HandleScope&) = delete;
+
+    B_Handle handle(Value v)
+    {
+        gc.handles.push_back(v);
+        return B_Handle{&gc.handles, gc.handles.size() - 1};
+    }
+
+    private:
+    B_GC& gc;
+    size_t base;
+};
+
+// How the interpreter loop goes on after an instruction
+enum class B_Step
+{
+    Next,
+    // Jumped, called or returned, having ended the block
+    Jumped,
+    Yield,
+    // Waiting on a host call
+    Wait,
 };
 
 struct VM
 {
     // Memory areas
     std::array<Value, 256> stack;
+    std::array<B_Frame, 64> frames;
     std::vector<Value> constants;
     std::vector<unsigned char> instructions;
+    // Bump after changing `instructions` of a VM that already ran, so their index and register tier translation are redone
+    uint64_t instructions_generation {0};
     std::vector<Value> globals;
 
     // Registers
     int64_t ip;
     int64_t sp;
+    // Base of the locals of the running function and number of active frames
+    int64_t bp;
+    int64_t fp;
+
+    // Execution accounting
+    int64_t instructions_executed;
+    RunStatus status;
+    std::string error;
 
     // Constants
     Value trueValue {true};
@@ -44,6 +169,40 @@ struct VM
 
     // Allocator
     B_GC bgc;
+    // Collect after every instruction, or every block on the register tier. Hosts that schedule collections themselves (see B_Scheduler) turn it off.
+    bool auto_gc {true};
+    // Keep the top two values of the stack in registers across the instructions that allow it, see stack_cache.cpp
+    bool cache_top {false};
+    // Run the programs the register tier translates on their three-address form, see registers.hpp
+    bool register_tier {true};
+
+    // Host functions callable with OpCallHost, and the result the VM is waiting on with the function it called
+    std::vector<B_HostBinding> host_functions;
+    std::optional<B_HostResult> pending_host;
+    int32_t pending_host_function {0};
+    // Native functions callable with OpCallNative
+    std::vector<B_NativeBinding> native_functions;
+
+    // Hashes with at most this many distinct string keys are built as records
+    size_t max_record_keys {32};
+    // Inline caches of the OpIndex instructions, by offset
+    std::vector<B_InlineCache> index_caches;
+    // Constant each OpIndex site loads its key from right before it, by offset, -1 for the other sites
+    std::vector<int32_t> index_keys;
+
+    // Published position of the VM while a B_Sampler is attached, see sampler.hpp
+    B_SamplePoint* sample_point {nullptr};
+    // Recorder of blocks, inputs and collections while attached, see trace.hpp
+    B_TraceRecorder* trace {nullptr};
+
+#ifdef BONSAI_PROFILE
+    // Execution statistics, see profile.hpp
+    B_Stats stats;
+#endif
+
+    // Bulk collection operations on arrays at least this long run in parallel on `pool`
+    size_t parallel_threshold {1 << 14};
+    B_ThreadPool* pool {&B_ThreadPool::shared()};
 
     VM(std::shared_ptr<B_Allocator> alloc = std::make_shared<B_Allocator>());
     VM(const ByteCode&, std::shared_ptr<B_Allocator> alloc = std::make_shared<B_Allocator>());
@@ -52,10 +211,78 @@ struct VM
     Value pop();
 
     void run();
+    /**
+     * Execute at most `budget` instructions, or until `deadline`, and return.
+     * Budget checks happen only at block ends (jumps) so a straight-line block always
+     * runs to completion; the deadline is sampled only at back-edges.
+     * A yielded VM resumes from `ip` on the next call.
+    */
+    RunStatus run_for(int64_t budget, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+    /**
+     * Run as a coroutine that suspends while a host call is pending
+     * and resumes with the host value pushed onto the stack.
+    */
+    B_Task run_async();
+
+    int16_t register_host_function(std::string name, int arity, B_HostFunction function);
+    int16_t register_native_function(std::string name, int arity, B_NativeFunction function);
+    // Register F through the B_Native wrapper, which converts its arguments and result
+    template <auto F>
+    int16_t register_native(std::string name)
+    {
+        return register_native_function(std::move(name), B_Native<F>::arity, &B_Native<F>::call);
+    }
+    // Push the value of the resolved pending host call and make the VM runnable again
+    void complete_host_call();
 
     void executeBinaryOp(Operation op);
     void executeBinaryComparison(Operation op);
+    void executeBulkOp(Operation op);
+    void executeCollectionOp(Operation op, int32_t operand);
+    void executeSetIndex();
+    void executeSlice();
+    void executeSelect(Operation op, int32_t count);
+    B_Object* makeArray(Value* first, Value* last);
+    B_Object* makeHash(Value* first, Value* last);
     void run_gc();
+    // Write the heap as seen from the collector roots, see heapdump.hpp
+    void dump_heap(std::ostream& out) const;
+
+    private:
+    RunStatus execute(int64_t budget, std::chrono::steady_clock::time_point deadline);
+    // One instruction of the interpreter loop, see vm.cpp
+    template <Operation Op, bool Wide>
+    B_Step step(int64_t op_start, int64_t& block_start);
+    // Run from `ip` with the top of the stack cached, up to an instruction it does not handle, and tell whether to yield
+    bool execute_cached(int64_t& block_start);
+    // One instruction with `Depth` values in `cache`, and whether to yield
+    template <int Depth>
+    bool step_cached(B_StackCache& cache, int64_t& block_start);
+    // Whether the program from `ip` on runs on the register tier, translating it when it changed
+    bool use_register_tier();
+    // Run the register tier from `ip` to the end of the program, and tell whether to yield
+    bool execute_registers(int64_t& block_start);
+    Value readOperand(const B_Operand& operand);
+    void writeOperand(const B_Operand& operand, const Value& value);
+    void index_instructions();
+    bool end_block(int64_t block_start, int64_t block_end, bool back_edge);
+    B_Function* callee(int64_t argc);
+    int64_t localSlot(int32_t idx) const;
+    Value indexRecord(const B_Record* record, const Value& key, int64_t op_start);
+    B_Object* packArray(Value* first, Value* last);
+    B_Object* setIndex(B_Object* target, const Value& idx, const Value& value);
+    size_t chunkCount(size_t n) const;
+    void forEachChunk(size_t n, const std::function<void(size_t, size_t, size_t, B_Allocator&)>& fn);
+
+    // Ordinal of the instruction starting at each byte offset, used to charge whole blocks
+    std::vector<int32_t> instruction_ordinals;
+    // Generation of the instructions the ordinals and inline caches were made from
+    std::optional<uint64_t> indexed_generation;
+    // Register tier translation of the instructions at `register_generation`, none before the first one
+    B_RegisterCode register_code;
+    std::optional<uint64_t> register_generation;
+    int64_t budget_limit;
+    std::chrono::steady_clock::time_point budget_deadline;
 };
 
 class full_stack_exception: public std::exception
@@ -74,6 +301,14 @@ class empty_stack_exception: public std::exception
   }
 };
 
+class call_depth_exception: public std::exception
+{
+  virtual const char* what() const throw()
+  {
+    return "Too many nested function calls";
+  }
+};
+
 class global_index_too_large_exception: public std::exception
 {
   virtual const char* what() const throw()
@@ -109,6 +344,12 @@ class not_implemented
   std::string what() {return message;}
 };
 
+// Semantics of the binary instructions, shared by the interpreter and the bulk collection operations
+Value binaryOp(Operation op, const Value& left, const Value& right, B_Allocator& allocator);
+Value binaryComparison(Operation op, const Value& left, const Value& right);
+// Record that an object is referenced from somewhere else than the stack, so OpSetIndex must not update it in place
+void share(const Value& v);
+
 template <typename InputIt>
 requires std::input_iterator<InputIt>
 void mark_container(const InputIt it_b, const InputIt it_e, std::vector<B_Object*>& mark_stack);
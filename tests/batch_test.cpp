@@ -0,0 +1,168 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/batch.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+namespace
+{
+    std::vector<Value> run_scalar(const ByteCode& bc, const std::vector<Value>& input)
+    {
+        auto testVM = VM(bc);
+        testVM.globals = input;
+        testVM.run();
+        return testVM.globals;
+    }
+
+    void expect_same_as_scalar(const ByteCode& bc, const std::vector<std::vector<Value>>& inputs)
+    {
+        B_BatchVM batch {bc};
+        batch.run(inputs);
+        ASSERT_EQ(batch.lanes(), inputs.size());
+        for (size_t lane = 0; lane < inputs.size(); ++lane)
+        {
+            EXPECT_EQ(batch.globals(lane), run_scalar(bc, inputs[lane])) << "lane " << lane;
+        }
+    }
+}
+
+TEST(BatchTest, StraightLineAssertions)
+{
+    // g2 = g0 * 3 + g1
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpReadGlobal, 0),
+                make(OpConstant, 0),
+                make(OpMul),
+                make(OpReadGlobal, 1),
+                make(OpAdd),
+                make(OpWriteGlobal, 2),
+            }
+        ));
+    ByteCode bc {instrs, std::vector<Value>{3}};
+    std::vector<std::vector<Value>> inputs;
+    for (int64_t i = 0; i < 100; ++i)
+    {
+        inputs.push_back({i, 7 - i});
+    }
+    expect_same_as_scalar(bc, inputs);
+}
+
+TEST(BatchTest, DivergentBranchAssertions)
+{
+    // if (g0 > 10) g1 = g0 - 10 else g1 = g0 + 100
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpReadGlobal, 0),
+                make(OpConstant, 0),
+                make(OpGreaterThan),
+                make(OpJumpFalse, 16),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 0),
+                make(OpSub),
+                make(OpWriteGlobal, 1),
+                make(OpJump, 13),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 1),
+                make(OpAdd),
+                make(OpWriteGlobal, 1),
+            }
+        ));
+    ByteCode bc {instrs, std::vector<Value>{10, 100}};
+    std::vector<std::vector<Value>> inputs;
+    for (int64_t i = 0; i < 21; ++i)
+    {
+        inputs.push_back({i});
+    }
+    expect_same_as_scalar(bc, inputs);
+
+    B_BatchVM batch {bc};
+    batch.run(inputs);
+    EXPECT_EQ(batch.global(3, 1), Value{103});
+    EXPECT_EQ(batch.global(15, 1), Value{5});
+}
+
+TEST(BatchTest, LoopsWithDifferentTripCountsAssertions)
+{
+    // g1 = 0; g2 = 0; while (g0 > g1) { g2 = g2 + g1; g1 = g1 + 1; }
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpWriteGlobal, 1),
+                make(OpConstant, 0),
+                make(OpWriteGlobal, 2),
+                make(OpReadGlobal, 0),
+                make(OpReadGlobal, 1),
+                make(OpGreaterThan),
+                make(OpJumpFalse, 26),
+                make(OpReadGlobal, 2),
+                make(OpReadGlobal, 1),
+                make(OpAdd),
+                make(OpWriteGlobal, 2),
+                make(OpReadGlobal, 1),
+                make(OpConstant, 1),
+                make(OpAdd),
+                make(OpWriteGlobal, 1),
+                make(OpJump, -30),
+            }
+        ));
+    ByteCode bc {instrs, std::vector<Value>{0, 1}};
+    std::vector<std::vector<Value>> inputs;
+    for (int64_t i = 0; i < 33; ++i)
+    {
+        inputs.push_back({(i * 7) % 13});
+    }
+    expect_same_as_scalar(bc, inputs);
+}
+
+TEST(BatchTest, TopOfStackAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpReadGlobal, 0),
+                make(OpUnaryMinus),
+                make(OpConstant, 0),
+                make(OpGreaterEqual),
+                make(OpBang),
+            }
+        ));
+    B_BatchVM batch {ByteCode{instrs, std::vector<Value>{-5}}};
+    batch.run({{Value{4}}, {Value{6}}});
+    EXPECT_EQ(batch.sp(), 1);
+    EXPECT_EQ(batch.top(0), Value{false});
+    EXPECT_EQ(batch.top(1), Value{true});
+}
+
+TEST(BatchTest, UnsupportedProgramsAssertions)
+{
+    B_Allocator allocator {};
+    auto strings = ByteCode{make(OpConstant, 0), std::vector<Value>{allocator.alloc("str")}};
+    EXPECT_FALSE(B_BatchVM::supports(strings));
+    EXPECT_THROW(B_BatchVM{strings}, not_implemented);
+
+    auto arrays = ByteCode{make_instructions({make(OpConstant, 0), make(OpArray, 1)}), std::vector<Value>{1}};
+    EXPECT_FALSE(B_BatchVM::supports(arrays));
+
+    auto uneven = ByteCode{make_instructions({make(OpTrue), make(OpJumpFalse, 4), make(OpTrue)}), std::vector<Value>{}};
+    EXPECT_FALSE(B_BatchVM::supports(uneven));
+}
+
+TEST(BatchTest, GlobalBoundsAssertions)
+{
+    // g0 = 1; g2 = 2: the scalar VM fails unless the input already has g1
+    auto instrs = make_instructions(std::vector({make(OpConstant, 0), make(OpWriteGlobal, 0), make(OpConstant, 1), make(OpWriteGlobal, 2)}));
+    ByteCode bc {instrs, std::vector<Value>{1, 2}};
+    auto scalar = VM(bc);
+    EXPECT_EQ(scalar.run_for(10), RunStatus::Error);
+
+    B_BatchVM batch {bc};
+    EXPECT_THROW(batch.run({{}}), global_index_too_large_exception);
+    // One lane missing g1 fails the batch, as it would fail on its own
+    EXPECT_THROW(batch.run({{int64_t{5}, int64_t{6}}, {int64_t{5}}}), global_index_too_large_exception);
+    expect_same_as_scalar(bc, {{int64_t{5}, int64_t{6}}, {int64_t{7}, int64_t{8}, int64_t{9}}});
+}
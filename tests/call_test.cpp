@@ -0,0 +1,158 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+namespace
+{
+    // sum(n, acc) = n == 0 ? acc : sum(n - 1, acc + n), then g0 = sum(n, 0)
+    ByteCode make_sum(B_Allocator& allocator, int64_t n, bool tail_call)
+    {
+        std::vector<std::vector<unsigned char>> parts {
+            make(OpJump, tail_call ? 37 : 38),
+            make(OpGetLocal, 0),
+            make(OpConstant, 1),
+            make(OpEqual),
+            make(OpJumpFalse, 7),
+            make(OpGetLocal, 1),
+            make(OpReturn),
+            make(OpConstant, 0),
+            make(OpGetLocal, 0),
+            make(OpConstant, 2),
+            make(OpSub),
+            make(OpGetLocal, 1),
+            make(OpGetLocal, 0),
+            make(OpAdd),
+        };
+        if (tail_call)
+        {
+            parts.push_back(make(OpTailCall, 2));
+        } else
+        {
+            parts.push_back(make(OpCall, 2));
+            parts.push_back(make(OpReturn));
+        }
+        parts.push_back(make(OpConstant, 0));
+        parts.push_back(make(OpConstant, 3));
+        parts.push_back(make(OpConstant, 1));
+        parts.push_back(make(OpCall, 2));
+        parts.push_back(make(OpWriteGlobal, 0));
+        return ByteCode{make_instructions(parts), std::vector<Value>{allocator.alloc(3, 2, 2), 0, 1, n}};
+    }
+}
+
+TEST(CallTest, OpCallAssertions)
+{
+    B_Allocator allocator {};
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpJump, 11),
+                make(OpGetLocal, 0),
+                make(OpGetLocal, 1),
+                make(OpSub),
+                make(OpReturn),
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpCall, 2),
+                make(OpWriteGlobal, 0),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{allocator.alloc(3, 2, 2), 7, 3}});
+    testVM.run();
+    EXPECT_EQ(testVM.globals[0], Value{4});
+    EXPECT_EQ(testVM.sp, 0);
+    EXPECT_EQ(testVM.bp, 0);
+    EXPECT_EQ(testVM.fp, 0);
+}
+
+TEST(CallTest, OpSetLocalAssertions)
+{
+    // f(a) { b = a * a; return b + a; }
+    B_Allocator allocator {};
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpJump, 21),
+                make(OpGetLocal, 0),
+                make(OpGetLocal, 0),
+                make(OpMul),
+                make(OpSetLocal, 1),
+                make(OpGetLocal, 1),
+                make(OpGetLocal, 0),
+                make(OpAdd),
+                make(OpReturn),
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpCall, 1),
+                make(OpWriteGlobal, 0),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{allocator.alloc(3, 1, 2), 5}});
+    testVM.run();
+    EXPECT_EQ(testVM.globals[0], Value{30});
+    EXPECT_EQ(testVM.sp, 0);
+}
+
+TEST(CallTest, OpTailCallReusesFrameAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_sum(allocator, 1000, true));
+    testVM.run();
+    EXPECT_EQ(testVM.globals[0], Value{500500});
+    EXPECT_EQ(testVM.sp, 0);
+    EXPECT_EQ(testVM.fp, 0);
+}
+
+TEST(CallTest, RecursionAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_sum(allocator, 50, false));
+    testVM.run();
+    EXPECT_EQ(testVM.globals[0], Value{1275});
+    EXPECT_EQ(testVM.sp, 0);
+    EXPECT_EQ(testVM.fp, 0);
+}
+
+TEST(CallTest, CallDepthAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_sum(allocator, 1000, false));
+    EXPECT_EQ(testVM.run_for(std::numeric_limits<int64_t>::max()), RunStatus::Error);
+    EXPECT_EQ(testVM.error, "Too many nested function calls");
+}
+
+TEST(CallTest, RunForYieldsInsideCallsAssertions)
+{
+    B_Allocator allocator {};
+    auto sliced = VM(make_sum(allocator, 40, false));
+    auto yields = 0;
+    while (sliced.run_for(7) == RunStatus::Yielded)
+    {
+        ++yields;
+    }
+    auto whole = VM(make_sum(allocator, 40, false));
+    whole.run();
+    EXPECT_GT(yields, 10);
+    EXPECT_EQ(sliced.globals, whole.globals);
+    EXPECT_EQ(sliced.instructions_executed, whole.instructions_executed);
+}
+
+TEST(CallTest, ArityMismatchAssertions)
+{
+    B_Allocator allocator {};
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpCall, 1),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{allocator.alloc(0, 2, 2), 5}});
+    EXPECT_EQ(testVM.run_for(10), RunStatus::Error);
+    EXPECT_EQ(testVM.error, "Function expects 2 arguments, found 1");
+}
@@ -0,0 +1,79 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+// The table is a constant expression: these hold before anything runs
+static_assert(opDefinitions[OpConstant].opName == "OpConstantInt");
+static_assert(opDefinitions[OpWide].opName == "OpWide" && opDefinitions[OpWide].numOperands == 0);
+static_assert(opDefinitions[OpAdd].pops == 2 && opDefinitions[OpAdd].pushes == 1);
+static_assert(opDefinitions[OpCall].pops == variable_effect);
+static_assert(instruction_count == OpWide + 1);
+static_assert(opDefinitions[instruction_count].opName.empty());
+static_assert(instruction_width(OpAdd) == 1 && instruction_width(OpJump) == 3 && instruction_width(OpJump, true) == 6);
+
+TEST(CodeTest, InstructionSetAssertions)
+{
+    for (auto op = 0; op < instruction_count; ++op)
+    {
+        const auto& def = opDefinitions[op];
+        EXPECT_FALSE(def.opName.empty());
+        if (def.numOperands == 0)
+        {
+            const auto instructions = make(static_cast<Operation>(op));
+            EXPECT_EQ(instruction_width(instructions, 0), 1);
+        } else
+        {
+            const auto instructions = make(static_cast<Operation>(op), -300);
+            EXPECT_EQ(instruction_width(instructions, 0), 1 + def.operandsWidth[0]);
+            EXPECT_EQ(read_operand(instructions, 0), -300);
+        }
+    }
+
+    // The stack effects in the table are the ones of the interpreter
+    for (const auto op: {OpPop, OpAdd, OpSub, OpMul, OpDiv, OpEqual, OpGreaterThan, OpGreaterEqual, OpUnaryMinus, OpBang})
+    {
+        std::vector<std::vector<unsigned char>> parts(opDefinitions[op].pops, make(OpConstant, 0));
+        parts.push_back(make(op));
+        auto testVM = VM(ByteCode{make_instructions(parts), std::vector<Value>{1}});
+        testVM.run();
+        EXPECT_EQ(testVM.sp, opDefinitions[op].pushes) << opDefinitions[op].opName;
+    }
+}
+
+TEST(CodeTest, OperandAccessorsAssertions)
+{
+    auto instructions = make_instructions(std::vector({make(OpJump, -300), make_wide(OpJumpFalse, 70000), make(OpConstant, 7)}));
+    EXPECT_EQ(read_operand<OpJump>(instructions, 0), -300);
+    EXPECT_EQ(read_operand<OpConstant>(instructions, 9), 7);
+
+    write_operand(instructions, 0, 12);
+    write_operand(instructions, 3, -70000);
+    EXPECT_EQ(read_operand<OpJump>(instructions, 0), 12);
+    EXPECT_EQ(read_operand(instructions, 3), -70000);
+    EXPECT_EQ(instruction_width(instructions, 3), instruction_width(OpJumpFalse, true));
+    // Neighbouring instructions are left alone
+    EXPECT_EQ(read_operand(instructions, 9), 7);
+}
+
+TEST(CodeTest, DisassembleAssertions)
+{
+    const auto instructions = make_instructions(std::vector({
+        make(OpConstant, 1),
+        make(OpTrue),
+        make_wide(OpJumpFalse, 40000),
+        make(OpJump, -10),
+    }));
+    EXPECT_EQ(disassemble(instructions),
+        "0000 OpConstantInt 1\n"
+        "0003 OpTrue\n"
+        "0004 OpWide OpJumpFalse 40000\n"
+        "0010 OpJump -10\n");
+
+    EXPECT_EQ(disassemble(std::vector<unsigned char>{OpPop, 250, OpReadGlobal, 0}),
+        "0000 OpPop\n"
+        "0001 <unknown 250>\n"
+        "0002 OpReadGlobal <truncated>\n");
+}
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+namespace
+{
+    // Runs `op` on constants 0 and, for binary forms, 1. A tiny threshold and a private pool
+    // make the parallel path run even for small arrays and on a single core.
+    std::unique_ptr<VM> run_collection_op(std::vector<Value> constants, std::vector<unsigned char> op, B_ThreadPool& pool, size_t threshold)
+    {
+        std::vector<std::vector<unsigned char>> parts {make(OpConstant, 0)};
+        if (constants.size() > 1)
+        {
+            parts.push_back(make(OpConstant, 1));
+        }
+        parts.push_back(op);
+        auto testVM = std::make_unique<VM>(ByteCode{make_instructions(parts), constants});
+        testVM->pool = &pool;
+        testVM->parallel_threshold = threshold;
+        testVM->run();
+        return testVM;
+    }
+
+    std::vector<int64_t> random_ints(size_t n)
+    {
+        std::mt19937 rng {3};
+        std::uniform_int_distribution<int64_t> dist(-500, 500);
+        std::vector<int64_t> values(n);
+        std::generate(values.begin(), values.end(), [&]{return dist(rng);});
+        return values;
+    }
+}
+
+class CollectionsTest: public ::testing::TestWithParam<size_t>
+{
+    protected:
+    B_ThreadPool pool {3};
+    B_Allocator allocator {};
+};
+
+TEST_P(CollectionsTest, MapAssertions)
+{
+    auto values = random_ints(1000);
+    auto testVM = run_collection_op({allocator.alloc(values), Value{3}}, make(OpArrayMap, OpMul), pool, GetParam());
+    ASSERT_EQ(testVM->sp, 1);
+    auto* result = dynamic_cast<B_IntArray*>(std::get<B_Object*>(testVM->stack[0]));
+    ASSERT_NE(result, nullptr);
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        EXPECT_EQ(result->values[i], 3 * values[i]);
+    }
+}
+
+TEST_P(CollectionsTest, MapAllocatesInWorkersAssertions)
+{
+    std::vector<Value> words;
+    for (auto i = 0; i < 100; ++i)
+    {
+        words.push_back(allocator.alloc(std::string("w").append(std::to_string(i))));
+    }
+    auto testVM = run_collection_op({allocator.alloc(words.data(), words.data() + words.size()), allocator.alloc("!")}, 
+        make(OpArrayMap, OpAdd), pool, GetParam());
+    // 100 new strings and the result array, all registered in the VM allocator and kept by the collector
+    EXPECT_EQ(testVM->bgc.allocator->memory.size(), 101);
+    auto result = get_array(testVM->stack[0]);
+    ASSERT_EQ(result.size(), 100);
+    for (auto i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(get_string(result[i]), std::string("w").append(std::to_string(i)).append("!"));
+    }
+}
+
+TEST_P(CollectionsTest, FilterAssertions)
+{
+    auto values = random_ints(1000);
+    auto testVM = run_collection_op({allocator.alloc(values), Value{100}}, make(OpArrayFilter, OpGreaterThan), pool, GetParam());
+    std::vector<Value> expected;
+    std::copy_if(values.begin(), values.end(), std::back_inserter(expected), [](int64_t v){return v > 100;});
+    EXPECT_EQ(get_array(testVM->stack[0]), expected);
+}
+
+TEST_P(CollectionsTest, ReduceAssertions)
+{
+    auto values = random_ints(1000);
+    auto testVM = run_collection_op({allocator.alloc(values), Value{7}}, make(OpArrayReduce, OpAdd), pool, GetParam());
+    int64_t expected = 7;
+    for (auto v: values)
+    {
+        expected += v;
+    }
+    EXPECT_EQ(testVM->stack[0], Value{expected});
+
+    std::vector<int64_t> small {1, 2, 3, 4, 5, 6};
+    auto mulVM = run_collection_op({allocator.alloc(small), Value{2}}, make(OpArrayReduce, OpMul), pool, GetParam());
+    EXPECT_EQ(mulVM->stack[0], Value{1440});
+}
+
+TEST_P(CollectionsTest, SortAssertions)
+{
+    auto values = random_ints(1001);
+    auto testVM = run_collection_op({allocator.alloc(values)}, make(OpArraySort), pool, GetParam());
+    std::sort(values.begin(), values.end());
+    EXPECT_EQ(dynamic_cast<B_IntArray*>(std::get<B_Object*>(testVM->stack[0]))->values, values);
+
+    std::vector<Value> words {allocator.alloc("pear"), allocator.alloc("apple"), allocator.alloc("fig"), allocator.alloc("kiwi"), allocator.alloc("date")};
+    auto wordsVM = run_collection_op({allocator.alloc(words.data(), words.data() + words.size())}, make(OpArraySort), pool, GetParam());
+    auto sorted = get_array(wordsVM->stack[0]);
+    std::vector<std::string> names;
+    std::transform(sorted.begin(), sorted.end(), std::back_inserter(names), get_string);
+    EXPECT_EQ(names, (std::vector<std::string>{"apple", "date", "fig", "kiwi", "pear"}));
+
+    // NaN goes after every number, in packed and in mixed arrays
+    const auto nan = std::numeric_limits<_Float64>::quiet_NaN();
+    std::vector<_Float64> floats {2.5, nan, -1.0, nan, 0.5};
+    auto floatsVM = run_collection_op({allocator.alloc(floats)}, make(OpArraySort), pool, GetParam());
+    const auto& sorted_floats = dynamic_cast<B_FloatArray*>(std::get<B_Object*>(floatsVM->stack[0]))->values;
+    ASSERT_EQ(sorted_floats.size(), 5);
+    EXPECT_EQ(std::vector<_Float64>(sorted_floats.begin(), sorted_floats.begin() + 3), (std::vector<_Float64>{-1.0, 0.5, 2.5}));
+    EXPECT_TRUE(std::isnan(sorted_floats[3]) && std::isnan(sorted_floats[4]));
+    std::vector<Value> numbers {Value{nan}, Value{3}, Value{1.5}, Value{-2}};
+    auto numbersVM = run_collection_op({allocator.alloc(numbers.data(), numbers.data() + numbers.size())}, make(OpArraySort), pool, GetParam());
+    auto sorted_numbers = get_array(numbersVM->stack[0]);
+    EXPECT_EQ(std::vector<Value>(sorted_numbers.begin(), sorted_numbers.begin() + 3), (std::vector<Value>{-2, 1.5, 3}));
+    EXPECT_TRUE(std::isnan(std::get<_Float64>(sorted_numbers[3])));
+
+    // Slices of strings sort with the strings
+    auto* phrase = allocator.alloc("melon");
+    std::vector<Value> pieces {allocator.alloc(phrase, 2, 3), allocator.alloc("banana"), allocator.alloc(phrase, 0, 2)};
+    auto piecesVM = run_collection_op({allocator.alloc(pieces.data(), pieces.data() + pieces.size())}, make(OpArraySort), pool, GetParam());
+    auto sorted_pieces = get_array(piecesVM->stack[0]);
+    names.clear();
+    std::transform(sorted_pieces.begin(), sorted_pieces.end(), std::back_inserter(names), get_string);
+    EXPECT_EQ(names, (std::vector<std::string>{"banana", "lon", "me"}));
+}
+
+TEST_P(CollectionsTest, BinarySearchAssertions)
+{
+    std::vector<int64_t> values {1, 3, 5, 7, 9, 11};
+    auto found = run_collection_op({allocator.alloc(values), Value{7}}, make(OpArrayBinarySearch), pool, GetParam());
+    EXPECT_EQ(found->stack[0], Value{3});
+    auto missing = run_collection_op({allocator.alloc(values), Value{8}}, make(OpArrayBinarySearch), pool, GetParam());
+    EXPECT_EQ(missing->stack[0], Value{-1});
+}
+
+INSTANTIATE_TEST_SUITE_P(SerialAndParallel, CollectionsTest, ::testing::Values(1 << 14, 4));
+
+TEST(CollectionsErrorsTest, InvalidOperandsAssertions)
+{
+    B_Allocator allocator {};
+    std::vector<Value> mixed {Value{1}, allocator.alloc("one")};
+    auto sortVM = VM(ByteCode{make_instructions({make(OpConstant, 0), make(OpArraySort)}), 
+        {allocator.alloc(mixed.data(), mixed.data() + mixed.size())}});
+    EXPECT_EQ(sortVM.run_for(10), RunStatus::Error);
+
+    auto reduceVM = VM(ByteCode{make_instructions({make(OpConstant, 0), make(OpConstant, 1), make(OpArrayReduce, OpSub)}), 
+        {allocator.alloc(std::vector<int64_t>{1, 2}), Value{0}}});
+    EXPECT_EQ(reduceVM.run_for(10), RunStatus::Error);
+
+    auto notArrayVM = VM(ByteCode{make_instructions({make(OpConstant, 0), make(OpConstant, 0), make(OpArrayMap, OpAdd)}), {Value{1}}});
+    EXPECT_EQ(notArrayVM.run_for(10), RunStatus::Error);
+}
@@ -0,0 +1,196 @@
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+ByteCode make_garbage_loop(int64_t iterations, B_Allocator& constants_allocator);
+
+TEST(CompactTest, RegionAssertions)
+{
+    B_Region region;
+    auto* a = static_cast<std::byte*>(region.allocate(24, 8));
+    auto* b = static_cast<std::byte*>(region.allocate(8, 8));
+    EXPECT_EQ(b, a + 24);
+    EXPECT_EQ(region.used(), 32);
+    EXPECT_EQ(region.reserved(), B_Region::chunk_size);
+    // Larger than a chunk: a chunk of its own
+    region.allocate(2 * B_Region::chunk_size, 8);
+    EXPECT_EQ(region.reserved(), 3 * B_Region::chunk_size);
+
+    B_Region other;
+    other.allocate(16, 8);
+    region.adopt(other);
+    EXPECT_EQ(region.used(), 2 * B_Region::chunk_size + 48);
+    EXPECT_EQ(other.used(), 0);
+    EXPECT_EQ(other.reserved(), 0);
+}
+
+TEST(CompactTest, FragmentationAssertions)
+{
+    B_Allocator allocator {};
+    EXPECT_EQ(allocator.fragmentation(), 0.0);
+    for (int i = 0; i < 4; ++i)
+    {
+        allocator.alloc(std::to_string(i));
+    }
+    EXPECT_EQ(allocator.fragmentation(), 0.0);
+    allocator.release(allocator.memory[0]);
+    allocator.release(allocator.memory[2]);
+    allocator.memory = {allocator.memory[1], allocator.memory[3]};
+    EXPECT_DOUBLE_EQ(allocator.fragmentation(), 0.5);
+
+    const auto relocation = allocator.compact();
+    EXPECT_EQ(allocator.fragmentation(), 0.0);
+    EXPECT_EQ(allocator.region_bytes(), 2 * (sizeof(B_String) + 1));
+    EXPECT_EQ(relocation.forward.size(), 2);
+    // The order of the objects is kept
+    EXPECT_EQ(get_string(allocator.memory[0]), "1");
+    EXPECT_EQ(get_string(allocator.memory[1]), "3");
+    // Objects of other allocators stay where they are
+    B_String outside {"outside"};
+    EXPECT_EQ(relocation(&outside), &outside);
+}
+
+TEST(CompactTest, CompactionUpdatesReferencesAssertions)
+{
+    auto testVM = VM();
+    testVM.bgc.compaction_min_bytes = 0;
+    auto& allocator = *testVM.bgc.allocator;
+    auto key = allocator.alloc("key");
+    auto text = allocator.alloc("some text");
+    std::vector<B_HashPair> pairs {B_HashPair{key, text}, B_HashPair{int64_t{1}, key}};
+    auto hash = allocator.alloc(pairs.data(), pairs.data() + pairs.size());
+    auto record = allocator.alloc(allocator.shape({"key"}), std::vector<Value>{text});
+    const auto vector = PersistentVector<Value>{}.set(0, text);
+    auto pvector = allocator.alloc(vector);
+    // Two versions sharing the trie
+    auto pvector2 = allocator.alloc(vector.set(1, key));
+    auto pmap = allocator.alloc(PersistentMap<Value, Value, VHash, VEqual>{}.set(key, text));
+    auto slice = allocator.alloc(text, 5, 4);
+    std::vector<Value> elements {key, hash, record, pvector, pvector2, pmap, slice};
+    testVM.globals.push_back(allocator.alloc(elements.data(), elements.data() + elements.size()));
+    for (int i = 0; i < 100; ++i)
+    {
+        allocator.alloc(std::to_string(i));
+    }
+    B_HandleScope scope(testVM.bgc);
+    auto handle = scope.handle(text);
+
+    testVM.run_gc();
+    EXPECT_EQ(testVM.bgc.telemetry.compactions, 1);
+    EXPECT_EQ(allocator.memory.size(), 9);
+    EXPECT_EQ(allocator.fragmentation(), 0.0);
+    EXPECT_GT(testVM.bgc.telemetry.compacted_bytes, 0);
+
+    const auto moved = get_array(testVM.globals[0]);
+    EXPECT_NE(std::get<B_Object*>(moved[0]), key);
+    EXPECT_EQ(get_string(moved[0]), "key");
+    EXPECT_EQ(get_string(handle.get()), "some text");
+    EXPECT_NE(handle.object(), text);
+
+    auto* moved_hash = dynamic_cast<B_HashMap*>(std::get<B_Object*>(moved[1]));
+    ASSERT_NE(moved_hash, nullptr);
+    auto found = moved_hash->values.find(moved[0]);
+    ASSERT_NE(found, moved_hash->values.end());
+    EXPECT_EQ(std::get<B_Object*>(found->first), std::get<B_Object*>(moved[0]));
+    EXPECT_EQ(found->second.key, moved[0]);
+    EXPECT_EQ(found->second.value, handle.get());
+    EXPECT_EQ(moved_hash->values.at(Value{int64_t{1}}).value, moved[0]);
+
+    EXPECT_EQ(dynamic_cast<B_Record*>(std::get<B_Object*>(moved[2]))->values[0], handle.get());
+    EXPECT_EQ(dynamic_cast<B_PVector*>(std::get<B_Object*>(moved[3]))->values[0], handle.get());
+    const auto& values2 = dynamic_cast<B_PVector*>(std::get<B_Object*>(moved[4]))->values;
+    EXPECT_EQ(values2[0], handle.get());
+    EXPECT_EQ(values2[1], moved[0]);
+    const auto& map = dynamic_cast<B_PMap*>(std::get<B_Object*>(moved[5]))->values;
+    map.for_each([&](const Value& k, const Value& v){
+        EXPECT_EQ(k, moved[0]);
+        EXPECT_EQ(v, handle.get());
+    });
+    EXPECT_EQ(dynamic_cast<B_Slice*>(std::get<B_Object*>(moved[6]))->parent, handle.object());
+    EXPECT_EQ(get_string_view(moved[6]), "text");
+
+    // A heap with little garbage is left in place
+    allocator.alloc("garbage");
+    const auto before = allocator.memory[0];
+    testVM.run_gc();
+    EXPECT_EQ(testVM.bgc.telemetry.compactions, 1);
+    EXPECT_EQ(allocator.memory[0], before);
+}
+
+TEST(CompactTest, CompactingWhileRunningAssertions)
+{
+    B_Allocator constants {};
+    auto testVM = VM(make_garbage_loop(200, constants));
+    testVM.bgc.compaction_min_bytes = 0;
+    testVM.run();
+    EXPECT_GT(testVM.bgc.telemetry.compactions, 0);
+    EXPECT_EQ(testVM.globals[0], Value{200});
+    EXPECT_EQ(get_string(testVM.globals[1]), "ab");
+    EXPECT_EQ(testVM.bgc.allocator->memory.size(), 1);
+
+    auto uncompacted = VM(make_garbage_loop(200, constants));
+    uncompacted.bgc.compact_heap = false;
+    uncompacted.run();
+    EXPECT_EQ(uncompacted.bgc.telemetry.compactions, 0);
+    EXPECT_GT(uncompacted.bgc.allocator->fragmentation(), 0.9);
+}
+
+TEST(CompactTest, InlineStorageAssertions)
+{
+    B_Allocator allocator {};
+    auto* str = dynamic_cast<B_String*>(allocator.concat("ab", "cd"));
+    EXPECT_EQ(str->value, "abcd");
+    EXPECT_EQ(static_cast<const void*>(str->value.data()), static_cast<const void*>(str + 1));
+
+    auto elements = std::vector<Value>{1, true, 2.5};
+    auto* array = dynamic_cast<B_Array*>(allocator.alloc(elements.data(), elements.data() + elements.size()));
+    EXPECT_EQ(static_cast<const void*>(array->values.data()), static_cast<const void*>(array + 1));
+    EXPECT_EQ(allocator.region_bytes(), sizeof(B_String) + 4 + sizeof(B_Array) + 3 * sizeof(Value));
+    // Growing past the room it was allocated with moves the elements out
+    array->values.push_back(Value{int64_t{3}});
+    EXPECT_NE(static_cast<const void*>(array->values.data()), static_cast<const void*>(array + 1));
+    EXPECT_EQ(array->values, (std::vector<Value>{1, true, 2.5, 3}));
+
+    // Long packed arrays keep the buffer they are built in
+    std::vector<int64_t> ints(B_Allocator::max_inline_bytes / sizeof(int64_t) + 1, 7);
+    const auto* buffer = ints.data();
+    auto* packed = dynamic_cast<B_IntArray*>(allocator.alloc(std::move(ints)));
+    EXPECT_EQ(packed->values.data(), buffer);
+
+    allocator.compact();
+    str = dynamic_cast<B_String*>(allocator.memory[0]);
+    array = dynamic_cast<B_Array*>(allocator.memory[1]);
+    EXPECT_EQ(str->value, "abcd");
+    EXPECT_EQ(static_cast<const void*>(str->value.data()), static_cast<const void*>(str + 1));
+    EXPECT_EQ(array->values, (std::vector<Value>{1, true, 2.5, 3}));
+    EXPECT_EQ(dynamic_cast<B_IntArray*>(allocator.memory[2])->values.data(), buffer);
+    EXPECT_EQ(allocator.region_bytes(), sizeof(B_String) + 4 + sizeof(B_Array) + sizeof(B_IntArray));
+}
+
+TEST(CompactTest, ViewsAcrossCompactionAssertions)
+{
+    auto testVM = VM();
+    testVM.bgc.compaction_min_bytes = 0;
+    auto& allocator = *testVM.bgc.allocator;
+    for (int i = 0; i < 50; ++i)
+    {
+        allocator.alloc(std::to_string(i));
+    }
+    auto elements = std::vector<Value>{1, 2, 3};
+    B_HandleScope scope(testVM.bgc);
+    auto text = scope.handle(allocator.alloc("held by the host"));
+    auto array = scope.handle(allocator.alloc(elements.data(), elements.data() + elements.size()));
+    const auto* old_chars = get_string_view(text.get()).data();
+    const auto* old_elements = get_array_view(array.get()).data();
+
+    testVM.run_gc();
+    ASSERT_EQ(testVM.bgc.telemetry.compactions, 1);
+    // The objects moved with their inline storage: views taken before point into freed space
+    EXPECT_NE(get_string_view(text.get()).data(), old_chars);
+    EXPECT_NE(get_array_view(array.get()).data(), old_elements);
+    EXPECT_EQ(get_string_view(text.get()), "held by the host");
+    const auto view = get_array_view(array.get());
+    EXPECT_EQ(std::vector<Value>(view.begin(), view.end()), elements);
+}
@@ -0,0 +1,120 @@
+#include <map>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+namespace
+{
+    // Leaves constant 0 + constant 1 on the stack
+    ByteCode make_concat(B_Allocator& allocator, std::string left, std::string right)
+    {
+        auto instrs = make_instructions(std::vector({make(OpConstant, 0), make(OpConstant, 1), make(OpAdd)}));
+        return ByteCode{instrs, std::vector<Value>{allocator.alloc(left), allocator.alloc(right)}};
+    }
+}
+
+TEST(EmbedTest, StringViewAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_concat(allocator, "zero-", "copy"));
+    testVM.run();
+    auto view = get_string_view(testVM.stack[0]);
+    EXPECT_EQ(view, "zero-copy");
+    EXPECT_EQ(view.data(), dynamic_cast<B_String*>(std::get<B_Object*>(testVM.stack[0]))->value.data());
+    EXPECT_THROW(get_string_view(Value{1}), invalid_value);
+}
+
+TEST(EmbedTest, ArrayViewAssertions)
+{
+    B_Allocator allocator {};
+    auto elements = std::vector<Value>{1, true};
+    auto* mixed = allocator.alloc(elements.data(), elements.data() + elements.size());
+    auto* ints = allocator.alloc(std::vector<int64_t>{4, 5, 6, 7});
+    auto* slice = allocator.alloc(ints, 1, 2);
+
+    auto values = get_array_view(mixed);
+    EXPECT_EQ(values.data(), dynamic_cast<B_Array*>(mixed)->values.data());
+    EXPECT_EQ(values[1], Value{true});
+
+    auto packed = get_packed_view<int64_t>(ints);
+    EXPECT_EQ(packed.data(), dynamic_cast<B_IntArray*>(ints)->values.data());
+    auto sliced = get_packed_view<int64_t>(slice);
+    EXPECT_EQ(std::vector<int64_t>(sliced.begin(), sliced.end()), std::vector<int64_t>({5, 6}));
+    EXPECT_EQ(sliced.data(), packed.data() + 1);
+
+    EXPECT_THROW(get_array_view(ints), invalid_value);
+    EXPECT_THROW(get_packed_view<_Float64>(ints), invalid_value);
+}
+
+TEST(EmbedTest, ForEachEntryAssertions)
+{
+    B_Allocator allocator {};
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 2),
+                make(OpConstant, 1),
+                make(OpConstant, 3),
+                make(OpHash, 4),
+                make(OpConstant, 2),
+                make(OpConstant, 3),
+                make(OpHash, 2),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{allocator.alloc("a"), allocator.alloc("b"), 1, 2}});
+    testVM.run();
+
+    std::map<std::string, Value> record;
+    for_each_entry(testVM.stack[0], [&](const Value& key, const Value& value){
+        record.emplace(get_string_view(key), value);
+    });
+    EXPECT_EQ(record, (std::map<std::string, Value>{{"a", 1}, {"b", 2}}));
+
+    std::vector<std::pair<Value, Value>> hash;
+    for_each_entry(testVM.stack[1], [&](const Value& key, const Value& value){hash.emplace_back(key, value);});
+    EXPECT_EQ(hash, (std::vector<std::pair<Value, Value>>{{1, 2}}));
+}
+
+TEST(EmbedTest, HandleKeepsObjectAliveAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_concat(allocator, "kept", " alive"));
+    testVM.run();
+    {
+        B_HandleScope scope(testVM.bgc);
+        auto handle = scope.handle(testVM.pop());
+        testVM.run_gc();
+        EXPECT_EQ(testVM.bgc.allocator->memory.size(), 1);
+        EXPECT_EQ(get_string_view(handle.get()), "kept alive");
+    }
+    testVM.run_gc();
+    EXPECT_EQ(testVM.bgc.allocator->memory.size(), 0);
+}
+
+TEST(EmbedTest, NestedHandleScopesAssertions)
+{
+    B_Allocator allocator {};
+    auto outerVM = VM(make_concat(allocator, "out", "er"));
+    outerVM.run();
+    B_HandleScope outer(outerVM.bgc);
+    auto kept = outer.handle(outerVM.pop());
+    {
+        B_HandleScope inner(outerVM.bgc);
+        for (int i = 0; i < 100; ++i)
+        {
+            inner.handle(outerVM.bgc.allocator->alloc(std::to_string(i)));
+        }
+        outerVM.run_gc();
+        EXPECT_EQ(outerVM.bgc.allocator->memory.size(), 101);
+        EXPECT_EQ(outerVM.bgc.handles.size(), 101);
+    }
+    EXPECT_EQ(outerVM.bgc.handles.size(), 1);
+    outerVM.run_gc();
+    EXPECT_EQ(outerVM.bgc.allocator->memory.size(), 1);
+    EXPECT_EQ(kept.object(), outerVM.bgc.allocator->memory[0]);
+    EXPECT_EQ(get_string(kept.get()), "outer");
+}
@@ -0,0 +1,167 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/escape.hpp"
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+namespace
+{
+    /**
+     * pick(i) = [10, 20, 30][i]; g0 = pick(2);
+     * g1 = 0; g2 = 0; while (3 > g1) { g2 = {"a": g1, "b": 100}["a"] + g2; g1 = g1 + 1; }
+    */
+    ByteCode make_program(B_Allocator& allocator)
+    {
+        const auto instructions = make_instructions(
+            std::vector(
+                {
+                    make(OpJump, 20),
+                    make(OpConstant, 1),
+                    make(OpConstant, 2),
+                    make(OpConstant, 3),
+                    make(OpArray, 3),
+                    make(OpGetLocal, 0),
+                    make(OpIndex),
+                    make(OpReturn),
+                    make(OpConstant, 0),
+                    make(OpConstant, 4),
+                    make(OpCall, 1),
+                    make(OpWriteGlobal, 0),
+                    make(OpConstant, 5),
+                    make(OpWriteGlobal, 1),
+                    make(OpConstant, 5),
+                    make(OpWriteGlobal, 2),
+                    make(OpConstant, 6),
+                    make(OpReadGlobal, 1),
+                    make(OpGreaterThan),
+                    make(OpJumpFalse, 42),
+                    make(OpConstant, 7),
+                    make(OpReadGlobal, 1),
+                    make(OpConstant, 8),
+                    make(OpConstant, 9),
+                    make(OpHash, 4),
+                    make(OpConstant, 7),
+                    make(OpIndex),
+                    make(OpReadGlobal, 2),
+                    make(OpAdd),
+                    make(OpWriteGlobal, 2),
+                    make(OpReadGlobal, 1),
+                    make(OpConstant, 10),
+                    make(OpAdd),
+                    make(OpWriteGlobal, 1),
+                    make(OpJump, -46),
+                }
+            ));
+        return ByteCode{
+            instructions,
+            std::vector<Value>{allocator.alloc(3, 1, 1), 10, 20, 30, 2, 0, 3, allocator.alloc("a"), allocator.alloc("b"), 100, 1}
+        };
+    }
+
+    // Elide the temporaries of `parts` and return the stats, leaving the code in `code`
+    B_EscapeStats elide(ByteCode& code, const std::vector<std::vector<unsigned char>>& parts, std::vector<Value> constants)
+    {
+        code = ByteCode{make_instructions(parts), std::move(constants)};
+        return elide_temporaries(code);
+    }
+}
+
+TEST(EscapeTest, ElisionKeepsResultsAssertions)
+{
+    B_Allocator allocator {};
+    const auto original = make_program(allocator);
+    auto testVM = VM(original);
+    testVM.run();
+
+    auto code = make_program(allocator);
+    const auto stats = elide_temporaries(code);
+    EXPECT_EQ(stats.arrays, 1);
+    EXPECT_EQ(stats.hashes, 1);
+    // Each site loses its collection instruction and turns OpIndex into a wider select
+    EXPECT_EQ(code.instructions.size(), original.instructions.size() - 2);
+    auto elidedVM = VM(code);
+    elidedVM.run();
+
+    EXPECT_EQ(elidedVM.globals, testVM.globals);
+    EXPECT_EQ(elidedVM.globals, (std::vector<Value>{30, 3, 3}));
+    // One array and three hashes, none of them once elided
+    EXPECT_EQ(testVM.bgc.allocator->allocated.objects, 4);
+    EXPECT_EQ(elidedVM.bgc.allocator->allocated.objects, 0);
+    EXPECT_EQ(elidedVM.sp, 0);
+}
+
+TEST(EscapeTest, SelectAssertions)
+{
+    B_Allocator allocator {};
+    ByteCode code;
+    // g0 = {1: "x", "k": 2, 1: "y"}[1]; g1 = {1: 2}[3]
+    auto stats = elide(code, {
+        make(OpConstant, 0),
+        make(OpConstant, 1),
+        make(OpConstant, 2),
+        make(OpConstant, 3),
+        make(OpConstant, 0),
+        make(OpConstant, 4),
+        make(OpHash, 6),
+        make(OpConstant, 0),
+        make(OpIndex),
+        make(OpWriteGlobal, 0),
+        make(OpConstant, 0),
+        make(OpConstant, 3),
+        make(OpHash, 2),
+        make(OpConstant, 5),
+        make(OpIndex),
+        make(OpWriteGlobal, 1),
+    }, {1, allocator.alloc("x"), allocator.alloc("k"), 2, allocator.alloc("y"), 3});
+    EXPECT_EQ(stats.hashes, 2);
+    auto testVM = VM(code);
+    testVM.run();
+    // The last pair with the key wins, missing keys read as null
+    EXPECT_EQ(get_string(testVM.globals[0]), "y");
+    EXPECT_EQ(testVM.globals[1], Value{static_cast<B_Object*>(nullptr)});
+
+    // [1, 2][2]
+    stats = elide(code, {make(OpConstant, 0), make(OpConstant, 1), make(OpArray, 2), make(OpConstant, 1), make(OpIndex)}, {1, 2});
+    EXPECT_EQ(stats.arrays, 1);
+    auto outOfBounds = VM(code);
+    EXPECT_THROW(outOfBounds.run(), invalid_value);
+}
+
+TEST(EscapeTest, EscapingCollectionsAssertions)
+{
+    ByteCode code;
+    // g0 = [1, 2]
+    auto stats = elide(code, {make(OpConstant, 0), make(OpConstant, 1), make(OpArray, 2), make(OpWriteGlobal, 0)}, {1, 2});
+    EXPECT_EQ(stats.arrays, 0);
+
+    // [[1, 2], 0][0]: the inner array escapes into the outer one, which does not escape
+    const std::vector<std::vector<unsigned char>> nested {
+        make(OpConstant, 0),
+        make(OpConstant, 1),
+        make(OpArray, 2),
+        make(OpConstant, 2),
+        make(OpArray, 2),
+        make(OpConstant, 2),
+        make(OpIndex),
+        make(OpWriteGlobal, 0),
+    };
+    stats = elide(code, nested, {1, 2, 0});
+    EXPECT_EQ(stats.arrays, 1);
+    auto testVM = VM(code);
+    testVM.run();
+    EXPECT_EQ(get_array(testVM.globals[0]), (std::vector<Value>{1, 2}));
+
+    // The array lives across a jump
+    stats = elide(code, {make(OpConstant, 0), make(OpArray, 1), make(OpJump, 3), make(OpConstant, 1), make(OpIndex)}, {1, 0});
+    EXPECT_EQ(stats.arrays, 0);
+
+    // The stack effect of host calls is not known until they are registered
+    stats = elide(code, {make(OpConstant, 0), make(OpArray, 1), make(OpCallHost, 0), make(OpIndex)}, {1});
+    EXPECT_EQ(stats.arrays, 0);
+
+    // [1] compared with [1]
+    stats = elide(code, {make(OpConstant, 0), make(OpArray, 1), make(OpConstant, 0), make(OpArray, 1), make(OpEqual)}, {1});
+    EXPECT_EQ(stats.arrays, 0);
+}
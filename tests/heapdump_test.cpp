@@ -0,0 +1,92 @@
+#include <sstream>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/heapdump.hpp"
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+TEST(HeapDumpTest, DominatorsAssertions)
+{
+    // Roots 0 and 5; 3 is reached both through 1 and through 2, which 5 also reaches; 6 is garbage
+    B_HeapGraph graph;
+    graph.add_object(B_Kind::Array, 1, {1, 2});
+    graph.add_object(B_Kind::Array, 10, {3});
+    graph.add_object(B_Kind::Array, 100, {3});
+    graph.add_object(B_Kind::Array, 1000, {4});
+    graph.add_object(B_Kind::Array, 10000, {0});
+    graph.add_object(B_Kind::Array, 100000, {2});
+    graph.add_object(B_Kind::String, 7, {});
+    graph.roots = {0, 5};
+
+    const auto dom = dominators(graph);
+    EXPECT_EQ(dom.idom, (std::vector<int64_t>{-1, 0, -1, -1, 3, -1, -2}));
+    EXPECT_EQ(dom.retained, (std::vector<uint64_t>{11, 10, 100, 11000, 10000, 100000, 0}));
+
+    const auto top = top_retainers(graph, dom, 2);
+    ASSERT_EQ(top.size(), 2);
+    EXPECT_EQ(top[0].id, 5);
+    EXPECT_EQ(top[1].id, 3);
+    EXPECT_EQ(top[1].shallow, 1000);
+    EXPECT_EQ(top[1].retained, 11000);
+}
+
+TEST(HeapDumpTest, LongChainAssertions)
+{
+    // A list deep enough to need the iterative DFS and path compression
+    const uint32_t n = 100000;
+    B_HeapGraph graph;
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        graph.add_object(B_Kind::Array, 1, i + 1 < n ? std::vector<uint32_t>{i + 1} : std::vector<uint32_t>{});
+    }
+    graph.roots = {0};
+    const auto dom = dominators(graph);
+    EXPECT_EQ(dom.retained[0], n);
+    EXPECT_EQ(dom.retained[n - 1], 1);
+    EXPECT_EQ(dom.idom[n - 1], n - 2);
+}
+
+TEST(HeapDumpTest, DumpRoundTripAssertions)
+{
+    B_Allocator constants {};
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpArray, 2),
+                make(OpWriteGlobal, 0),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{constants.alloc("a"), constants.alloc("b")}});
+    testVM.run();
+
+    std::stringstream dump;
+    testVM.dump_heap(dump);
+    const auto graph = B_HeapGraph::read(dump);
+
+    // The array first, then the constants of the other allocator
+    ASSERT_EQ(graph.size(), 3);
+    EXPECT_EQ(graph.kinds, (std::vector<B_Kind>{B_Kind::Array, B_Kind::String, B_Kind::String}));
+    EXPECT_EQ(graph.roots, (std::vector<uint32_t>{1, 2, 0}));
+    EXPECT_EQ(graph.edges, (std::vector<uint32_t>{1, 2}));
+    EXPECT_EQ(graph.sizes[0], testVM.bgc.allocator->memory[0]->bytes());
+
+    // The strings are roots too, so the array retains only itself
+    const auto dom = dominators(graph);
+    EXPECT_EQ(dom.retained[0], graph.sizes[0]);
+    EXPECT_EQ(dom.idom[1], -1);
+}
+
+TEST(HeapDumpTest, MalformedDumpAssertions)
+{
+    std::stringstream not_a_dump("BHD0");
+    EXPECT_THROW(B_HeapGraph::read(not_a_dump), heap_dump_exception);
+    // One object with an edge to object 1
+    std::stringstream bad_edge(std::string("BHD1\x01\x00\x01\x08\x01\x01", 10));
+    EXPECT_THROW(B_HeapGraph::read(bad_edge), heap_dump_exception);
+    std::stringstream truncated(std::string("BHD1\x02\x00\x01", 7));
+    EXPECT_THROW(B_HeapGraph::read(truncated), heap_dump_exception);
+}
@@ -0,0 +1,240 @@
+#include <deque>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/scheduler.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+/**
+ * Stand-in for an asynchronous host service, e.g. local file reads.
+ * Requests stay pending until the test completes them.
+*/
+class FakeAsyncService
+{
+    public:
+    B_HostResult request(std::span<const Value> args)
+    {
+        B_HostResult result {};
+        pending.emplace_back(result, std::get<int64_t>(args[0]));
+        return result;
+    }
+
+    // Answer every pending request with twice its argument, including the ones issued while answering
+    void complete_all()
+    {
+        while (!pending.empty())
+        {
+            auto [result, arg] = pending.front();
+            pending.pop_front();
+            result.resolve(Value{2 * arg});
+        }
+    }
+
+    std::deque<std::pair<B_HostResult, int64_t>> pending;
+};
+
+ByteCode make_host_call_program(int64_t arg)
+{
+    // g0 = host(arg) + 1
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpCallHost, 0),
+                make(OpConstant, 1),
+                make(OpAdd),
+                make(OpWriteGlobal, 0),
+            }
+        ));
+    return ByteCode{instrs, std::vector<Value>{arg, 1}};
+}
+
+TEST(HostTest, ReadyHostCallAssertions)
+{
+    auto testVM = VM(make_host_call_program(20));
+    testVM.register_host_function("twice", 1, [](std::span<const Value> args){
+        return B_HostResult{Value{2 * std::get<int64_t>(args[0])}};
+    });
+    testVM.run();
+    EXPECT_EQ(testVM.globals[0], Value{41});
+    EXPECT_EQ(testVM.sp, 0);
+}
+
+TEST(HostTest, PendingHostCallInRunThrowsAssertions)
+{
+    FakeAsyncService service;
+    auto testVM = VM(make_host_call_program(20));
+    testVM.register_host_function("read", 1, [&](std::span<const Value> args){return service.request(args);});
+    EXPECT_THROW(testVM.run(), invalid_instruction);
+    EXPECT_EQ(testVM.status, RunStatus::Waiting);
+}
+
+TEST(HostTest, RunForStopsOnPendingCallAssertions)
+{
+    FakeAsyncService service;
+    auto testVM = VM(make_host_call_program(4));
+    testVM.register_host_function("read", 1, [&](std::span<const Value> args){return service.request(args);});
+    EXPECT_EQ(testVM.run_for(100), RunStatus::Waiting);
+    EXPECT_EQ(testVM.ip, 6);
+    EXPECT_EQ(testVM.run_for(100), RunStatus::Waiting);
+    service.complete_all();
+    testVM.complete_host_call();
+    EXPECT_EQ(testVM.run_for(100), RunStatus::Finished);
+    EXPECT_EQ(testVM.globals[0], Value{9});
+}
+
+TEST(HostTest, CoroutinesInterleaveOnOneThreadAssertions)
+{
+    FakeAsyncService service;
+    std::vector<std::unique_ptr<VM>> vms;
+    std::vector<B_Task> tasks;
+    for (int64_t i = 0; i < 2000; ++i)
+    {
+        vms.push_back(std::make_unique<VM>(make_host_call_program(i)));
+        vms.back()->register_host_function("read", 1, [&](std::span<const Value> args){return service.request(args);});
+        tasks.push_back(vms.back()->run_async());
+    }
+    EXPECT_EQ(service.pending.size(), 2000);
+    for (auto& task: tasks)
+    {
+        EXPECT_FALSE(task.done());
+    }
+
+    service.complete_all();
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        ASSERT_TRUE(tasks[i].done());
+        EXPECT_EQ(tasks[i].result(), RunStatus::Finished);
+        EXPECT_EQ(vms[i]->globals[0], Value{static_cast<int64_t>(2 * i + 1)});
+    }
+}
+
+TEST(HostTest, CoroutineSuspendsOnEveryCallAssertions)
+{
+    // g0 = host(host(3))
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpCallHost, 0),
+                make(OpCallHost, 0),
+                make(OpWriteGlobal, 0),
+            }
+        ));
+    FakeAsyncService service;
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{3}});
+    testVM.register_host_function("read", 1, [&](std::span<const Value> args){return service.request(args);});
+    auto task = testVM.run_async();
+    EXPECT_EQ(service.pending.size(), 1);
+    auto [first, first_arg] = service.pending.front();
+    service.pending.pop_front();
+    first.resolve(Value{2 * first_arg});
+    EXPECT_FALSE(task.done());
+    EXPECT_EQ(service.pending.size(), 1);
+    service.complete_all();
+    ASSERT_TRUE(task.done());
+    EXPECT_EQ(testVM.globals[0], Value{12});
+}
+
+TEST(HostTest, CoroutineKeepsExceptionsAssertions)
+{
+    struct host_failure {};
+    // g0 = host(host(3)), with the second call failing once the first is resolved on another thread
+    auto instrs = make_instructions(std::vector({make(OpConstant, 0), make(OpCallHost, 0), make(OpCallHost, 0), make(OpWriteGlobal, 0)}));
+    FakeAsyncService service;
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{3}});
+    auto calls = 0;
+    testVM.register_host_function("read", 1, [&](std::span<const Value> args){
+        if (++calls == 2)
+        {
+            throw host_failure{};
+        }
+        return service.request(args);
+    });
+    auto task = testVM.run_async();
+    ASSERT_EQ(service.pending.size(), 1);
+    std::thread resolver([&]{
+        auto [result, arg] = service.pending.front();
+        result.resolve(Value{2 * arg});
+    });
+    resolver.join();
+    ASSERT_TRUE(task.done());
+    EXPECT_THROW(task.result(), host_failure);
+}
+
+TEST(HostTest, CoroutineDroppedWhileWaitingAssertions)
+{
+    FakeAsyncService service;
+    auto testVM = VM(make_host_call_program(5));
+    testVM.register_host_function("read", 1, [&](std::span<const Value> args){return service.request(args);});
+    {
+        auto task = testVM.run_async();
+        EXPECT_FALSE(task.done());
+    }
+    ASSERT_EQ(service.pending.size(), 1);
+    // The result outlives the task: resolving it must not resume the destroyed coroutine
+    service.complete_all();
+    EXPECT_EQ(testVM.status, RunStatus::Waiting);
+    EXPECT_TRUE(testVM.globals.empty());
+}
+
+TEST(HostTest, SchedulerParksWaitingVMsAssertions)
+{
+    FakeAsyncService service;
+    std::mutex lock;
+    std::vector<std::shared_ptr<VM>> vms;
+    B_Scheduler scheduler{2, 100};
+    for (int64_t i = 0; i < 50; ++i)
+    {
+        vms.push_back(std::make_shared<VM>(make_host_call_program(i)));
+        vms.back()->register_host_function("read", 1, [&](std::span<const Value> args){
+            std::lock_guard guard(lock);
+            return service.request(args);
+        });
+        scheduler.submit(vms.back());
+    }
+    while (true)
+    {
+        std::lock_guard guard(lock);
+        if (service.pending.size() == 50)
+        {
+            service.complete_all();
+            break;
+        }
+    }
+    scheduler.wait();
+    for (size_t i = 0; i < vms.size(); ++i)
+    {
+        EXPECT_EQ(vms[i]->status, RunStatus::Finished);
+        EXPECT_EQ(vms[i]->globals[0], Value{static_cast<int64_t>(2 * i + 1)});
+    }
+}
+
+TEST(HostTest, SchedulerCancelsWaitingVMsAssertions)
+{
+    FakeAsyncService service;
+    auto waiting = std::make_shared<VM>(make_host_call_program(5));
+    waiting->register_host_function("read", 1, [&](std::span<const Value> args){
+        return service.request(args);
+    });
+    auto running = std::make_shared<VM>(make_host_call_program(7));
+    running->register_host_function("twice", 1, [](std::span<const Value> args){
+        return B_HostResult{Value{2 * std::get<int64_t>(args[0])}};
+    });
+    {
+        B_Scheduler scheduler{2, 100};
+        scheduler.submit(waiting);
+        scheduler.submit(running);
+        // Destroyed with `waiting` parked on a result nobody resolves
+    }
+    EXPECT_EQ(running->status, RunStatus::Finished);
+    EXPECT_EQ(running->globals[0], Value{15});
+    EXPECT_EQ(waiting->status, RunStatus::Waiting);
+    ASSERT_EQ(service.pending.size(), 1);
+    // Resolving it once the scheduler is gone leaves the VM alone
+    service.complete_all();
+    EXPECT_EQ(waiting->status, RunStatus::Waiting);
+    EXPECT_TRUE(waiting->globals.empty());
+}
@@ -0,0 +1,77 @@
+#include <numeric>
+#include <random>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/kernels.hpp"
+
+namespace
+{
+    template <typename T>
+    std::vector<T> random_values(size_t n, std::mt19937& rng)
+    {
+        std::uniform_int_distribution<int64_t> dist(-1000, 1000);
+        std::vector<T> values(n);
+        for (auto& v: values)
+        {
+            v = static_cast<T>(dist(rng));
+        }
+        return values;
+    }
+
+    // Sizes around the vector widths exercise both the SIMD body and the scalar tail
+    const std::vector<size_t> sizes {1, 2, 3, 4, 5, 7, 8, 9, 17, 1000, 1003};
+}
+
+TEST(KernelsTest, IntKernelsMatchScalarAssertions)
+{
+    std::mt19937 rng {42};
+    for (auto n: sizes)
+    {
+        auto l = random_values<int64_t>(n, rng);
+        auto r = random_values<int64_t>(n, rng);
+        EXPECT_EQ(kernels::sum(l.data(), n), std::accumulate(l.begin(), l.end(), int64_t{0}));
+        EXPECT_EQ(kernels::min(l.data(), n), *std::min_element(l.begin(), l.end()));
+        EXPECT_EQ(kernels::max(l.data(), n), *std::max_element(l.begin(), l.end()));
+        EXPECT_EQ(kernels::dot(l.data(), r.data(), n), std::inner_product(l.begin(), l.end(), r.begin(), int64_t{0}));
+
+        std::vector<int64_t> out(n);
+        kernels::add(l.data(), r.data(), out.data(), n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            EXPECT_EQ(out[i], l[i] + r[i]);
+        }
+        kernels::mul(l.data(), r.data(), out.data(), n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            EXPECT_EQ(out[i], l[i] * r[i]);
+        }
+    }
+}
+
+TEST(KernelsTest, FloatKernelsMatchScalarAssertions)
+{
+    std::mt19937 rng {7};
+    for (auto n: sizes)
+    {
+        // Integral values keep the sums exact whatever the summation order
+        auto l = random_values<_Float64>(n, rng);
+        auto r = random_values<_Float64>(n, rng);
+        EXPECT_EQ(kernels::sum(l.data(), n), std::accumulate(l.begin(), l.end(), _Float64{0}));
+        EXPECT_EQ(kernels::min(l.data(), n), *std::min_element(l.begin(), l.end()));
+        EXPECT_EQ(kernels::max(l.data(), n), *std::max_element(l.begin(), l.end()));
+        EXPECT_EQ(kernels::dot(l.data(), r.data(), n), std::inner_product(l.begin(), l.end(), r.begin(), _Float64{0}));
+
+        std::vector<_Float64> out(n);
+        kernels::add(l.data(), r.data(), out.data(), n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            EXPECT_EQ(out[i], l[i] + r[i]);
+        }
+        kernels::mul(l.data(), r.data(), out.data(), n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            EXPECT_EQ(out[i], l[i] * r[i]);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+namespace
+{
+    int64_t add(int64_t a, int64_t b) {return a + b;}
+    _Float64 half(_Float64 x) {return x / 2;}
+    std::string repeat(std::string_view s, int n)
+    {
+        std::string result;
+        for (int i = 0; i < n; ++i)
+        {
+            result += s;
+        }
+        return result;
+    }
+    int64_t answer() {return 42;}
+
+    // Sum of any number of integers, written straight into the first slot
+    void sum3(std::span<Value> args, B_Allocator&)
+    {
+        int64_t total = 0;
+        for (const auto& v: args)
+        {
+            total += std::get<int64_t>(v);
+        }
+        args[0] = total;
+    }
+}
+
+TEST(NativeTest, TypedWrapperAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM();
+    const auto add_idx = testVM.register_native<add>("add");
+    const auto half_idx = testVM.register_native<half>("half");
+    const auto repeat_idx = testVM.register_native<repeat>("repeat");
+    EXPECT_EQ(testVM.native_functions[repeat_idx].arity, 2);
+    testVM.instructions = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpCallNative, add_idx),
+                make(OpConstant, 0),
+                make(OpCallNative, half_idx),
+                make(OpConstant, 2),
+                make(OpConstant, 1),
+                make(OpCallNative, repeat_idx),
+            }
+        ));
+    testVM.constants = std::vector<Value>{3, 4, allocator.alloc("ab")};
+    testVM.run();
+    EXPECT_EQ(testVM.sp, 3);
+    EXPECT_EQ(testVM.stack[0], Value{7});
+    EXPECT_EQ(testVM.stack[1], Value{_Float64{1.5}});
+    EXPECT_EQ(get_string(testVM.stack[2]), "abababab");
+}
+
+TEST(NativeTest, RawNativeAssertions)
+{
+    auto testVM = VM();
+    const auto sum_idx = testVM.register_native_function("sum3", 3, sum3);
+    const auto answer_idx = testVM.register_native<answer>("answer");
+    testVM.instructions = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpCallNative, sum_idx),
+                make(OpCallNative, answer_idx),
+            }
+        ));
+    testVM.constants = std::vector<Value>{1, 10, 100};
+    testVM.run();
+    EXPECT_EQ(testVM.sp, 3);
+    EXPECT_EQ(testVM.stack[0], Value{1});
+    EXPECT_EQ(testVM.stack[1], Value{111});
+    EXPECT_EQ(testVM.stack[2], Value{42});
+}
+
+TEST(NativeTest, UnknownNativeAssertions)
+{
+    auto testVM = VM(ByteCode{make(OpCallNative, 0), std::vector<Value>()});
+    EXPECT_EQ(testVM.run_for(10), RunStatus::Error);
+    EXPECT_EQ(testVM.error, "Unknown native function 0");
+}
@@ -0,0 +1,200 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+namespace
+{
+    // Every key collides, so the map degrades to its collision nodes
+    struct ConstantHash
+    {
+        size_t operator()(int64_t) const {return 42;}
+    };
+}
+
+TEST(PersistentTest, VectorVersionsAssertions)
+{
+    PersistentVector<int64_t> empty;
+    auto v = empty;
+    for (int64_t i = 0; i < 5000; ++i)
+    {
+        v.set_in_place(i, i);
+    }
+    auto w = v.set(1234, -1).set(5000, 7);
+    EXPECT_EQ(empty.size(), 0);
+    EXPECT_EQ(v.size(), 5000);
+    EXPECT_EQ(w.size(), 5001);
+    EXPECT_EQ(v[1234], 1234);
+    EXPECT_EQ(w[1234], -1);
+    EXPECT_EQ(w[5000], 7);
+    int64_t total = 0;
+    v.for_each([&](int64_t x){total += x;});
+    EXPECT_EQ(total, 4999 * 5000 / 2);
+    EXPECT_THROW(v.set(5001, 0), std::out_of_range);
+}
+
+TEST(PersistentTest, MapVersionsAssertions)
+{
+    PersistentMap<int64_t, int64_t, std::hash<int64_t>, std::equal_to<int64_t>> m;
+    for (int64_t i = 0; i < 2000; ++i)
+    {
+        m.set_in_place(i * 7919, i);
+    }
+    auto n = m.set(7919, -1).set(-5, 5);
+    EXPECT_EQ(m.size(), 2000);
+    EXPECT_EQ(n.size(), 2001);
+    EXPECT_EQ(*m.find(7919), 1);
+    EXPECT_EQ(*n.find(7919), -1);
+    EXPECT_EQ(m.find(-5), nullptr);
+    EXPECT_EQ(*n.find(1999 * 7919), 1999);
+}
+
+TEST(PersistentTest, MapCollisionsAssertions)
+{
+    PersistentMap<int64_t, int64_t, ConstantHash, std::equal_to<int64_t>> m;
+    for (int64_t i = 0; i < 50; ++i)
+    {
+        m.set_in_place(i, i * i);
+    }
+    auto n = m.set(3, 0);
+    EXPECT_EQ(m.size(), 50);
+    EXPECT_EQ(*m.find(7), 49);
+    EXPECT_EQ(*m.find(3), 9);
+    EXPECT_EQ(*n.find(3), 0);
+    EXPECT_EQ(n.find(50), nullptr);
+}
+
+TEST(OpTest, OpSetIndexInPlaceAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpArray, 2),
+                make(OpConstant, 0),
+                make(OpConstant, 2),
+                make(OpSetIndex),
+                make(OpConstant, 2),
+                make(OpConstant, 1),
+                make(OpSetIndex),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{0, 1, 2}});
+    testVM.run();
+    EXPECT_EQ(testVM.bgc.allocator->memory.size(), 1);
+    auto* array = dynamic_cast<B_IntArray*>(std::get<B_Object*>(testVM.stack[0]));
+    ASSERT_NE(array, nullptr);
+    EXPECT_EQ(array->values, std::vector<int64_t>({2, 1, 1}));
+}
+
+TEST(OpTest, OpSetIndexSharedAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpArray, 2),
+                make(OpWriteGlobal, 0),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpSetIndex),
+                make(OpWriteGlobal, 1),
+                make(OpReadGlobal, 1),
+                make(OpConstant, 1),
+                make(OpIndex),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{0, 1, 5}});
+    testVM.run();
+    EXPECT_EQ(get_array(testVM.globals[0]), std::vector<Value>({0, 1}));
+    EXPECT_NE(dynamic_cast<B_PVector*>(std::get<B_Object*>(testVM.globals[1])), nullptr);
+    EXPECT_EQ(get_array(testVM.globals[1]), std::vector<Value>({0, 5}));
+    EXPECT_EQ(testVM.stack[0], Value{5});
+}
+
+TEST(OpTest, OpSetIndexRecordTransitionAssertions)
+{
+    std::shared_ptr<B_Allocator> allocator = std::make_shared<B_Allocator>();
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 2),
+                make(OpHash, 2),
+                make(OpConstant, 1),
+                make(OpConstant, 3),
+                make(OpSetIndex),
+                make(OpWriteGlobal, 0),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 0),
+                make(OpConstant, 3),
+                make(OpSetIndex),
+            }
+        ));
+    auto constants = std::vector<Value>{allocator->alloc("a"), allocator->alloc("b"), 1, 2};
+    auto testVM = VM(ByteCode{instrs, constants}, allocator);
+    testVM.run();
+    auto* original = dynamic_cast<B_Record*>(std::get<B_Object*>(testVM.globals[0]));
+    auto* updated = dynamic_cast<B_Record*>(std::get<B_Object*>(testVM.stack[0]));
+    ASSERT_NE(original, nullptr);
+    ASSERT_NE(updated, nullptr);
+    EXPECT_NE(original, updated);
+    EXPECT_EQ(original->shape, allocator->shape({"a", "b"}));
+    EXPECT_EQ(updated->shape, original->shape);
+    EXPECT_EQ(original->values, std::vector<Value>({1, 2}));
+    EXPECT_EQ(updated->values, std::vector<Value>({2, 2}));
+}
+
+TEST(OpTest, OpSetIndexHashAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpHash, 2),
+                make(OpWriteGlobal, 0),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 0),
+                make(OpSetIndex),
+                make(OpConstant, 1),
+                make(OpIndex),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{1, 2}});
+    testVM.run();
+    EXPECT_EQ(testVM.stack[0], Value{1});
+    auto original = get_hash(testVM.globals[0]);
+    EXPECT_EQ(original.size(), 1);
+    EXPECT_EQ(original[Value{1}].value, Value{2});
+}
+
+TEST(GcTest, MarkAndSweepPersistentVectorAssertions)
+{
+    std::shared_ptr<B_Allocator> allocator = std::make_shared<B_Allocator>();
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpArray, 1),
+                make(OpWriteGlobal, 0),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpConstant, 2),
+                make(OpAdd),
+                make(OpSetIndex),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{0, 1, allocator->alloc("ab")}}, allocator);
+    testVM.run();
+    // The constant, the global array, the persistent version and the string it holds
+    EXPECT_EQ(allocator->memory.size(), 4);
+    EXPECT_EQ(get_string(get_array(testVM.stack[0])[1]), "abab");
+}
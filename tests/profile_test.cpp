@@ -0,0 +1,65 @@
+#include <sstream>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+#ifdef BONSAI_PROFILE
+
+ByteCode make_counting_loop(int64_t iterations);
+
+TEST(ProfileTest, OpcodeCountsAssertions)
+{
+    auto testVM = VM(make_counting_loop(5));
+    testVM.run();
+    // 5 iterations and a final test
+    EXPECT_EQ(testVM.stats.op_counts[OpGreaterThan], 6);
+    EXPECT_EQ(testVM.stats.op_counts[OpAdd], 5);
+    EXPECT_EQ(testVM.stats.op_counts[OpJump], 5);
+    EXPECT_EQ(testVM.stats.pair(OpReadGlobal, OpGreaterThan), 6);
+    EXPECT_EQ(testVM.stats.pair(OpJump, OpConstant), 5);
+    uint64_t total = 0;
+    for (auto count: testVM.stats.op_counts)
+    {
+        total += count;
+    }
+    EXPECT_EQ(total, static_cast<uint64_t>(testVM.instructions_executed));
+}
+
+TEST(ProfileTest, GcTimeAssertions)
+{
+    auto testVM = VM(make_counting_loop(3));
+    testVM.run();
+    EXPECT_EQ(testVM.stats.gc_runs, testVM.instructions_executed);
+    EXPECT_GT(testVM.stats.class_time[static_cast<size_t>(B_OpClass::Control)].count(), 0);
+
+    testVM.auto_gc = false;
+    testVM.stats.reset();
+    testVM.ip = 0;
+    testVM.run();
+    EXPECT_EQ(testVM.stats.gc_runs, 0);
+    EXPECT_EQ(testVM.stats.op_counts[OpAdd], 3);
+}
+
+TEST(ProfileTest, ReportAssertions)
+{
+    auto testVM = VM(make_counting_loop(2));
+    testVM.run();
+    std::ostringstream out;
+    testVM.stats.report(out);
+    EXPECT_NE(out.str().find("OpGreaterThan 3"), std::string::npos);
+    EXPECT_NE(out.str().find("gc "), std::string::npos);
+}
+
+#else
+
+template <typename T>
+constexpr bool has_stats = requires (T& vm) {vm.stats;};
+
+TEST(ProfileTest, DisabledAssertions)
+{
+    // Release builds carry no instrumentation state
+    EXPECT_FALSE(has_stats<VM>);
+}
+
+#endif
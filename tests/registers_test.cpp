@@ -0,0 +1,240 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/registers.hpp"
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+ByteCode make_counting_loop(int64_t iterations);
+ByteCode make_garbage_loop(int64_t iterations, B_Allocator& constants_allocator);
+
+namespace
+{
+    VM make_vm(const ByteCode& code, bool registers, bool auto_gc = false)
+    {
+        auto vm = VM(code);
+        vm.auto_gc = auto_gc;
+        vm.register_tier = registers;
+        return vm;
+    }
+
+    // Strings the two runs allocate are different objects with the same contents
+    void expect_same_value(const Value& registers, const Value& stack)
+    {
+        if (std::holds_alternative<B_Object*>(stack))
+        {
+            EXPECT_EQ(get_string(registers), get_string(stack));
+        } else
+        {
+            EXPECT_EQ(registers, stack);
+        }
+    }
+
+    // Run `code` on both tiers and compare what they leave
+    void expect_same_run(const ByteCode& code, bool auto_gc = false)
+    {
+        auto stack = make_vm(code, false, auto_gc);
+        stack.run();
+        auto registers = make_vm(code, true, auto_gc);
+        registers.run();
+        ASSERT_EQ(registers.globals.size(), stack.globals.size());
+        for (size_t i = 0; i < stack.globals.size(); ++i)
+        {
+            expect_same_value(registers.globals[i], stack.globals[i]);
+        }
+        ASSERT_EQ(registers.sp, stack.sp);
+        for (int64_t i = 0; i < stack.sp; ++i)
+        {
+            expect_same_value(registers.stack[i], stack.stack[i]);
+        }
+        EXPECT_EQ(registers.ip, stack.ip);
+        EXPECT_EQ(registers.instructions_executed, stack.instructions_executed);
+    }
+}
+
+TEST(RegistersTest, TranslationAssertions)
+{
+    const auto loop = translate_registers(make_counting_loop(10).instructions);
+    ASSERT_TRUE(loop.translated);
+    // g0 = 0; then g0 > n and the exit test; then g0 = g0 + 1 and the back jump: 11 stack instructions
+    ASSERT_EQ(loop.code.size(), 5);
+    EXPECT_EQ(loop.code[0].op, B_RegOp::Move);
+    EXPECT_EQ(loop.code[0].dst.kind, B_Operand::Global);
+    EXPECT_EQ(loop.code[1].op, B_RegOp::GreaterThan);
+    EXPECT_EQ(loop.code[1].a.kind, B_Operand::Constant);
+    EXPECT_EQ(loop.code[1].b.kind, B_Operand::Global);
+    EXPECT_EQ(loop.code[2].op, B_RegOp::JumpFalse);
+    EXPECT_EQ(loop.code[2].target, 5);
+    EXPECT_EQ(loop.code[3].op, B_RegOp::Add);
+    EXPECT_EQ(loop.code[3].dst.kind, B_Operand::Global);
+    EXPECT_EQ(loop.code[4].op, B_RegOp::Jump);
+    EXPECT_EQ(loop.code[4].target, 1);
+    EXPECT_EQ(loop.entries[6], 1);
+    EXPECT_EQ(loop.entries[7], -1);
+
+    // Instructions the tier does not run
+    EXPECT_FALSE(translate_registers(make_instructions(std::vector({make(OpConstant, 0), make(OpArray, 1)}))).translated);
+    // Paths reaching the end with different depths
+    EXPECT_FALSE(translate_registers(make_instructions(std::vector({make(OpTrue), make(OpJumpFalse, 4), make(OpTrue)}))).translated);
+    // A pop of an empty stack
+    EXPECT_FALSE(translate_registers(make_instructions(std::vector({make(OpPop)}))).translated);
+}
+
+TEST(RegistersTest, MatchesStackInterpreterAssertions)
+{
+    B_Allocator constants {};
+    expect_same_run(make_counting_loop(50));
+    expect_same_run(make_garbage_loop(20, constants));
+
+    // g0 = 3; g1 = 4; g1 = g0; g0 = g0 + 1 with the old g0 still pending; then leave 1 + 2 * g0, -g1 and !false
+    expect_same_run(ByteCode{
+        make_instructions(std::vector({
+            make(OpConstant, 0),
+            make(OpWriteGlobal, 0),
+            make(OpConstant, 1),
+            make(OpWriteGlobal, 1),
+            make(OpReadGlobal, 0),
+            make(OpReadGlobal, 0),
+            make(OpConstant, 2),
+            make(OpAdd),
+            make(OpWriteGlobal, 0),
+            make(OpWriteGlobal, 1),
+            make(OpConstant, 2),
+            make(OpConstant, 3),
+            make(OpReadGlobal, 0),
+            make(OpMul),
+            make(OpAdd),
+            make(OpReadGlobal, 1),
+            make(OpUnaryMinus),
+            make(OpFalse),
+            make(OpBang),
+            make(OpReadGlobal, 1),
+            make(OpPop),
+        })),
+        std::vector<Value>{3, 4, 1, 2}
+    });
+
+    // Values left on the stack across a jump: g0 = (true ? 5 : 6) + 10 with the branch value kept on the stack
+    expect_same_run(ByteCode{
+        make_instructions(std::vector({
+            make(OpConstant, 2),
+            make(OpTrue),
+            make(OpJumpFalse, 9),
+            make(OpConstant, 0),
+            make(OpJump, 6),
+            make(OpConstant, 1),
+            make(OpAdd),
+            make(OpWriteGlobal, 0),
+        })),
+        std::vector<Value>{5, 6, 10}
+    });
+
+    // Missing globals fail as in the stack interpreter, even when the value is dropped
+    auto missing = make_vm(ByteCode{make_instructions(std::vector({make(OpReadGlobal, 0), make(OpPop)})), {}}, true);
+    EXPECT_THROW(missing.run(), global_index_too_large_exception);
+}
+
+TEST(RegistersTest, MatchesWithAutoGcAssertions)
+{
+    // The arithmetic, global and jump programs of the OpTest suite, on VMs that collect as they run
+    expect_same_run(ByteCode{
+        make_instructions(std::vector({make(OpConstant, 0), make(OpConstant, 1), make(OpAdd), make(OpPop)})),
+        std::vector<Value>{3, 2}
+    }, true);
+    expect_same_run(ByteCode{
+        make_instructions(std::vector({
+            make(OpConstant, 0),
+            make(OpConstant, 1),
+            make(OpFalse),
+            make(OpJumpFalse, 5),
+            make(OpAdd),
+            make(OpTrue),
+            make(OpSub),
+        })),
+        std::vector<Value>{5, 2}
+    }, true);
+    expect_same_run(ByteCode{
+        make_instructions(std::vector({
+            make(OpConstant, 0),
+            make(OpConstant, 1),
+            make(OpTrue),
+            make(OpJumpFalse, 5),
+            make(OpAdd),
+            make(OpPop),
+            make(OpJump, 4),
+            make(OpSub),
+        })),
+        std::vector<Value>{5, 2}
+    }, true);
+    expect_same_run(ByteCode{
+        make_instructions(std::vector({make(OpConstant, 0), make(OpConstant, 1), make(OpWriteGlobal, 0), make(OpWriteGlobal, 0)})),
+        std::vector<Value>{5, 1.0}
+    }, true);
+    expect_same_run(ByteCode{
+        make_instructions(std::vector({
+            make(OpConstant, 0),
+            make(OpWriteGlobal, 0),
+            make(OpConstant, 1),
+            make(OpReadGlobal, 0),
+            make(OpAdd),
+            make(OpPop),
+        })),
+        std::vector<Value>{5, 1}
+    }, true);
+    B_Allocator constants {};
+    expect_same_run(ByteCode{
+        make_instructions(std::vector({make(OpConstant, 0), make(OpConstant, 1), make(OpAdd)})),
+        std::vector<Value>{constants.alloc("string1"), constants.alloc("string2")}
+    }, true);
+    expect_same_run(make_counting_loop(50), true);
+    expect_same_run(make_garbage_loop(20, constants), true);
+
+#ifndef BONSAI_PROFILE
+    // The tier collects at the end of each block instead of after each instruction; profiling builds go without it
+    auto registers = make_vm(make_garbage_loop(100, constants), true, true);
+    registers.run();
+    const auto& telemetry = registers.bgc.telemetry;
+    EXPECT_GT(telemetry.collections, 100);
+    EXPECT_LT(telemetry.collections, static_cast<uint64_t>(registers.instructions_executed));
+    EXPECT_EQ(telemetry.objects_freed, 99);
+    EXPECT_EQ(registers.bgc.heap_stats().live_total.objects, 1);
+    EXPECT_EQ(get_string(registers.globals[1]), "ab");
+#endif
+}
+
+TEST(RegistersTest, RetranslatesChangedCodeAssertions)
+{
+    auto registers = make_vm(make_counting_loop(10), true);
+    registers.run();
+    // 2 setup instructions, 9 per iteration, 4 for the final test
+    EXPECT_EQ(registers.instructions_executed, 2 + 10 * 9 + 4);
+    // Start the count at 1: same length, one iteration less
+    registers.instructions[2] = 2;
+    ++registers.instructions_generation;
+    registers.ip = 0;
+    registers.run();
+    EXPECT_EQ(registers.globals[0], Value{10});
+    EXPECT_EQ(registers.instructions_executed, 2 * (2 + 4) + 19 * 9);
+}
+
+TEST(RegistersTest, YieldsAndResumesAssertions)
+{
+    auto stack = make_vm(make_counting_loop(20), false);
+    auto registers = make_vm(make_counting_loop(20), true);
+    auto status = RunStatus::Yielded;
+    auto slices = 0;
+    while ((status = registers.run_for(10)) == RunStatus::Yielded)
+    {
+        EXPECT_EQ(stack.run_for(10), RunStatus::Yielded);
+        EXPECT_EQ(registers.ip, stack.ip);
+        EXPECT_EQ(registers.sp, 0);
+        EXPECT_EQ(registers.globals, stack.globals);
+        // Either tier resumes where the other one yielded
+        registers.register_tier = ++slices % 2 == 0;
+    }
+    EXPECT_EQ(status, RunStatus::Finished);
+    EXPECT_EQ(stack.run_for(10), RunStatus::Finished);
+    EXPECT_EQ(registers.globals[0], Value{20});
+    EXPECT_EQ(registers.instructions_executed, stack.instructions_executed);
+    EXPECT_GT(slices, 10);
+}
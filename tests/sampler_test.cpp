@@ -0,0 +1,138 @@
+#include <csignal>
+#include <sstream>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/sampler.hpp"
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+ByteCode make_counting_loop(int64_t iterations);
+
+namespace
+{
+    // Take a sample synchronously, as if the timer had fired in the middle of the call
+    int64_t tick()
+    {
+        std::raise(SIGPROF);
+        return 1;
+    }
+}
+
+TEST(SamplerTest, SignalSampleAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM();
+    const auto tick_idx = testVM.register_native<tick>("tick");
+    // g0 = f() where f() calls tick()
+    testVM.instructions = make_instructions(
+        std::vector(
+            {
+                make(OpJump, 7),
+                make(OpCallNative, tick_idx),
+                make(OpReturn),
+                make(OpConstant, 0),
+                make(OpCall, 0),
+                make(OpWriteGlobal, 0),
+            }
+        ));
+    testVM.constants = std::vector<Value>{allocator.alloc(3, 0, 0)};
+
+    // Only the raised signal is sampled
+    B_Sampler sampler(std::chrono::seconds(60));
+    sampler.start(testVM);
+    testVM.run();
+    sampler.stop();
+
+    EXPECT_EQ(testVM.globals[0], Value{1});
+    EXPECT_EQ(testVM.sample_point, nullptr);
+    EXPECT_EQ(sampler.histogram(), (std::map<int64_t, uint64_t>{{3, 1}}));
+    std::ostringstream folded;
+    sampler.write_folded(folded);
+    EXPECT_EQ(folded.str(), "main;OpCall@10;OpCallNative@3 1\n");
+
+    // Ticks after stop() are ignored
+    std::raise(SIGPROF);
+    EXPECT_EQ(sampler.sample_count(), 1);
+}
+
+TEST(SamplerTest, WideCallSiteAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM();
+    const auto tick_idx = testVM.register_native<tick>("tick");
+    // As above, with f() called through a wide OpCall
+    testVM.instructions = make_instructions(
+        std::vector(
+            {
+                make(OpJump, 7),
+                make(OpCallNative, tick_idx),
+                make(OpReturn),
+                make(OpConstant, 0),
+                make_wide(OpCall, 0),
+                make(OpWriteGlobal, 0),
+            }
+        ));
+    testVM.constants = std::vector<Value>{allocator.alloc(3, 0, 0)};
+
+    B_Sampler sampler(std::chrono::seconds(60));
+    sampler.start(testVM);
+    testVM.run();
+    sampler.stop();
+
+    EXPECT_EQ(testVM.globals[0], Value{1});
+    std::ostringstream folded;
+    sampler.write_folded(folded);
+    EXPECT_EQ(folded.str(), "main;OpWide OpCall@10;OpCallNative@3 1\n");
+}
+
+TEST(SamplerTest, TimerSampleAssertions)
+{
+    auto testVM = VM(make_counting_loop(50000));
+    B_Sampler sampler(std::chrono::microseconds(100));
+    sampler.start(testVM);
+    testVM.run();
+    sampler.stop();
+
+    EXPECT_GT(sampler.sample_count(), 0);
+    uint64_t total = 0;
+    for (const auto& [offset, count]: sampler.histogram())
+    {
+        EXPECT_GE(offset, 0);
+        EXPECT_LT(offset, static_cast<int64_t>(testVM.instructions.size()));
+        total += count;
+    }
+    EXPECT_EQ(total, sampler.sample_count());
+    EXPECT_LE(sampler.gc_samples(), sampler.sample_count());
+}
+
+TEST(SamplerTest, GcSampleAssertions)
+{
+    auto testVM = VM(make_counting_loop(1));
+    B_Sampler sampler(std::chrono::seconds(60), 1);
+    sampler.start(testVM);
+    // Outside the interpreter loop only collections are sampled
+    sampler.sample();
+    EXPECT_EQ(sampler.sample_count(), 0);
+    testVM.sample_point->in_gc = true;
+    sampler.sample();
+    sampler.sample();
+    sampler.stop();
+
+    EXPECT_EQ(sampler.gc_samples(), 1);
+    EXPECT_EQ(sampler.dropped(), 1);
+    std::ostringstream folded;
+    sampler.write_folded(folded);
+    EXPECT_EQ(folded.str(), "main;[gc] 1\n");
+}
+
+TEST(SamplerTest, SingleActiveSamplerAssertions)
+{
+    auto testVM = VM(make_counting_loop(1));
+    B_Sampler first(std::chrono::seconds(60));
+    B_Sampler second(std::chrono::seconds(60));
+    first.start(testVM);
+    EXPECT_THROW(second.start(testVM), sampler_exception);
+    first.stop();
+    EXPECT_NO_THROW(second.start(testVM));
+}
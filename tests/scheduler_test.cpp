@@ -0,0 +1,106 @@
+#include <mutex>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/scheduler.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+ByteCode make_counting_loop(int64_t iterations);
+
+ByteCode make_garbage_loop(int64_t iterations, B_Allocator& constants_allocator)
+{
+    // g0 = 0; while (iterations > g0) { g1 = "a" + "b"; g0 = g0 + 1; }
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpWriteGlobal, 0),
+                make(OpConstant, 1),
+                make(OpReadGlobal, 0),
+                make(OpGreaterThan),
+                make(OpJumpFalse, 26),
+                make(OpConstant, 3),
+                make(OpConstant, 4),
+                make(OpAdd),
+                make(OpWriteGlobal, 1),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 2),
+                make(OpAdd),
+                make(OpWriteGlobal, 0),
+                make(OpJump, -30),
+            }
+        ));
+    auto constants = std::vector<Value>{0, iterations, 1, constants_allocator.alloc("a"), constants_allocator.alloc("b")};
+    return ByteCode{instrs, constants};
+}
+
+TEST(SchedulerTest, RunsAllVMsAssertions)
+{
+    std::vector<std::shared_ptr<VM>> vms;
+    {
+        B_Scheduler scheduler{4, 50};
+        for (int64_t i = 0; i < 200; ++i)
+        {
+            vms.push_back(std::make_shared<VM>(make_counting_loop(i % 37)));
+            scheduler.submit(vms.back());
+        }
+        scheduler.wait();
+        EXPECT_GT(scheduler.slices(), 200);
+    }
+    for (size_t i = 0; i < vms.size(); ++i)
+    {
+        EXPECT_EQ(vms[i]->status, RunStatus::Finished);
+        EXPECT_EQ(vms[i]->globals[0], Value{static_cast<int64_t>(i % 37)});
+    }
+}
+
+TEST(SchedulerTest, FairnessAssertions)
+{
+    std::mutex lock;
+    std::vector<int64_t> finished;
+    auto record = [&](VM& vm){
+        std::lock_guard guard(lock);
+        finished.push_back(std::get<int64_t>(vm.globals[0]));
+    };
+
+    B_Scheduler scheduler{1, 20};
+    scheduler.submit(std::make_shared<VM>(make_counting_loop(2000)), record);
+    scheduler.submit(std::make_shared<VM>(make_counting_loop(10)), record);
+    scheduler.wait();
+    ASSERT_EQ(finished.size(), 2);
+    EXPECT_EQ(finished[0], 10);
+    EXPECT_EQ(finished[1], 2000);
+}
+
+TEST(SchedulerTest, ErrorDoesNotStopOthersAssertions)
+{
+    auto failing = std::make_shared<VM>(ByteCode{make(OpPop), std::vector<Value>()});
+    auto counting = std::make_shared<VM>(make_counting_loop(100));
+    B_Scheduler scheduler{2, 10};
+    scheduler.submit(failing);
+    scheduler.submit(counting);
+    scheduler.wait();
+    EXPECT_EQ(failing->status, RunStatus::Error);
+    EXPECT_EQ(counting->status, RunStatus::Finished);
+    EXPECT_EQ(counting->globals[0], Value{100});
+}
+
+TEST(SchedulerTest, WorkerCollectsGarbageAssertions)
+{
+    B_Allocator constants_allocator {};
+    std::vector<std::shared_ptr<VM>> vms;
+    B_Scheduler scheduler{2, 100, 16};
+    for (auto i = 0; i < 8; ++i)
+    {
+        vms.push_back(std::make_shared<VM>(make_garbage_loop(500, constants_allocator)));
+        scheduler.submit(vms.back());
+    }
+    scheduler.wait();
+    for (auto& vm: vms)
+    {
+        EXPECT_FALSE(vm->auto_gc);
+        EXPECT_EQ(vm->status, RunStatus::Finished);
+        EXPECT_EQ(get_string(vm->globals[1]), "ab");
+        EXPECT_EQ(vm->bgc.allocator->memory.size(), 1);
+    }
+}
@@ -0,0 +1,150 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+namespace
+{
+    // g0 = (constant 0 + constant 1)[constant 2 : constant 3]: the parent string only exists at run time
+    ByteCode make_runtime_slice(B_Allocator& allocator, std::string left, std::string right, int64_t start, int64_t end)
+    {
+        auto instrs = make_instructions(
+            std::vector(
+                {
+                    make(OpConstant, 0),
+                    make(OpConstant, 1),
+                    make(OpAdd),
+                    make(OpConstant, 2),
+                    make(OpConstant, 3),
+                    make(OpSlice),
+                    make(OpWriteGlobal, 0),
+                }
+            ));
+        return ByteCode{instrs, std::vector<Value>{allocator.alloc(left), allocator.alloc(right), start, end}};
+    }
+}
+
+TEST(SliceTest, StringSliceAssertions)
+{
+    B_Allocator allocator {};
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpSlice),
+                make(OpConstant, 3),
+                make(OpAdd),
+            }
+        ));
+    auto constants = std::vector<Value>{allocator.alloc("hello world"), 6, 11, allocator.alloc("!")};
+    auto testVM = VM(ByteCode{instrs, constants});
+    testVM.auto_gc = false;
+    testVM.run();
+    EXPECT_EQ(get_string(testVM.stack[0]), "world!");
+    auto* slice = dynamic_cast<B_Slice*>(testVM.bgc.allocator->memory[0]);
+    ASSERT_NE(slice, nullptr);
+    EXPECT_EQ(slice->parent, std::get<B_Object*>(constants[0]));
+    EXPECT_EQ(slice->chars(), "world");
+}
+
+TEST(SliceTest, ArraySliceAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpConstant, 3),
+                make(OpConstant, 4),
+                make(OpArray, 5),
+                make(OpConstant, 1),
+                make(OpConstant, 4),
+                make(OpSlice),
+                make(OpConstant, 0),
+                make(OpConstant, 2),
+                make(OpSlice),
+                make(OpWriteGlobal, 0),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 0),
+                make(OpIndex),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{0, 1, 2, 3, 4}});
+    testVM.run();
+    // [0, 1, 2, 3, 4][1:4][0:2] == [1, 2]
+    EXPECT_EQ(get_array(testVM.globals[0]), std::vector<Value>({1, 2}));
+    EXPECT_EQ(testVM.stack[0], Value{1});
+    auto* slice = dynamic_cast<B_Slice*>(std::get<B_Object*>(testVM.globals[0]));
+    ASSERT_NE(slice, nullptr);
+    EXPECT_NE(dynamic_cast<B_IntArray*>(slice->parent), nullptr);
+    EXPECT_EQ(slice->offset, 1);
+}
+
+TEST(SliceTest, SliceBoundsAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_runtime_slice(allocator, "ab", "cd", 2, 5));
+    EXPECT_EQ(testVM.run_for(100), RunStatus::Error);
+    EXPECT_EQ(testVM.error, "Slice bounds out of range");
+}
+
+TEST(GcTest, MarkAndSweepSliceKeepsParentAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_runtime_slice(allocator, std::string(100, 'x'), "y", 0, 3));
+    testVM.bgc.compact_slices = false;
+    testVM.run();
+    // The slice and its parent
+    EXPECT_EQ(testVM.bgc.allocator->memory.size(), 2);
+    EXPECT_EQ(get_string(testVM.globals[0]), "xxx");
+}
+
+TEST(GcTest, MarkAndSweepCompactsSliceAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_runtime_slice(allocator, std::string(100, 'x'), "y", 98, 101));
+    testVM.run();
+    auto* slice = dynamic_cast<B_Slice*>(std::get<B_Object*>(testVM.globals[0]));
+    ASSERT_NE(slice, nullptr);
+    EXPECT_EQ(slice->parent_length(), 3);
+    EXPECT_EQ(slice->offset, 0);
+    EXPECT_EQ(testVM.bgc.allocator->memory.size(), 2);
+    EXPECT_EQ(get_string(testVM.globals[0]), "xxy");
+}
+
+TEST(GcTest, MarkAndSweepLargeSliceKeepsParentAssertions)
+{
+    B_Allocator allocator {};
+    auto testVM = VM(make_runtime_slice(allocator, std::string(100, 'x'), "y", 1, 101));
+    testVM.run();
+    auto* slice = dynamic_cast<B_Slice*>(std::get<B_Object*>(testVM.globals[0]));
+    ASSERT_NE(slice, nullptr);
+    EXPECT_EQ(slice->parent_length(), 101);
+    EXPECT_EQ(slice->offset, 1);
+}
+
+TEST(SliceTest, CollectionOpOnSliceAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpConstant, 3),
+                make(OpArray, 4),
+                make(OpConstant, 4),
+                make(OpConstant, 3),
+                make(OpSlice),
+                make(OpArraySort),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{9, 7, 5, 3, 1}});
+    testVM.run();
+    EXPECT_EQ(get_array(testVM.stack[0]), std::vector<Value>({5, 7}));
+}
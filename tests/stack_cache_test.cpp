@@ -0,0 +1,144 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+ByteCode make_counting_loop(int64_t iterations);
+ByteCode make_garbage_loop(int64_t iterations, B_Allocator& constants_allocator);
+
+namespace
+{
+    VM cached_vm(const ByteCode& code)
+    {
+        auto vm = VM(code);
+        vm.cache_top = true;
+        vm.register_tier = false;
+        return vm;
+    }
+}
+
+TEST(StackCacheTest, MatchesPlainInterpreterAssertions)
+{
+    B_Allocator constants {};
+    for (const auto& code: {make_counting_loop(50), make_garbage_loop(50, constants)})
+    {
+        auto plain = VM(code);
+        plain.run();
+        auto cached = cached_vm(code);
+        cached.run();
+        ASSERT_EQ(cached.globals.size(), plain.globals.size());
+        EXPECT_EQ(cached.globals[0], plain.globals[0]);
+        EXPECT_EQ(cached.sp, plain.sp);
+        EXPECT_EQ(cached.instructions_executed, plain.instructions_executed);
+    }
+    auto strings = cached_vm(make_garbage_loop(50, constants));
+    strings.run();
+    EXPECT_EQ(get_string(strings.globals[1]), "ab");
+
+    // Straight-line code leaves its values on the stack: 7, !true, -(2 * 3 - 1) >= 0
+    auto straight = cached_vm(ByteCode{
+        make_instructions(std::vector({
+            make(OpConstant, 0),
+            make(OpTrue),
+            make(OpBang),
+            make(OpConstant, 1),
+            make(OpConstant, 2),
+            make(OpMul),
+            make(OpConstant, 3),
+            make(OpSub),
+            make(OpUnaryMinus),
+            make(OpConstant, 4),
+            make(OpGreaterEqual),
+        })),
+        std::vector<Value>{7, 2, 3, 1, 0}
+    });
+    straight.run();
+    EXPECT_EQ(straight.sp, 3);
+    EXPECT_EQ(straight.stack[0], Value{7});
+    EXPECT_EQ(straight.stack[1], Value{false});
+    EXPECT_EQ(straight.stack[2], Value{false});
+}
+
+TEST(StackCacheTest, CallsAndLocalsAssertions)
+{
+    B_Allocator allocator {};
+    // f(x) { x = x * 2; return x - 1; }; g0 = f(5) + f(1)
+    const ByteCode code {
+        make_instructions(std::vector({
+            make(OpJump, 21),
+            make(OpGetLocal, 0),
+            make(OpConstant, 1),
+            make(OpMul),
+            make(OpSetLocal, 0),
+            make(OpGetLocal, 0),
+            make(OpConstant, 3),
+            make(OpSub),
+            make(OpReturn),
+            make(OpConstant, 0),
+            make(OpConstant, 2),
+            make(OpCall, 1),
+            make(OpConstant, 0),
+            make(OpConstant, 3),
+            make(OpCall, 1),
+            make(OpAdd),
+            make(OpWriteGlobal, 0),
+        })),
+        std::vector<Value>{allocator.alloc(3, 1, 1), 2, 5, 1}
+    };
+    auto testVM = cached_vm(code);
+    testVM.run();
+    EXPECT_EQ(testVM.globals[0], Value{10});
+    EXPECT_EQ(testVM.sp, 0);
+}
+
+TEST(StackCacheTest, YieldsAndResumesAssertions)
+{
+    auto sliced = cached_vm(make_counting_loop(20));
+    auto status = RunStatus::Yielded;
+    while ((status = sliced.run_for(10)) == RunStatus::Yielded)
+    {
+        // Nothing stays in registers while the VM is suspended
+        EXPECT_EQ(sliced.sp, 0);
+    }
+    EXPECT_EQ(status, RunStatus::Finished);
+    EXPECT_EQ(sliced.globals[0], Value{20});
+    EXPECT_EQ(sliced.instructions_executed, 2 + 20 * 9 + 4);
+
+    auto failing = cached_vm(ByteCode{make_instructions(std::vector({make(OpConstant, 0), make(OpAdd)})), std::vector<Value>{1}});
+    EXPECT_EQ(failing.run_for(10), RunStatus::Error);
+    EXPECT_EQ(failing.error, "Not enough items to remove from the stack");
+
+    // Overflowing the stack, with two values cached, fails as in the plain interpreter
+    const ByteCode deep {make_instructions(std::vector<std::vector<unsigned char>>(300, make(OpConstant, 0))), std::vector<Value>{1}};
+    auto plain = VM(deep);
+    auto overflowing = cached_vm(deep);
+    EXPECT_EQ(overflowing.run_for(1000), RunStatus::Error);
+    EXPECT_EQ(plain.run_for(1000), RunStatus::Error);
+    EXPECT_EQ(overflowing.error, plain.error);
+    EXPECT_EQ(overflowing.sp, plain.sp);
+}
+
+TEST(StackCacheTest, CachedObjectsAreRootsAssertions)
+{
+    B_Allocator constants {};
+    const auto garbage = std::vector({make(OpConstant, 0), make(OpConstant, 1), make(OpAdd), make(OpPop)});
+    // "a" + "b" stays cached while the collections after each instruction free and compact the garbage around it
+    std::vector<std::vector<unsigned char>> parts = garbage;
+    parts.insert(parts.end(), garbage.begin(), garbage.end());
+    parts.insert(parts.end(), {make(OpConstant, 2), make(OpConstant, 3), make(OpAdd)});
+    for (auto i = 0; i < 3; ++i)
+    {
+        parts.insert(parts.end(), garbage.begin(), garbage.end());
+    }
+    parts.insert(parts.end(), {make(OpConstant, 4), make(OpAdd), make(OpWriteGlobal, 0)});
+    auto testVM = cached_vm(ByteCode{
+        make_instructions(parts),
+        std::vector<Value>{constants.alloc("x"), constants.alloc("y"), constants.alloc("a"), constants.alloc("b"), constants.alloc("c")}
+    });
+    testVM.bgc.compaction_min_bytes = 0;
+    testVM.run();
+    EXPECT_GT(testVM.bgc.telemetry.compactions, 0);
+    EXPECT_EQ(get_string(testVM.globals[0]), "abc");
+    EXPECT_EQ(testVM.bgc.allocator->memory.size(), 1);
+}
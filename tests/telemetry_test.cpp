@@ -0,0 +1,103 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/vm.hpp"
+
+ByteCode make_garbage_loop(int64_t iterations, B_Allocator& constants_allocator);
+
+TEST(TelemetryTest, HeapStatsAssertions)
+{
+    B_Allocator allocator {};
+    allocator.alloc("a");
+    allocator.alloc(std::string(1000, 'b'));
+    auto values = std::vector<Value>{1, 2, 3};
+    allocator.alloc(values.data(), values.data() + values.size());
+    allocator.alloc(std::vector<int64_t>{1, 2});
+
+    auto stats = allocator.heap_stats();
+    EXPECT_EQ(stats[B_Kind::String].objects, 2);
+    EXPECT_GE(stats[B_Kind::String].bytes, 1000 + 2 * sizeof(B_String));
+    EXPECT_EQ(stats[B_Kind::Array].objects, 1);
+    EXPECT_GE(stats[B_Kind::Array].bytes, 3 * sizeof(Value));
+    EXPECT_EQ(stats[B_Kind::IntArray].objects, 1);
+    EXPECT_EQ(stats[B_Kind::HashMap].objects, 0);
+    EXPECT_EQ(stats.live_total.objects, 4);
+    EXPECT_EQ(stats.allocated_total.objects, 4);
+    EXPECT_EQ(stats.allocated_total.bytes, stats.live_total.bytes);
+
+    B_Allocator other {};
+    other.alloc("c");
+    allocator.adopt(other);
+    EXPECT_EQ(allocator.heap_stats().allocated_total.objects, 5);
+    EXPECT_EQ(other.allocated.objects, 0);
+}
+
+TEST(TelemetryTest, GcCountersAssertions)
+{
+    B_Allocator constants {};
+    auto testVM = VM(make_garbage_loop(100, constants));
+    // One collection per instruction is the stack interpreter's contract, the register tier collects per block
+    testVM.register_tier = false;
+    testVM.run();
+    const auto& telemetry = testVM.bgc.telemetry;
+    EXPECT_EQ(telemetry.collections, static_cast<uint64_t>(testVM.instructions_executed));
+    EXPECT_EQ(telemetry.pauses.count(), telemetry.collections);
+    // One concatenation per iteration, all but the last one garbage
+    EXPECT_EQ(telemetry.objects_freed, 99);
+    auto heap = testVM.bgc.heap_stats();
+    EXPECT_EQ(heap.allocated_total.objects, 100);
+    EXPECT_EQ(heap.live_total.objects, 1);
+    EXPECT_EQ(heap.allocated_total.bytes, heap.live_total.bytes + telemetry.bytes_freed);
+}
+
+TEST(TelemetryTest, PauseHistogramAssertions)
+{
+    B_PauseHistogram pauses;
+    EXPECT_EQ(pauses.percentile(50).count(), 0);
+    for (int i = 0; i < 99; ++i)
+    {
+        pauses.record(std::chrono::nanoseconds(100));
+    }
+    pauses.record(std::chrono::nanoseconds(10000));
+    EXPECT_EQ(pauses.count(), 100);
+    EXPECT_EQ(pauses.buckets()[6], 99);
+    EXPECT_EQ(pauses.total().count(), 99 * 100 + 10000);
+    // Bucket bounds, 100ns lies in [64, 128)
+    EXPECT_EQ(pauses.percentile(50).count(), 128);
+    EXPECT_EQ(pauses.percentile(99).count(), 128);
+    EXPECT_EQ(pauses.percentile(100).count(), 10000);
+    EXPECT_EQ(pauses.max().count(), 10000);
+}
+
+TEST(TelemetryTest, JsonDumpAssertions)
+{
+    const auto path = std::filesystem::temp_directory_path() / "bonsai_telemetry_test.jsonl";
+    std::filesystem::remove(path);
+
+    B_Allocator constants {};
+    auto testVM = VM(make_garbage_loop(10, constants));
+    testVM.bgc.telemetry.dump_path = path.string();
+    testVM.bgc.telemetry.dump_interval = std::chrono::hours(1);
+    testVM.run();
+
+    // Only the first collection falls outside the interval
+    std::ifstream in(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);)
+    {
+        lines.push_back(line);
+    }
+    std::filesystem::remove(path);
+    ASSERT_EQ(lines.size(), 1);
+    EXPECT_EQ(lines[0].rfind("{\"uptime_ns\":", 0), 0);
+    EXPECT_NE(lines[0].find("\"gc\":{\"collections\":1,"), std::string::npos);
+
+    std::ostringstream out;
+    testVM.bgc.write_telemetry(out);
+    EXPECT_NE(out.str().find("\"string\":{\"objects\":1,"), std::string::npos);
+    EXPECT_NE(out.str().find("\"p99\":"), std::string::npos);
+    EXPECT_EQ(out.str().back(), '}');
+}
@@ -0,0 +1,252 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/trace.hpp"
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+ByteCode make_garbage_loop(int64_t iterations, B_Allocator& constants_allocator);
+
+namespace
+{
+    std::string trace_path(const std::string& name)
+    {
+        return (std::filesystem::temp_directory_path() / ("bonsai_" + name + ".trace")).string();
+    }
+
+    B_Trace read_trace(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        auto trace = B_Trace::read(in);
+        std::filesystem::remove(path);
+        return trace;
+    }
+}
+
+TEST(TraceTest, SpscRingAssertions)
+{
+    B_SpscRing<int> ring(3);
+    EXPECT_EQ(ring.capacity(), 4);
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(ring.push(i));
+    }
+    EXPECT_FALSE(ring.push(4));
+    int item;
+    EXPECT_TRUE(ring.pop(item));
+    EXPECT_EQ(item, 0);
+    // Only one slot is free: all or nothing
+    const std::vector<int> two {5, 6};
+    EXPECT_FALSE(ring.push(two));
+    EXPECT_TRUE(ring.pop(item));
+    EXPECT_TRUE(ring.push(two));
+    std::vector<int> rest;
+    while (ring.pop(item))
+    {
+        rest.push_back(item);
+    }
+    EXPECT_EQ(rest, (std::vector<int>{2, 3, 5, 6}));
+}
+
+TEST(TraceTest, SpscRingThreadsAssertions)
+{
+    const int count = 20000;
+    B_SpscRing<int> ring(64);
+    std::thread producer([&]{
+        for (int i = 0; i < count; ++i)
+        {
+            while (!ring.push(i))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    int expected = 0;
+    while (expected < count)
+    {
+        int item;
+        if (ring.pop(item))
+        {
+            ASSERT_EQ(item, expected);
+            ++expected;
+        } else
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+}
+
+TEST(TraceTest, RecordReplayInputsAssertions)
+{
+    B_Allocator allocator {};
+    // g1 = g0 + host0(); g2 = host1("a")
+    const auto code = ByteCode{
+        make_instructions(
+            std::vector(
+                {
+                    make(OpReadGlobal, 0),
+                    make(OpCallHost, 0),
+                    make(OpAdd),
+                    make(OpWriteGlobal, 1),
+                    make(OpConstant, 0),
+                    make(OpCallHost, 1),
+                    make(OpWriteGlobal, 2),
+                }
+            )),
+        std::vector<Value>{allocator.alloc("a")}
+    };
+    const auto long_string = std::string("bcdefghijklmnopqrstuvwxyz");
+
+    const auto path = trace_path("inputs");
+    {
+        auto testVM = VM(code);
+        testVM.globals = std::vector<Value>{10};
+        testVM.register_host_function("five", 0, [](std::span<const Value>){return B_HostResult(Value{5});});
+        testVM.register_host_function("suffix", 1, [&](std::span<const Value>){return B_HostResult(allocator.alloc(long_string));});
+        B_TraceRecorder recorder(path);
+        recorder.start(testVM);
+        testVM.run();
+        recorder.stop();
+        EXPECT_EQ(recorder.dropped(), 0);
+        EXPECT_EQ(testVM.trace, nullptr);
+    }
+
+    const auto trace = read_trace(path);
+    EXPECT_EQ(trace.blocks(), std::vector<int64_t>{0});
+    auto replayVM = trace.replay(code);
+    EXPECT_EQ(replayVM->globals, std::vector<Value>{10});
+    replayVM->run();
+    EXPECT_EQ(replayVM->globals[1], Value{15});
+    EXPECT_EQ(get_string(replayVM->globals[2]), long_string);
+}
+
+TEST(TraceTest, FileFormatAssertions)
+{
+    // Header, a block at 300, then g0 = -2 as recorded: kind, tag, aux, zigzag a and b, varints low group first
+    const std::string bytes {
+        'B', 'T', 'R', '2',
+        0, 0, 0, '\xd8', '\x04', 0,
+        1, 0, 0, 3, 0,
+    };
+    std::istringstream in(bytes);
+    const auto trace = B_Trace::read(in);
+    ASSERT_EQ(trace.events.size(), 2);
+    EXPECT_EQ(trace.blocks(), std::vector<int64_t>{300});
+    EXPECT_EQ(trace.events[1].kind, B_TraceKind::Global);
+    EXPECT_EQ(trace.events[1].a, -2);
+
+    std::istringstream truncated(bytes.substr(0, bytes.size() - 1));
+    EXPECT_THROW(B_Trace::read(truncated), trace_exception);
+}
+
+TEST(TraceTest, ReplayReproducesExecutionAssertions)
+{
+    B_Allocator constants {};
+    const auto code = make_garbage_loop(5, constants);
+    const auto path = trace_path("recorded");
+    {
+        auto testVM = VM(code);
+        B_TraceRecorder recorder(path);
+        recorder.start(testVM);
+        // Yielding between blocks does not change the trace
+        while (testVM.run_for(3) == RunStatus::Yielded)
+        {
+        }
+        recorder.stop();
+    }
+    const auto recorded = read_trace(path);
+    // The entry, then the body and the loop test of each iteration
+    EXPECT_EQ(recorded.blocks().size(), 11);
+    EXPECT_EQ(recorded.collections().size(), 4);
+
+    const auto replay_path = trace_path("replayed");
+    {
+        auto replayVM = recorded.replay(code);
+        B_TraceRecorder recorder(replay_path);
+        recorder.start(*replayVM);
+        replayVM->run();
+        recorder.stop();
+    }
+    const auto replayed = read_trace(replay_path);
+    EXPECT_EQ(replayed.blocks(), recorded.blocks());
+    EXPECT_EQ(replayed.collections(), recorded.collections());
+}
+
+TEST(TraceTest, FullRingDropsEventsAssertions)
+{
+    B_Allocator constants {};
+    auto testVM = VM(make_garbage_loop(100, constants));
+    const auto path = trace_path("dropped");
+    B_TraceRecorder recorder(path, 4, std::chrono::hours(1));
+    recorder.start(testVM);
+    testVM.run();
+    recorder.stop();
+    EXPECT_GT(recorder.dropped(), 0);
+    // The markers account for every dropped event, and block drops do not stop the replay
+    const auto trace = read_trace(path);
+    EXPECT_EQ(trace.dropped(), recorder.dropped());
+    // 201 blocks and 99 collections in all
+    EXPECT_EQ(trace.blocks().size() + trace.collections().size() + trace.dropped(), 201 + 99);
+    EXPECT_NO_THROW(trace.replay(make_garbage_loop(100, constants)));
+}
+
+TEST(TraceTest, FullRingKeepsInputsAssertions)
+{
+    // g_i = host0(), twenty times
+    std::vector<std::vector<unsigned char>> instructions;
+    for (int32_t idx = 0; idx < 20; ++idx)
+    {
+        instructions.push_back(make(OpCallHost, 0));
+        instructions.push_back(make(OpWriteGlobal, idx));
+    }
+    const auto code = ByteCode{make_instructions(instructions), {}};
+    B_Allocator allocator {};
+    const auto path = trace_path("inputs_kept");
+    {
+        auto testVM = VM(code);
+        testVM.globals = std::vector<Value>(20);
+        int64_t calls = 0;
+        // Odd calls return strings longer than the ring
+        testVM.register_host_function("next", 0, [&](std::span<const Value>){
+            const auto call = calls++;
+            return call % 2 == 0 ? B_HostResult(Value{call}) : B_HostResult(allocator.alloc(std::string(40, 'a' + call)));
+        });
+        // The flusher would sleep for an hour unless the VM wakes it
+        B_TraceRecorder recorder(path, 4, std::chrono::hours(1));
+        recorder.start(testVM);
+        testVM.run();
+        recorder.stop();
+    }
+
+    auto replayVM = read_trace(path).replay(code);
+    replayVM->run();
+    for (int64_t idx = 0; idx < 20; ++idx)
+    {
+        if (idx % 2 == 0)
+        {
+            EXPECT_EQ(replayVM->globals[idx], Value{idx});
+        } else
+        {
+            EXPECT_EQ(get_string(replayVM->globals[idx]), std::string(40, 'a' + idx));
+        }
+    }
+}
+
+TEST(TraceTest, ReplayRefusesLostInputsAssertions)
+{
+    // A block at 0, then a marker for two blocks and one input lost
+    const std::string bytes {
+        'B', 'T', 'R', '2',
+        0, 0, 0, 0, 0,
+        5, 0, 1, 4, 0,
+    };
+    std::istringstream in(bytes);
+    const auto trace = B_Trace::read(in);
+    EXPECT_EQ(trace.dropped(), 3);
+    EXPECT_THROW(trace.replay(ByteCode{{}, {}}), trace_exception);
+}
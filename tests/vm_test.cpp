@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <gtest/gtest.h>
@@ -605,6 +606,357 @@ TEST(OpTest, MarkAndSweepEmptyHashAssertions)
     testVM.run();
     EXPECT_EQ(testVM.bgc.allocator->memory.size(), 4);
 }
+TEST(OpTest, OpArrayPackedIntAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpArray, 3),
+            }
+        ));
+    auto constants = std::vector<Value>{4, 2, 9};
+    auto testVM = VM(ByteCode{instrs, constants});
+    testVM.run();
+    auto* packed = dynamic_cast<B_IntArray*>(std::get<B_Object*>(testVM.stack[testVM.sp - 1]));
+    ASSERT_NE(packed, nullptr);
+    EXPECT_EQ(packed->values, (std::vector<int64_t>{4, 2, 9}));
+    EXPECT_EQ(get_array(Value{packed}), (std::vector<Value>{4, 2, 9}));
+
+    instrs = make_instructions(std::vector({instrs, make(OpConstant, 1), make(OpIndex)}));
+    auto indexVM = VM(ByteCode{instrs, constants});
+    indexVM.run();
+    EXPECT_EQ(indexVM.sp, 1);
+    EXPECT_EQ(indexVM.stack[0], Value{9});
+}
+
+TEST(OpTest, OpArrayPackedFloatAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpArray, 2),
+            }
+        ));
+    auto constants = std::vector<Value>{1.5, -2.0};
+    ByteCode bc {instrs, constants};
+    auto testVM = VM(bc);
+    testVM.run();
+    auto* packed = dynamic_cast<B_FloatArray*>(std::get<B_Object*>(testVM.stack[testVM.sp - 1]));
+    ASSERT_NE(packed, nullptr);
+    EXPECT_EQ(packed->values, (std::vector<_Float64>{1.5, -2.0}));
+}
+
+TEST(OpTest, OpArrayReductionsAssertions)
+{
+    for (auto [op, expected]: std::vector<std::pair<Operation, Value>>{{OpArraySum, 14}, {OpArrayMin, -3}, {OpArrayMax, 9}})
+    {
+        auto instrs = make_instructions(
+            std::vector(
+                {
+                    make(OpConstant, 0),
+                    make(OpConstant, 1),
+                    make(OpConstant, 2),
+                    make(OpConstant, 3),
+                    make(OpArray, 4),
+                    make(op),
+                }
+            ));
+        auto testVM = VM(ByteCode{instrs, std::vector<Value>{4, -3, 9, 4}});
+        testVM.run();
+        EXPECT_EQ(testVM.sp, 1);
+        EXPECT_EQ(testVM.stack[0], expected);
+    }
+}
+
+TEST(OpTest, OpArrayElementWiseAssertions)
+{
+    auto program = [](Operation op){
+        return make_instructions(
+            std::vector(
+                {
+                    make(OpConstant, 0),
+                    make(OpConstant, 1),
+                    make(OpConstant, 2),
+                    make(OpArray, 3),
+                    make(OpConstant, 2),
+                    make(OpConstant, 1),
+                    make(OpConstant, 0),
+                    make(OpArray, 3),
+                    make(op),
+                }
+            ));
+    };
+    auto constants = std::vector<Value>{1.0, 2.0, 4.0};
+
+    auto addVM = VM(ByteCode{program(OpArrayAdd), constants});
+    addVM.run();
+    EXPECT_EQ(get_array(addVM.stack[addVM.sp - 1]), (std::vector<Value>{5.0, 4.0, 5.0}));
+
+    auto mulVM = VM(ByteCode{program(OpArrayMul), constants});
+    mulVM.run();
+    EXPECT_EQ(get_array(mulVM.stack[mulVM.sp - 1]), (std::vector<Value>{4.0, 4.0, 4.0}));
+
+    auto dotVM = VM(ByteCode{program(OpArrayDot), constants});
+    dotVM.run();
+    EXPECT_EQ(dotVM.stack[dotVM.sp - 1], Value{12.0});
+}
+
+TEST(OpTest, OpArrayBulkOnMixedArrayAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpArray, 2),
+                make(OpArraySum),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{1, 2.0}});
+    EXPECT_EQ(testVM.run_for(100), RunStatus::Error);
+}
+
+TEST(GcTest, MarkAndSweepPackedArrayAssertions)
+{
+    std::shared_ptr<B_Allocator> allocator = std::make_shared<B_Allocator>();
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpArray, 2),
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpArray, 2),
+                make(OpPop),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{1, 2}}, allocator);
+    testVM.run();
+    EXPECT_EQ(allocator->memory.size(), 1);
+    EXPECT_EQ(allocator->memory[0], std::get<B_Object*>(testVM.stack[0]));
+}
+
+TEST(OpTest, OpHashRecordAssertions)
+{
+    std::shared_ptr<B_Allocator> allocator = std::make_shared<B_Allocator>();
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 2),
+                make(OpConstant, 1),
+                make(OpConstant, 3),
+                make(OpHash, 4),
+                make(OpWriteGlobal, 0),
+                make(OpConstant, 0),
+                make(OpConstant, 4),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpHash, 4),
+                make(OpWriteGlobal, 1),
+                make(OpReadGlobal, 1),
+                make(OpConstant, 1),
+                make(OpIndex),
+            }
+        ));
+    auto constants = std::vector<Value>{allocator->alloc("a"), allocator->alloc("b"), 1, 2, 3};
+    auto testVM = VM(ByteCode{instrs, constants}, allocator);
+    testVM.run();
+    auto* first = dynamic_cast<B_Record*>(std::get<B_Object*>(testVM.globals[0]));
+    auto* second = dynamic_cast<B_Record*>(std::get<B_Object*>(testVM.globals[1]));
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    EXPECT_EQ(first->shape, second->shape);
+    EXPECT_EQ(second->values, std::vector<Value>({3, 1}));
+    EXPECT_EQ(testVM.stack[0], Value{1});
+    EXPECT_EQ(testVM.index_caches[42].shape, first->shape);
+    EXPECT_EQ(testVM.index_caches[42].slot, 1);
+    // The site reads its key from constant 1, which the cache is filled for
+    EXPECT_EQ(testVM.index_keys[42], 1);
+    EXPECT_EQ(std::count(testVM.index_keys.begin(), testVM.index_keys.end(), -1), static_cast<int64_t>(testVM.instructions.size()) - 1);
+}
+
+TEST(OpTest, OpIndexShapeMismatchAssertions)
+{
+    // f(r) = r["b"], called on records shaped {a, b}, {b, c} and {a, b} again
+    std::shared_ptr<B_Allocator> allocator = std::make_shared<B_Allocator>();
+    std::vector<std::vector<unsigned char>> parts {
+        make(OpJump, 11),
+        make(OpGetLocal, 0),
+        make(OpConstant, 2),
+        make(OpIndex),
+        make(OpReturn),
+    };
+    for (auto [first_key, second_key, global]: std::vector<std::array<int16_t, 3>>{{1, 2, 0}, {2, 3, 1}, {1, 2, 2}})
+    {
+        auto call = std::vector({
+            make(OpConstant, 0),
+            make(OpConstant, first_key),
+            make(OpConstant, 4),
+            make(OpConstant, second_key),
+            make(OpConstant, 5),
+            make(OpHash, 4),
+            make(OpCall, 1),
+            make(OpWriteGlobal, global),
+        });
+        parts.insert(parts.end(), call.begin(), call.end());
+    }
+    auto constants = std::vector<Value>{allocator->alloc(3, 1, 1), allocator->alloc("a"), allocator->alloc("b"), allocator->alloc("c"), 10, 20};
+    auto testVM = VM(ByteCode{make_instructions(parts), constants}, allocator);
+    testVM.run();
+    EXPECT_EQ(testVM.globals, std::vector<Value>({20, 10, 20}));
+    EXPECT_EQ(testVM.index_caches[9].shape, allocator->shape({"a", "b"}));
+}
+
+TEST(OpTest, OpHashWithoutStringKeysAssertions)
+{
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpHash, 2),
+                make(OpWriteGlobal, 0),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 0),
+                make(OpIndex),
+            }
+        ));
+    auto testVM = VM(ByteCode{instrs, std::vector<Value>{1, 2}});
+    testVM.run();
+    EXPECT_EQ(testVM.stack[0], Value{2});
+    EXPECT_NE(dynamic_cast<B_HashMap*>(std::get<B_Object*>(testVM.globals[0])), nullptr);
+}
+
+TEST(GcTest, MarkAndSweepRecordAssertions)
+{
+    std::shared_ptr<B_Allocator> allocator = std::make_shared<B_Allocator>();
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpConstant, 1),
+                make(OpConstant, 2),
+                make(OpAdd),
+                make(OpHash, 2),
+            }
+        ));
+    auto constants = std::vector<Value>{allocator->alloc("k"), allocator->alloc("x"), allocator->alloc("y")};
+    auto testVM = VM(ByteCode{instrs, constants}, allocator);
+    testVM.run();
+    EXPECT_EQ(allocator->memory.size(), 5);
+    auto hash_value = get_hash(testVM.stack[0]);
+    B_String key{"k"};
+    EXPECT_EQ(get_string(hash_value[&key].value), "xy");
+}
+
+TEST(GcTest, MarkAndSweepNullElementsAssertions)
+{
+    // g0 = [{"a": 1}["b"]]; g1 = {1: {"a": 1}["b"]}, both holding the null a missing key reads as
+    std::shared_ptr<B_Allocator> allocator = std::make_shared<B_Allocator>();
+    auto missing_key = std::vector({
+        make(OpConstant, 0),
+        make(OpConstant, 2),
+        make(OpHash, 2),
+        make(OpConstant, 1),
+        make(OpIndex),
+    });
+    std::vector<std::vector<unsigned char>> parts(missing_key);
+    parts.insert(parts.end(), {make(OpArray, 1), make(OpWriteGlobal, 0), make(OpConstant, 2)});
+    parts.insert(parts.end(), missing_key.begin(), missing_key.end());
+    parts.insert(parts.end(), {make(OpHash, 2), make(OpWriteGlobal, 1)});
+    auto constants = std::vector<Value>{allocator->alloc("a"), allocator->alloc("b"), 1};
+    auto testVM = VM(ByteCode{make_instructions(parts), constants}, allocator);
+    testVM.run();
+    testVM.run_gc();
+    auto* array = dynamic_cast<B_Array*>(std::get<B_Object*>(testVM.globals[0]));
+    ASSERT_NE(array, nullptr);
+    EXPECT_EQ(array->values[0], Value{static_cast<B_Object*>(nullptr)});
+    auto* hash = dynamic_cast<B_HashMap*>(std::get<B_Object*>(testVM.globals[1]));
+    ASSERT_NE(hash, nullptr);
+    EXPECT_EQ(hash->values.size(), 1);
+}
+
+ByteCode make_counting_loop(int64_t iterations)
+{
+    // g0 = 0; while (iterations > g0) { g0 = g0 + 1; }
+    auto instrs = make_instructions(
+        std::vector(
+            {
+                make(OpConstant, 0),
+                make(OpWriteGlobal, 0),
+                make(OpConstant, 1),
+                make(OpReadGlobal, 0),
+                make(OpGreaterThan),
+                make(OpJumpFalse, 16),
+                make(OpReadGlobal, 0),
+                make(OpConstant, 2),
+                make(OpAdd),
+                make(OpWriteGlobal, 0),
+                make(OpJump, -20),
+            }
+        ));
+    return ByteCode{instrs, std::vector<Value>{0, iterations, 1}};
+}
+
+TEST(RunTest, RunForFinishesAssertions)
+{
+    auto testVM = VM(make_counting_loop(5));
+    EXPECT_EQ(testVM.run_for(1000), RunStatus::Finished);
+    EXPECT_EQ(testVM.globals[0], Value{5});
+    // 2 setup instructions, 9 per iteration, 4 for the final test
+    EXPECT_EQ(testVM.instructions_executed, 2 + 5 * 9 + 4);
+}
+
+TEST(RunTest, RunForYieldsAndResumesAssertions)
+{
+    auto testVM = VM(make_counting_loop(20));
+    auto yields = 0;
+    auto status = RunStatus::Yielded;
+    while ((status = testVM.run_for(10)) == RunStatus::Yielded)
+    {
+        ++yields;
+        // Yields only happen at block boundaries: loop head, loop body or loop exit
+        EXPECT_TRUE(testVM.ip == 6 || testVM.ip == 16 || testVM.ip == 29);
+        EXPECT_EQ(testVM.sp, 0);
+    }
+    EXPECT_EQ(status, RunStatus::Finished);
+    EXPECT_EQ(testVM.globals[0], Value{20});
+    EXPECT_GT(yields, 10);
+    EXPECT_EQ(testVM.instructions_executed, 2 + 20 * 9 + 4);
+}
+
+TEST(RunTest, RunForMatchesRunAssertions)
+{
+    auto sliced = VM(make_counting_loop(7));
+    while (sliced.run_for(3) == RunStatus::Yielded) {}
+    auto whole = VM(make_counting_loop(7));
+    whole.run();
+    EXPECT_EQ(sliced.globals, whole.globals);
+    EXPECT_EQ(sliced.instructions_executed, whole.instructions_executed);
+}
+
+TEST(RunTest, RunForDeadlineAssertions)
+{
+    auto testVM = VM(make_counting_loop(1000));
+    auto status = testVM.run_for(std::numeric_limits<int64_t>::max(), std::chrono::steady_clock::now());
+    EXPECT_EQ(status, RunStatus::Yielded);
+    EXPECT_EQ(testVM.globals[0], Value{1});
+}
+
+TEST(RunTest, RunForErrorAssertions)
+{
+    auto testVM = VM(ByteCode{make(OpPop), std::vector<Value>()});
+    EXPECT_EQ(testVM.run_for(10), RunStatus::Error);
+    EXPECT_EQ(testVM.error, "Not enough items to remove from the stack");
+    EXPECT_EQ(testVM.run_for(10), RunStatus::Error);
+}
 
 
 std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>> instrs) 
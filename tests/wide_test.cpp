@@ -0,0 +1,119 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../src/escape.hpp"
+#include "../src/registers.hpp"
+#include "../src/vm.hpp"
+
+std::vector<unsigned char> make_instructions(std::vector<std::vector<unsigned char>>);
+
+TEST(WideTest, EncodingAssertions)
+{
+    EXPECT_EQ(make_wide(OpConstant, 65536), (std::vector<unsigned char>{OpWide, OpConstant, 0, 1, 0, 0}));
+    EXPECT_EQ(make_wide(OpJump, -2), (std::vector<unsigned char>{OpWide, OpJump, 0xff, 0xff, 0xff, 0xfe}));
+    // Operands that fit 16 bits keep the short form
+    EXPECT_EQ(make_sized(OpConstant, 32767), make(OpConstant, 32767));
+    EXPECT_EQ(make_sized(OpJump, -32768), make(OpJump, -32768));
+    EXPECT_EQ(make_sized(OpConstant, 32768), make_wide(OpConstant, 32768));
+
+    for (const int32_t value: {0, 1, -1, 40000, -40000, std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::min()})
+    {
+        EXPECT_EQ(ReadInt32(WriteInt32(value)), value);
+    }
+
+    const auto instructions = make_instructions(std::vector({make_wide(OpReadGlobal, 70000), make(OpTrue), make(OpJump, -7)}));
+    EXPECT_EQ(instruction_width(instructions, 0), 6);
+    EXPECT_EQ(read_operand(instructions, 0), 70000);
+    EXPECT_EQ(instruction_width(instructions, 6), 1);
+    EXPECT_EQ(instruction_width(instructions, 7), 3);
+    EXPECT_EQ(read_operand(instructions, 7), -7);
+}
+
+TEST(WideTest, ExecutionAssertions)
+{
+    // g0 = constants[39999]; g1 = g0; g0 = g1 + constants[1], with the constant and the second global wide
+    std::vector<Value> constants(40000, Value{0});
+    constants[1] = 2;
+    constants[39999] = 40;
+    auto testVM = VM(ByteCode{
+        make_instructions(std::vector({
+            make_sized(OpConstant, 39999),
+            make(OpWriteGlobal, 0),
+            make(OpReadGlobal, 0),
+            make_wide(OpWriteGlobal, 1),
+            make_wide(OpReadGlobal, 1),
+            make_wide(OpConstant, 1),
+            make(OpAdd),
+            make(OpWriteGlobal, 0),
+        })),
+        constants
+    });
+    testVM.run();
+    EXPECT_EQ(testVM.globals, (std::vector<Value>{42, 40}));
+    EXPECT_EQ(testVM.sp, 0);
+    EXPECT_EQ(testVM.instructions_executed, 8);
+
+    // A jump over 40000 bytes of unreachable code, then a wide OpJumpFalse not taken and one taken
+    std::vector<std::vector<unsigned char>> parts {make_sized(OpJump, 6 + 40000)};
+    parts.insert(parts.end(), 40000, make(OpPop));
+    parts.insert(parts.end(), {
+        make(OpTrue),
+        make_wide(OpJumpFalse, 100),
+        make(OpFalse),
+        make_wide(OpJumpFalse, 9),
+        make(OpConstant, 0),
+        make(OpConstant, 0),
+        make(OpWriteGlobal, 0),
+    });
+    auto jumps = VM(ByteCode{make_instructions(parts), std::vector<Value>{7}});
+    jumps.run();
+    EXPECT_EQ(jumps.globals, (std::vector<Value>{7}));
+    EXPECT_EQ(jumps.sp, 0);
+    EXPECT_EQ(jumps.ip, 6 + 40000 + 1 + 6 + 1 + 6 + 3 + 3 + 3);
+}
+
+TEST(WideTest, MalformedPrefixAssertions)
+{
+    auto no_operands = VM(ByteCode{make_instructions(std::vector({make(OpWide), make(OpTrue)})), {}});
+    EXPECT_EQ(no_operands.run_for(10), RunStatus::Error);
+    EXPECT_EQ(no_operands.error, "Found OpWide before OpTrue");
+
+    auto twice = VM(ByteCode{make_instructions(std::vector({make(OpWide), make_wide(OpConstant, 0)})), std::vector<Value>{1}});
+    EXPECT_EQ(twice.run_for(10), RunStatus::Error);
+    EXPECT_EQ(twice.error, "Found OpWide before OpWide");
+
+    auto trailing = VM(ByteCode{make_instructions(std::vector({make(OpTrue), make(OpWide)})), {}});
+    EXPECT_EQ(trailing.run_for(10), RunStatus::Error);
+    EXPECT_EQ(trailing.error, "Found OpWide at the end of the instructions");
+}
+
+TEST(WideTest, PassesAssertions)
+{
+    // g0 = [10, 20][1], skipped over by a wide jump whose offset the escape pass rewrites
+    auto code = ByteCode{
+        make_instructions(std::vector({
+            make(OpTrue),
+            make_wide(OpJumpFalse, 22),
+            make(OpConstant, 0),
+            make(OpConstant, 1),
+            make(OpArray, 2),
+            make(OpConstant, 2),
+            make(OpIndex),
+            make(OpWriteGlobal, 0),
+        })),
+        std::vector<Value>{10, 20, 1}
+    };
+    const auto stats = elide_temporaries(code);
+    EXPECT_EQ(stats.arrays, 1);
+    EXPECT_EQ(read_operand(code.instructions, 1), 21);
+    auto elided = VM(code);
+    elided.run();
+    EXPECT_EQ(elided.globals, (std::vector<Value>{20}));
+
+    // The register tier leaves wide instructions to the stack interpreter
+    EXPECT_FALSE(translate_registers(make_instructions(std::vector({make_wide(OpConstant, 0)}))).translated);
+    auto fallback = VM(ByteCode{make_instructions(std::vector({make_wide(OpConstant, 0), make(OpWriteGlobal, 0)})), std::vector<Value>{5}});
+    fallback.auto_gc = false;
+    fallback.run();
+    EXPECT_EQ(fallback.globals, (std::vector<Value>{5}));
+}
@@ -0,0 +1,62 @@
+/**
+ * heap_analyzer DUMP [COUNT]
+ *
+ * Summarize a heap dump written by VM::dump_heap: objects and bytes by kind,
+ * then the COUNT (default 20) objects with the largest retained size.
+*/
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "../src/heapdump.hpp"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " DUMP [COUNT]\n";
+        return 2;
+    }
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "cannot open " << argv[1] << "\n";
+        return 1;
+    }
+    const size_t count = argc > 2 ? std::stoul(argv[2]) : 20;
+
+    try
+    {
+        const auto graph = B_HeapGraph::read(in);
+        const auto dom = dominators(graph);
+
+        std::array<B_KindStats, static_cast<size_t>(B_Kind::Count)> kinds {};
+        uint64_t reachable = 0;
+        for (size_t i = 0; i < graph.size(); ++i)
+        {
+            auto& kind = kinds[static_cast<size_t>(graph.kinds[i])];
+            ++kind.objects;
+            kind.bytes += graph.sizes[i];
+            reachable += dom.idom[i] != -2;
+        }
+        std::cout << graph.size() << " objects, " << reachable << " reachable from " << graph.roots.size() << " roots\n\n";
+        std::cout << "kind\tobjects\tbytes\n";
+        for (size_t k = 0; k < kinds.size(); ++k)
+        {
+            if (kinds[k].objects > 0)
+            {
+                std::cout << kind_name(static_cast<B_Kind>(k)) << "\t" << kinds[k].objects << "\t" << kinds[k].bytes << "\n";
+            }
+        }
+        std::cout << "\nid\tkind\tshallow\tretained\n";
+        for (const auto& r: top_retainers(graph, dom, count))
+        {
+            std::cout << r.id << "\t" << kind_name(r.kind) << "\t" << r.shallow << "\t" << r.retained << "\n";
+        }
+    } catch (heap_dump_exception& e)
+    {
+        std::cerr << argv[1] << ": " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}